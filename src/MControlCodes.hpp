@@ -0,0 +1,97 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+// The C0 and C1 control codes
+
+#pragma once
+
+#include <cstdint>
+
+enum MCtrlChr : uint8_t
+{
+	NUL = 0x00,
+	DLE = 0x10,
+	SP = 0x20,
+	DCS = 0x90,
+	SOH = 0x01,
+	DC1 = 0x11,
+	PU1 = 0x91,
+	STX = 0x02,
+	DC2 = 0x12,
+	PU2 = 0x92,
+	ETX = 0x03,
+	DC3 = 0x13,
+	STS = 0x93,
+	EOT = 0x04,
+	DC4 = 0x14,
+	IND = 0x84,
+	CCH = 0x94,
+	ENQ = 0x05,
+	NAK = 0x15,
+	NEL = 0x85,
+	MW = 0x95,
+	ACK = 0x06,
+	SYN = 0x16,
+	SSA = 0x86,
+	SPA = 0x96,
+	BEL = 0x07,
+	ETB = 0x17,
+	ESA = 0x87,
+	EPA = 0x97,
+	BS = 0x08,
+	CAN = 0x18,
+	HTS = 0x88,
+	HT = 0x09,
+	EM = 0x19,
+	HTJ = 0x89,
+	LF = 0x0a,
+	SUB = 0x1a,
+	VTS = 0x8a,
+	VT = 0x0b,
+	ESC = 0x1b,
+	PLD = 0x8b,
+	CSI = 0x9b,
+	FF = 0x0c,
+	FS = 0x1c,
+	PLU = 0x8c,
+	ST = 0x9c,
+	CR = 0x0d,
+	GS = 0x1d,
+	RI = 0x8d,
+	OSC = 0x9d,
+	SO = 0x0e,
+	RS = 0x1e,
+	SS2 = 0x8e,
+	PM = 0x9e,
+	SI = 0x0f,
+	US = 0x1f,
+	DEL = 0x7f,
+	SS3 = 0x8f,
+	APC = 0x9f
+};
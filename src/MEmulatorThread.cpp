@@ -0,0 +1,147 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#include "MEmulatorThread.hpp"
+
+#include <chrono>
+#include <iostream>
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+// The maximum number of bytes emulated before the lock is released
+const std::size_t
+	kMaxSliceSize = 4096;
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+MEmulatorThread::MEmulatorThread(MTerminalEmulator &inEmulator, MRingBuffer &ioInput,
+	std::size_t inLowWaterMark, WakeUpCallback inWakeUp)
+	: mEmulator(inEmulator)
+	, mWakeUp(std::move(inWakeUp))
+	, mInput(ioInput)
+	, mLowWaterMark(inLowWaterMark)
+{
+	// clang-format off
+	mThread = std::thread(
+		[this]
+		{
+			try
+			{
+				Run();
+			}
+			catch (const std::exception &ex)
+			{
+				std::cerr << "Exception in emulator thread: " << ex.what() << '\n';
+			}
+		});
+	// clang-format on
+}
+
+MEmulatorThread::~MEmulatorThread()
+{
+	{
+		std::unique_lock lock(mMutex);
+		mStop = true;
+		mCondition.notify_one();
+	}
+
+	if (mThread.joinable())
+		mThread.join();
+}
+
+std::unique_lock<std::recursive_mutex> MEmulatorThread::Lock()
+{
+	++mWaiting;
+
+	std::unique_lock lock(mMutex);
+
+	if (--mWaiting == 0)
+		mHandOff.notify_one();
+
+	return lock;
+}
+
+void MEmulatorThread::Notify()
+{
+	std::unique_lock lock(mMutex);
+	mCondition.notify_one();
+}
+
+void MEmulatorThread::Run()
+{
+	std::unique_lock lock(mMutex);
+
+	while (not mStop)
+	{
+		if (mInput.Empty() or mEmulator.HasHostRequests())
+		{
+			mCondition.wait(lock);
+			continue;
+		}
+
+		auto nextSmoothScroll = mEmulator.GetNextSmoothScroll();
+		if (nextSmoothScroll.has_value())
+		{
+			if (*nextSmoothScroll > std::chrono::system_clock::now())
+			{
+				mCondition.wait_until(lock, *nextSmoothScroll);
+				continue;
+			}
+
+			mEmulator.PerformSmoothScroll();
+		}
+
+		auto data = mInput.Peek();
+		if (data.size() > kMaxSliceSize)
+			data = data.first(kMaxSliceSize);
+
+		uint64_t version = mEmulator.GetVersion();
+		bool aboveLowWater = mInput.Size() > mLowWaterMark;
+
+		mInput.Consume(mEmulator.Emulate(data));
+
+		bool wakeUp = mEmulator.HasHostRequests() or mEmulator.GetVersion() != version or
+		              (aboveLowWater and mInput.Size() <= mLowWaterMark);
+
+		lock.unlock();
+
+		if (wakeUp and mWakeUp)
+			mWakeUp();
+
+		lock.lock();
+
+		// threads waiting for the lock go first, the wait releases the lock
+		mHandOff.wait(lock, [this] { return mWaiting == 0; });
+	}
+}
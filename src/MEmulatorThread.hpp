@@ -0,0 +1,91 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#pragma once
+
+#include "MRingBuffer.hpp"
+#include "MTerminalEmulator.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// --------------------------------------------------------------------
+// MEmulatorThread runs an MTerminalEmulator on a thread of its own.
+// Data received from the host is read directly into the input ring by
+// the user interface, the emulator then processes this data in slices.
+// Threads waiting in Lock get the lock before the next slice is started.
+// All access to the emulator and the input ring from other threads
+// should be done while holding the lock returned by Lock.
+
+class MEmulatorThread
+{
+  public:
+	typedef std::function<void()> WakeUpCallback;
+
+	// The wake up callback is called from the emulator thread when
+	// the emulator has host requests pending, emulation is then halted
+	// until Notify is called. It is also called after each slice that
+	// changed the emulator, so the new contents can be drawn, and when
+	// the input ring drained to inLowWaterMark, so reading can resume.
+	MEmulatorThread(MTerminalEmulator &inEmulator, MRingBuffer &ioInput,
+		std::size_t inLowWaterMark, WakeUpCallback inWakeUp);
+	~MEmulatorThread();
+
+	MEmulatorThread(const MEmulatorThread &) = delete;
+	MEmulatorThread &operator=(const MEmulatorThread &) = delete;
+
+	std::unique_lock<std::recursive_mutex> Lock();
+
+	// Wake up the emulator thread, after adding input or answering host requests
+	void Notify();
+
+	bool IsEmulatorThread() const { return std::this_thread::get_id() == mThread.get_id(); }
+
+  private:
+	void Run();
+
+	MTerminalEmulator &mEmulator;
+	WakeUpCallback mWakeUp;
+
+	MRingBuffer &mInput;
+	std::size_t mLowWaterMark;
+	std::recursive_mutex mMutex;
+	std::condition_variable_any mCondition;
+	bool mStop = false;
+
+	// The number of threads waiting in Lock, the emulator thread
+	// waits for mHandOff until they all had their turn.
+	std::atomic<uint32_t> mWaiting = 0;
+	std::condition_variable_any mHandOff;
+
+	std::thread mThread;
+};
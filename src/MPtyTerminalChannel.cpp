@@ -303,7 +303,7 @@ void MPtyTerminalChannel::SendSignal(const std::string &inSignal)
 		killpg(mPid, SIGKILL);
 }
 
-void MPtyTerminalChannel::ReadData(const ReadCallback &inCallback)
+void MPtyTerminalChannel::ReadData(MRingBuffer &ioBuffer, const ReadCallback &inCallback)
 {
 	MAppExecutor my_executor{ &MSaltApp::Instance().get_context() };
 
@@ -312,10 +312,13 @@ void MPtyTerminalChannel::ReadData(const ReadCallback &inCallback)
 		[this, inCallback](const std::error_code &ec, std::size_t inBytesReceived)
 		{
 			if (this->mRefCount > 0)
-				inCallback(ec, this->mResponse);
+			{
+				inCallback(ec, inBytesReceived);
+			}
 		});
 
-	asio_ns::async_read(mPty, mResponse, asio_ns::transfer_at_least(1), std::move(cb));
+	auto buffer = ioBuffer.Prepare(kMinimumReadSize);
+	mPty.async_read_some(asio_ns::buffer(buffer.data(), buffer.size()), std::move(cb));
 }
 
 // --------------------------------------------------------------------
@@ -56,7 +56,7 @@ class MPtyTerminalChannel : public MTerminalChannel
 
 	void SendData(std::string &&inData) override;
 	void SendSignal(const std::string &inSignal) override;
-	void ReadData(const ReadCallback &inCallback) override;
+	void ReadData(MRingBuffer &ioBuffer, const ReadCallback &inCallback) override;
 
 	std::filesystem::path GetCWD() const;
 	void SetCWD(const std::filesystem::path &inCWD)
@@ -90,5 +90,4 @@ class MPtyTerminalChannel : public MTerminalChannel
 	std::filesystem::path mCWD;
 
 	asio_ns::posix::stream_descriptor mPty;
-	asio_ns::streambuf mResponse;
 };
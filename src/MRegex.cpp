@@ -0,0 +1,820 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#include "MRegex.hpp"
+#include "MUnicode.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+#include <utility>
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+const uint32_t
+	kMaxRepeat = 1000;
+
+// Repeats are expanded by copying, nested counted repeats multiply.
+// Patterns needing more NFA nodes than this are refused.
+const std::size_t
+	kMaxNodes = 100000;
+
+// The DFA is discarded and built anew when it grows beyond this
+// number of states, each state takes about a kilobyte.
+const std::size_t
+	kMaxDFAStates = 4096;
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+MRegex::MRegex(const std::string &inPattern, bool inIgnoreCase)
+	: mPattern(inPattern)
+	, mIgnoreCase(inIgnoreCase)
+{
+	MFragment f = ParseAlternation();
+	if (mPos < mPattern.length())
+		throw MRegexError("unmatched )");
+
+	Patch(f, AddNode(eMatch));
+	mStart = f.start;
+
+	mUnanchored.unanchored = true;
+}
+
+// --------------------------------------------------------------------
+// Compilation, a Thompson construction directly from the pattern
+
+int32_t MRegex::AddNode(MNodeType inType, uint32_t inSet)
+{
+	if (mNodes.size() >= kMaxNodes)
+		throw MRegexError("pattern too complex");
+
+	mNodes.push_back({ inType, inSet });
+	return static_cast<int32_t>(mNodes.size() - 1);
+}
+
+void MRegex::Patch(const MFragment &inFragment, int32_t inTarget)
+{
+	for (auto [node, alt] : inFragment.out)
+	{
+		if (alt)
+			mNodes[node].alt = inTarget;
+		else
+			mNodes[node].next = inTarget;
+	}
+}
+
+MRegex::MFragment MRegex::Alternative(MFragment a, MFragment b)
+{
+	int32_t s = AddNode(eSplit);
+	mNodes[s].next = a.start;
+	mNodes[s].alt = b.start;
+
+	a.out.insert(a.out.end(), b.out.begin(), b.out.end());
+	return { s, std::move(a.out) };
+}
+
+MRegex::MFragment MRegex::Sequence(MFragment a, MFragment b)
+{
+	Patch(a, b.start);
+	return { a.start, std::move(b.out) };
+}
+
+MRegex::MFragment MRegex::Optional(MFragment a)
+{
+	int32_t s = AddNode(eSplit);
+	mNodes[s].next = a.start;
+
+	a.out.emplace_back(s, true);
+	return { s, std::move(a.out) };
+}
+
+MRegex::MFragment MRegex::Star(MFragment a)
+{
+	int32_t s = AddNode(eSplit);
+	mNodes[s].next = a.start;
+	Patch(a, s);
+
+	return { s, { { s, true } } };
+}
+
+MRegex::MFragment MRegex::Empty()
+{
+	int32_t s = AddNode(eSplit);
+	return { s, { { s, false } } };
+}
+
+MRegex::MFragment MRegex::Assertion(MNodeType inType)
+{
+	int32_t s = AddNode(inType);
+	return { s, { { s, false } } };
+}
+
+MRegex::MFragment MRegex::Bytes(const std::bitset<256> &inBytes)
+{
+	auto i = std::find(mSets.begin(), mSets.end(), inBytes);
+	if (i == mSets.end())
+		i = mSets.insert(mSets.end(), inBytes);
+
+	int32_t s = AddNode(eSet, i - mSets.begin());
+	return { s, { { s, false } } };
+}
+
+MRegex::MFragment MRegex::CodePoint(char32_t inChar)
+{
+	if (mIgnoreCase)
+		inChar = ToLower(inChar);
+
+	std::string s;
+	auto iter = back_inserter(s);
+	MEncodingTraits<kEncodingUTF8>::WriteUnicode(iter, inChar);
+
+	MFragment result = Empty();
+	for (unsigned char ch : s)
+	{
+		std::bitset<256> b;
+		b.set(ch);
+		result = Sequence(result, Bytes(b));
+	}
+
+	return result;
+}
+
+MRegex::MFragment MRegex::CodePointRange(char32_t inFirst, char32_t inLast)
+{
+	// Split the range until all code points in it have the same encoded
+	// length and the trailing bytes span their full range, each byte of
+	// the encoding is then matched by a single set.
+	for (char32_t limit : { 0x7f, 0x7ff, 0xffff })
+	{
+		if (inFirst <= limit and inLast > limit)
+			return Alternative(CodePointRange(inFirst, limit), CodePointRange(limit + 1, inLast));
+	}
+
+	for (int i = 1; i < 4; ++i)
+	{
+		char32_t mask = (char32_t(1) << (6 * i)) - 1;
+		if ((inFirst & ~mask) == (inLast & ~mask))
+			continue;
+
+		if ((inFirst & mask) != 0)
+			return Alternative(CodePointRange(inFirst, inFirst | mask), CodePointRange((inFirst | mask) + 1, inLast));
+
+		if ((inLast & mask) != mask)
+			return Alternative(CodePointRange(inFirst, (inLast & ~mask) - 1), CodePointRange(inLast & ~mask, inLast));
+	}
+
+	std::string first, last;
+	auto firstIter = back_inserter(first), lastIter = back_inserter(last);
+	MEncodingTraits<kEncodingUTF8>::WriteUnicode(firstIter, inFirst);
+	MEncodingTraits<kEncodingUTF8>::WriteUnicode(lastIter, inLast);
+
+	MFragment result = Empty();
+	for (std::size_t i = 0; i < first.length(); ++i)
+	{
+		std::bitset<256> b;
+		for (int ch = static_cast<uint8_t>(first[i]); ch <= static_cast<uint8_t>(last[i]); ++ch)
+			b.set(ch);
+		result = Sequence(result, Bytes(b));
+	}
+
+	return result;
+}
+
+MRegex::MFragment MRegex::AnyNonASCII()
+{
+	// The text is valid UTF-8, so a lead byte followed by continuation bytes will do
+	std::bitset<256> lead, continuation;
+	for (int b = 0xc0; b < 0x100; ++b)
+		lead.set(b);
+	for (int b = 0x80; b < 0xc0; ++b)
+		continuation.set(b);
+
+	return Sequence(Bytes(lead), Star(Bytes(continuation)));
+}
+
+MRegex::MFragment MRegex::Class(std::bitset<128> inASCII, const std::vector<char32_t> &inOther, bool inNonASCII, bool inNegated)
+{
+	if (mIgnoreCase)
+	{
+		for (int ch = 'A'; ch <= 'Z'; ++ch)
+		{
+			if (inASCII.test(ch))
+				inASCII.set(ch - 'A' + 'a');
+		}
+	}
+
+	if (inNegated)
+		inASCII.flip();
+
+	std::bitset<256> bytes;
+	for (int ch = 0; ch < 128; ++ch)
+		bytes[ch] = inASCII[ch];
+
+	std::vector<MFragment> alternatives;
+	if (bytes.any())
+		alternatives.push_back(Bytes(bytes));
+
+	if (not inNegated)
+	{
+		if (inNonASCII)
+			alternatives.push_back(AnyNonASCII());
+		else
+		{
+			for (char32_t ch : inOther)
+				alternatives.push_back(CodePoint(ch));
+		}
+	}
+	else if (not inNonASCII)
+	{
+		// all non-ASCII characters, except those in the class
+		std::vector<char32_t> other;
+		for (char32_t ch : inOther)
+			other.push_back(mIgnoreCase ? ToLower(ch) : ch);
+		std::sort(other.begin(), other.end());
+
+		char32_t first = 0x80;
+		for (char32_t ch : other)
+		{
+			if (ch > first)
+				alternatives.push_back(CodePointRange(first, ch - 1));
+			if (ch >= first)
+				first = ch + 1;
+		}
+
+		if (first <= 0x10ffff)
+			alternatives.push_back(CodePointRange(first, 0x10ffff));
+	}
+
+	if (alternatives.empty())
+		throw MRegexError("empty character class");
+
+	MFragment result = alternatives.back();
+	alternatives.pop_back();
+	while (not alternatives.empty())
+	{
+		result = Alternative(std::move(alternatives.back()), std::move(result));
+		alternatives.pop_back();
+	}
+
+	return result;
+}
+
+char32_t MRegex::ReadChar()
+{
+	unicode ch;
+	uint32_t length;
+	MEncodingTraits<kEncodingUTF8>::ReadUnicode(mPattern.begin() + mPos, length, ch);
+
+	mPos += length > 0 ? length : 1;
+	return ch;
+}
+
+bool MRegex::ParseEscapedClass(char inEscape, std::bitset<128> &outASCII, bool &outNegated)
+{
+	outASCII.reset();
+	outNegated = std::isupper(inEscape);
+
+	switch (std::tolower(inEscape))
+	{
+		case 'd':
+			for (int ch = '0'; ch <= '9'; ++ch)
+				outASCII.set(ch);
+			break;
+
+		case 'w':
+			for (int ch = 0; ch < 128; ++ch)
+			{
+				if (std::isalnum(ch) or ch == '_')
+					outASCII.set(ch);
+			}
+			break;
+
+		case 's':
+			outASCII.set(' ');
+			outASCII.set('\t');
+			break;
+
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+char32_t MRegex::ParseEscapedChar(char inEscape)
+{
+	switch (inEscape)
+	{
+		case 't': return '\t';
+		case 'n': return '\n';
+		case 'r': return '\r';
+		case 'e': return 033;
+
+		case 'x':
+		{
+			char32_t result = 0;
+			for (int i = 0; i < 2; ++i)
+			{
+				if (mPos >= mPattern.length() or not std::isxdigit(mPattern[mPos]))
+					throw MRegexError("invalid \\x escape");
+
+				char ch = mPattern[mPos++];
+				result = result * 16 + (std::isdigit(ch) ? ch - '0' : std::tolower(ch) - 'a' + 10);
+			}
+			return result;
+		}
+
+		default:
+			if (std::isalnum(inEscape))
+				throw MRegexError(std::string("unsupported escape \\") + inEscape);
+			return inEscape;
+	}
+}
+
+MRegex::MFragment MRegex::ParseAlternation()
+{
+	MFragment result = ParseConcatenation();
+
+	while (mPos < mPattern.length() and mPattern[mPos] == '|')
+	{
+		++mPos;
+		result = Alternative(std::move(result), ParseConcatenation());
+	}
+
+	return result;
+}
+
+MRegex::MFragment MRegex::ParseConcatenation()
+{
+	MFragment result = Empty();
+
+	while (mPos < mPattern.length() and mPattern[mPos] != '|' and mPattern[mPos] != ')')
+		result = Sequence(std::move(result), ParseRepeat(mPattern.length()));
+
+	return result;
+}
+
+MRegex::MFragment MRegex::Copy(std::size_t inBegin, std::size_t inEnd)
+{
+	std::size_t saved = mPos;
+	mPos = inBegin;
+	MFragment result = ParseRepeat(inEnd);
+	mPos = saved;
+	return result;
+}
+
+MRegex::MFragment MRegex::ParseRepeat(std::size_t inLimit)
+{
+	// repeating means copying, the atom is parsed again for each copy
+	std::size_t begin = mPos;
+
+	MFragment result = ParseAtom();
+
+	while (mPos < inLimit)
+	{
+		std::size_t end = mPos;
+
+		char ch = mPattern[mPos];
+		if (ch == '*')
+		{
+			++mPos;
+			result = Star(std::move(result));
+		}
+		else if (ch == '+')
+		{
+			++mPos;
+			result = Sequence(std::move(result), Star(Copy(begin, end)));
+		}
+		else if (ch == '?')
+		{
+			++mPos;
+			result = Optional(std::move(result));
+		}
+		else if (ch == '{')
+		{
+			// {n}, {n,} or {n,m}, anything else is taken literally
+			std::size_t p = mPos + 1;
+			auto number = [&](uint32_t &outValue)
+			{
+				std::size_t start = p;
+				outValue = 0;
+				while (p < mPattern.length() and std::isdigit(mPattern[p]) and outValue <= kMaxRepeat)
+					outValue = outValue * 10 + (mPattern[p++] - '0');
+				return p > start;
+			};
+
+			uint32_t min, max;
+			bool unbounded = false;
+
+			if (not number(min))
+				break;
+
+			if (p < mPattern.length() and mPattern[p] == ',')
+			{
+				++p;
+				if (not number(max))
+					unbounded = true;
+			}
+			else
+				max = min;
+
+			if (p >= mPattern.length() or mPattern[p] != '}')
+				break;
+
+			if (min > kMaxRepeat or max > kMaxRepeat or (not unbounded and max < min))
+				throw MRegexError("invalid repeat count");
+
+			mPos = p + 1;
+
+			bool first = true;
+			auto next = [&]()
+			{
+				if (std::exchange(first, false))
+					return std::move(result);
+				return Copy(begin, end);
+			};
+
+			MFragment repeated = Empty();
+			for (uint32_t i = 0; i < min; ++i)
+				repeated = Sequence(std::move(repeated), next());
+
+			if (unbounded)
+				repeated = Sequence(std::move(repeated), Star(next()));
+			else
+			{
+				for (uint32_t i = min; i < max; ++i)
+					repeated = Sequence(std::move(repeated), Optional(next()));
+			}
+
+			result = std::move(repeated);
+		}
+		else
+			break;
+	}
+
+	return result;
+}
+
+MRegex::MFragment MRegex::ParseAtom()
+{
+	char ch = mPattern[mPos];
+
+	switch (ch)
+	{
+		case '(':
+		{
+			++mPos;
+			if (mPattern.compare(mPos, 2, "?:") == 0)
+				mPos += 2;
+
+			MFragment result = ParseAlternation();
+
+			if (mPos >= mPattern.length() or mPattern[mPos] != ')')
+				throw MRegexError("missing )");
+			++mPos;
+
+			return result;
+		}
+
+		case '.':
+		{
+			++mPos;
+
+			std::bitset<128> all;
+			all.set();
+			return Class(all, {}, true, false);
+		}
+
+		case '^':
+			++mPos;
+			return Assertion(eBegin);
+
+		case '$':
+			++mPos;
+			return Assertion(eEnd);
+
+		case '[':
+			++mPos;
+			return ParseClass();
+
+		case '*':
+		case '+':
+		case '?':
+			throw MRegexError("nothing to repeat");
+
+		case '\\':
+		{
+			if (++mPos >= mPattern.length())
+				throw MRegexError("trailing \\");
+
+			char escape = mPattern[mPos++];
+
+			std::bitset<128> ascii;
+			bool negated;
+			if (ParseEscapedClass(escape, ascii, negated))
+				return Class(ascii, {}, false, negated);
+
+			return CodePoint(ParseEscapedChar(escape));
+		}
+
+		default:
+			return CodePoint(ReadChar());
+	}
+}
+
+MRegex::MFragment MRegex::ParseClass()
+{
+	std::bitset<128> ascii;
+	std::vector<char32_t> other;
+	bool nonASCII = false, negated = false;
+
+	if (mPos < mPattern.length() and mPattern[mPos] == '^')
+	{
+		negated = true;
+		++mPos;
+	}
+
+	auto add = [&](char32_t inChar)
+	{
+		if (inChar < 128)
+			ascii.set(inChar);
+		else
+			other.push_back(inChar);
+	};
+
+	bool first = true;
+	for (;;)
+	{
+		if (mPos >= mPattern.length())
+			throw MRegexError("missing ]");
+
+		if (mPattern[mPos] == ']' and not first)
+		{
+			++mPos;
+			break;
+		}
+
+		first = false;
+
+		char32_t lo;
+		if (mPattern[mPos] == '\\')
+		{
+			if (++mPos >= mPattern.length())
+				throw MRegexError("missing ]");
+
+			char escape = mPattern[mPos++];
+
+			std::bitset<128> set;
+			bool setNegated;
+			if (ParseEscapedClass(escape, set, setNegated))
+			{
+				if (setNegated)
+				{
+					set.flip();
+					nonASCII = true;
+				}
+				ascii |= set;
+				continue;
+			}
+
+			lo = ParseEscapedChar(escape);
+		}
+		else
+			lo = ReadChar();
+
+		// a range, unless the - is the last character in the class
+		if (mPos + 1 < mPattern.length() and mPattern[mPos] == '-' and mPattern[mPos + 1] != ']')
+		{
+			++mPos;
+
+			char32_t hi;
+			if (mPattern[mPos] == '\\')
+			{
+				mPos += 2;
+				hi = ParseEscapedChar(mPattern[mPos - 1]);
+			}
+			else
+				hi = ReadChar();
+
+			if (hi < lo)
+				throw MRegexError("invalid range in character class");
+
+			if (hi >= 128 and hi - std::max<char32_t>(lo, 128) > kMaxRepeat)
+				throw MRegexError("range in character class too large");
+
+			for (char32_t ch = lo; ch <= hi; ++ch)
+				add(ch);
+		}
+		else
+			add(lo);
+	}
+
+	return Class(ascii, other, nonASCII, negated);
+}
+
+// --------------------------------------------------------------------
+// The DFA, each state is the set of NFA nodes reachable at that point
+
+void MRegex::Closure(std::vector<int32_t> &ioNodes, bool inAtBegin, bool inAtEnd) const
+{
+	std::vector<bool> seen(mNodes.size());
+	std::vector<int32_t> stack;
+	stack.swap(ioNodes);
+
+	while (not stack.empty())
+	{
+		int32_t n = stack.back();
+		stack.pop_back();
+
+		if (n < 0 or seen[n])
+			continue;
+		seen[n] = true;
+
+		const MNode &node = mNodes[n];
+		switch (node.type)
+		{
+			case eSplit:
+				stack.push_back(node.next);
+				stack.push_back(node.alt);
+				break;
+
+			case eBegin:
+				if (inAtBegin)
+					stack.push_back(node.next);
+				break;
+
+			case eEnd:
+				if (inAtEnd)
+					stack.push_back(node.next);
+				// keep it, it may pass at the end of the text
+				ioNodes.push_back(n);
+				break;
+
+			case eSet:
+			case eMatch:
+				ioNodes.push_back(n);
+				break;
+		}
+	}
+
+	std::sort(ioNodes.begin(), ioNodes.end());
+}
+
+int32_t MRegex::GetState(MDFA &inDFA, std::vector<int32_t> &&inNodes)
+{
+	auto i = inDFA.index.find(inNodes);
+	if (i != inDFA.index.end())
+		return i->second;
+
+	MState state;
+	std::fill(std::begin(state.next), std::end(state.next), -1);
+
+	auto isMatch = [this](int32_t n) { return mNodes[n].type == eMatch; };
+
+	state.accepting = std::any_of(inNodes.begin(), inNodes.end(), isMatch);
+
+	std::vector<int32_t> atEnd(inNodes);
+	Closure(atEnd, false, true);
+	state.acceptingAtEnd = std::any_of(atEnd.begin(), atEnd.end(), isMatch);
+
+	state.nodes = inNodes;
+
+	int32_t result = static_cast<int32_t>(inDFA.states.size());
+	inDFA.states.push_back(std::move(state));
+	inDFA.index.emplace(std::move(inNodes), result);
+
+	return result;
+}
+
+int32_t MRegex::GetStart(MDFA &inDFA, bool inAtBegin)
+{
+	int32_t &result = inDFA.start[inAtBegin ? 1 : 0];
+	if (result < 0)
+	{
+		std::vector<int32_t> nodes{ mStart };
+		Closure(nodes, inAtBegin, false);
+		result = GetState(inDFA, std::move(nodes));
+	}
+	return result;
+}
+
+int32_t MRegex::Step(MDFA &inDFA, int32_t inState, uint8_t inByte)
+{
+	int32_t result = inDFA.states[inState].next[inByte];
+
+	if (result < 0)
+	{
+		std::vector<int32_t> next;
+		for (int32_t n : inDFA.states[inState].nodes)
+		{
+			const MNode &node = mNodes[n];
+			if (node.type == eSet and mSets[node.set].test(inByte))
+				next.push_back(node.next);
+		}
+
+		// a match may start anywhere
+		if (inDFA.unanchored)
+			next.push_back(mStart);
+
+		Closure(next, false, false);
+		result = GetState(inDFA, std::move(next));
+
+		inDFA.states[inState].next[inByte] = result;
+	}
+
+	return result;
+}
+
+bool MRegex::Search(std::string_view inText, std::size_t inFrom, std::size_t &outBegin, std::size_t &outEnd)
+{
+	for (MDFA *dfa : { &mAnchored, &mUnanchored })
+	{
+		if (dfa->states.size() > kMaxDFAStates)
+		{
+			dfa->states.clear();
+			dfa->index.clear();
+			dfa->start[0] = dfa->start[1] = -1;
+		}
+	}
+
+	const uint8_t *text = reinterpret_cast<const uint8_t *>(inText.data());
+	std::size_t length = inText.length();
+
+	// First a single pass to see if there is any match at all, most lines have none
+	int32_t s = GetStart(mUnanchored, inFrom == 0);
+	bool found = mUnanchored.states[s].accepting;
+	for (std::size_t i = inFrom; i < length and not found; ++i)
+	{
+		s = Step(mUnanchored, s, text[i]);
+		found = mUnanchored.states[s].accepting;
+	}
+
+	if (not found and not mUnanchored.states[s].acceptingAtEnd)
+		return false;
+
+	// Then find the leftmost start position of a non-empty match, and its longest extent
+	for (std::size_t b = inFrom; b < length; ++b)
+	{
+		if ((text[b] & 0xc0) == 0x80)
+			continue;
+
+		std::size_t end = 0;
+
+		s = GetStart(mAnchored, b == 0);
+
+		std::size_t i = b;
+		while (i < length)
+		{
+			s = Step(mAnchored, s, text[i++]);
+
+			if (mAnchored.states[s].nodes.empty())
+				break;
+
+			if (mAnchored.states[s].accepting)
+				end = i;
+		}
+
+		if (i == length and not mAnchored.states[s].nodes.empty() and mAnchored.states[s].acceptingAtEnd)
+			end = length;
+
+		if (end > b)
+		{
+			outBegin = b;
+			outEnd = end;
+			return true;
+		}
+	}
+
+	return false;
+}
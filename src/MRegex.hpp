@@ -0,0 +1,159 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --------------------------------------------------------------------
+// MRegex is a small regular expression engine for searching the UTF-8
+// text of terminal lines. The pattern is compiled into an NFA that is
+// turned into a DFA lazily, one state at a time, as the text requires
+// it. There is no backtracking, the time needed is linear in the length
+// of the text for each position a match may start at.
+//
+// Supported are literals, '.', character classes with ranges and
+// negation, the escapes \d \w \s \D \W \S \t and \xHH, grouping with
+// (...) and (?:...), alternation, the anchors ^ and $ and the
+// quantifiers *, +, ?, {n}, {n,} and {n,m}. Matches are leftmost longest.
+
+class MRegexError : public std::runtime_error
+{
+  public:
+	MRegexError(const std::string &inMessage)
+		: std::runtime_error(inMessage)
+	{
+	}
+};
+
+class MRegex
+{
+  public:
+	// When inIgnoreCase is true the pattern is folded to lower case, the
+	// text searched should then be folded as well. Throws MRegexError.
+	MRegex(const std::string &inPattern, bool inIgnoreCase);
+
+	MRegex(const MRegex &) = delete;
+	MRegex &operator=(const MRegex &) = delete;
+
+	// Find the leftmost longest non-empty match starting at or after inFrom
+	bool Search(std::string_view inText, std::size_t inFrom, std::size_t &outBegin, std::size_t &outEnd);
+
+  private:
+	// Compilation
+
+	enum MNodeType : uint8_t
+	{
+		eSet,     // match a byte in mSets[set]
+		eSplit,   // continue at next and at alt
+		eBegin,   // only at the start of the text
+		eEnd,     // only at the end of the text
+		eMatch
+	};
+
+	struct MNode
+	{
+		MNodeType type;
+		uint32_t set = 0;
+		int32_t next = -1, alt = -1;
+	};
+
+	// A partially built NFA, out lists the links still to be patched,
+	// as node index and a flag telling if it is the alt link.
+	struct MFragment
+	{
+		int32_t start;
+		std::vector<std::pair<int32_t, bool>> out;
+	};
+
+	int32_t AddNode(MNodeType inType, uint32_t inSet = 0);
+	void Patch(const MFragment &inFragment, int32_t inTarget);
+
+	MFragment ParseAlternation();
+	MFragment ParseConcatenation();
+	MFragment ParseRepeat(std::size_t inLimit);
+	MFragment ParseAtom();
+	MFragment ParseClass();
+	MFragment Copy(std::size_t inBegin, std::size_t inEnd);
+
+	MFragment Alternative(MFragment a, MFragment b);
+	MFragment Sequence(MFragment a, MFragment b);
+	MFragment Optional(MFragment a);
+	MFragment Star(MFragment a);
+	MFragment Empty();
+	MFragment Assertion(MNodeType inType);
+	MFragment Bytes(const std::bitset<256> &inBytes);
+	MFragment CodePoint(char32_t inChar);
+	MFragment CodePointRange(char32_t inFirst, char32_t inLast);
+	MFragment AnyNonASCII();
+	MFragment Class(std::bitset<128> inASCII, const std::vector<char32_t> &inOther, bool inNonASCII, bool inNegated);
+
+	char32_t ReadChar();
+	bool ParseEscapedClass(char inEscape, std::bitset<128> &outASCII, bool &outNegated);
+	char32_t ParseEscapedChar(char inEscape);
+
+	std::string mPattern;
+	std::size_t mPos = 0;
+	bool mIgnoreCase;
+
+	std::vector<MNode> mNodes;
+	std::vector<std::bitset<256>> mSets;
+	int32_t mStart = -1;
+
+	// The lazily built DFA, one for anchored runs starting at a given
+	// position, one for a quick check if there is a match at all.
+
+	struct MState
+	{
+		std::vector<int32_t> nodes;
+		int32_t next[256];
+		bool accepting = false, acceptingAtEnd = false;
+	};
+
+	struct MDFA
+	{
+		std::vector<MState> states;
+		std::map<std::vector<int32_t>, int32_t> index;
+		int32_t start[2] = { -1, -1 }; // not at begin, at begin
+		bool unanchored = false;
+	};
+
+	void Closure(std::vector<int32_t> &ioNodes, bool inAtBegin, bool inAtEnd) const;
+	int32_t GetState(MDFA &inDFA, std::vector<int32_t> &&inNodes);
+	int32_t GetStart(MDFA &inDFA, bool inAtBegin);
+	int32_t Step(MDFA &inDFA, int32_t inState, uint8_t inByte);
+
+	MDFA mAnchored, mUnanchored;
+};
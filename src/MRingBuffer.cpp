@@ -0,0 +1,146 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#include "MRingBuffer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+// --------------------------------------------------------------------
+
+MRingBuffer::MRingBuffer(std::size_t inCapacity)
+	: mData(inCapacity)
+{
+}
+
+std::span<const uint8_t> MRingBuffer::Peek() const
+{
+	return { mData.data() + mHead, std::min(mSize, mData.size() - mHead) };
+}
+
+void MRingBuffer::Consume(std::size_t inLength)
+{
+	assert(inLength <= mSize);
+
+	mSize -= inLength;
+
+	if (mSize == 0 and mPrepared == 0)
+		mHead = 0;
+	else
+		mHead = (mHead + inLength) % mData.size();
+}
+
+std::span<uint8_t> MRingBuffer::Prepare(std::size_t inMinimum)
+{
+	assert(mPrepared == 0);
+
+	if (mData.size() - mSize < inMinimum)
+		Grow(inMinimum);
+
+	std::size_t tail = (mHead + mSize) % mData.size();
+	std::size_t free = tail >= mHead and mSize < mData.size()
+	                       ? mData.size() - tail
+	                       : mHead - tail;
+
+	mPrepared = free;
+
+	return { mData.data() + tail, free };
+}
+
+void MRingBuffer::Commit(std::size_t inLength)
+{
+	assert(inLength <= mPrepared);
+
+	mPrepared = 0;
+
+	if (mPending.empty())
+		mSize += inLength;
+	else
+	{
+		// Data was written while the read was outstanding, that data
+		// should come first.
+		std::size_t tail = (mHead + mSize) % mData.size();
+		std::vector<uint8_t> received(mData.begin() + tail, mData.begin() + tail + inLength);
+
+		std::string pending;
+		std::swap(pending, mPending);
+
+		Append(reinterpret_cast<const uint8_t *>(pending.data()), pending.length());
+		Append(received.data(), received.size());
+	}
+}
+
+void MRingBuffer::Write(std::string_view inData)
+{
+	if (mPrepared > 0)
+		mPending.append(inData);
+	else
+		Append(reinterpret_cast<const uint8_t *>(inData.data()), inData.length());
+}
+
+void MRingBuffer::Clear()
+{
+	assert(mPrepared == 0);
+
+	mHead = mSize = 0;
+	mPending.clear();
+}
+
+void MRingBuffer::Append(const uint8_t *inData, std::size_t inLength)
+{
+	if (mData.size() - mSize < inLength)
+		Grow(inLength);
+
+	std::size_t tail = (mHead + mSize) % mData.size();
+	std::size_t n = std::min(inLength, mData.size() - tail);
+
+	std::memcpy(mData.data() + tail, inData, n);
+	if (n < inLength)
+		std::memcpy(mData.data(), inData + n, inLength - n);
+
+	mSize += inLength;
+}
+
+void MRingBuffer::Grow(std::size_t inMinimum)
+{
+	std::size_t capacity = std::max<std::size_t>(mData.size(), 1024);
+	while (capacity - mSize < inMinimum)
+		capacity *= 2;
+
+	std::vector<uint8_t> data(capacity);
+
+	std::size_t n = std::min(mSize, mData.size() - mHead);
+	std::memcpy(data.data(), mData.data() + mHead, n);
+	if (n < mSize)
+		std::memcpy(data.data() + n, mData.data(), mSize - n);
+
+	std::swap(mData, data);
+	mHead = 0;
+}
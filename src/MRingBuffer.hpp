@@ -0,0 +1,89 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --------------------------------------------------------------------
+// MRingBuffer is a growable ring of bytes. The terminal channels read
+// directly into the free space of the ring and the emulator consumes the
+// data as contiguous spans, avoiding a copy for each byte received.
+
+class MRingBuffer
+{
+  public:
+	MRingBuffer(std::size_t inCapacity = 64 * 1024);
+
+	MRingBuffer(const MRingBuffer &) = delete;
+	MRingBuffer &operator=(const MRingBuffer &) = delete;
+
+	bool Empty() const { return mSize == 0; }
+	std::size_t Size() const { return mSize; }
+	std::size_t Capacity() const { return mData.size(); }
+
+	// The contiguous range of bytes at the front of the ring. This
+	// may be less than Size() when the data wraps around.
+	std::span<const uint8_t> Peek() const;
+	void Consume(std::size_t inLength);
+
+	uint8_t operator[](std::size_t inIndex) const
+	{
+		return mData[(mHead + inIndex) % mData.size()];
+	}
+
+	// Prepare returns a contiguous region of free space for a read
+	// operation, the ring grows when less than inMinimum bytes are
+	// available. The region returned can be smaller than inMinimum
+	// when the free space wraps around the end of the storage.
+	// Data written into the region is added by calling Commit.
+	std::span<uint8_t> Prepare(std::size_t inMinimum);
+	void Commit(std::size_t inLength);
+
+	// Append data to the ring, used for local echo and messages
+	void Write(std::string_view inData);
+
+	void Clear();
+
+  private:
+	void Append(const uint8_t *inData, std::size_t inLength);
+	void Grow(std::size_t inMinimum);
+
+	std::vector<uint8_t> mData;
+	std::size_t mHead = 0, mSize = 0;
+
+	// A read may be outstanding on the region returned by Prepare,
+	// data written in the mean time is kept apart until Commit.
+	std::size_t mPrepared = 0;
+	std::string mPending;
+};
@@ -0,0 +1,457 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#include "MScrollbackFile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------
+// A segment starts with the number of lines it contains, followed by
+// the offsets of each line in the segment plus one for the end of the
+// last line. The packed lines follow this index. Once the segment is
+// full, the number of styles and the styles themselves are written after
+// the last line. Characters refer to these styles by their number.
+
+namespace
+{
+
+const std::size_t
+	kLinesPerSegment = 65536,
+	kSegmentSize = 16 * 1024 * 1024,
+	kIndexSize = (kLinesPerSegment + 2) * sizeof(uint64_t),
+	kGrowSize = 1024 * 1024,
+	kMaxMappedSegments = 8,
+	kMaxStyles = 65536,
+	kStyleSize = 4 * sizeof(uint32_t) + sizeof(int16_t);
+
+const uint64_t *GetIndex(const char *inData)
+{
+	return reinterpret_cast<const uint64_t *>(inData);
+}
+
+uint64_t *GetIndex(char *inData)
+{
+	return reinterpret_cast<uint64_t *>(inData);
+}
+
+// The number of bytes in use
+std::size_t GetUsedSize(const char *inData)
+{
+	const uint64_t *index = GetIndex(inData);
+	return index[index[0] + 1];
+}
+
+// The size of the style table, including the count in front
+std::size_t GetStylesSize(std::size_t inCount)
+{
+	return sizeof(uint32_t) + inCount * kStyleSize;
+}
+
+void WriteStyle(char *outData, const MAttributeTable::MAttributes &inAttributes)
+{
+	uint32_t values[4] = {
+		inAttributes.style.GetFlags(),
+		inAttributes.style.GetForeColorValue(),
+		inAttributes.style.GetBackColorValue(),
+		inAttributes.style.GetUnderlineColorValue()
+	};
+
+	std::memcpy(outData, values, sizeof(values));
+	std::memcpy(outData + sizeof(values), &inAttributes.hyperLink, sizeof(int16_t));
+}
+
+MAttributeTable::MAttributes ReadStyle(const char *inData)
+{
+	uint32_t values[4];
+	std::memcpy(values, inData, sizeof(values));
+
+	MAttributeTable::MAttributes result{ MStyle(values[0], values[1], values[2], values[3]) };
+	std::memcpy(&result.hyperLink, inData + sizeof(values), sizeof(int16_t));
+
+	return result;
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+MScrollbackFile::MScrollbackFile(const std::filesystem::path &inDirectory, bool inKeepFiles)
+	: mDirectory(inDirectory)
+	, mKeepFiles(inKeepFiles)
+{
+	std::filesystem::create_directories(mDirectory);
+}
+
+MScrollbackFile::~MScrollbackFile()
+{
+	for (auto &segment : mSegments)
+		CloseSegment(segment, not mKeepFiles);
+
+	if (not mKeepFiles)
+	{
+		std::error_code ec;
+		std::filesystem::remove(mDirectory, ec);
+	}
+}
+
+void MScrollbackFile::Clear()
+{
+	for (auto &segment : mSegments)
+		CloseSegment(segment, true);
+
+	mSegments.clear();
+	mMapped.clear();
+	mLineCount = 0;
+
+	mStyles.clear();
+	mStyleIndex.clear();
+	mHyperLinks.clear();
+}
+
+// --------------------------------------------------------------------
+// The last segment is mapped for writing over its full maximum size, the
+// file itself grows in steps. Pages past the end of the file are never
+// touched. The file descriptor is only needed while mapping or growing.
+
+void MScrollbackFile::AddSegment()
+{
+	MSegment segment{ mDirectory / ("segment-" + std::to_string(mSegments.size()) + ".dat"), mLineCount, 0 };
+
+	int fd = open(segment.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		throw std::runtime_error(strerror(errno));
+
+	void *data = mmap(nullptr, kSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int err = data == MAP_FAILED ? errno : 0;
+
+	close(fd);
+
+	if (err != 0)
+	{
+		std::filesystem::remove(segment.path);
+		throw std::runtime_error(strerror(err));
+	}
+
+	segment.data = static_cast<char *>(data);
+
+	try
+	{
+		GrowSegment(segment, kIndexSize + kGrowSize);
+	}
+	catch (...)
+	{
+		munmap(segment.data, kSegmentSize);
+		std::filesystem::remove(segment.path);
+		throw;
+	}
+
+	uint64_t *index = GetIndex(segment.data);
+	index[0] = 0;
+	index[1] = kIndexSize;
+
+	if (not mSegments.empty())
+	{
+		try
+		{
+			SealSegment(mSegments.back());
+		}
+		catch (...)
+		{
+			munmap(segment.data, kSegmentSize);
+			std::filesystem::remove(segment.path);
+			throw;
+		}
+	}
+
+	mSegments.push_back(segment);
+}
+
+void MScrollbackFile::GrowSegment(MSegment &ioSegment, std::size_t inSize)
+{
+	int fd = open(ioSegment.path.c_str(), O_RDWR);
+	if (fd < 0)
+		throw std::runtime_error(strerror(errno));
+
+	// Allocate the space, writing to a sparse file on a full disk would crash
+	int err = posix_fallocate(fd, 0, inSize);
+	close(fd);
+
+	if (err != 0)
+		throw std::runtime_error(strerror(err));
+
+	ioSegment.size = inSize;
+}
+
+void MScrollbackFile::SealSegment(MSegment &ioSegment)
+{
+	std::size_t used = GetUsedSize(ioSegment.data);
+	std::size_t size = used + GetStylesSize(mStyles.size());
+
+	if (size > ioSegment.size)
+		GrowSegment(ioSegment, size);
+
+	uint32_t count = mStyles.size();
+	std::memcpy(ioSegment.data + used, &count, sizeof(count));
+	for (uint32_t i = 0; i < count; ++i)
+		WriteStyle(ioSegment.data + used + GetStylesSize(i), mStyles[i]);
+
+	mStyles.clear();
+	mStyleIndex.clear();
+
+	munmap(ioSegment.data, kSegmentSize);
+	ioSegment.data = nullptr;
+
+	// trim off the unused part, the segment is only read from now on
+	if (truncate(ioSegment.path.c_str(), size) != 0)
+		std::cerr << "Could not truncate " << ioSegment.path << ": " << strerror(errno) << '\n';
+	else
+		ioSegment.size = size;
+}
+
+void MScrollbackFile::CloseSegment(MSegment &ioSegment, bool inRemove)
+{
+	if (&ioSegment == &mSegments.back() and ioSegment.data != nullptr)
+	{
+		if (not inRemove)
+		{
+			try
+			{
+				SealSegment(ioSegment);
+			}
+			catch (const std::exception &ex)
+			{
+				std::cerr << "Could not write the styles to " << ioSegment.path << ": " << ex.what() << '\n';
+			}
+		}
+
+		if (ioSegment.data != nullptr)
+		{
+			munmap(ioSegment.data, kSegmentSize);
+			ioSegment.data = nullptr;
+		}
+	}
+	else
+		UnmapSegment(ioSegment);
+
+	if (inRemove)
+	{
+		std::error_code ec;
+		std::filesystem::remove(ioSegment.path, ec);
+	}
+}
+
+const char *MScrollbackFile::MapSegment(std::size_t inSegment) const
+{
+	MSegment &segment = mSegments[inSegment];
+
+	if (inSegment + 1 == mSegments.size())
+		return segment.data;
+
+	if (segment.data != nullptr)
+	{
+		auto i = std::find(mMapped.begin(), mMapped.end(), inSegment);
+		if (i + 1 != mMapped.end())
+		{
+			mMapped.erase(i);
+			mMapped.push_back(inSegment);
+		}
+
+		return segment.data;
+	}
+
+	if (mMapped.size() >= kMaxMappedSegments)
+	{
+		UnmapSegment(mSegments[mMapped.front()]);
+		mMapped.pop_front();
+	}
+
+	int fd = open(segment.path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error(strerror(errno));
+
+	void *data = mmap(nullptr, segment.size, PROT_READ, MAP_SHARED, fd, 0);
+	int err = data == MAP_FAILED ? errno : 0;
+
+	close(fd);
+
+	if (err != 0)
+		throw std::runtime_error(strerror(err));
+
+	segment.data = static_cast<char *>(data);
+	mMapped.push_back(inSegment);
+
+	return segment.data;
+}
+
+void MScrollbackFile::UnmapSegment(MSegment &ioSegment) const
+{
+	if (ioSegment.data != nullptr)
+	{
+		munmap(ioSegment.data, ioSegment.size);
+		ioSegment.data = nullptr;
+	}
+}
+
+// --------------------------------------------------------------------
+
+uint16_t MScrollbackFile::StoreAttributes(uint16_t inAttributes)
+{
+	const MAttributeTable::MAttributes &attributes = MAttributeTable::Get(inAttributes);
+
+	auto i = mStyleIndex.find(attributes);
+	if (i == mStyleIndex.end())
+	{
+		// a full table is noticed by Append, which starts a new segment
+		if (mStyles.size() >= kMaxStyles)
+			return 0;
+
+		i = mStyleIndex.emplace(attributes, mStyles.size()).first;
+		mStyles.push_back(attributes);
+
+		if (attributes.hyperLink != 0)
+			mHyperLinks.insert(attributes.hyperLink);
+	}
+
+	return i->second;
+}
+
+void MScrollbackFile::Append(const MCompressedLine &inLine)
+{
+	auto store = [this](uint16_t inAttributes) { return StoreAttributes(inAttributes); };
+
+	std::size_t styleCount = mStyles.size();
+
+	mPacked.clear();
+	inLine.Pack(mPacked, store);
+
+	auto fits = [this](const MSegment &inSegment)
+	{
+		const uint64_t *index = GetIndex(inSegment.data);
+		return index[0] < kLinesPerSegment and mStyles.size() < kMaxStyles and
+		       index[index[0] + 1] + mPacked.size() + GetStylesSize(mStyles.size()) <= kSegmentSize;
+	};
+
+	if (mSegments.empty() or not fits(mSegments.back()))
+	{
+		// forget the styles added for this line, they go in the new segment
+		for (std::size_t i = styleCount; i < mStyles.size(); ++i)
+			mStyleIndex.erase(mStyles[i]);
+		mStyles.erase(mStyles.begin() + styleCount, mStyles.end());
+
+		AddSegment();
+
+		mPacked.clear();
+		inLine.Pack(mPacked, store);
+
+		if (not fits(mSegments.back()))
+			throw std::runtime_error("Line too long to store in scrollback file");
+	}
+
+	auto &segment = mSegments.back();
+	uint64_t *index = GetIndex(segment.data);
+
+	uint64_t lineNr = index[0];
+	uint64_t offset = index[lineNr + 1];
+
+	if (offset + mPacked.size() > segment.size)
+		GrowSegment(segment, std::min(kSegmentSize, (offset + mPacked.size() + kGrowSize - 1) / kGrowSize * kGrowSize));
+
+	std::memcpy(segment.data + offset, mPacked.data(), mPacked.size());
+
+	index[lineNr + 2] = offset + mPacked.size();
+	index[0] = lineNr + 1;
+
+	++mLineCount;
+}
+
+MCompressedLine MScrollbackFile::ReadLine(std::size_t inLineNr, bool inAttributes) const
+{
+	if (inLineNr >= mLineCount)
+		throw std::runtime_error("Out of range");
+
+	auto segment = std::upper_bound(mSegments.begin(), mSegments.end(), inLineNr,
+		[](std::size_t lineNr, const MSegment &segment)
+		{ return lineNr < segment.firstLine; });
+
+	assert(segment != mSegments.begin());
+	--segment;
+
+	const char *data = MapSegment(segment - mSegments.begin());
+	const uint64_t *index = GetIndex(data);
+	std::size_t lineNr = inLineNr - segment->firstLine;
+
+	MCompressedLine::MAttributeMap load;
+
+	if (inAttributes and segment + 1 == mSegments.end())
+	{
+		load = [this](uint16_t inStyle) -> uint16_t
+		{
+			return inStyle < mStyles.size() ? MAttributeTable::Intern(mStyles[inStyle].style, mStyles[inStyle].hyperLink) : 0;
+		};
+	}
+	else if (inAttributes)
+	{
+		// the styles of a full segment follow the lines, if they could be written
+		std::size_t used = GetUsedSize(data);
+		uint32_t count = 0;
+		if (segment->size >= used + GetStylesSize(0))
+			std::memcpy(&count, data + used, sizeof(count));
+		if (segment->size < used + GetStylesSize(count))
+			count = 0;
+
+		load = [styles = data + used, count](uint16_t inStyle) -> uint16_t
+		{
+			if (inStyle >= count)
+				return 0;
+
+			MAttributeTable::MAttributes attributes = ReadStyle(styles + GetStylesSize(inStyle));
+			return MAttributeTable::Intern(attributes.style, attributes.hyperLink);
+		};
+	}
+
+	return MCompressedLine::Unpack(data + index[lineNr + 1], index[lineNr + 2] - index[lineNr + 1], load);
+}
+
+MCompressedLine MScrollbackFile::GetLine(std::size_t inLineNr) const
+{
+	return ReadLine(inLineNr, true);
+}
+
+void MScrollbackFile::GetText(std::size_t inLineNr, std::string &outText, bool &outSoftWrapped) const
+{
+	MCompressedLine line = ReadLine(inLineNr, false);
+	outText.assign(line.GetText());
+	outSoftWrapped = line.IsSoftWrapped();
+}
@@ -0,0 +1,123 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#pragma once
+
+#include "MTerminalBuffer.hpp"
+
+#include <deque>
+#include <filesystem>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// --------------------------------------------------------------------
+// MScrollbackFile stores scrollback lines that no longer fit in memory.
+// The lines are appended to segment files, each segment starts with an
+// index containing the offset of each line so that any line can be
+// located directly. Only the last segment is mapped for writing, it grows
+// in steps. Older segments are mapped read only when lines are read, a
+// few of these mappings are kept. The segment files are removed when the
+// object is destroyed, unless asked to keep them.
+//
+// Characters refer to entries in the process wide MAttributeTable, each
+// segment has its own table of the styles and hyperlinks used instead.
+// It is stored after the lines when the segment is full.
+
+class MScrollbackFile
+{
+  public:
+	MScrollbackFile(const std::filesystem::path &inDirectory, bool inKeepFiles);
+	~MScrollbackFile();
+
+	MScrollbackFile(const MScrollbackFile &) = delete;
+	MScrollbackFile &operator=(const MScrollbackFile &) = delete;
+
+	// Append a line, lines are numbered in the order they were appended
+	void Append(const MCompressedLine &inLine);
+
+	MCompressedLine GetLine(std::size_t inLineNr) const;
+
+	// Only the text of a line, without looking up the attributes
+	void GetText(std::size_t inLineNr, std::string &outText, bool &outSoftWrapped) const;
+
+	std::size_t size() const { return mLineCount; }
+
+	// The hyperlinks of the buffer used by the stored lines
+	template <typename Handler>
+	void ForeachHyperLink(Handler &&inHandler) const
+	{
+		for (int16_t hyperLink : mHyperLinks)
+			inHandler(hyperLink);
+	}
+
+	// Remove all lines and segment files
+	void Clear();
+
+  private:
+	struct MSegment
+	{
+		std::filesystem::path path;
+		std::size_t firstLine;
+		std::size_t size;     // of the file
+		char *data = nullptr; // if mapped
+	};
+
+	void AddSegment();
+	void GrowSegment(MSegment &ioSegment, std::size_t inSize);
+	void SealSegment(MSegment &ioSegment);
+	void CloseSegment(MSegment &ioSegment, bool inRemove);
+
+	const char *MapSegment(std::size_t inSegment) const;
+	void UnmapSegment(MSegment &ioSegment) const;
+
+	MCompressedLine ReadLine(std::size_t inLineNr, bool inAttributes) const;
+	uint16_t StoreAttributes(uint16_t inAttributes);
+
+	std::filesystem::path mDirectory;
+	bool mKeepFiles;
+	mutable std::vector<MSegment> mSegments;
+	mutable std::deque<std::size_t> mMapped; // read only mappings, most recently used last
+	std::size_t mLineCount = 0;
+	std::string mPacked;
+
+	struct MAttributesHash
+	{
+		std::size_t operator()(const MAttributeTable::MAttributes &inAttributes) const
+		{
+			return inAttributes.Hash();
+		}
+	};
+
+	// the styles used in the last segment
+	std::vector<MAttributeTable::MAttributes> mStyles;
+	std::unordered_map<MAttributeTable::MAttributes, uint16_t, MAttributesHash> mStyleIndex;
+
+	std::set<int16_t> mHyperLinks;
+};
@@ -95,6 +95,17 @@ MSearchPanel::MSearchPanel(const std::string &inID, MRect inBounds)
 	AddChild(mCaseSensitive);
 	mCaseSensitive->SetChecked(MPrefs::GetBoolean("find-case-sensitive", false));
 
+	label = _("Regular expression");
+	dev.SetText(label);
+	labelWidth = static_cast<uint32_t>(dev.GetTextWidth());
+
+	bounds.x += bounds.width + 4;
+	bounds.width = 20 + labelWidth;
+	mRegex = new MCheckbox("regex", bounds, label);
+	mRegex->SetLayout({ false, 4 });
+	AddChild(mRegex);
+	mRegex->SetChecked(MPrefs::GetBoolean("find-regex", false));
+
 	// nog twee knoppen
 
 	bounds.x += bounds.width + 10;
@@ -129,6 +140,7 @@ MSearchPanel::~MSearchPanel()
 void MSearchPanel::Close()
 {
 	MPrefs::SetString("find-recent", mTextBox->GetText());
+	MPrefs::SetBoolean("find-regex", mRegex->IsChecked());
 	Hide();
 	if (auto w = dynamic_cast<MTerminalWindow *>(GetWindow()); w != nullptr)
 		w->FocusTerminalView();
@@ -194,3 +206,8 @@ bool MSearchPanel::GetIgnoreCase() const
 {
 	return not mCaseSensitive->IsChecked();
 }
+
+bool MSearchPanel::GetRegex() const
+{
+	return mRegex->IsChecked();
+}
@@ -51,6 +51,7 @@ class MSearchPanel : public MBoxControl
 
 	std::string GetSearchString() const;
 	bool GetIgnoreCase() const;
+	bool GetRegex() const;
 
 	uint32_t GetHeight() const;
 
@@ -70,4 +71,5 @@ class MSearchPanel : public MBoxControl
 
 	MEdittext *mTextBox;
 	MCheckbox *mCaseSensitive;
+	MCheckbox *mRegex;
 };
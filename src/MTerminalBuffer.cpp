@@ -30,32 +30,384 @@
 #include "MTerminalBuffer.hpp"
 #include "MError.hpp"
 #include "MPreferences.hpp"
+#include "MRegex.hpp"
+#include "MScrollbackFile.hpp"
+#include "MTrigramIndex.hpp"
 #include "MUnicode.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <regex>
 #include <set>
+#include <unordered_map>
 
 #include <zeep/http/uri.hpp>
 #include <zeep/unicode-support.hpp>
 
+#include <cctype>
+#include <cstring>
+
+#include <unistd.h>
+
+// --------------------------------------------------------------------
+
+MXTermColor MStyle::ToXTermColor(uint32_t inColor)
+{
+	if ((inColor & kRGBColor) == 0)
+		return static_cast<MXTermColor>(inColor);
+
+	int red = (inColor >> 16) & 0xff, green = (inColor >> 8) & 0xff, blue = inColor & 0xff;
+
+	// the 6x6x6 color cube in the xterm palette
+	const int kLevels[6] = { 0, 95, 135, 175, 215, 255 };
+
+	auto nearestLevel = [&kLevels](int v)
+	{
+		int result = 0;
+		for (int i = 1; i < 6; ++i)
+		{
+			if (std::abs(kLevels[i] - v) < std::abs(kLevels[result] - v))
+				result = i;
+		}
+		return result;
+	};
+
+	int r = nearestLevel(red), g = nearestLevel(green), b = nearestLevel(blue);
+	int cubeDistance = (kLevels[r] - red) * (kLevels[r] - red) +
+	                   (kLevels[g] - green) * (kLevels[g] - green) +
+	                   (kLevels[b] - blue) * (kLevels[b] - blue);
+
+	// and the 24 grays
+	int gray = std::clamp(((red + green + blue) / 3 - 8 + 5) / 10, 0, 23);
+	int grayLevel = 8 + 10 * gray;
+	int grayDistance = (grayLevel - red) * (grayLevel - red) +
+	                   (grayLevel - green) * (grayLevel - green) +
+	                   (grayLevel - blue) * (grayLevel - blue);
+
+	if (grayDistance < cubeDistance)
+		return static_cast<MXTermColor>(232 + gray);
+
+	return static_cast<MXTermColor>(16 + 36 * r + 6 * g + b);
+}
+
+MStyle MStyle::WithoutRGB() const
+{
+	MStyle result(*this);
+	result.mForeColor = GetForeColor();
+	result.mBackColor = GetBackColor();
+	result.mUnderlineColor = GetUnderlineColor();
+	return result;
+}
+
+std::size_t MStyle::Hash() const
+{
+	std::size_t result = mFlags;
+	result = result * 31 + mForeColor;
+	result = result * 31 + mBackColor;
+	result = result * 31 + mUnderlineColor;
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+const std::size_t
+	kMaxAttributes = 65536;
+
+// A collection is started when this many entries are in use, and at
+// least kMinCollectGrowth more than were left after the previous one
+const std::size_t
+	kCollectThreshold = kMaxAttributes * 3 / 4,
+	kMinCollectGrowth = 4096;
+
+struct MAttributesHash
+{
+	std::size_t operator()(const MAttributeTable::MAttributes &inAttributes) const
+	{
+		return inAttributes.Hash();
+	}
+};
+
+std::mutex sAttributesMutex;
+std::unordered_map<MAttributeTable::MAttributes, uint16_t, MAttributesHash> sAttributesIndex;
+std::vector<uint16_t> sFreeAttributes;
+std::size_t sNextAttributes = 1, sLiveAttributes = 0;
+
+// The collection state
+std::atomic<uint32_t> sAttributesGeneration = 0;
+std::set<uint32_t> sCollectors, sPendingCollectors;
+uint32_t sNextCollector = 1;
+bool sCollecting = false;
+MAttributeTable::MMarks sMarks;
+
+void StartCollection()
+{
+	sCollecting = true;
+	sPendingCollectors = sCollectors;
+	sMarks.assign(kMaxAttributes, false);
+	sMarks[0] = true;
+
+	// make sure the attributes cached by each thread are interned, and thus marked, again
+	++sAttributesGeneration;
+}
+
+void FinishCollection()
+{
+	for (auto i = sAttributesIndex.begin(); i != sAttributesIndex.end();)
+	{
+		if (sMarks[i->second])
+			++i;
+		else
+		{
+			sFreeAttributes.push_back(i->second);
+			i = sAttributesIndex.erase(i);
+		}
+	}
+
+	sCollecting = false;
+	sLiveAttributes = sAttributesIndex.size();
+	++sAttributesGeneration;
+}
+
+} // namespace
+
+MAttributeTable::MAttributes *MAttributeTable::GetTable()
+{
+	static std::unique_ptr<MAttributes[]> sTable(new MAttributes[kMaxAttributes]);
+	return sTable.get();
+}
+
+uint16_t MAttributeTable::Intern(const MStyle &inStyle, int16_t inHyperLink)
+{
+	MAttributes attributes{ inStyle, inHyperLink };
+
+	// Most of the time the same attributes are used over and over again
+	thread_local MAttributes tLastAttributes;
+	thread_local uint16_t tLastID = 0;
+	thread_local uint32_t tLastGeneration = 0;
+
+	uint32_t generation = sAttributesGeneration;
+	if (attributes == tLastAttributes and generation == tLastGeneration)
+		return tLastID;
+
+	std::unique_lock lock(sAttributesMutex);
+
+	if (sAttributesIndex.empty())
+		sAttributesIndex.emplace(MAttributes{}, 0);
+
+	auto i = sAttributesIndex.find(attributes);
+	if (i == sAttributesIndex.end())
+	{
+		uint16_t id = 0;
+		if (not sFreeAttributes.empty())
+		{
+			id = sFreeAttributes.back();
+			sFreeAttributes.pop_back();
+		}
+		else if (sNextAttributes < kMaxAttributes)
+			id = static_cast<uint16_t>(sNextAttributes++);
+		else
+		{
+			// The table is full, fall back to palette colors and then to no hyperlink
+			lock.unlock();
+
+			if (inStyle.IsForeColorRGB() or inStyle.IsBackColorRGB() or inStyle.IsUnderlineColorRGB())
+				return Intern(inStyle.WithoutRGB(), inHyperLink);
+
+			if (inHyperLink != 0)
+				return Intern(inStyle, 0);
+
+			return 0;
+		}
+
+		GetTable()[id] = attributes;
+		i = sAttributesIndex.emplace(attributes, id).first;
+
+		if (not sCollecting and not sCollectors.empty() and sAttributesIndex.size() >= kCollectThreshold and
+			sAttributesIndex.size() >= sLiveAttributes + kMinCollectGrowth)
+		{
+			StartCollection();
+		}
+	}
+
+	// entries handed out during a collection are in use
+	if (sCollecting)
+		sMarks[i->second] = true;
+
+	tLastAttributes = attributes;
+	tLastID = i->second;
+	tLastGeneration = sAttributesGeneration;
+
+	return tLastID;
+}
+
+uint32_t MAttributeTable::RegisterCollector()
+{
+	std::unique_lock lock(sAttributesMutex);
+
+	uint32_t result = sNextCollector++;
+	sCollectors.insert(result);
+	return result;
+}
+
+void MAttributeTable::UnregisterCollector(uint32_t inCollector)
+{
+	std::unique_lock lock(sAttributesMutex);
+
+	sCollectors.erase(inCollector);
+
+	if (sCollecting and sPendingCollectors.erase(inCollector) and sPendingCollectors.empty())
+		FinishCollection();
+}
+
+bool MAttributeTable::NeedsMark(uint32_t inCollector)
+{
+	std::unique_lock lock(sAttributesMutex);
+	return sCollecting and sPendingCollectors.contains(inCollector);
+}
+
+MAttributeTable::MMarks MAttributeTable::CreateMarks()
+{
+	return MMarks(kMaxAttributes, false);
+}
+
+void MAttributeTable::Mark(uint32_t inCollector, const MMarks &inMarks)
+{
+	std::unique_lock lock(sAttributesMutex);
+
+	if (sCollecting and sPendingCollectors.erase(inCollector))
+	{
+		for (std::size_t i = 0; i < kMaxAttributes and i < inMarks.size(); ++i)
+		{
+			if (inMarks[i])
+				sMarks[i] = true;
+		}
+
+		if (sPendingCollectors.empty())
+			FinishCollection();
+	}
+}
+
+uint32_t MAttributeTable::GetGeneration()
+{
+	return sAttributesGeneration;
+}
+
+// --------------------------------------------------------------------
+// The character storage for lines is recycled. Lines come and go all
+// the time and are almost always of the same width, so we keep a free
+// list of blocks per width. Each thread has its own store, blocks
+// may be released by another thread than the one that allocated them.
+
+namespace
+{
+
+const std::size_t
+	kMaxFreeBlocksPerWidth = 1024;
+
+// The number of expanded scrollback lines kept, enough for a large screen
+const std::size_t
+	kMaxExpandedLines = 256;
+
+// Make room in a cache keyed by line serial by dropping the entry
+// furthest away from inSerial, which is not in the cache itself.
+template <typename Cache>
+void DropFurthest(Cache &ioCache, uint64_t inSerial)
+{
+	uint64_t first = ioCache.begin()->first;
+	uint64_t last = ioCache.rbegin()->first;
+
+	uint64_t before = inSerial > first ? inSerial - first : 0;
+	uint64_t after = last > inSerial ? last - inSerial : 0;
+
+	if (before > after)
+		ioCache.erase(ioCache.begin());
+	else
+		ioCache.erase(std::prev(ioCache.end()));
+}
+
+class MLineStore
+{
+  public:
+	static MChar *Allocate(uint32_t inSize)
+	{
+		if (sDestroyed)
+			return new MChar[inSize];
+		return sInstance.Get(inSize);
+	}
+
+	static void Release(MChar *inBlock, uint32_t inSize)
+	{
+		if (sDestroyed)
+			delete[] inBlock;
+		else
+			sInstance.Put(inBlock, inSize);
+	}
+
+  private:
+	~MLineStore()
+	{
+		sDestroyed = true;
+
+		for (auto &[size, blocks] : mFree)
+		{
+			for (auto block : blocks)
+				delete[] block;
+		}
+	}
+
+	MChar *Get(uint32_t inSize)
+	{
+		auto i = mFree.find(inSize);
+		if (i == mFree.end() or i->second.empty())
+			return new MChar[inSize];
+
+		MChar *result = i->second.back();
+		i->second.pop_back();
+		return result;
+	}
+
+	void Put(MChar *inBlock, uint32_t inSize)
+	{
+		auto &blocks = mFree[inSize];
+		if (blocks.size() < kMaxFreeBlocksPerWidth)
+			blocks.push_back(inBlock);
+		else
+			delete[] inBlock;
+	}
+
+	std::map<uint32_t, std::vector<MChar *>> mFree;
+
+	static thread_local MLineStore sInstance;
+	static thread_local bool sDestroyed;
+};
+
+thread_local MLineStore MLineStore::sInstance;
+thread_local bool MLineStore::sDestroyed = false;
+
+} // namespace
+
 // --------------------------------------------------------------------
 
-MLine::MLine(uint32_t inSize, MXTermColor inForeColor, MXTermColor inBackColor)
-	: mCharacters(new MChar[inSize])
+MLine::MLine(uint32_t inSize, uint32_t inForeColor, uint32_t inBackColor)
+	: mCharacters(MLineStore::Allocate(inSize))
 	, mSize(inSize)
 	, mSoftWrapped(false)
 	, mDoubleWidth(false)
 	, mDoubleHeight(false)
 {
-	std::for_each(mCharacters, mCharacters + mSize,
-		[inForeColor, inBackColor](MChar &ch)
-		{ ch = MChar(inForeColor, inBackColor); });
+	std::fill(mCharacters, mCharacters + mSize, MChar(inForeColor, inBackColor));
 }
 
 MLine::MLine(const MLine &rhs)
-	: mCharacters(new MChar[rhs.mSize])
+	: mCharacters(MLineStore::Allocate(rhs.mSize))
 	, mSize(rhs.mSize)
 	, mSoftWrapped(rhs.mSoftWrapped)
 	, mDoubleWidth(rhs.mDoubleWidth)
@@ -67,10 +419,11 @@ MLine::MLine(const MLine &rhs)
 
 MLine::~MLine()
 {
-	delete[] mCharacters;
+	if (mCharacters != nullptr)
+		MLineStore::Release(mCharacters, mSize);
 }
 
-void MLine::Delete(uint32_t inColumn, uint32_t inWidth, MXTermColor inForeColor, MXTermColor inBackColor)
+void MLine::Delete(uint32_t inColumn, uint32_t inWidth, uint32_t inForeColor, uint32_t inBackColor)
 {
 	if (inWidth == 0 or inWidth > mSize)
 		inWidth = mSize;
@@ -91,6 +444,15 @@ void MLine::Insert(uint32_t inColumn, uint32_t inWidth)
 	mCharacters[inColumn] = ' ';
 }
 
+void MLine::Resize(uint32_t inSize, uint32_t inForeColor, uint32_t inBackColor)
+{
+	MLine resized(inSize, inForeColor, inBackColor);
+	std::copy(mCharacters, mCharacters + std::min(mSize, inSize), resized.mCharacters);
+
+	std::swap(mCharacters, resized.mCharacters);
+	std::swap(mSize, resized.mSize);
+}
+
 template <class OutputIterator>
 void MLine::CopyOut(OutputIterator iter) const
 {
@@ -109,10 +471,196 @@ void swap(MLine &lhs, MLine &rhs) noexcept
 	std::swap(lhs.mDoubleHeightTop, rhs.mDoubleHeightTop);
 }
 
+bool operator==(const MLine &lhs, const MLine &rhs)
+{
+	return lhs.mSize == rhs.mSize and
+	       lhs.mSoftWrapped == rhs.mSoftWrapped and
+	       lhs.mDoubleWidth == rhs.mDoubleWidth and
+	       lhs.mDoubleHeight == rhs.mDoubleHeight and
+	       lhs.mDoubleHeightTop == rhs.mDoubleHeightTop and
+	       std::equal(lhs.mCharacters, lhs.mCharacters + lhs.mSize, rhs.mCharacters);
+}
+
+// --------------------------------------------------------------------
+
+MCompressedLine::MCompressedLine(const MLine &inLine)
+	: mSize(inLine.size())
+	, mSoftWrapped(inLine.IsSoftWrapped())
+	, mDoubleWidth(inLine.IsDoubleWidth())
+	, mDoubleHeight(inLine.IsDoubleHeight())
+	, mDoubleHeightTop(inLine.IsDoubleHeightTop())
+{
+	// trailing blanks are filled in again using the attributes of the last one
+	uint32_t length = mSize;
+	if (length > 0 and inLine[length - 1] == ' ' and not inLine[length - 1].IsTab())
+	{
+		mFillAttributes = inLine[length - 1].GetAttributes();
+		while (length > 0 and inLine[length - 1] == ' ' and inLine[length - 1].GetAttributes() == mFillAttributes and
+			   not inLine[length - 1].IsTab())
+			--length;
+	}
+
+	auto iter = back_inserter(mText);
+
+	for (uint32_t i = 0; i < length; ++i)
+	{
+		MChar ch = inLine[i];
+
+		uint16_t attributes = ch.GetAttributes();
+		bool tab = ch.IsTab();
+
+		if (mRuns.empty() or mRuns.back().attributes != attributes or mRuns.back().tab != tab)
+			mRuns.push_back({ 0, attributes, tab });
+		++mRuns.back().length;
+
+		MEncodingTraits<kEncodingUTF8>::WriteUnicode(iter, static_cast<unicode>(ch));
+	}
+
+	mText.shrink_to_fit();
+	mRuns.shrink_to_fit();
+}
+
+MLine MCompressedLine::Expand() const
+{
+	MLine result(mSize, kXTermColorNone, kXTermColorNone);
+
+	uint32_t column = 0;
+	auto text = mText.begin();
+
+	for (auto &run : mRuns)
+	{
+		for (uint32_t i = 0; i < run.length and column < mSize; ++i, ++column)
+		{
+			unicode ch = ' ';
+			uint32_t length = 1;
+			if (text != mText.end())
+				MEncodingTraits<kEncodingUTF8>::ReadUnicode(text, length, ch);
+			text += length > 0 ? length : 1;
+
+			result[column] = MChar(ch, run.attributes);
+			if (run.tab)
+				result[column].SetTab(true);
+		}
+	}
+
+	for (; column < mSize; ++column)
+		result[column] = MChar(' ', mFillAttributes);
+
+	result.SetSoftWrapped(mSoftWrapped);
+	if (mDoubleWidth)
+		result.SetDoubleWidth();
+	else if (mDoubleHeight)
+		result.SetDoubleHeight(mDoubleHeightTop);
+
+	return result;
+}
+
+namespace
+{
+
+// A packed line starts with its size, the length of the text, the number
+// of runs, the fill attributes and the flags. The runs follow, each as a
+// length, attributes and tab flag, and then the text. Fields are written
+// one by one in native byte order, without padding.
+
+const std::size_t
+	kPackedHeaderSize = 3 * sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t),
+	kPackedRunSize = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t);
+
+enum MPackedLineFlags : uint8_t
+{
+	kPackedSoftWrapped = 1 << 0,
+	kPackedDoubleWidth = 1 << 1,
+	kPackedDoubleHeight = 1 << 2,
+	kPackedDoubleHeightTop = 1 << 3
+};
+
+template <typename T>
+void WritePacked(std::string &ioData, T inValue)
+{
+	ioData.append(reinterpret_cast<const char *>(&inValue), sizeof(T));
+}
+
+template <typename T>
+T ReadPacked(const char *&ioData)
+{
+	T result;
+	std::memcpy(&result, ioData, sizeof(T));
+	ioData += sizeof(T);
+	return result;
+}
+
+} // namespace
+
+void MCompressedLine::Pack(std::string &ioData, const MAttributeMap &inStore) const
+{
+	uint8_t flags = 0;
+	if (mSoftWrapped)
+		flags |= kPackedSoftWrapped;
+	if (mDoubleWidth)
+		flags |= kPackedDoubleWidth;
+	if (mDoubleHeight)
+		flags |= kPackedDoubleHeight;
+	if (mDoubleHeightTop)
+		flags |= kPackedDoubleHeightTop;
+
+	WritePacked<uint32_t>(ioData, mSize);
+	WritePacked<uint32_t>(ioData, mText.length());
+	WritePacked<uint32_t>(ioData, mRuns.size());
+	WritePacked<uint16_t>(ioData, inStore(mFillAttributes));
+	WritePacked<uint8_t>(ioData, flags);
+
+	for (auto &run : mRuns)
+	{
+		WritePacked<uint32_t>(ioData, run.length);
+		WritePacked<uint16_t>(ioData, inStore(run.attributes));
+		WritePacked<uint8_t>(ioData, run.tab);
+	}
+
+	ioData.append(mText);
+}
+
+MCompressedLine MCompressedLine::Unpack(const char *inData, std::size_t inSize, const MAttributeMap &inLoad)
+{
+	if (inSize < kPackedHeaderSize)
+		throw std::runtime_error("Invalid packed line");
+
+	MCompressedLine result;
+
+	result.mSize = ReadPacked<uint32_t>(inData);
+	uint32_t textLength = ReadPacked<uint32_t>(inData);
+	uint32_t runCount = ReadPacked<uint32_t>(inData);
+	uint16_t fillAttributes = ReadPacked<uint16_t>(inData);
+	uint8_t flags = ReadPacked<uint8_t>(inData);
+
+	if (inSize != kPackedHeaderSize + static_cast<uint64_t>(runCount) * kPackedRunSize + textLength)
+		throw std::runtime_error("Invalid packed line");
+
+	result.mFillAttributes = inLoad ? inLoad(fillAttributes) : 0;
+	result.mSoftWrapped = flags & kPackedSoftWrapped;
+	result.mDoubleWidth = flags & kPackedDoubleWidth;
+	result.mDoubleHeight = flags & kPackedDoubleHeight;
+	result.mDoubleHeightTop = flags & kPackedDoubleHeightTop;
+
+	result.mRuns.resize(runCount);
+	for (auto &run : result.mRuns)
+	{
+		run.length = ReadPacked<uint32_t>(inData);
+		uint16_t attributes = ReadPacked<uint16_t>(inData);
+		run.attributes = inLoad ? inLoad(attributes) : 0;
+		run.tab = ReadPacked<uint8_t>(inData) != 0;
+	}
+
+	result.mText.assign(inData, textLength);
+
+	return result;
+}
+
 // --------------------------------------------------------------------
 
 MTerminalBuffer::MTerminalBuffer(uint32_t inWidth, uint32_t inHeight, bool inBuffer)
 	: mLines(inHeight, MLine(inWidth, kXTermColorNone, kXTermColorNone))
+	, mLineGenerations(inHeight, 0)
 	, mWidth(inWidth)
 	, mDirty(false)
 	, mBeginLine(0)
@@ -124,145 +672,322 @@ MTerminalBuffer::MTerminalBuffer(uint32_t inWidth, uint32_t inHeight, bool inBuf
 	, mBackColor(kXTermColorNone)
 {
 	mBufferSize = inBuffer ? MPrefs::GetInteger("buffer-size", 5000) : 0;
+
+	if (inBuffer and MPrefs::GetBoolean("disk-scrollback", false))
+	{
+		static int sNextScrollbackNr = 1;
+
+		auto dir = gPrefsDir / "scrollback" / (std::to_string(getpid()) + '-' + std::to_string(sNextScrollbackNr++));
+
+		try
+		{
+			mScrollbackFile.reset(new MScrollbackFile(dir, MPrefs::GetBoolean("keep-scrollback-files", false)));
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Could not create scrollback file: " << ex.what() << '\n';
+		}
+	}
+
+	if (inBuffer and MPrefs::GetBoolean("scrollback-index", false))
+		mMaxIndexMemory = static_cast<std::size_t>(MPrefs::GetInteger("scrollback-index-size", 64)) * 1024 * 1024;
 }
 
 MTerminalBuffer::~MTerminalBuffer()
 {
 }
 
-const MLine &MTerminalBuffer::GetLine(int32_t inLine) const
+int32_t MTerminalBuffer::BufferedLines() const
+{
+	std::size_t result = mBuffer.size();
+	if (mScrollbackFile)
+		result += mScrollbackFile->size();
+	return static_cast<int32_t>(result);
+}
+
+MLine MTerminalBuffer::GetLine(int32_t inLine) const
 {
 	if (inLine >= 0)
 	{
 		if (static_cast<uint32_t>(inLine) >= mLines.size())
 			throw std::runtime_error("Out of range");
-		return mLines[inLine];
+		return ScreenLine(inLine);
 	}
 	else
 	{
 		inLine = -inLine - 1;
-		if (static_cast<uint32_t>(inLine) >= mBuffer.size())
+		if (inLine >= BufferedLines())
 			throw std::runtime_error("Out of range");
-		return mBuffer[inLine];
+
+		uint64_t serial = mBufferSerial - inLine - 1;
+
+		auto i = mExpandedLines.find(serial);
+		if (i == mExpandedLines.end())
+		{
+			// keep the cache small, drop the line furthest away from this one
+			if (mExpandedLines.size() >= kMaxExpandedLines)
+				DropFurthest(mExpandedLines, serial);
+
+			MLine line = static_cast<std::size_t>(inLine) < mBuffer.size()
+				? mBuffer[inLine].Expand()
+				: mScrollbackFile->GetLine(BufferedLines() - inLine - 1).Expand();
+
+			// lines on disk, and lines not reflowed yet, may still have the old width
+			if (line.size() != mWidth)
+				line.Resize(mWidth, mForeColor, mBackColor);
+
+			i = mExpandedLines.emplace(serial, std::move(line)).first;
+		}
+
+		return i->second;
+	}
+}
+
+void MTerminalBuffer::UnrotateLines()
+{
+	std::rotate(mLines.begin(), mLines.begin() + mFirstLine, mLines.end());
+	mFirstLine = 0;
+}
+
+void MTerminalBuffer::PushToBuffer(const MLine &inLine)
+{
+	if (mBufferSize > 0)
+	{
+		mBuffer.emplace_front(inLine);
+		++mBufferSerial;
+		++mReflowed;
+
+		// while the index is being built, BuildIndex picks up new lines
+		if (mIndex and mIndexNext + 1 == mBufferSerial)
+		{
+			AddToIndex(0);
+			mIndexNext = mBufferSerial;
+		}
+
+		while (mBuffer.size() > mBufferSize)
+		{
+			if (mIndex and not mIndex->Empty() and mIndex->Begin() == mBufferSerial - mBuffer.size())
+				RemoveFromIndex();
+
+			if (mScrollbackFile)
+			{
+				try
+				{
+					mScrollbackFile->Append(mBuffer.back());
+				}
+				catch (const std::exception &ex)
+				{
+					// e.g. a full disk, continue without the scrollback on disk
+					std::cerr << "Could not write to scrollback file, scrollback on disk is disabled: " << ex.what() << '\n';
+					mScrollbackFile.reset();
+
+					// the lines on disk are gone, the search results refer to them
+					mExpandedLines.clear();
+					mBufferLinks.clear();
+					++mBufferEpoch;
+				}
+			}
+
+			mBuffer.pop_back();
+		}
+
+		if (mReflowed > mBuffer.size())
+			mReflowed = mBuffer.size();
 	}
 }
 
 void MTerminalBuffer::Resize(uint32_t inWidth, uint32_t inHeight, int32_t &ioAnchorLine)
 {
+	UnrotateLines();
+	mExpandedLines.clear();
+	mBufferLinks.clear();
+	mIndex.reset();
+
 	if (inWidth == mWidth)
 	{
-		// simple case, shift lines from mBuffer to/from mLines
+		// simple case, shift lines from mBuffer to/from mLines, but make sure
+		// the lines we pull back onto the screen have the right width
+		while (mReflowed + mLines.size() < inHeight and NeedsReflow())
+			ReflowBuffer(mReflowed, mReflowed);
+
 		while (inHeight > mLines.size() and not mBuffer.empty())
 		{
-			mLines.insert(mLines.begin(), mBuffer.front());
+			mLines.insert(mLines.begin(), mBuffer.front().Expand());
 			mBuffer.pop_front();
+			--mBufferSerial;
+			--mReflowed;
 		}
 
 		while (inHeight < mLines.size() and not mLines.empty())
 		{
-			mBuffer.push_front(mLines.front());
+			mBuffer.emplace_front(mLines.front());
+			++mBufferSerial;
+			++mReflowed;
 			mLines.erase(mLines.begin());
 		}
 
-		// this can happen if mBuffer is exhausted or was empty
-		while (mLines.size() < inHeight)
-			mLines.insert(mLines.begin(), MLine(mWidth, mForeColor, mBackColor));
+		// this can happen if mBuffer is exhausted or was empty
+		while (mLines.size() < inHeight)
+			mLines.insert(mLines.begin(), MLine(mWidth, mForeColor, mBackColor));
+
+		assert(mLines.size() == inHeight);
+	}
+	else
+	{
+		// first push all lines in the buffer, none of them has the right width anymore
+		for (MLine &line : mLines)
+			mBuffer.emplace_front(line);
+		mReflowed = 0;
+		mWidth = inWidth;
+		++mBufferEpoch;
+
+		// Only rewrap what is needed to fill the screen and to locate the anchor,
+		// the rest of the buffer is done lazily in Reflow
+		std::size_t anchor = 0;
+		if (ioAnchorLine < 0)
+		{
+			anchor = mLines.size() - ioAnchorLine - 1;
+			if (anchor >= mBuffer.size())
+				anchor = mBuffer.size() - 1;
+			anchor = ReflowBuffer(anchor, anchor);
+		}
+
+		while (mReflowed < inHeight and NeedsReflow())
+			ReflowBuffer(mReflowed, mReflowed);
+
+		mLines = std::vector<MLine>(inHeight, MLine(inWidth, mForeColor, mBackColor));
+
+		// fill the mLines array from the new buffer
+		std::size_t pulled = 0;
+		for (std::vector<MLine>::reverse_iterator line = mLines.rbegin(); line != mLines.rend(); ++line)
+		{
+			if (mBuffer.empty())
+				break;
+			*line = mBuffer.front().Expand();
+			mBuffer.pop_front();
+			++pulled;
+		}
+
+		mReflowed -= pulled;
+		mBufferSerial = BufferedLines();
+
+		// finally, calculate new anchorline
+		if (ioAnchorLine < 0)
+			ioAnchorLine = anchor < pulled ? 0 : -static_cast<int32_t>(anchor - pulled) - 1;
+	}
+
+	mLineGenerations.assign(mLines.size(), 0);
+	TouchLines(0, mLines.size() - 1);
+}
+
+std::size_t MTerminalBuffer::ReflowBuffer(std::size_t inUntil, std::size_t inTrack)
+{
+	std::deque<MCompressedLine> rewrapped;
+	std::vector<MChar> chars;
+	std::size_t tracked = inTrack, emptyLines = 0;
 
-		assert(mLines.size() == inHeight);
-	}
-	else
+	std::size_t i = mReflowed;
+	while (i <= inUntil and i < mBuffer.size())
 	{
-		// for ioAnchorLine, find out what unwrapped line it is on
-		int32_t anchor = 0, newAnchorLine = ioAnchorLine;
-		for (int32_t i = 0; i < ioAnchorLine + static_cast<int32_t>(mBuffer.size()) and i < static_cast<int32_t>(mBuffer.size()); ++i)
+		// A logical line is a line that is not softwrapped and all
+		// softwrapped lines preceding it, which are older and thus
+		// have a higher index in mBuffer.
+		std::size_t j = i;
+		while (j + 1 < mBuffer.size() and mBuffer[j + 1].IsSoftWrapped())
+			++j;
+
+		for (std::size_t k = j + 1; k-- > i;)
 		{
-			if (not mBuffer[mBuffer.size() - i - 1].IsSoftWrapped())
-				++anchor;
+			MLine line = mBuffer[k].Expand();
+			line.CopyOut(back_inserter(chars));
 		}
 
-		// first push all lines in the buffer
-		for (MLine &line : mLines)
-			mBuffer.push_front(line);
+		// strip off trailing spaces of old line
+		std::vector<MChar>::iterator e = chars.end();
+		while (e != chars.begin() and *(e - 1) == ' ')
+			--e;
+		if (e != chars.end())
+			chars.erase(e, chars.end());
 
-		std::deque<MLine> rewrapped;
-		std::vector<MChar> chars;
+		if (chars.empty())
+			++emptyLines;
+		else
+			emptyLines = 0;
 
-		// then pull the lines out of the buffer, starting by the oldest
+		// copy over to new lines, the first part is the oldest
+		std::size_t first = rewrapped.size();
+		uint32_t offset = 0;
 		do
 		{
-			if (not mBuffer.empty())
-			{
-				MLine line = mBuffer.back();
-				mBuffer.pop_back();
-				line.CopyOut(back_inserter(chars));
+			MLine line(mWidth, mForeColor, mBackColor);
 
-				// concatenate lines, if they were softwrapped
-				if (line.IsSoftWrapped())
-					continue;
-			}
+			uint32_t n = mWidth;
+			if (n + offset >= chars.size())
+				n = chars.size() - offset;
 
-			// strip off trailing spaces of old line
-			std::vector<MChar>::iterator e = chars.end();
-			while (e != chars.begin() and *(e - 1) == ' ')
-				--e;
-			if (e != chars.end())
-				chars.erase(e, chars.end());
+			for (uint32_t c = 0; c < n; ++c)
+				line[c] = chars[c + offset];
 
-			// if this is the first line and it is empty, ignore it
-			if (chars.empty() and rewrapped.empty())
-				continue;
+			offset += n;
+			line.SetSoftWrapped(offset < chars.size());
 
-			// create a new line
-			rewrapped.push_front(MLine(inWidth, mForeColor, mBackColor));
+			rewrapped.emplace(rewrapped.begin() + first, line);
+		} while (offset < chars.size());
 
-			// store the new anchor position
-			if (--anchor == 0)
-				newAnchorLine = rewrapped.size();
+		// store the new anchor position
+		if (inTrack >= i and inTrack <= j)
+			tracked = mReflowed + rewrapped.size() - 1;
 
-			// copy over to new
-			uint32_t offset = 0;
-			while (offset < chars.size())
-			{
-				MLine &line(rewrapped.front());
+		// rinse and repeat
+		chars.clear();
+		i = j + 1;
+	}
 
-				uint32_t n = inWidth;
-				if (n + offset >= chars.size())
-					n = chars.size() - offset;
+	// empty lines at the very start of the history are not worth keeping
+	if (i == mBuffer.size() and not mScrollbackFile)
+	{
+		while (emptyLines-- > 0 and not rewrapped.empty())
+			rewrapped.pop_back();
 
-				for (uint32_t i = 0; i < n; ++i)
-					line[i] = chars[i + offset];
+		if (inTrack < i and tracked >= mReflowed + rewrapped.size())
+			tracked = mReflowed + rewrapped.size() > 0 ? mReflowed + rewrapped.size() - 1 : 0;
+	}
 
-				offset += n;
-				if (offset < chars.size())
-				{
-					line.SetSoftWrapped(true);
-					rewrapped.push_front(MLine(inWidth, mForeColor, mBackColor));
-				}
-			}
+	auto b = mBuffer.begin() + mReflowed;
+	b = mBuffer.erase(b, b + (i - mReflowed));
+	mBuffer.insert(b, std::make_move_iterator(rewrapped.begin()), std::make_move_iterator(rewrapped.end()));
+	++mBufferEpoch;
+	mIndex.reset();
 
-			// rinse and repeat until end
-			chars.clear();
-		} while (not mBuffer.empty());
+	// lines following the rewrapped ones have moved
+	if (inTrack >= i)
+		tracked = inTrack + (mReflowed + rewrapped.size()) - i;
 
-		mWidth = inWidth;
-		mLines = std::vector<MLine>(inHeight, MLine(inWidth, mForeColor, mBackColor));
-		swap(mBuffer, rewrapped);
+	mReflowed += rewrapped.size();
 
-		// fill the mLines array from the new buffer
-		for (std::vector<MLine>::reverse_iterator line = mLines.rbegin(); line != mLines.rend(); ++line)
-		{
-			if (mBuffer.empty())
-				break;
-			*line = mBuffer.front();
-			mBuffer.pop_front();
-		}
+	return tracked;
+}
 
-		// finally, calculate new anchorline
-		if (ioAnchorLine < 0)
-			ioAnchorLine = newAnchorLine - static_cast<int32_t>(mBuffer.size());
-	}
+bool MTerminalBuffer::Reflow(int32_t inLine)
+{
+	if (inLine >= 0 or not NeedsReflow())
+		return false;
+
+	std::size_t index = -inLine - 1;
+	if (index < mReflowed)
+		return false;
+
+	ReflowBuffer(index, index);
+
+	// the numbering of the lines following the rewrapped lines has changed
+	mExpandedLines.clear();
+	mBufferLinks.clear();
+	if (mBufferSerial < static_cast<uint64_t>(BufferedLines()))
+		mBufferSerial = BufferedLines();
 
 	mDirty = true;
+
+	return true;
 }
 
 void MTerminalBuffer::ScrollForward(uint32_t inFromLine, uint32_t inToLine,
@@ -277,31 +1002,46 @@ void MTerminalBuffer::ScrollForward(uint32_t inFromLine, uint32_t inToLine,
 	if (inLeftMargin == 0 and inRightMargin == mWidth - 1)
 	{
 		// last chance for the lines moving into the buffer
-		mBuffer.push_front(mLines[inFromLine]);
-		while (mBuffer.size() > mBufferSize)
-			mBuffer.pop_back();
+		PushToBuffer(ScreenLine(inFromLine));
 
-		for (uint32_t line = inFromLine; line < inToLine; ++line)
-			swap(mLines[line], mLines[line + 1]);
+		if (inFromLine == 0)
+			++mScrollCount;
+
+		uint32_t height = mLines.size();
+
+		if (2 * (inToLine - inFromLine) < height)
+		{
+			for (uint32_t line = inFromLine; line < inToLine; ++line)
+				swap(ScreenLine(line), ScreenLine(line + 1));
+		}
+		else
+		{
+			// rotate the ring and move the lines outside the scroll region back
+			// where they were, ending with the first line of the region at inToLine
+			mFirstLine = (mFirstLine + 1) % height;
+
+			for (uint32_t i = height - (inToLine - inFromLine) - 1; i > 0; --i)
+				swap(ScreenLine((inToLine + i) % height), ScreenLine((inToLine + i - 1) % height));
+		}
 	}
 	else
 	{
 		for (uint32_t line = inFromLine; line < inToLine; ++line)
 		{
-			MLine &a = mLines[line];
-			MLine &b = mLines[line + 1];
+			MLine &a = ScreenLine(line);
+			MLine &b = ScreenLine(line + 1);
 
 			for (uint32_t col = inLeftMargin; col <= inRightMargin; ++col)
 				std::swap(a[col], b[col]);
 		}
 	}
 
-	MLine &line = mLines[inToLine];
+	MLine &line = ScreenLine(inToLine);
 	for (uint32_t c = inLeftMargin; c <= inRightMargin; ++c)
 		line[c] = MChar(mForeColor, mBackColor);
 	line.SetSoftWrapped(false);
 
-	mDirty = true;
+	TouchLines(inFromLine, inToLine);
 }
 
 void MTerminalBuffer::ScrollBackward(uint32_t inFromLine, uint32_t inToLine,
@@ -315,32 +1055,55 @@ void MTerminalBuffer::ScrollBackward(uint32_t inFromLine, uint32_t inToLine,
 
 	if (inLeftMargin == 0 and inRightMargin == mWidth - 1)
 	{
-		for (uint32_t line = inToLine; line > inFromLine; --line)
-			swap(mLines[line], mLines[line - 1]);
+		uint32_t height = mLines.size();
+
+		if (inFromLine == 0)
+			--mScrollCount;
+
+		if (2 * (inToLine - inFromLine) < height)
+		{
+			for (uint32_t line = inToLine; line > inFromLine; --line)
+				swap(ScreenLine(line), ScreenLine(line - 1));
+		}
+		else
+		{
+			// same as in ScrollForward, but in the other direction
+			mFirstLine = (mFirstLine + height - 1) % height;
+
+			for (uint32_t i = height - (inToLine - inFromLine) - 1; i > 0; --i)
+				swap(ScreenLine((inFromLine + height - i) % height), ScreenLine((inFromLine + height - i + 1) % height));
+		}
 	}
 	else
 	{
 		for (uint32_t line = inToLine; line > inFromLine; --line)
 		{
-			MLine &a = mLines[line];
-			MLine &b = mLines[line - 1];
+			MLine &a = ScreenLine(line);
+			MLine &b = ScreenLine(line - 1);
 
 			for (uint32_t col = inLeftMargin; col <= inRightMargin; ++col)
 				std::swap(a[col], b[col]);
 		}
 	}
 
-	MLine &line = mLines[inFromLine];
+	MLine &line = ScreenLine(inFromLine);
 	for (uint32_t c = inLeftMargin; c <= inRightMargin; ++c)
 		line[c] = MChar(mForeColor, mBackColor);
 	line.SetSoftWrapped(false);
 
-	mDirty = true;
+	TouchLines(inFromLine, inToLine);
 }
 
 void MTerminalBuffer::Clear()
 {
 	mBuffer.clear();
+	mReflowed = 0;
+	++mBufferEpoch;
+	mExpandedLines.clear();
+	mBufferLinks.clear();
+	mIndex.reset();
+	if (mScrollbackFile)
+		mScrollbackFile->Clear();
 	mHyperLinks.clear();
 	EraseDisplay(0, 0, 2, false);
 }
@@ -351,10 +1114,27 @@ void MTerminalBuffer::SetCharacter(uint32_t inLine, uint32_t inColumn, unicode i
 	if (inLine >= mLines.size())
 		return;
 
-	MLine &line(mLines[inLine]);
+	MLine &line(ScreenLine(inLine));
 	line[inColumn] = MChar(inChar, inStyle, inHyperLink);
 
-	mDirty = true;
+	TouchLine(inLine);
+}
+
+void MTerminalBuffer::SetCharacters(uint32_t inLine, uint32_t inColumn, const unicode *inText, uint32_t inLength,
+	MStyle inStyle, int inHyperLink)
+{
+	if (inLine >= mLines.size() or inColumn >= mWidth)
+		return;
+
+	if (inLength > mWidth - inColumn)
+		inLength = mWidth - inColumn;
+
+	MLine &line(ScreenLine(inLine));
+	uint16_t attributes = MAttributeTable::Intern(inStyle, inHyperLink);
+	for (uint32_t i = 0; i < inLength; ++i)
+		line[inColumn + i] = MChar(inText[i], attributes);
+
+	TouchLine(inLine);
 }
 
 void MTerminalBuffer::SetIsTab(uint32_t inLine, uint32_t inColumn, bool inIsTab)
@@ -362,11 +1142,11 @@ void MTerminalBuffer::SetIsTab(uint32_t inLine, uint32_t inColumn, bool inIsTab)
 	if (inLine >= mLines.size())
 		return;
 
-	MLine &line(mLines[inLine]);
+	MLine &line(ScreenLine(inLine));
 	if (auto &ch = line[inColumn]; ch == char32_t(' '))
 		ch.SetTab(inIsTab);
 
-	mDirty = true;
+	TouchLine(inLine);
 }
 
 void MTerminalBuffer::ReverseFlag(uint32_t inFromLine, uint32_t inFromColumn,
@@ -377,7 +1157,7 @@ void MTerminalBuffer::ReverseFlag(uint32_t inFromLine, uint32_t inFromColumn,
 		if (li >= mLines.size())
 			break;
 
-		MLine &line(mLines[li]);
+		MLine &line(ScreenLine(li));
 
 		for (uint32_t ci = inFromColumn; ci <= inToColumn; ++ci)
 		{
@@ -388,7 +1168,7 @@ void MTerminalBuffer::ReverseFlag(uint32_t inFromLine, uint32_t inFromColumn,
 		}
 	}
 
-	mDirty = true;
+	TouchLines(inFromLine, inToLine);
 }
 
 void MTerminalBuffer::ChangeFlags(uint32_t inFromLine, uint32_t inFromColumn,
@@ -399,7 +1179,7 @@ void MTerminalBuffer::ChangeFlags(uint32_t inFromLine, uint32_t inFromColumn,
 		if (li >= mLines.size())
 			break;
 
-		MLine &line(mLines[li]);
+		MLine &line(ScreenLine(li));
 
 		for (uint32_t ci = inFromColumn; ci <= inToColumn; ++ci)
 		{
@@ -410,7 +1190,7 @@ void MTerminalBuffer::ChangeFlags(uint32_t inFromLine, uint32_t inFromColumn,
 		}
 	}
 
-	mDirty = true;
+	TouchLines(inFromLine, inToLine);
 }
 
 void MTerminalBuffer::SetLineDoubleWidth(uint32_t inLine)
@@ -418,8 +1198,8 @@ void MTerminalBuffer::SetLineDoubleWidth(uint32_t inLine)
 	if (inLine >= mLines.size())
 		return;
 
-	mLines[inLine].SetDoubleWidth();
-	mDirty = true;
+	ScreenLine(inLine).SetDoubleWidth();
+	TouchLine(inLine);
 }
 
 void MTerminalBuffer::SetLineDoubleHeight(uint32_t inLine, bool inTop)
@@ -427,8 +1207,8 @@ void MTerminalBuffer::SetLineDoubleHeight(uint32_t inLine, bool inTop)
 	if (inLine >= mLines.size())
 		return;
 
-	mLines[inLine].SetDoubleHeight(inTop);
-	mDirty = true;
+	ScreenLine(inLine).SetDoubleHeight(inTop);
+	TouchLine(inLine);
 }
 
 void MTerminalBuffer::SetLineSingleWidth(uint32_t inLine)
@@ -436,15 +1216,15 @@ void MTerminalBuffer::SetLineSingleWidth(uint32_t inLine)
 	if (inLine >= mLines.size())
 		return;
 
-	mLines[inLine].SetSingleWidth();
-	mDirty = true;
+	ScreenLine(inLine).SetSingleWidth();
+	TouchLine(inLine);
 }
 
 void MTerminalBuffer::EraseDisplay(uint32_t inLine, uint32_t inColumn, uint32_t inMode, bool inSelective)
 {
 	for (uint32_t l = 0; l < mLines.size(); ++l)
 	{
-		MLine &line(mLines[l]);
+		MLine &line(ScreenLine(l));
 		line.SetSoftWrapped(false);
 		line.SetSingleWidth();
 
@@ -468,7 +1248,7 @@ void MTerminalBuffer::EraseDisplay(uint32_t inLine, uint32_t inColumn, uint32_t
 		}
 	}
 
-	mDirty = true;
+	TouchLines(0, mLines.size() - 1);
 }
 
 void MTerminalBuffer::EraseLine(uint32_t inLine, uint32_t inColumn, uint32_t inMode, bool inSelective)
@@ -476,7 +1256,7 @@ void MTerminalBuffer::EraseLine(uint32_t inLine, uint32_t inColumn, uint32_t inM
 	if (inLine >= mLines.size())
 		return;
 
-	MLine &line(mLines[inLine]);
+	MLine &line(ScreenLine(inLine));
 	line.SetSoftWrapped(false);
 	//	line.SetSingleWidth();
 
@@ -494,7 +1274,7 @@ void MTerminalBuffer::EraseLine(uint32_t inLine, uint32_t inColumn, uint32_t inM
 		line[c] = MChar(mForeColor, mBackColor);
 	}
 
-	mDirty = true;
+	TouchLine(inLine);
 }
 
 void MTerminalBuffer::EraseCharacter(uint32_t inLine, uint32_t inColumn, uint32_t inCount)
@@ -505,7 +1285,7 @@ void MTerminalBuffer::EraseCharacter(uint32_t inLine, uint32_t inColumn, uint32_
 	if (inCount >= mWidth - inColumn)
 		inCount = mWidth - inColumn;
 
-	MLine &line(mLines[inLine]);
+	MLine &line(ScreenLine(inLine));
 
 	for (uint32_t c = inColumn; c < inColumn + inCount and c < mWidth; ++c)
 	{
@@ -514,7 +1294,7 @@ void MTerminalBuffer::EraseCharacter(uint32_t inLine, uint32_t inColumn, uint32_
 		line[c] = MChar(mForeColor, mBackColor);
 	}
 
-	mDirty = true;
+	TouchLine(inLine);
 }
 
 void MTerminalBuffer::DeleteCharacter(uint32_t inLine, uint32_t inColumn, uint32_t inWidth)
@@ -522,9 +1302,9 @@ void MTerminalBuffer::DeleteCharacter(uint32_t inLine, uint32_t inColumn, uint32
 	if (inLine >= mLines.size())
 		return;
 
-	mLines[inLine].Delete(inColumn, inWidth, mForeColor, mBackColor);
+	ScreenLine(inLine).Delete(inColumn, inWidth, mForeColor, mBackColor);
 
-	mDirty = true;
+	TouchLine(inLine);
 }
 
 void MTerminalBuffer::InsertCharacter(uint32_t inLine, uint32_t inColumn, uint32_t inWidth)
@@ -532,33 +1312,65 @@ void MTerminalBuffer::InsertCharacter(uint32_t inLine, uint32_t inColumn, uint32
 	if (inLine >= mLines.size())
 		return;
 
-	mLines[inLine].Insert(inColumn, inWidth);
+	ScreenLine(inLine).Insert(inColumn, inWidth);
 
-	mDirty = true;
+	TouchLine(inLine);
 }
 
 void MTerminalBuffer::WrapLine(uint32_t inLine)
 {
 	if (inLine < mLines.size())
-		mLines[inLine].SetSoftWrapped(true);
+	{
+		ScreenLine(inLine).SetSoftWrapped(true);
+		TouchLine(inLine);
+	}
 }
 
 void MTerminalBuffer::SetDirty(bool inDirty)
 {
 	if (inDirty != mDirty)
+	{
+		// the lines changed since the last frame are scanned for URLs
+		if (not inDirty)
+			ScanForHyperLinks();
+
 		mDirty = inDirty;
+	}
+}
+
+void MTerminalBuffer::TouchLines(uint32_t inFromLine, uint32_t inToLine)
+{
+	++mGeneration;
+
+	for (uint32_t line = inFromLine; line <= inToLine and line < mLineGenerations.size(); ++line)
+		mLineGenerations[line] = mGeneration;
+
+	mDirty = true;
+}
+
+std::vector<uint32_t> MTerminalBuffer::GetChangedLines(uint64_t inGeneration) const
+{
+	std::vector<uint32_t> result;
+
+	for (uint32_t line = 0; line < mLineGenerations.size(); ++line)
+	{
+		if (mLineGenerations[line] > inGeneration)
+			result.push_back(line);
+	}
+
+	return result;
 }
 
 void MTerminalBuffer::FillWithE()
 {
 	for (uint32_t l = 0; l < mLines.size(); ++l)
 	{
-		MLine &line(mLines[l]);
+		MLine &line(ScreenLine(l));
 		for (uint32_t column = 0; column < mWidth; ++column)
 			line[column] = MChar('E', MStyle(mForeColor, mBackColor));
 	}
 
-	mDirty = true;
+	TouchLines(0, mLines.size() - 1);
 }
 
 bool MTerminalBuffer::IsSelectionEmpty() const
@@ -620,7 +1432,7 @@ void MTerminalBuffer::SelectCharacter(int32_t inLine, int32_t inColumn)
 	mBeginColumn = inColumn;
 	mEndColumn = inColumn + 1;
 
-	auto &line = GetLine(inLine);
+	MLine line = GetLine(inLine);
 
 	while (mBeginColumn > 0 and line[mBeginColumn].IsTab())
 		--mBeginColumn;
@@ -720,7 +1532,7 @@ void MTerminalBuffer::FindWord(int32_t inLine, int32_t inColumn,
 	{
 		if (inLine > 0)
 		{
-			if (not mLines[inLine - 1].IsSoftWrapped())
+			if (not ScreenLine(inLine - 1).IsSoftWrapped())
 				break;
 			--inLine;
 			inColumn += mWidth;
@@ -743,7 +1555,7 @@ void MTerminalBuffer::FindWord(int32_t inLine, int32_t inColumn,
 	int32_t lineNr = inLine;
 	for (;;)
 	{
-		const MLine &line = GetLine(lineNr);
+		MLine line = GetLine(lineNr);
 		++lineNr;
 
 		line.CopyOut(back_inserter(s));
@@ -830,7 +1642,7 @@ std::string MTerminalBuffer::GetText(int32_t inBeginLine, int32_t inBeginColumn,
 
 	for (int32_t l = inBeginLine; l <= inEndLine; ++l)
 	{
-		const MLine &line(GetLine(l));
+		MLine line = GetLine(l);
 
 		int32_t c1 = 1, c2 = 0;
 		if (inBlock)
@@ -854,152 +1666,432 @@ std::string MTerminalBuffer::GetText(int32_t inBeginLine, int32_t inBeginColumn,
 
 		if (not inBlock and (l == inEndLine or not line.IsSoftWrapped()))
 		{
-			while (c2 > c1 and line[c2 - 1] == ' ')
-				--c2;
+			while (c2 > c1 and line[c2 - 1] == ' ')
+				--c2;
+		}
+
+		auto iter = back_inserter(result);
+
+		bool tab = false;
+		for (int32_t c = c1; c < c2; ++c)
+		{
+			auto ch = line[c];
+
+			char32_t cc = ch;
+			if (not inBlock)
+			{
+				if (tab and ch.IsTab())
+					continue;
+
+				if (cc == ' ' and c + 1 < c2 and line[c + 1].IsTab())
+				{
+					cc = '\t';
+					tab = true;
+				}
+				else
+					tab = false;
+			}
+
+			MEncodingTraits<kEncodingUTF8>::WriteUnicode(iter, cc);
+		}
+
+		if (mBlockSelection or (l != inEndLine and not line.IsSoftWrapped()))
+			result += '\n';
+	}
+
+	return result;
+}
+
+std::string MTerminalBuffer::GetSelectedText() const
+{
+	return GetText(mBeginLine, mBeginColumn, mEndLine, mEndColumn, mBlockSelection);
+}
+
+// --------------------------------------------------------------------
+// Find works on the UTF-8 text of each line, for lines in the scrollback
+// this is the text stored in the compressed line, no need to expand those.
+// Candidates are located using memchr on the first byte and checked on the
+// last byte before comparing the rest. Trailing blanks are not searched,
+// unless the line is soft wrapped and a match may continue on the next line.
+// Regular expressions are matched by MRegex over the same text.
+// When the scrollback-index preference is set, lines in mBuffer that do
+// not contain all trigrams of a literal search string are skipped.
+
+namespace
+{
+
+std::size_t CountCells(std::string_view inText)
+{
+	std::size_t result = 0;
+	for (char ch : inText)
+	{
+		if ((ch & 0xc0) != 0x80)
+			++result;
+	}
+	return result;
+}
+
+std::size_t CellOffset(std::string_view inText, std::size_t inCells)
+{
+	std::size_t result = 0;
+	while (result < inText.length())
+	{
+		if ((inText[result] & 0xc0) != 0x80 and inCells-- == 0)
+			break;
+		++result;
+	}
+	return result;
+}
+
+void FoldCase(std::string_view inText, std::string &ioFolded)
+{
+	if (std::all_of(inText.begin(), inText.end(), [](char ch) { return (ch & 0x80) == 0; }))
+	{
+		std::size_t n = ioFolded.length();
+		ioFolded.resize(n + inText.length());
+		std::transform(inText.begin(), inText.end(), ioFolded.begin() + n,
+			[](char ch) { return (ch >= 'A' and ch <= 'Z') ? ch - 'A' + 'a' : ch; });
+	}
+	else
+	{
+		auto iter = back_inserter(ioFolded);
+		for (auto t = inText.begin(); t != inText.end();)
+		{
+			unicode ch;
+			uint32_t length;
+			MEncodingTraits<kEncodingUTF8>::ReadUnicode(t, length, ch);
+			t += length > 0 ? length : 1;
+
+			MEncodingTraits<kEncodingUTF8>::WriteUnicode(iter, ToLower(ch));
+		}
+	}
+}
+
+std::size_t FindInText(std::string_view inText, std::string_view inWhat, std::size_t inFrom)
+{
+	std::size_t M = inWhat.length();
+	if (M == 0 or inText.length() < M or inFrom > inText.length() - M)
+		return std::string_view::npos;
+
+	const char *s = inText.data();
+	const char *e = s + inText.length() - M + 1;
+	const char first = inWhat.front(), last = inWhat.back();
+
+	for (const char *p = s + inFrom; p < e; ++p)
+	{
+		p = static_cast<const char *>(std::memchr(p, first, e - p));
+		if (p == nullptr)
+			break;
+
+		if (p[M - 1] == last and std::memcmp(p, inWhat.data(), M) == 0)
+			return p - s;
+	}
+
+	return std::string_view::npos;
+}
+
+} // namespace
+
+std::string_view MTerminalBuffer::GetLineText(int32_t inLine, std::string &ioScratch, bool &outSoftWrapped) const
+{
+	std::string_view result;
+
+	if (inLine >= 0)
+	{
+		const MLine &line = ScreenLine(inLine);
+
+		uint32_t length = line.size();
+		while (length > 0 and line[length - 1] == ' ')
+			--length;
+
+		ioScratch.clear();
+		auto iter = back_inserter(ioScratch);
+		for (uint32_t i = 0; i < length; ++i)
+			MEncodingTraits<kEncodingUTF8>::WriteUnicode(iter, static_cast<unicode>(line[i]));
+
+		outSoftWrapped = line.IsSoftWrapped();
+		result = ioScratch;
+	}
+	else
+	{
+		std::size_t index = -inLine - 1;
+		if (index < mBuffer.size())
+		{
+			outSoftWrapped = mBuffer[index].IsSoftWrapped();
+			result = mBuffer[index].GetText();
+		}
+		else
+		{
+			mScrollbackFile->GetText(BufferedLines() - index - 1, ioScratch, outSoftWrapped);
+			result = ioScratch;
+		}
+	}
+
+	return result;
+}
+
+std::string_view MTerminalBuffer::GetSearchText(int32_t inLine, std::size_t inLookahead, bool inIgnoreCase,
+	bool inPadBlanks, std::string &ioText, std::string &ioScratch, std::size_t &outLineLength) const
+{
+	std::string &scratch = ioScratch;
+	bool softWrapped;
+	std::string_view text = GetLineText(inLine, scratch, softWrapped);
+
+	int32_t lastLine = static_cast<int32_t>(mLines.size()) - 1;
+
+	bool pad = inPadBlanks or (softWrapped and inLine < lastLine);
+
+	if (not inIgnoreCase and not pad)
+	{
+		outLineLength = text.length();
+		return text;
+	}
+
+	ioText.clear();
+	if (inIgnoreCase)
+		FoldCase(text, ioText);
+	else
+		ioText.assign(text);
+
+	if (pad)
+	{
+		std::size_t cells = CountCells(ioText);
+		if (cells < mWidth)
+			ioText.append(mWidth - cells, ' ');
+	}
+
+	outLineLength = ioText.length();
+
+	// a match may continue on the next lines, as long as these are soft wrapped
+	for (int32_t next = inLine + 1; softWrapped and next <= lastLine and ioText.length() - outLineLength < inLookahead; ++next)
+	{
+		std::size_t start = ioText.length();
+
+		text = GetLineText(next, scratch, softWrapped);
+		if (inIgnoreCase)
+			FoldCase(text, ioText);
+		else
+			ioText.append(text);
+
+		// the next line may have been trimmed
+		if ((softWrapped and next < lastLine) or inPadBlanks)
+		{
+			std::size_t cells = CountCells(std::string_view(ioText).substr(start));
+			if (cells < mWidth)
+				ioText.append(mWidth - cells, ' ');
+		}
+	}
+
+	if (ioText.length() - outLineLength > inLookahead)
+		ioText.resize(outLineLength + inLookahead);
+
+	return ioText;
+}
+
+namespace
+{
+
+// A literal search string or a regular expression, ready for searching
+class MSearchPattern
+{
+  public:
+	MSearchPattern(const std::string &inWhat, bool inIgnoreCase, bool inRegex)
+	{
+		if (inIgnoreCase)
+			FoldCase(inWhat, mWhat);
+		else
+			mWhat = inWhat;
+
+		if (inRegex and not inWhat.empty())
+			mRegex = std::make_unique<MRegex>(inWhat, inIgnoreCase);
+		else
+		{
+			// the index contains folded text without trailing blanks
+			FoldCase(inWhat, mIndexKey);
+			mIndexKey.erase(mIndexKey.find_last_not_of(' ') + 1);
+		}
+	}
+
+	bool Empty() const { return mWhat.empty(); }
+
+	// blanks at the end of a search string may match the blank tail of a line
+	bool PadBlanks() const { return not mRegex and mWhat.back() == ' '; }
+
+	// how far a match may extend beyond the line it starts in, a regular
+	// expression may match up to the end of the soft wrapped line
+	std::size_t Lookahead() const { return mRegex ? std::numeric_limits<std::size_t>::max() : mWhat.length(); }
+
+	// the text to look up in the index, empty for regular expressions
+	std::string_view IndexKey() const { return mIndexKey; }
+
+	bool Find(std::string_view inText, std::size_t inFrom, std::size_t &outBegin, std::size_t &outEnd) const
+	{
+		if (mRegex)
+			return mRegex->Search(inText, inFrom, outBegin, outEnd);
+
+		outBegin = FindInText(inText, mWhat, inFrom);
+		outEnd = outBegin + mWhat.length();
+		return outBegin != std::string_view::npos;
+	}
+
+  private:
+	std::string mWhat, mIndexKey;
+	std::unique_ptr<MRegex> mRegex;
+};
+
+// The lines a search needs to look at. Lines covered by the index are
+// skipped unless they are a candidate, all other lines are searched.
+class MCandidateLines
+{
+  public:
+	MCandidateLines(const MTrigramIndex *inIndex, std::string_view inKey, uint64_t inBufferSerial,
+		int32_t inFromLine, int32_t inToLine)
+	{
+		std::vector<uint64_t> serials;
+		if (inIndex != nullptr and inIndex->GetCandidates(inKey, inBufferSerial + inFromLine, inBufferSerial + inToLine, serials))
+		{
+			mBegin = static_cast<int32_t>(static_cast<int64_t>(inIndex->Begin() - inBufferSerial));
+			mEnd = static_cast<int32_t>(static_cast<int64_t>(inIndex->End() - inBufferSerial));
+
+			mLines.reserve(serials.size());
+			for (uint64_t serial : serials)
+				mLines.push_back(static_cast<int32_t>(static_cast<int64_t>(serial - inBufferSerial)));
 		}
+	}
 
-		auto iter = back_inserter(result);
+	// The first line at or after inLine that needs to be searched
+	int32_t Next(int32_t inLine) const
+	{
+		if (inLine < mBegin or inLine >= mEnd)
+			return inLine;
 
-		bool tab = false;
-		for (int32_t c = c1; c < c2; ++c)
-		{
-			auto ch = line[c];
+		auto i = std::lower_bound(mLines.begin(), mLines.end(), inLine);
+		return i != mLines.end() ? *i : mEnd;
+	}
 
-			char32_t cc = ch;
-			if (not inBlock)
-			{
-				if (tab and ch.IsTab())
-					continue;
+	// The last line at or before inLine that needs to be searched
+	int32_t Previous(int32_t inLine) const
+	{
+		if (inLine < mBegin or inLine >= mEnd)
+			return inLine;
 
-				if (cc == ' ' and c + 1 < c2 and line[c + 1].IsTab())
-				{
-					cc = '\t';
-					tab = true;
-				}
-				else
-					tab = false;
-			}
+		auto i = std::upper_bound(mLines.begin(), mLines.end(), inLine);
+		return i != mLines.begin() ? *std::prev(i) : mBegin - 1;
+	}
 
-			MEncodingTraits<kEncodingUTF8>::WriteUnicode(iter, cc);
-		}
+  private:
+	int32_t mBegin = 0, mEnd = 0;
+	std::vector<int32_t> mLines;
+};
 
-		if (mBlockSelection or (l != inEndLine and not line.IsSoftWrapped()))
-			result += '\n';
-	}
+} // namespace
 
-	return result;
-}
+// --------------------------------------------------------------------
+// The optional trigram index over mBuffer
 
-std::string MTerminalBuffer::GetSelectedText() const
+std::size_t MTerminalBuffer::GetIndexMemoryUsage() const
 {
-	return GetText(mBeginLine, mBeginColumn, mEndLine, mEndColumn, mBlockSelection);
+	return mIndex ? mIndex->GetMemoryUsage() : 0;
 }
 
-unicode MTerminalBuffer::GetChar(int32_t inLine, int32_t inColumn, bool inToLower) const
+bool MTerminalBuffer::IsIndexComplete() const
 {
-	char32_t result = GetLine(inLine)[inColumn];
-	if (inToLower)
-		result = ToLower(result);
-	return result;
+	return mMaxIndexMemory == 0 or (mIndex and mIndexNext == mBufferSerial);
 }
 
-unicode MTerminalBuffer::GetChar(uint32_t inOffset, bool inToLower) const
+bool MTerminalBuffer::BuildIndex(std::size_t inMaxLines) const
 {
-	int32_t line = inOffset / mWidth;
-	int32_t column = inOffset % mWidth;
+	if (mMaxIndexMemory == 0)
+		return true;
 
-	assert(line >= 0 and line < static_cast<int32_t>(mBuffer.size() + mLines.size()));
+	uint64_t first = mBufferSerial - mBuffer.size();
 
-	unicode result;
-	if (line >= static_cast<int32_t>(mBuffer.size()))
-		result = mLines[line - mBuffer.size()][column];
-	else
-		result = mBuffer[mBuffer.size() - line - 1][column];
+	if (not mIndex)
+	{
+		mIndex = std::make_unique<MTrigramIndex>(mMaxIndexMemory);
+		mIndexNext = first;
+	}
 
-	if (inToLower)
-		result = ToLower(result);
+	// lines dropped from mBuffer before they were indexed are skipped
+	if (mIndexNext < first)
+		mIndexNext = first;
 
-	return result;
+	for (std::size_t n = 0; n < inMaxLines and mIndexNext < mBufferSerial; ++n, ++mIndexNext)
+		AddToIndex(mBufferSerial - mIndexNext - 1);
+
+	return mIndexNext == mBufferSerial;
 }
 
-// --------------------------------------------------------------------
-// Find is implemented using the Rabin-Karp algorithm
-// Implement forward and backward searching in separate routines to
-// keep code readable.
+const MTrigramIndex *MTerminalBuffer::GetIndex() const
+{
+	return IsIndexComplete() ? mIndex.get() : nullptr;
+}
 
-bool MTerminalBuffer::FindNext(int32_t &ioLine, int32_t &ioColumn, const std::string &inWhat,
-	bool inIgnoreCase, bool inWrapAround)
+void MTerminalBuffer::AddToIndex(std::size_t inIndex) const
 {
-	// q is a rather large prime, d is the alphabet size (of Unicode)
-	const int64_t q = 33554393, d = 1114112;
+	const MCompressedLine &line = mBuffer[inIndex];
 
-	// convert the search string to unicode's
-	std::vector<unicode> what;
-	for (std::string::const_iterator w = inWhat.begin(); w != inWhat.end();)
-	{
-		unicode ch;
-		uint32_t l;
-		MEncodingTraits<kEncodingUTF8>::ReadUnicode(w, l, ch);
-		w += l;
+	std::string text;
+	FoldCase(line.GetText(), text);
+	mIndex->Add(mBufferSerial - inIndex - 1, text, line.IsSoftWrapped());
 
-		if (inIgnoreCase)
-			ch = ToLower(ch);
+	while (mIndex->IsFull() and not mIndex->Empty())
+		RemoveFromIndex();
+}
 
-		what.push_back(ch);
-	}
+void MTerminalBuffer::RemoveFromIndex() const
+{
+	const MCompressedLine &line = mBuffer[mBufferSerial - mIndex->Begin() - 1];
 
-	// M is the length of the search string
-	int32_t M = what.size();
+	std::string text;
+	FoldCase(line.GetText(), text);
+	mIndex->RemoveFirst(text, line.IsSoftWrapped());
+}
 
-	// We're looking forward. N is the length of the remaining characters in the buffer
-	int32_t lineCount = static_cast<int32_t>(mBuffer.size() + mLines.size());
-	int32_t line = static_cast<int32_t>(mBuffer.size()) + ioLine;
-	int32_t N = (lineCount - line) * mWidth - ioColumn;
-	int32_t O = lineCount * mWidth - N; // offset from start for ioLine/ioColumn
+// --------------------------------------------------------------------
 
-	// sanity check
-	if (M >= N)
+bool MTerminalBuffer::FindNext(int32_t &ioLine, int32_t &ioColumn, int32_t &outLength, const std::string &inWhat,
+	bool inIgnoreCase, bool inRegex, bool inWrapAround)
+{
+	MSearchPattern pattern(inWhat, inIgnoreCase, inRegex);
+	if (pattern.Empty())
 		return false;
 
-	int64_t dM = 1, h1 = 0, h2 = 0;
-	int32_t i;
+	bool result = false;
+	std::string text, scratch;
 
-	for (i = 1; i < M; ++i)
-		dM = (d * dM) % q;
+	int32_t lineCount = static_cast<int32_t>(mLines.size());
+	int32_t firstLine = std::max(ioLine, -BufferedLines());
 
-	for (i = 0; i < M; ++i)
-	{
-		h1 = (h1 * d + what[i]) % q;
-		h2 = (h2 * d + GetChar(O + i, inIgnoreCase)) % q;
-	}
+	MCandidateLines candidates(GetIndex(), pattern.IndexKey(), mBufferSerial, firstLine, lineCount);
 
-	for (i = 0; i < N - M; ++i)
+	for (int32_t line = candidates.Next(firstLine); line < lineCount; line = candidates.Next(line + 1))
 	{
-		if (h1 == h2) // hashes match, make sure the characters are the same too (collision?)
-		{
-			bool found = true;
-			for (int j = 0; found and j < M; ++j)
-				found = what[j] == GetChar(O + i + j, inIgnoreCase);
-			if (found)
-				break;
-		}
+		std::size_t lineLength;
+		std::string_view s = GetSearchText(line, pattern.Lookahead(), inIgnoreCase, pattern.PadBlanks(), text, scratch, lineLength);
 
-		h2 = (h2 + d * q - GetChar(O + i, inIgnoreCase) * dM) % q;
-		h2 = (h2 * d + GetChar(O + i + M, inIgnoreCase)) % q;
-	}
+		std::size_t from = line == ioLine ? CellOffset(s, ioColumn) : 0;
 
-	bool result = false;
-	if (i < N - M)
-	{
-		ioLine = (O + i) / mWidth - static_cast<int32_t>(mBuffer.size());
-		ioColumn = (O + i) % mWidth;
+		std::size_t begin, end;
+		if (not pattern.Find(s, from, begin, end) or begin >= lineLength)
+			continue;
+
+		int32_t column = CountCells(s.substr(0, begin));
+		if (column >= static_cast<int32_t>(mWidth))
+			continue;
+
+		ioLine = line;
+		ioColumn = column;
+		outLength = CountCells(s.substr(begin, end - begin));
 		result = true;
+		break;
 	}
-	else if (inWrapAround and (ioLine > -static_cast<int32_t>(mBuffer.size()) or ioColumn > 0))
+
+	if (not result and inWrapAround and (ioLine > -BufferedLines() or ioColumn > 0))
 	{
-		int32_t line = -static_cast<int32_t>(mBuffer.size()), column = 0;
-		result = FindNext(line, column, inWhat, inIgnoreCase, false);
-		if (result and (line > ioLine or (line == ioLine and column + static_cast<int32_t>(what.size()) >= ioColumn)))
+		int32_t line = -BufferedLines(), column = 0;
+		result = FindNext(line, column, outLength, inWhat, inIgnoreCase, inRegex, false);
+		if (result and (line > ioLine or (line == ioLine and column + outLength >= ioColumn)))
 			result = false;
 		else
 		{
@@ -1011,80 +2103,47 @@ bool MTerminalBuffer::FindNext(int32_t &ioLine, int32_t &ioColumn, const std::st
 	return result;
 }
 
-bool MTerminalBuffer::FindPrevious(int32_t &ioLine, int32_t &ioColumn, const std::string &inWhat,
-	bool inIgnoreCase, bool inWrapAround)
+bool MTerminalBuffer::FindPrevious(int32_t &ioLine, int32_t &ioColumn, int32_t &outLength, const std::string &inWhat,
+	bool inIgnoreCase, bool inRegex, bool inWrapAround)
 {
-	// q is a rather large prime, d is the alphabet size (of Unicode)
-	const int64_t q = 33554393, d = 1114112;
-
-	// convert the search string to unicode's
-	std::vector<unicode> what;
-	for (std::string::const_iterator w = inWhat.begin(); w != inWhat.end();)
-	{
-		unicode ch;
-		uint32_t l;
-		MEncodingTraits<kEncodingUTF8>::ReadUnicode(w, l, ch);
-		w += l;
-
-		if (inIgnoreCase)
-			ch = ToLower(ch);
-
-		what.push_back(ch);
-	}
-	reverse(what.begin(), what.end());
-
-	// M is the length of the search string
-	int32_t M = what.size();
-
-	// We're looking backward now. N is the length of the characters in the buffer
-	// up until the point where we start.
-	int32_t lineCount = static_cast<int32_t>(mBuffer.size() + mLines.size());
-	int32_t line = static_cast<int32_t>(mBuffer.size()) + ioLine;
-	int32_t N = line * mWidth + ioColumn;
-
-	// sanity check
-	if (M >= N)
+	MSearchPattern pattern(inWhat, inIgnoreCase, inRegex);
+	if (pattern.Empty())
 		return false;
 
-	int64_t dM = 1, h1 = 0, h2 = 0;
-	int32_t i;
+	bool result = false;
+	std::string text, scratch;
+
+	int32_t lineCount = static_cast<int32_t>(mLines.size());
+	int32_t lastLine = std::min(ioLine, lineCount - 1);
 
-	for (i = 1; i < M; ++i)
-		dM = (d * dM) % q;
+	MCandidateLines candidates(GetIndex(), pattern.IndexKey(), mBufferSerial, -BufferedLines(), lastLine + 1);
 
-	for (i = 0; i < M; ++i)
+	for (int32_t line = candidates.Previous(lastLine); line >= -BufferedLines() and not result; line = candidates.Previous(line - 1))
 	{
-		h1 = (h1 * d + what[i]) % q;
-		h2 = (h2 * d + GetChar(N - i, inIgnoreCase)) % q;
-	}
+		std::size_t lineLength;
+		std::string_view s = GetSearchText(line, pattern.Lookahead(), inIgnoreCase, pattern.PadBlanks(), text, scratch, lineLength);
 
-	for (i = 0; i < N - M; ++i)
-	{
-		if (h1 == h2) // hashes match, make sure the characters are the same too (collision?)
+		// take the last match on this line that ends before the starting point
+		std::size_t begin, end;
+		for (std::size_t from = 0; pattern.Find(s, from, begin, end) and begin < lineLength; from = begin + 1)
 		{
-			bool found = true;
-			for (int j = 0; found and j < M; ++j)
-				found = what[j] == GetChar(N - (i + j), inIgnoreCase);
-			if (found)
+			int32_t column = CountCells(s.substr(0, begin));
+			int32_t length = CountCells(s.substr(begin, end - begin));
+			if (column >= static_cast<int32_t>(mWidth) or (line == ioLine and column + length - 1 > ioColumn))
 				break;
-		}
 
-		h2 = (h2 + d * q - GetChar(N - i, inIgnoreCase) * dM) % q;
-		h2 = (h2 * d + GetChar(N - (i + M), inIgnoreCase)) % q;
+			ioLine = line;
+			ioColumn = column;
+			outLength = length;
+			result = true;
+		}
 	}
 
-	bool result = false;
-	if (i < N - M)
+	if (not result and inWrapAround and (ioLine < lineCount or ioColumn < static_cast<int32_t>(mWidth)))
 	{
-		ioLine = (N - i - M + 1) / mWidth - static_cast<int32_t>(mBuffer.size());
-		ioColumn = (N - i - M + 1) % mWidth;
-		result = true;
-	}
-	else if (inWrapAround and (ioLine < lineCount or ioColumn < static_cast<int32_t>(mWidth)))
-	{
-		int32_t line = lineCount - mBuffer.size() - 1, column = mWidth - 1;
-		result = FindPrevious(line, column, inWhat, inIgnoreCase, false);
-		if (result and (line < ioLine or (line == ioLine and column + static_cast<int32_t>(what.size()) <= ioColumn)))
+		int32_t line = lineCount - 1, column = mWidth - 1;
+		result = FindPrevious(line, column, outLength, inWhat, inIgnoreCase, inRegex, false);
+		if (result and (line < ioLine or (line == ioLine and column + outLength <= ioColumn)))
 			result = false;
 		else
 		{
@@ -1096,6 +2155,37 @@ bool MTerminalBuffer::FindPrevious(int32_t &ioLine, int32_t &ioColumn, const std
 	return result;
 }
 
+void MTerminalBuffer::FindAll(int32_t inFromLine, int32_t inToLine, const std::string &inWhat,
+	bool inIgnoreCase, bool inRegex, std::vector<std::tuple<int32_t, int32_t, int32_t>> &ioFound) const
+{
+	MSearchPattern pattern(inWhat, inIgnoreCase, inRegex);
+	if (pattern.Empty())
+		return;
+
+	std::string text, scratch;
+
+	inFromLine = std::max(inFromLine, -BufferedLines());
+	inToLine = std::min(inToLine, static_cast<int32_t>(mLines.size()));
+
+	MCandidateLines candidates(GetIndex(), pattern.IndexKey(), mBufferSerial, inFromLine, inToLine);
+
+	for (int32_t line = candidates.Next(inFromLine); line < inToLine; line = candidates.Next(line + 1))
+	{
+		std::size_t lineLength;
+		std::string_view s = GetSearchText(line, pattern.Lookahead(), inIgnoreCase, pattern.PadBlanks(), text, scratch, lineLength);
+
+		std::size_t begin, end;
+		for (std::size_t from = 0; pattern.Find(s, from, begin, end) and begin < lineLength; from = end)
+		{
+			int32_t column = CountCells(s.substr(0, begin));
+			if (column >= static_cast<int32_t>(mWidth))
+				break;
+
+			ioFound.emplace_back(line, column, CountCells(s.substr(begin, end - begin)));
+		}
+	}
+}
+
 int MTerminalBuffer::AddHyperLink(const std::string &inURI, const std::string &inID)
 {
 	for (auto &&[nr, id, uri] : mHyperLinks)
@@ -1123,92 +2213,25 @@ std::string MTerminalBuffer::GetURIAtPosition(int32_t inLine, int32_t inColumn,
 	int32_t &outBeginLine, int32_t &outBeginColumn,
 	int32_t &outEndLine, int32_t &outEndColumn) const
 {
-	std::string uri;
-
-	if (GetChar(inLine, inColumn, false) == ':' and inColumn > 1)
-	{
-		int32_t l1, l2, c1, c2;
-		FindWord(inLine, inColumn + 1, l1, c1, l2, c2);
-
-		uri = GetText(l1, c1, l2, c2, false);
-
-		if (uri.starts_with("//"))
-		{
-			outEndLine = l2;
-			outEndColumn = c2;
-
-			FindWord(l1, inColumn - 1, l1, c1, l2, c2);
+	if (inLine < -BufferedLines() or inLine >= static_cast<int32_t>(mLines.size()))
+		return {};
 
-			auto scheme = GetText(l1, c1, l2, c2, true);
-			if (not scheme.empty())
-			{
-				uri = scheme + ':' + uri;
-
-				if (not zeep::http::is_valid_uri(uri))
-					uri.clear();
-				else
-				{
-					outBeginLine = l1;
-					outBeginColumn = c1;
-				}
-			}
-		}
-	}
-	else
+	for (const MDetectedLink &link : GetDetectedLinks(inLine))
 	{
-		int32_t l1, l2, c1, c2;
-		FindWord(inLine, inColumn, l1, c1, l2, c2);
-
-		uri = GetText(l1, c1, l2, c2, false);
-
-		if (uri.starts_with("//") and c1 > 1 and GetChar(l1, c1 - 1, false) == ':')
-		{
-			outEndLine = l2;
-			outEndColumn = c2;
+		int32_t begin = link.beginLine < 0 ? 0 : link.beginColumn;
+		int32_t end = link.endLine > 0 ? mWidth : link.endColumn;
 
-			FindWord(l1, c1 - 2, l1, c1, l2, c2);
-
-			auto scheme = GetText(l1, c1, l2, c2, false);
-			if (not scheme.empty())
-			{
-				uri = scheme + ':' + uri;
-
-				if (not zeep::http::is_valid_uri(uri))
-					uri.clear();
-				else
-				{
-					outBeginLine = l1;
-					outBeginColumn = c1;
-				}
-			}
-		}
-		else if (c2 + 3 < static_cast<int32_t>(mWidth) and
-				 GetChar(l2, c2 + 1, false) == ':' and
-				 GetChar(l2, c2 + 2, false) == '/' and GetChar(l2, c2 + 3, false) == '/')
+		if (inColumn >= begin and inColumn < end)
 		{
-			outBeginLine = l1;
-			outBeginColumn = c1;
-
-			uri = GetText(l1, c1, l2, c2, false) + ':';
-
-			FindWord(l2, c2 + 2, l1, c1, l2, c2);
-
-			if (l2 > l1 or c2 > c1)
-			{
-				uri += GetText(l1, c1, l2, c2, false);
-
-				if (not zeep::http::is_valid_uri(uri))
-					uri.clear();
-				else
-				{
-					outEndLine = l2;
-					outEndColumn = c2;
-				}
-			}
+			outBeginLine = inLine + link.beginLine;
+			outBeginColumn = link.beginColumn;
+			outEndLine = inLine + link.endLine;
+			outEndColumn = link.endColumn;
+			return link.uri;
 		}
 	}
 
-	return uri;
+	return {};
 }
 
 int MTerminalBuffer::GetHoveredLink(int32_t inLine, int32_t inColumn)
@@ -1226,18 +2249,17 @@ int MTerminalBuffer::GetHoveredLink(int32_t inLine, int32_t inColumn)
 	if (inLine >= 0)
 	{
 		if (static_cast<uint32_t>(inLine) < mLines.size())
-			result = mLines[inLine][inColumn].GetHyperLink();
+			result = ScreenLine(inLine)[inColumn].GetHyperLink();
 	}
 	else
 	{
 		auto line = -inLine - 1;
-		if (static_cast<std::size_t>(line) < mBuffer.size())
-			result = mBuffer[line][inColumn].GetHyperLink();
+		if (line < BufferedLines())
+			result = GetLine(inLine)[inColumn].GetHyperLink();
 	}
 
-	// Not a registered hyperlink, see if there's something underneath the pointer
-	// that looks like a hyperlink
-	if (result == 0 and inColumn + 1 < static_cast<int32_t>(mWidth))
+	// Not a registered hyperlink, see if there's a URL underneath the pointer
+	if (result == 0 and inColumn < static_cast<int32_t>(mWidth))
 	{
 		mHoveredLink = GetURIAtPosition(inLine, inColumn,
 			mHoverdLinkBeginLine, mHoverdLinkBeginColumn, mHoverdLinkEndLine, mHoverdLinkEndColumn);
@@ -1268,7 +2290,7 @@ std::tuple<int32_t, int32_t> MTerminalBuffer::GetHoveredLinkColumBounds(int32_t
 	if (inLine >= mHoverdLinkBeginLine and inLine <= mHoverdLinkEndLine)
 	{
 		c1 = inLine > mHoverdLinkBeginLine ? 0 : mHoverdLinkBeginColumn;
-		c2 = inLine < mHoverdLinkBeginLine ? mWidth : mHoverdLinkEndColumn;
+		c2 = inLine < mHoverdLinkEndLine ? mWidth : mHoverdLinkEndColumn;
 	}
 
 	return { c1, c2 };
@@ -1288,13 +2310,10 @@ void MTerminalBuffer::GarbageCollectHyperlinks()
 	}
 
 	for (auto &line : mBuffer)
-	{
-		for (auto &ch : line)
-		{
-			if (int link = ch.GetHyperLink())
-				inUse.insert(link);
-		}
-	}
+		line.ForeachHyperLink([&inUse](int link) { inUse.insert(link); });
+
+	if (mScrollbackFile)
+		mScrollbackFile->ForeachHyperLink([&inUse](int link) { inUse.insert(link); });
 
 	mHyperLinks.erase(
 		std::remove_if(mHyperLinks.begin(), mHyperLinks.end(),
@@ -1305,90 +2324,238 @@ void MTerminalBuffer::GarbageCollectHyperlinks()
 		mHyperLinks.end());
 }
 
-// // Very simple scan, we only support http and https links for now
-// void MTerminalBuffer::ScanForHyperLinks()
-// {
-// 	std::string uri;
-// 	auto add_uri = [&](std::size_t start, std::size_t length, int nr)
-// 	{
-// 		while (length-- > 0)
-// 		{
-// 			auto &ch = mLines[start / mWidth][start % mWidth];
-// 			if (ch.GetHyperLink() == 0)
-// 				ch.SetHyperLink(nr);
-// 			++start;
-// 		}
-// 	};
-
-// 	// clang-format off
-// 	enum State { nope, maybe, h, t1, t2, p, s, colon, slash1, rest } state = maybe;
-// 	// clang-format on
-
-// 	std::size_t start;
-
-// 	for (std::size_t l = 0; l < mLines.size(); ++l)
-// 	{
-// 		auto &line = mLines[l];
-// 		for (std::size_t c = 0; c < mWidth; ++c)
-// 		{
-// 			auto ch = line[c];
-
-// 			if (state != nope)
-// 				zeep::append(uri, ch);
-// 			else
-// 				uri.clear();
-
-// 			switch (state)
-// 			{
-// 				case nope:
-// 					if (std::isspace(ch) or std::ispunct(ch))
-// 						state = maybe;
-// 					break;
-
-// 				case maybe:
-// 					if ((ch | 0x0020) == 'h')
-// 					{
-// 						state = h;
-// 						start = l * mWidth + c;
-// 					}
-// 					else
-// 						uri.clear();
-// 					break;
-// 				case h: state = ((ch | 0x0020) == 't') ? t1 : nope; break;
-// 				case t1: state = ((ch | 0x0020) == 't') ? t2 : nope; break;
-// 				case t2: state = ((ch | 0x0020) == 'p') ? p : nope; break;
-// 				case p:
-// 					if ((ch | 0x0020) == 's')
-// 						state = s;
-// 					else if (ch == ':')
-// 						state = colon;
-// 					else
-// 						state = nope;
-// 					break;
-// 				case s: state = ch == ':' ? colon : nope; break;
-// 				case colon: state = ch == '/' ? slash1 : nope; break;
-// 				case slash1: state = ch == '/' ? rest : nope; break;
-// 				case rest:
-// 					if (std::isspace(ch))
-// 					{
-// 						uri.pop_back();
-// 						if (uri.length() > 10)
-// 						{
-// 							int nr = AddHyperLink(uri, "");
-// 							add_uri(start, l * mWidth + c - start, nr);
-// 						}
-// 						state = nope;
-// 					}
-// 					break;
-// 			}
-// 		}
-
-// 		break;
-// 	}
-
-// 	if (uri.length() > 10)
-// 	{
-// 		int nr = AddHyperLink(uri, "");
-// 		add_uri(start, mLines.size() * mWidth - start, nr);
-// 	}
-// }
+void MTerminalBuffer::MarkAttributes(MAttributeTable::MMarks &ioMarks) const
+{
+	auto mark = [&ioMarks](const MLine &inLine)
+	{
+		for (uint32_t c = 0; c < inLine.size(); ++c)
+			ioMarks[inLine[c].GetAttributes()] = true;
+	};
+
+	for (auto &line : mLines)
+		mark(line);
+
+	for (auto &[serial, line] : mExpandedLines)
+		mark(line);
+
+	for (auto &line : mBuffer)
+		line.ForeachAttributes([&ioMarks](uint16_t inAttributes) { ioMarks[inAttributes] = true; });
+}
+
+// --------------------------------------------------------------------
+// URLs in the text are detected for each line that changed since the last
+// frame and stored in a side table, the lines on screen in mScreenLinks,
+// those in the scrollback in a small cache filled on demand. A URL may
+// continue on soft wrapped lines, these are scanned together.
+
+namespace
+{
+
+// Scanning soft wrapped lines stops after this many lines in each direction
+const int32_t
+	kMaxLinkLines = 16;
+
+// The number of scrollback lines for which detected links are kept
+const std::size_t
+	kMaxBufferLinks = 256;
+
+bool IsSchemeChar(char ch)
+{
+	return std::isalnum(static_cast<unsigned char>(ch)) or ch == '+' or ch == '-' or ch == '.';
+}
+
+bool IsURLChar(char ch)
+{
+	return ch > ' ' and ch < 0x7f and std::strchr("<>\"`{}|\\^", ch) == nullptr;
+}
+
+// Find the URLs in inText as byte ranges. Candidates are located by looking
+// for a ':' followed by "//" using memchr, then the scheme before it and
+// the rest of the URL are delimited and the result is validated.
+void FindURLs(std::string_view inText, std::vector<std::pair<std::size_t, std::size_t>> &outURLs)
+{
+	const char *s = inText.data();
+	const char *e = s + inText.length();
+	const char *last = s;
+
+	for (const char *p = s; e - p >= 3;)
+	{
+		p = static_cast<const char *>(std::memchr(p, ':', e - p - 2));
+		if (p == nullptr)
+			break;
+
+		if (p[1] != '/' or p[2] != '/')
+		{
+			++p;
+			continue;
+		}
+
+		// the scheme starts with a letter
+		const char *b = p;
+		while (b > last and IsSchemeChar(b[-1]))
+			--b;
+		while (b < p and not std::isalpha(static_cast<unsigned char>(*b)))
+			++b;
+
+		const char *t = p + 3;
+		while (t < e and IsURLChar(*t))
+			++t;
+
+		// punctuation at the end is most likely not part of the URL,
+		// neither is a closing parenthesis without an opening one
+		while (t > p + 3)
+		{
+			if (std::strchr(".,;:!?'", t[-1]) != nullptr)
+				--t;
+			else if (t[-1] == ')' and std::count(p, t, ')') > std::count(p, t, '('))
+				--t;
+			else
+				break;
+		}
+
+		if (p - b >= 2 and t > p + 3 and zeep::http::is_valid_uri(std::string(b, t)))
+		{
+			outURLs.emplace_back(b - s, t - s);
+			last = t;
+		}
+
+		p = std::max(t, p + 3);
+	}
+}
+
+} // namespace
+
+bool MTerminalBuffer::IsSoftWrapped(int32_t inLine) const
+{
+	if (inLine >= 0)
+		return ScreenLine(inLine).IsSoftWrapped();
+
+	std::size_t index = -inLine - 1;
+	if (index < mBuffer.size())
+		return mBuffer[index].IsSoftWrapped();
+
+	return GetLine(inLine).IsSoftWrapped();
+}
+
+int32_t MTerminalBuffer::ScanForHyperLinks(int32_t inLine) const
+{
+	int32_t lineCount = static_cast<int32_t>(mLines.size());
+
+	// a line in the scrollback may continue on screen
+	if (mScreenLinks.size() != mLines.size())
+		mScreenLinks.assign(mLines.size(), {});
+
+	// the lines that together with inLine form one line of text
+	int32_t first = inLine, last = inLine;
+	while (first > -BufferedLines() and inLine - first < kMaxLinkLines and IsSoftWrapped(first - 1))
+		--first;
+	while (last + 1 < lineCount and last - inLine < kMaxLinkLines and IsSoftWrapped(last))
+		++last;
+
+	std::string text, scratch;
+	for (int32_t line = first; line <= last; ++line)
+	{
+		bool softWrapped;
+		std::size_t start = text.length();
+		text.append(GetLineText(line, scratch, softWrapped));
+
+		if (line < last)
+		{
+			std::size_t cells = CountCells(std::string_view(text).substr(start));
+			if (cells < mWidth)
+				text.append(mWidth - cells, ' ');
+		}
+	}
+
+	std::vector<std::pair<std::size_t, std::size_t>> urls;
+	FindURLs(text, urls);
+
+	std::vector<MDetectedLinks> links(last - first + 1);
+	for (auto [begin, end] : urls)
+	{
+		int32_t b = CountCells(std::string_view(text).substr(0, begin));
+		int32_t e = b + CountCells(std::string_view(text).substr(begin, end - begin)) - 1;
+
+		// lines that were not rewrapped yet may be wider
+		int32_t beginLine = b / mWidth, endLine = std::min<int32_t>(e / mWidth, links.size() - 1);
+		if (beginLine > endLine)
+			continue;
+
+		std::string uri = text.substr(begin, end - begin);
+
+		for (int32_t line = beginLine; line <= endLine; ++line)
+			links[line].push_back({ beginLine - line, b % static_cast<int32_t>(mWidth), endLine - line, e % static_cast<int32_t>(mWidth) + 1, uri });
+	}
+
+	for (int32_t line = first; line <= last; ++line)
+	{
+		if (line >= 0)
+		{
+			mScreenLinks[line].generation = mLineGenerations[line];
+			mScreenLinks[line].links = std::move(links[line - first]);
+		}
+		else
+		{
+			uint64_t serial = mBufferSerial + line;
+
+			// keep the cache small, drop the line furthest away from this one
+			if (not mBufferLinks.contains(serial) and mBufferLinks.size() >= kMaxBufferLinks)
+				DropFurthest(mBufferLinks, serial);
+
+			mBufferLinks[serial] = std::move(links[line - first]);
+		}
+	}
+
+	return last;
+}
+
+void MTerminalBuffer::ScanForHyperLinks()
+{
+	if (mScreenLinks.size() != mLines.size())
+		mScreenLinks.assign(mLines.size(), {});
+
+	// A change in one line may also change the links in its neighbours, through soft wrapping
+	std::vector<bool> changed(mLines.size(), false);
+	for (std::size_t line = 0; line < mLines.size(); ++line)
+	{
+		if (mScreenLinks[line].generation != mLineGenerations[line])
+		{
+			changed[line] = true;
+			if (line > 0)
+				changed[line - 1] = true;
+			if (line + 1 < mLines.size())
+				changed[line + 1] = true;
+		}
+	}
+
+	// the lines scanned along with a changed line are done as well
+	for (int32_t line = 0; line < static_cast<int32_t>(mLines.size()); ++line)
+	{
+		if (changed[line])
+			line = ScanForHyperLinks(line);
+	}
+}
+
+const MTerminalBuffer::MDetectedLinks &MTerminalBuffer::GetDetectedLinks(int32_t inLine) const
+{
+	if (inLine >= 0)
+	{
+		if (mScreenLinks.size() != mLines.size() or mScreenLinks[inLine].generation != mLineGenerations[inLine])
+			ScanForHyperLinks(inLine);
+
+		return mScreenLinks[inLine].links;
+	}
+	else
+	{
+		uint64_t serial = mBufferSerial + inLine;
+
+		auto i = mBufferLinks.find(serial);
+		if (i == mBufferLinks.end())
+		{
+			ScanForHyperLinks(inLine);
+			i = mBufferLinks.find(serial);
+		}
+
+		return i->second;
+	}
+}
@@ -33,6 +33,9 @@
 
 #include <cassert>
 #include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -82,125 +85,197 @@ enum MXTermColor
 	kXTermColorBrightWhite
 };
 
+// MStyle contains the flags and colors for a character. Colors are
+// either an index in the xterm palette or a 24 bit RGB value.
+
 class MStyle
 {
-	enum
+	enum : uint32_t
 	{
-		kForeColorMask = 0x01ff0000,
-		kBackColorMask = 0x0000ff80,
-		kFgShift = 16,
-		kBgShift = 7,
-		kDefaultStyle = kXTermColorNone << kFgShift | kXTermColorNone << kBgShift
+		kRGBColor = 0x01000000
 	};
 
   public:
-	MStyle()
-		: mData(kDefaultStyle)
-	{
-		static_assert(sizeof(MStyle) == 4, "style should be four bytes");
-	}
+	MStyle() = default;
 
 	explicit MStyle(MCharStyle inStyle)
-		: mData(inStyle)
+		: mFlags(inStyle)
 	{
-		SetForeColor(kXTermColorNone);
-		SetBackColor(kXTermColorNone);
 	}
-	//	explicit MStyle(uint32_t inValue) : mData(inValue) {}
 
-	MStyle(MXTermColor inForeColor, MXTermColor inBackColor)
-		: mData(0)
+	// Colors are either an MXTermColor or a value as returned by
+	// GetForeColorValue and GetBackColorValue
+	MStyle(uint32_t inForeColor, uint32_t inBackColor)
+		: mForeColor(inForeColor)
+		, mBackColor(inBackColor)
 	{
-		SetForeColor(inForeColor);
-		SetBackColor(inBackColor);
 	}
 
-	bool operator&(MCharStyle inStyle) const
+	// From the values as stored, see GetFlags and the Get...ColorValue methods
+	MStyle(uint32_t inFlags, uint32_t inForeColor, uint32_t inBackColor, uint32_t inUnderlineColor)
+		: mFlags(inFlags)
+		, mForeColor(inForeColor)
+		, mBackColor(inBackColor)
+		, mUnderlineColor(inUnderlineColor)
 	{
-		return (mData & inStyle) != 0;
 	}
 
-	operator uint32_t() const
+	bool operator&(MCharStyle inStyle) const
 	{
-		return mData;
+		return (mFlags & inStyle) != 0;
 	}
 
+	bool operator==(const MStyle &rhs) const = default;
+
 	void SetFlag(MCharStyle inStyle)
 	{
-		mData |= inStyle;
+		mFlags |= inStyle;
 	}
 
 	void ReverseFlag(MCharStyle inStyle)
 	{
-		mData ^= inStyle;
+		mFlags ^= inStyle;
 	}
 
 	void ClearFlag(MCharStyle inStyle)
 	{
-		mData &= ~inStyle;
+		mFlags &= ~inStyle;
 	}
 
 	void ChangeFlags(uint32_t inMode)
 	{
 		switch (inMode)
 		{
-			case 0: mData &= ~(kStyleBold | kStyleUnderline | kStyleInverse | kStyleBlink); break;
-			case 1: mData |= kStyleBold; break;
-			case 4: mData |= kStyleUnderline; break;
-			case 5: mData |= kStyleBlink; break;
-			case 7: mData |= kStyleInverse; break;
-			case 21: mData &= ~kStyleBold; break;
-			case 24: mData &= ~kStyleUnderline; break;
-			case 25: mData &= ~kStyleBlink; break;
-			case 27: mData &= ~kStyleInverse; break;
+			case 0: mFlags &= ~(kStyleBold | kStyleUnderline | kStyleInverse | kStyleBlink); break;
+			case 1: mFlags |= kStyleBold; break;
+			case 4: mFlags |= kStyleUnderline; break;
+			case 5: mFlags |= kStyleBlink; break;
+			case 7: mFlags |= kStyleInverse; break;
+			case 21: mFlags &= ~kStyleBold; break;
+			case 24: mFlags &= ~kStyleUnderline; break;
+			case 25: mFlags &= ~kStyleBlink; break;
+			case 27: mFlags &= ~kStyleInverse; break;
 		}
 	}
 
-	MXTermColor GetForeColor() const
-	{
-		return (MXTermColor)((mData & kForeColorMask) >> kFgShift);
-	}
+	// For RGB colors these return the closest color in the palette
+	MXTermColor GetForeColor() const { return ToXTermColor(mForeColor); }
+	MXTermColor GetBackColor() const { return ToXTermColor(mBackColor); }
+	MXTermColor GetUnderlineColor() const { return ToXTermColor(mUnderlineColor); }
 
-	void SetForeColor(MXTermColor inColor)
+	void SetForeColor(MXTermColor inColor) { mForeColor = inColor; }
+	void SetBackColor(MXTermColor inColor) { mBackColor = inColor; }
+	void SetUnderlineColor(MXTermColor inColor) { mUnderlineColor = inColor; }
+
+	bool IsForeColorRGB() const { return mForeColor & kRGBColor; }
+	bool IsBackColorRGB() const { return mBackColor & kRGBColor; }
+	bool IsUnderlineColorRGB() const { return mUnderlineColor & kRGBColor; }
+
+	// RGB values are returned as 0xRRGGBB
+	uint32_t GetForeColorRGB() const { return mForeColor & 0x00ffffff; }
+	uint32_t GetBackColorRGB() const { return mBackColor & 0x00ffffff; }
+	uint32_t GetUnderlineColorRGB() const { return mUnderlineColor & 0x00ffffff; }
+
+	// The flags and colors as stored, a palette index or a flagged RGB value
+	uint32_t GetFlags() const { return mFlags; }
+	uint32_t GetForeColorValue() const { return mForeColor; }
+	uint32_t GetBackColorValue() const { return mBackColor; }
+	uint32_t GetUnderlineColorValue() const { return mUnderlineColor; }
+
+	void SetForeColorRGB(uint8_t inRed, uint8_t inGreen, uint8_t inBlue) { mForeColor = MakeRGB(inRed, inGreen, inBlue); }
+	void SetBackColorRGB(uint8_t inRed, uint8_t inGreen, uint8_t inBlue) { mBackColor = MakeRGB(inRed, inGreen, inBlue); }
+	void SetUnderlineColorRGB(uint8_t inRed, uint8_t inGreen, uint8_t inBlue) { mUnderlineColor = MakeRGB(inRed, inGreen, inBlue); }
+
+	// Replace RGB colors with the closest color in the palette
+	MStyle WithoutRGB() const;
+
+	std::size_t Hash() const;
+
+  private:
+	static uint32_t MakeRGB(uint8_t inRed, uint8_t inGreen, uint8_t inBlue)
 	{
-		mData &= ~kForeColorMask;
-		mData |= ((uint32_t)inColor << kFgShift) & kForeColorMask;
+		return kRGBColor | inRed << 16 | inGreen << 8 | inBlue;
 	}
 
-	MXTermColor GetBackColor() const
+	static MXTermColor ToXTermColor(uint32_t inColor);
+
+	uint32_t mFlags = kStyleNormal;
+	uint32_t mForeColor = kXTermColorNone;
+	uint32_t mBackColor = kXTermColorNone;
+	uint32_t mUnderlineColor = kXTermColorNone;
+};
+
+// --------------------------------------------------------------------
+// The combination of style and hyperlink of characters is stored in a
+// table shared by all buffers, characters contain only the 16 bit index
+// in this table. Entry zero is the default style without a hyperlink.
+// Entries can be read without locking, they are only changed when they
+// are reused after no character refers to them anymore.
+//
+// Unused entries are reclaimed when the table fills up. Everyone holding
+// characters registers as a collector and, when asked by NeedsMark, marks
+// the entries it still uses. Once all collectors did so, the entries not
+// marked and not interned in the mean time are freed.
+
+class MAttributeTable
+{
+  public:
+	struct MAttributes
 	{
-		return (MXTermColor)((mData & kBackColorMask) >> kBgShift);
-	}
+		MStyle style;
+		int16_t hyperLink = 0;
+
+		bool operator==(const MAttributes &rhs) const = default;
+
+		std::size_t Hash() const { return style.Hash() * 31 + hyperLink; }
+	};
 
-	void SetBackColor(MXTermColor inColor)
+	static uint16_t Intern(const MStyle &inStyle, int16_t inHyperLink = 0);
+
+	static const MAttributes &Get(uint16_t inAttributes)
 	{
-		mData &= ~kBackColorMask;
-		mData |= ((uint32_t)inColor << kBgShift) & kBackColorMask;
+		return GetTable()[inAttributes];
 	}
 
+	using MMarks = std::vector<bool>;
+
+	static uint32_t RegisterCollector();
+	static void UnregisterCollector(uint32_t inCollector);
+
+	static bool NeedsMark(uint32_t inCollector);
+	static MMarks CreateMarks();
+	static void Mark(uint32_t inCollector, const MMarks &inMarks);
+
+	// Changes each time entries are freed, caches keyed by index should then be cleared
+	static uint32_t GetGeneration();
+
   private:
-	uint32_t mData;
+	static MAttributes *GetTable();
 };
 
-// MChar is a container for both a unicode and the style associated with
+// MChar is a container for both a unicode and the attributes associated with
 // this character in the buffer. Keeping them together makes coding easier.
-// Unicode is limited to 1ffff, Everything in Plane 2 and up is not supported.
 
 class MChar
 {
   public:
 	MChar() = default;
 
-	MChar(MXTermColor inForeColor, MXTermColor inBackColor) noexcept
+	MChar(uint32_t inForeColor, uint32_t inBackColor)
 		: mUnicode(' ')
-		, mStyle(inForeColor, inBackColor)
+		, mAttributes(MAttributeTable::Intern(MStyle(inForeColor, inBackColor)))
+	{
+	}
+
+	MChar(unicode inChar, MStyle inStyle, int inHyperLink = 0)
+		: mUnicode(inChar)
+		, mAttributes(MAttributeTable::Intern(inStyle, inHyperLink))
 	{
 	}
 
-	MChar(unicode inChar, MStyle inStyle, int inHyperLink = 0) noexcept
+	MChar(unicode inChar, uint16_t inAttributes) noexcept
 		: mUnicode(inChar)
-		, mStyle(inStyle)
-		, mHyperLink(inHyperLink)
+		, mAttributes(inAttributes)
 	{
 	}
 
@@ -220,52 +295,81 @@ class MChar
 		return *this;
 	}
 
-	MChar &operator=(MStyle inStyle) noexcept
+	MChar &operator=(MStyle inStyle)
 	{
-		mStyle = inStyle;
+		mAttributes = MAttributeTable::Intern(inStyle, GetHyperLink());
 		return *this;
 	}
 
+	bool operator==(const MChar &rhs) const
+	{
+		return mUnicode == rhs.mUnicode and mAttributes == rhs.mAttributes and mIsTab == rhs.mIsTab;
+	}
+
 	bool operator==(char rhs) const { return mUnicode == static_cast<char32_t>(rhs); }
 	bool operator==(unicode rhs) const { return mUnicode == rhs; }
-	bool operator==(MStyle rhs) const { return mStyle == rhs; }
+	bool operator==(MStyle rhs) const { return GetStyle() == rhs; }
 
 	bool operator!=(char rhs) const { return mUnicode != static_cast<char32_t>(rhs); }
 	bool operator!=(unicode rhs) const { return mUnicode != rhs; }
-	bool operator!=(MStyle rhs) const { return mStyle != rhs; }
+	bool operator!=(MStyle rhs) const { return GetStyle() != rhs; }
 
-	bool operator&(MCharStyle inStyle) const { return (mStyle & inStyle) != 0; }
+	bool operator&(MCharStyle inStyle) const { return (GetStyle() & inStyle) != 0; }
 
-	void operator|=(char32_t inStyle) { mStyle.SetFlag((MCharStyle)inStyle); }
-	void operator&=(char32_t inStyle) { mStyle.ClearFlag((MCharStyle)inStyle); }
+	void operator|=(char32_t inStyle)
+	{
+		MStyle style = GetStyle();
+		style.SetFlag((MCharStyle)inStyle);
+		*this = style;
+	}
 
-	void ReverseFlag(MCharStyle inStyle) { mStyle.ReverseFlag(inStyle); }
-	void ChangeFlags(char32_t inMode) { mStyle.ChangeFlags(inMode); }
+	void operator&=(char32_t inStyle)
+	{
+		MStyle style = GetStyle();
+		style.ClearFlag((MCharStyle)inStyle);
+		*this = style;
+	}
+
+	void ReverseFlag(MCharStyle inStyle)
+	{
+		MStyle style = GetStyle();
+		style.ReverseFlag(inStyle);
+		*this = style;
+	}
+
+	void ChangeFlags(char32_t inMode)
+	{
+		MStyle style = GetStyle();
+		style.ChangeFlags(inMode);
+		*this = style;
+	}
 
 	operator unicode() const { return mUnicode; }
-	operator MStyle() const { return mStyle; }
+	operator MStyle() const { return GetStyle(); }
+
+	const MStyle &GetStyle() const { return MAttributeTable::Get(mAttributes).style; }
+	uint16_t GetAttributes() const { return mAttributes; }
 
 	bool IsTab() const { return mUnicode == ' ' and mIsTab; }
 	void SetTab(bool inIsTab) { assert(mUnicode == ' '); mIsTab = inIsTab; }
 
 	void SetHyperLink(int16_t inLinkNr)
 	{
-		mHyperLink = inLinkNr;
+		mAttributes = MAttributeTable::Intern(GetStyle(), inLinkNr);
 	}
 
 	int16_t GetHyperLink() const
 	{
-		return mHyperLink;
+		return MAttributeTable::Get(mAttributes).hyperLink;
 	}
 
   private:
 	char32_t mUnicode = ' ';
-	MStyle mStyle{};
-	int16_t mHyperLink = 0;
+	uint16_t mAttributes = 0;
 	bool mIsTab = false;
 };
 
-static_assert(sizeof(MChar) == 12, "MChar should be 12 bytes");
+static_assert(sizeof(MChar) == 8, "MChar should be 8 bytes");
 
 // --------------------------------------------------------------------
 // Characters are store in lines
@@ -273,7 +377,7 @@ static_assert(sizeof(MChar) == 12, "MChar should be 12 bytes");
 class MLine
 {
   public:
-	MLine(uint32_t inSize, MXTermColor inForeColor, MXTermColor inBackColor);
+	MLine(uint32_t inSize, uint32_t inForeColor, uint32_t inBackColor);
 
 	MLine(const MLine &rhs);
 
@@ -290,9 +394,12 @@ class MLine
 		return *this;
 	}
 
-	void Delete(uint32_t inColumn, uint32_t inWidth, MXTermColor inForeColor, MXTermColor inBackColor);
+	void Delete(uint32_t inColumn, uint32_t inWidth, uint32_t inForeColor, uint32_t inBackColor);
 	void Insert(uint32_t inColumn, uint32_t inWidth);
 
+	// Change the number of characters, keeping the flags of the line
+	void Resize(uint32_t inSize, uint32_t inForeColor, uint32_t inBackColor);
+
 	MChar &operator[](uint32_t inColumn)
 	{
 		assert(inColumn < mSize);
@@ -306,6 +413,8 @@ class MLine
 
 	friend void swap(MLine &lhs, MLine &rhs) noexcept;
 
+	friend bool operator==(const MLine &lhs, const MLine &rhs);
+
 	bool IsSoftWrapped() const { return mSoftWrapped; }
 	void SetSoftWrapped(bool inSoftWrapped) { mSoftWrapped = inSoftWrapped; }
 
@@ -386,6 +495,72 @@ class MLine
 	bool mDoubleWidth = false, mDoubleHeight = false, mDoubleHeightTop = false;
 };
 
+// --------------------------------------------------------------------
+// Lines in the scrollback buffer are stored compressed. The text is
+// stored as UTF-8, the attributes and tab flags as runs and
+// trailing blanks are not stored at all.
+
+class MCompressedLine
+{
+  public:
+	explicit MCompressedLine(const MLine &inLine);
+
+	MLine Expand() const;
+
+	// Serialization, for lines stored on disk. Attribute table entries are
+	// only valid in this process, Pack stores the number returned by inStore
+	// instead and Unpack maps these back using inLoad. Without inLoad all
+	// characters get the default attributes, enough to get the text.
+	using MAttributeMap = std::function<uint16_t(uint16_t)>;
+
+	void Pack(std::string &ioData, const MAttributeMap &inStore) const;
+	static MCompressedLine Unpack(const char *inData, std::size_t inSize, const MAttributeMap &inLoad);
+
+	bool IsSoftWrapped() const { return mSoftWrapped; }
+	std::size_t size() const { return mSize; }
+
+	// The UTF-8 text, one character per cell, trailing blanks are omitted
+	std::string_view GetText() const { return mText; }
+
+	template <typename Handler>
+	void ForeachAttributes(Handler &&inHandler) const
+	{
+		inHandler(mFillAttributes);
+		for (auto &run : mRuns)
+			inHandler(run.attributes);
+	}
+
+	template <typename Handler>
+	void ForeachHyperLink(Handler &&inHandler) const
+	{
+		for (auto &run : mRuns)
+		{
+			if (int16_t hyperLink = MAttributeTable::Get(run.attributes).hyperLink; hyperLink != 0)
+				inHandler(hyperLink);
+		}
+	}
+
+  private:
+	MCompressedLine() = default;
+
+	struct MRun
+	{
+		uint32_t length;
+		uint16_t attributes;
+		bool tab;
+	};
+
+	std::string mText;
+	std::vector<MRun> mRuns;
+	uint16_t mFillAttributes = 0;
+	uint32_t mSize = 0;
+	bool mSoftWrapped = false;
+	bool mDoubleWidth = false, mDoubleHeight = false, mDoubleHeightTop = false;
+};
+
+class MScrollbackFile;
+class MTrigramIndex;
+
 // --------------------------------------------------------------------
 // And all the lines together for a buffer. We store the lines in a
 // deque object. We push new lines to the front of this list, and
@@ -402,7 +577,9 @@ class MTerminalBuffer
 
 	void SetBufferSize(uint32_t inBufferSize) { mBufferSize = inBufferSize; }
 
-	const MLine &GetLine(int32_t inLine) const;
+	// Returns a copy of the line, lines in the scrollback are expanded
+	// through a small cache of recently used lines.
+	MLine GetLine(int32_t inLine) const;
 
 	// anchor line is recalculated in Resize to help to
 	// adjust scrollbar.
@@ -411,6 +588,11 @@ class MTerminalBuffer
 	void SetCharacter(uint32_t inLine, uint32_t inColumn, unicode inChar,
 		MStyle inStyle = MStyle(), int inHyperLink = 0);
 
+	// Write a run of characters sharing the same style, the run is clipped
+	// at the end of the line
+	void SetCharacters(uint32_t inLine, uint32_t inColumn, const unicode *inText, uint32_t inLength,
+		MStyle inStyle = MStyle(), int inHyperLink = 0);
+
 	void SetIsTab(uint32_t inLine, uint32_t inColumn, bool inIsTab);
 
 	template <typename Handler>
@@ -422,7 +604,7 @@ class MTerminalBuffer
 			if (li >= static_cast<int32_t>(mLines.size()))
 				break;
 
-			MLine &line(mLines[li]);
+			MLine &line(ScreenLine(li));
 
 			for (int32_t ci = inFromColumn; ci <= inToColumn; ++ci)
 			{
@@ -431,6 +613,8 @@ class MTerminalBuffer
 
 				inHandler(line[ci], li, ci);
 			}
+
+			TouchLine(li);
 		}
 	}
 
@@ -463,6 +647,20 @@ class MTerminalBuffer
 	void SetDirty(bool inDirty);
 	bool IsDirty() const { return mDirty; }
 
+	// Damage tracking: each change to a line on screen stamps it with a new
+	// generation number. A consumer remembers GetGeneration() at the time it
+	// looked at the lines and later asks which lines changed since then.
+	uint64_t GetGeneration() const { return mGeneration; }
+	uint64_t GetLineGeneration(uint32_t inLine) const
+	{
+		return inLine < mLineGenerations.size() ? mLineGenerations[inLine] : mGeneration;
+	}
+	std::vector<uint32_t> GetChangedLines(uint64_t inGeneration) const;
+
+	// The number of times the screen scrolled forward, minus the times it
+	// scrolled backward, counting only scrolls of the full width from the top
+	int64_t GetScrollCount() const { return mScrollCount; }
+
 	bool IsSelectionEmpty() const;
 	bool IsSelectionBlock() const;
 
@@ -477,7 +675,8 @@ class MTerminalBuffer
 	void SelectCharacter(int32_t inLine, int32_t inColumn);
 	void ClearSelection();
 
-	void SetColors(MXTermColor inForeColor, MXTermColor inBackColor)
+	// Colors used to fill erased cells, see MStyle(uint32_t, uint32_t)
+	void SetColors(uint32_t inForeColor, uint32_t inBackColor)
 	{
 		mForeColor = inForeColor;
 		mBackColor = inBackColor;
@@ -489,12 +688,46 @@ class MTerminalBuffer
 	std::string GetSelectedText() const;
 	std::string GetText(int32_t inLine1, int32_t inColumn1, int32_t inLine2, int32_t inColumn2, bool inBlock) const;
 
-	int32_t BufferedLines() const { return static_cast<int32_t>(mBuffer.size()); }
-
-	bool FindNext(int32_t &ioLine, int32_t &ioColumn, const std::string &inWhat,
-		bool inIgnoreCase, bool inWrapAround);
-	bool FindPrevious(int32_t &ioLine, int32_t &ioColumn, const std::string &inWhat,
-		bool inIgnoreCase, bool inWrapAround);
+	int32_t BufferedLines() const;
+
+	// After a change in width only the lines on screen and around the anchor are
+	// rewrapped. The rest of the scrollback is rewrapped on demand, Reflow makes
+	// sure everything up to and including inLine is wrapped at the current width
+	// and returns true if any line was rewrapped.
+	bool NeedsReflow() const { return mReflowed < mBuffer.size(); }
+	bool Reflow(int32_t inLine);
+
+	// Search for inWhat, a regular expression if inRegex is true. A match
+	// may continue on the following lines if these are soft wrapped, outLength
+	// is the length of the match in cells. Throws MRegexError for invalid patterns.
+	bool FindNext(int32_t &ioLine, int32_t &ioColumn, int32_t &outLength, const std::string &inWhat,
+		bool inIgnoreCase, bool inRegex, bool inWrapAround);
+	bool FindPrevious(int32_t &ioLine, int32_t &ioColumn, int32_t &outLength, const std::string &inWhat,
+		bool inIgnoreCase, bool inRegex, bool inWrapAround);
+
+	// Append the position of all non overlapping matches in lines
+	// [inFromLine, inToLine) to ioFound, as line, column and length.
+	void FindAll(int32_t inFromLine, int32_t inToLine, const std::string &inWhat,
+		bool inIgnoreCase, bool inRegex, std::vector<std::tuple<int32_t, int32_t, int32_t>> &ioFound) const;
+
+	// Lines that move into the scrollback are numbered, line inLine has number
+	// GetBufferSerial() + inLine, for lines on screen as well. The numbering
+	// stays the same as long as the epoch does not change, it changes when
+	// the scrollback is rewrapped or cleared.
+	uint64_t GetBufferSerial() const { return mBufferSerial; }
+	uint32_t GetBufferEpoch() const { return mBufferEpoch; }
+
+	// Mark the attribute table entries used by the characters in this buffer
+	void MarkAttributes(MAttributeTable::MMarks &ioMarks) const;
+
+	// The memory used by the optional index over the scrollback, zero if there is none
+	std::size_t GetIndexMemoryUsage() const;
+
+	// The index is built in slices, BuildIndex adds at most inMaxLines lines
+	// and returns true when the index is complete. Searches scan all lines
+	// until then. Both return true if no index is used.
+	bool BuildIndex(std::size_t inMaxLines) const;
+	bool IsIndexComplete() const;
 
 	int AddHyperLink(const std::string &inURI, const std::string &inID);
 	int GetHoveredLink(int32_t inLine, int32_t inColumn);
@@ -508,21 +741,110 @@ class MTerminalBuffer
 	std::tuple<int32_t, int32_t> GetHoveredLinkColumBounds(int32_t inLine) const;
 
   private:
-	unicode GetChar(uint32_t inOffset, bool inToLower) const;
+	// The UTF-8 text of a line, without trailing blanks. ioScratch is used
+	// for lines that are not stored as text already.
+	std::string_view GetLineText(int32_t inLine, std::string &ioScratch, bool &outSoftWrapped) const;
 
-	unicode GetChar(int32_t inLine, int32_t inColumn, bool inToLower) const;
+	// The text searched for a line, case folded if needed and followed by up to
+	// inLookahead bytes of the next lines as long as these are soft wrapped.
+	// outLineLength is the part of this line.
+	std::string_view GetSearchText(int32_t inLine, std::size_t inLookahead, bool inIgnoreCase,
+		bool inPadBlanks, std::string &ioText, std::string &ioScratch, std::size_t &outLineLength) const;
 
 	void GarbageCollectHyperlinks();
-	// void ScanForHyperLinks();
 
-	std::deque<MLine> mBuffer;
+	bool IsSoftWrapped(int32_t inLine) const;
+
+	// URLs detected in the text of a line. A URL that continues on soft wrapped
+	// lines is stored for each of them, beginLine and endLine are relative to
+	// that line. The end column is exclusive.
+	struct MDetectedLink
+	{
+		int32_t beginLine, beginColumn, endLine, endColumn;
+		std::string uri;
+	};
+
+	using MDetectedLinks = std::vector<MDetectedLink>;
+
+	// Scan the lines on screen that changed since the last call
+	void ScanForHyperLinks();
+
+	// Scan inLine along with the lines it is soft wrapped with, returns the last line scanned
+	int32_t ScanForHyperLinks(int32_t inLine) const;
+
+	const MDetectedLinks &GetDetectedLinks(int32_t inLine) const;
+
+	// The screen lines are stored in a ring, line 0 is at mFirstLine.
+	// This way scrolling the whole screen does not move any lines.
+	MLine &ScreenLine(uint32_t inLine)
+	{
+		assert(inLine < mLines.size());
+		inLine += mFirstLine;
+		if (inLine >= mLines.size())
+			inLine -= mLines.size();
+		return mLines[inLine];
+	}
+
+	const MLine &ScreenLine(uint32_t inLine) const
+	{
+		return const_cast<MTerminalBuffer *>(this)->ScreenLine(inLine);
+	}
+
+	// Make mFirstLine zero again, for code that accesses mLines directly
+	void UnrotateLines();
+
+	// Mark lines on screen as changed, inclusive range
+	void TouchLine(uint32_t inLine) { TouchLines(inLine, inLine); }
+	void TouchLines(uint32_t inFromLine, uint32_t inToLine);
+
+	// Store a copy of a line that scrolled off the screen in the scrollback buffer
+	void PushToBuffer(const MLine &inLine);
+
+	// Rewrap the unwrapped lines in mBuffer up to and including index inUntil.
+	// Returns the new index of the first physical line of the logical line
+	// that contained inTrack, or inTrack itself if that line was not touched.
+	std::size_t ReflowBuffer(std::size_t inUntil, std::size_t inTrack);
+
+	// The trigram index over the lines in mBuffer, built by BuildIndex
+	// and dropped whenever the lines are renumbered. Returns nullptr if
+	// there is no index or it is not complete. Lines are added newest last,
+	// when the index grows too large the oldest lines are removed, these
+	// are searched without it.
+	const MTrigramIndex *GetIndex() const;
+	void AddToIndex(std::size_t inIndex) const;
+	void RemoveFromIndex() const;
+
+	std::deque<MCompressedLine> mBuffer;
 	uint32_t mBufferSize;
+
+	// The first mReflowed lines in mBuffer are wrapped at mWidth, the older ones
+	// still have the width they had before the last resize.
+	std::size_t mReflowed = 0;
+
+	// The lines in mBuffer are numbered, the number of mBuffer[0] is mBufferSerial - 1.
+	// Expanded lines are kept in a small cache using these numbers as key.
+	uint64_t mBufferSerial = 0;
+	uint32_t mBufferEpoch = 0;
+	mutable std::map<uint64_t, MLine> mExpandedLines;
+
+	// Lines dropped from mBuffer end up here, if scrollback is stored on disk
+	std::unique_ptr<MScrollbackFile> mScrollbackFile;
+
+	// Optional trigram index for searching mBuffer, see GetIndex
+	std::size_t mMaxIndexMemory = 0;
+	mutable std::unique_ptr<MTrigramIndex> mIndex;
+	mutable uint64_t mIndexNext = 0; // the serial of the next line to add
+
 	std::vector<MLine> mLines;
+	uint32_t mFirstLine = 0;
+	std::vector<uint64_t> mLineGenerations;
+	uint64_t mGeneration = 0;
+	int64_t mScrollCount = 0;
 	uint32_t mWidth;
 	bool mDirty;
 	int32_t mBeginLine, mBeginColumn, mEndLine, mEndColumn;
 	bool mBlockSelection;
-	MXTermColor mForeColor, mBackColor;
+	uint32_t mForeColor, mBackColor;
 
 	// On screen hyperlinks
 	int mNextHyperLinkNr = 1;
@@ -535,5 +857,16 @@ class MTerminalBuffer
 
 	std::vector<MHyperLink> mHyperLinks;
 	std::string mHoveredLink;
+
+	// Detected URLs for the lines on screen, valid as long as the line generation
+	// is the same, and for some lines in the scrollback using their serial number.
+	struct MLineLinks
+	{
+		uint64_t generation = 0;
+		MDetectedLinks links;
+	};
+
+	mutable std::vector<MLineLinks> mScreenLinks;
+	mutable std::map<uint64_t, MDetectedLinks> mBufferLinks;
 	int32_t mHoverdLinkBeginLine, mHoverdLinkBeginColumn, mHoverdLinkEndLine, mHoverdLinkEndColumn;
 };
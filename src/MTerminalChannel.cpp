@@ -98,7 +98,7 @@ class MSshTerminalChannel : public MTerminalChannel
 
 	void SendData(string &&inData) override;
 	void SendSignal(const string &inSignal) override;
-	void ReadData(const ReadCallback &inCallback) override;
+	void ReadData(MRingBuffer &ioBuffer, const ReadCallback &inCallback) override;
 
 	bool CanDownloadFiles() const override { return true; }
 	void DownloadFile(const std::filesystem::path &remotepath, const std::filesystem::path &localpath) override;
@@ -111,7 +111,6 @@ class MSshTerminalChannel : public MTerminalChannel
 
   private:
 	shared_ptr<pinch::terminal_channel> mChannel;
-	asio_ns::streambuf mResponse;
 };
 
 MSshTerminalChannel::MSshTerminalChannel(std::shared_ptr<pinch::basic_connection> inConnection)
@@ -204,7 +203,7 @@ void MSshTerminalChannel::SendSignal(const string &inSignal)
 	mChannel->send_signal(inSignal);
 }
 
-void MSshTerminalChannel::ReadData(const ReadCallback &inCallback)
+void MSshTerminalChannel::ReadData(MRingBuffer &ioBuffer, const ReadCallback &inCallback)
 {
 	MAppExecutor my_executor{ &MSaltApp::Instance().get_context() };
 
@@ -213,10 +212,13 @@ void MSshTerminalChannel::ReadData(const ReadCallback &inCallback)
 		[this, inCallback](const std::error_code &ec, size_t inBytesReceived)
 		{
 			if (this->mRefCount > 0)
-				inCallback(ec, this->mResponse);
+			{
+				inCallback(ec, inBytesReceived);
+			}
 		});
 
-	asio_ns::async_read(*mChannel, mResponse, asio_ns::transfer_at_least(1), std::move(cb));
+	auto buffer = ioBuffer.Prepare(kMinimumReadSize);
+	mChannel->async_read_some(asio_ns::buffer(buffer.data(), buffer.size()), std::move(cb));
 }
 
 void ReportError(asio_system_ns::error_code ec)
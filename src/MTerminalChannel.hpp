@@ -30,6 +30,7 @@
 #pragma once
 
 #include "MP2PEvents.hpp"
+#include "MRingBuffer.hpp"
 
 #include <pinch.hpp>
 
@@ -39,7 +40,7 @@ class MTerminalChannel
 	typedef std::function<void(std::error_code)> OpenCallback;
 	typedef std::function<void(const std::string &, const std::string &)> MessageCallback;
 	typedef std::function<void(std::error_code, std::size_t)> WriteCallback;
-	typedef std::function<void(std::error_code, std::streambuf &inData)> ReadCallback;
+	typedef std::function<void(std::error_code, std::size_t)> ReadCallback;
 
 	virtual void SetMessageCallback(const MessageCallback &inMessageCallback);
 
@@ -70,7 +71,10 @@ class MTerminalChannel
 	}
 
 	virtual void SendSignal(const std::string &inSignal) = 0;
-	virtual void ReadData(const ReadCallback &inCallback) = 0;
+	// Read data directly into the free space of ioBuffer. The data is
+	// not committed to the buffer, inCallback should call Commit with
+	// the number of bytes received, holding any lock guarding ioBuffer.
+	virtual void ReadData(MRingBuffer &ioBuffer, const ReadCallback &inCallback) = 0;
 
 	static MTerminalChannel *Create(std::shared_ptr<pinch::basic_connection> inConnection);
 	static MTerminalChannel *Create(MTerminalChannel *inCloneFrom);
@@ -87,6 +91,9 @@ class MTerminalChannel
 
   protected:
 	MTerminalChannel();
+
+	static constexpr std::size_t kMinimumReadSize = 4096;
+
 	virtual ~MTerminalChannel();
 
 	uint32_t mTerminalWidth, mTerminalHeight, mPixelWidth, mPixelHeight;
@@ -296,3 +296,130 @@ const MColor k256AnsiColors[256] = {
 	{ uint8_t(228), uint8_t(228), uint8_t(228) }, // 254: #e4e4e4
 	{ uint8_t(238), uint8_t(238), uint8_t(238) }  // 255: #eeeeee
 };
+
+// --------------------------------------------------------------------
+
+bool MTerminalPalette::Update(MColor inText, MColor inBack, MColor inBold, MColor inSelection,
+	bool inIgnoreColors, float inFactor)
+{
+	bool result = mVersion == 0 or
+	              not(inText == mText and inBack == mBack and inBold == mBold and inSelection == mSelection) or
+	              inIgnoreColors != mIgnoreColors or inFactor != mFactor;
+
+	if (result)
+	{
+		mText = inText;
+		mBack = inBack;
+		mBold = inBold;
+		mSelection = inSelection;
+		mIgnoreColors = inIgnoreColors;
+		mFactor = inFactor;
+
+		mResolved.clear();
+		++mVersion;
+	}
+
+	return result;
+}
+
+MColor MTerminalPalette::Fade(MColor inColor) const
+{
+	// correction factor for color. If negative, we bleach, otherwise we disable
+	if (mFactor > 0)
+		inColor = inColor.Disable(mBack, mFactor);
+	else if (mFactor < 0)
+		inColor = inColor.Bleach(-mFactor);
+	return inColor;
+}
+
+const MTerminalPalette::MColors &MTerminalPalette::Resolve(uint16_t inAttributes, bool inInverse)
+{
+	uint32_t key = inAttributes | (inInverse ? 0x10000 : 0);
+
+	// attribute table entries may have been reused
+	if (uint32_t generation = MAttributeTable::GetGeneration(); generation != mAttributesGeneration)
+	{
+		mResolved.clear();
+		mAttributesGeneration = generation;
+	}
+
+	auto i = mResolved.find(key);
+	if (i == mResolved.end())
+	{
+		const MStyle &st = MAttributeTable::Get(inAttributes).style;
+
+		const int
+			eNormalBack = -1,
+			eNormalText = -2,
+			eNormalBold = -3,
+			eRGBColor = 256;
+
+		int textColorIx = eNormalText, backColorIx = eNormalBack;
+
+		if (st & kStyleBold)
+			textColorIx = eNormalBold;
+
+		if (not mIgnoreColors)
+		{
+			if (st.IsForeColorRGB())
+				textColorIx = eRGBColor;
+			else if (st.GetForeColor() == kXTermColorRegularBack)
+				textColorIx = eNormalBack;
+			else if (st.GetForeColor() == kXTermColorRegularText)
+				textColorIx = eNormalText;
+			else if (st.GetForeColor() != kXTermColorNone)
+				textColorIx = st.GetForeColor();
+
+			if (st.IsBackColorRGB())
+				backColorIx = eRGBColor;
+			else if (st.GetBackColor() == kXTermColorRegularBack)
+				backColorIx = eNormalBack;
+			else if (st.GetBackColor() == kXTermColorRegularText)
+				backColorIx = eNormalText;
+			else if (st.GetBackColor() != kXTermColorNone)
+				backColorIx = st.GetBackColor();
+
+			if (st & kStyleBold and (textColorIx >= kXTermColorBlack and textColorIx <= kXTermColorWhite))
+				textColorIx += 8;
+		}
+
+		auto getColor = [this](int inColorIx, uint32_t inRGB)
+		{
+			switch (inColorIx)
+			{
+				case eNormalBack:
+					return mBack;
+				case eNormalText:
+					return mText;
+				case eNormalBold:
+					return mBold;
+				case eRGBColor:
+					return MColor((inRGB >> 16) & 0xff, (inRGB >> 8) & 0xff, inRGB & 0xff);
+				default:
+					return k256AnsiColors[inColorIx];
+			}
+		};
+
+		MColor textC = getColor(textColorIx, st.GetForeColorRGB());
+		MColor backC = getColor(backColorIx, st.GetBackColorRGB());
+
+		if (inInverse)
+		{
+			std::swap(textColorIx, backColorIx);
+			std::swap(textC, backC);
+		}
+
+		MColor selectedC = textC;
+
+		// make sure the low colors remain readable
+		if (textColorIx < 16 and st.GetForeColor() != kXTermColorRegularBack and st.GetBackColor() != kXTermColorRegularText)
+		{
+			selectedC = textC.Distinct(mSelection);
+			textC = textC.Distinct(backC);
+		}
+
+		i = mResolved.emplace(key, MColors{ Fade(textC), Fade(backC), Fade(selectedC) }).first;
+	}
+
+	return i->second;
+}
@@ -30,5 +30,52 @@
 #pragma once
 
 #include "MColor.hpp"
+#include "MTerminalBuffer.hpp"
+
+#include <unordered_map>
 
 extern const MColor k256AnsiColors[256];
+
+// --------------------------------------------------------------------
+// MTerminalPalette resolves the attributes of a character into the colors
+// to draw it with. The results for the current theme are cached, including
+// bold brightening, inverse video, contrast fixes and fading.
+
+class MTerminalPalette
+{
+  public:
+	struct MColors
+	{
+		MColor text, back;
+		MColor selectedText; // the text color on top of the selection color
+	};
+
+	// Returns true if anything changed, all resolved colors are dropped in that case
+	bool Update(MColor inText, MColor inBack, MColor inBold, MColor inSelection,
+		bool inIgnoreColors, float inFactor);
+
+	// Incremented each time the colors change
+	uint32_t GetVersion() const { return mVersion; }
+
+	const MColors &Resolve(uint16_t inAttributes, bool inInverse);
+
+	// The colors of the theme, faded if needed
+	MColor GetText() const { return Fade(mText); }
+	MColor GetBack() const { return Fade(mBack); }
+	MColor GetBold() const { return Fade(mBold); }
+	MColor GetSelection() const { return Fade(mSelection); }
+
+	// The background of search matches other than the selected one
+	MColor GetMatch() const { return Fade(mSelection.Disable(mBack)); }
+
+  private:
+	MColor Fade(MColor inColor) const;
+
+	std::unordered_map<uint32_t, MColors> mResolved;
+	uint32_t mAttributesGeneration = 0;
+
+	MColor mText, mBack, mBold, mSelection;
+	bool mIgnoreColors = false;
+	float mFactor = 0;
+	uint32_t mVersion = 0;
+};
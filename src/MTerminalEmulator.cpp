@@ -0,0 +1,3220 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#include "MTerminalEmulator.hpp"
+#include "MCSICommands.hpp"
+#include "MControlCodes.hpp"
+#include "MError.hpp"
+#include "MFormat.hpp"
+#include "MUtils.hpp"
+#include "MVT220CharSets.hpp"
+
+#include <zeep/crypto.hpp>
+#include <zeep/http/uri.hpp>
+
+#include <cstring>
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+// This is what we report as terminal type:
+// 62	VT200 family
+// 1	132 columns
+// 2	printer port
+// 6	selective erase
+// 8	user-defined keys
+// 9	national replacement character-sets
+
+const char
+	//	kVT220Attributes[] = "\033[?62;1;2;6;8;9c";
+	kVT420Attributes[] = "\033[?64;1;2;6;8;9c";
+//	kVT520Attributes[] = "\033[?65;1;2;6;8;9c";
+
+const std::string
+	kDCS("\033P");
+
+std::chrono::system_clock::duration
+	kSmoothScrollDelay = std::chrono::milliseconds(25);
+
+// The maximum time the screen is held back for synchronized output
+std::chrono::steady_clock::duration
+	kSynchronizedOutputTimeout = std::chrono::milliseconds(250);
+
+// Maximum number of printable characters collected by Emulate
+// before they are written to the screen.
+const uint32_t
+	kMaxPrintableRun = 512;
+
+} // namespace
+
+// --------------------------------------------------------------------
+// We even support the weird 'Device Control Strings', programmable function keys
+
+enum MPFKKey
+{
+	eUndefinedKey,
+	eF1 = 11,
+	eF2 = 12,
+	eF3 = 13,
+	eF4 = 14,
+	eF5 = 15,
+	eF6 = 17,
+	eF7 = 18,
+	eF8 = 19,
+	eF9 = 20,
+	eF10 = 21,
+	eF11 = 23,
+	eF12 = 24,
+	eF13 = 25,
+	eF14 = 26,
+	eF15 = 28,
+	eF16 = 29,
+	eF17 = 31,
+	eF18 = 32,
+	eF19 = 33,
+	eF20 = 34
+};
+
+struct MPFK
+{
+	bool clear;
+	bool locked;
+	std::map<uint32_t, std::string> key;
+};
+
+// --------------------------------------------------------------------
+// The MTerminalEmulator class.
+
+MTerminalEmulator::MTerminalEmulator(uint32_t inColumns, uint32_t inRows)
+	: mTerminalWidth(inColumns)
+	, mTerminalHeight(inRows)
+	, mScreenBuffer(mTerminalWidth, mTerminalHeight, true)
+	, mAlternateBuffer(mTerminalWidth, mTerminalHeight, false)
+	, mStatusLineBuffer(mTerminalWidth, 1, false)
+	, mBuffer(&mScreenBuffer)
+{
+	Reset();
+}
+
+MTerminalEmulator::~MTerminalEmulator()
+{
+	delete mPFK;
+	delete mNewPFK;
+}
+
+void MTerminalEmulator::ResetCursor()
+{
+	mCursor.x = 0;
+	mCursor.y = 0;
+	mCursor.style = MStyle(kStyleNormal);
+	mCursor.charSetG[0] = kUSCharSet;
+	mCursor.charSetGSel[0] = 'B';
+	mCursor.charSetG[1] = kLineCharSet;
+	mCursor.charSetGSel[1] = '0';
+	mCursor.charSetG[2] = kUSCharSet;
+	mCursor.charSetGSel[2] = 'B';
+	mCursor.charSetG[3] = kLineCharSet;
+	mCursor.charSetGSel[3] = '0';
+	mCursor.CSGL = 0;
+	mCursor.CSGR = 2;
+	mCursor.DECOM = false;
+	mCursor.DECAWM = true;
+	mCursor.SS = 0;
+	mCursor.blink = mBlinkCursor;
+	mCursor.block = mBlockCursor;
+}
+
+void MTerminalEmulator::Reset(bool inKeepCursorPosition)
+{
+	if (inKeepCursorPosition)
+	{
+		int32_t x = mCursor.x, y = mCursor.y;
+
+		Reset(false);
+
+		mCursor.x = x;
+		mCursor.y = y;
+		return;
+	}
+
+	mS8C1T = false;
+
+	mTabStops = std::vector<bool>(mTerminalWidth, false);
+	for (int32_t i = 8; i < mTerminalWidth; i += 8)
+		mTabStops[i] = true;
+
+	mParser.Reset();
+
+	mMarginTop = 0;
+	mMarginBottom = mTerminalHeight - 1;
+
+	mMarginLeft = 0;
+	mMarginTop = 0;
+	mMarginRight = mTerminalWidth - 1;
+	mMarginBottom = mTerminalHeight - 1;
+
+	ResetCursor();
+
+	mIRM = false;
+	mKAM = false;
+	mLNM = false;
+	mSRM = true;
+
+	mDECCKM = false;
+	mDECANM = true;
+	mDECSCLM = false;
+	mDECSCNM = false;
+	mDECARM = true;
+	mDECPFF = false;
+	mDECPEX = false;
+	mDECNMK = false;
+	mDECBKM = false;
+
+	mDECSCL = 4; // FIXME ? really?
+	mDECTCEM = true;
+	mDECNRCM = false;
+
+	mDECSASD = false;
+	bool needResize = mDECSSDT > 0;
+	mDECSSDT = mShowStatusLine ? 1 : 0;
+	mDECVSSM = false;
+
+	mCursor.saved = false;
+	mNextSmoothScroll.reset();
+	mSynchronizedOutput.reset();
+
+	mDECSACE = false;
+
+	// avoid problems when restore cursor is called
+	mAlternate.saved = false;
+	mSaved.saved = false;
+	mSavedSL.saved = false;
+
+	if (needResize)
+		ResizeTerminal(mTerminalWidth, mTerminalHeight);
+
+	mMouseMode = eTrackMouseNone;
+}
+
+void MTerminalEmulator::SoftReset()
+{
+	mDECTCEM = true;
+	mIRM = false;
+	mDECNMK = false;
+	mDECCKM = false;
+	mMarginTop = 0;
+	mMarginBottom = mTerminalHeight - 1;
+	mDECNRCM = false;
+
+	mCursor.style = MStyle();
+	mCursor.charSetG[0] = kUSCharSet;
+	mCursor.charSetGSel[0] = 'B';
+	mCursor.charSetG[1] = kLineCharSet;
+	mCursor.charSetGSel[1] = '0';
+	mCursor.charSetG[2] = kUSCharSet;
+	mCursor.charSetGSel[2] = 'B';
+	mCursor.charSetG[3] = kLineCharSet;
+	mCursor.charSetGSel[3] = '0';
+	mCursor.CSGL = 0;
+	mCursor.CSGR = 2;
+	mCursor.DECOM = false;
+	mCursor.DECAWM = true; // should be false
+	mCursor.SS = 0;
+
+	mSaved = mCursor;
+}
+
+void MTerminalEmulator::Resize(uint32_t inColumns, uint32_t inRows, int32_t &ioAnchor, bool inResetCursor)
+{
+	int32_t dh = inRows - mTerminalHeight;
+
+	mTerminalWidth = inColumns;
+	mTerminalHeight = inRows;
+
+	mMarginRight = mTerminalWidth - 1;
+	mMarginLeft = 0;
+
+	mMarginBottom = mTerminalHeight - 1;
+	mMarginTop = 0;
+
+	mCursor.y += dh;
+	mSaved.y += dh;
+	mAlternate.y += dh;
+
+	// not sure if this is really what we want:
+	mMarginTop = 0;
+	mMarginBottom = mTerminalHeight - 1;
+
+	mBuffer->Resize(inColumns, inRows, ioAnchor);
+
+	mTabStops = std::vector<bool>(mTerminalWidth, false);
+	for (int32_t i = 8; i < mTerminalWidth; i += 8)
+		mTabStops[i] = true;
+
+	// the anchor returned is the one for the active buffer
+	int32_t anchor = ioAnchor;
+
+	if (mBuffer == &mAlternateBuffer)
+		mScreenBuffer.Resize(mTerminalWidth, mTerminalHeight, anchor);
+	else
+		mAlternateBuffer.Resize(mTerminalWidth, mTerminalHeight, anchor);
+
+	mStatusLineBuffer.Resize(mTerminalWidth, 1, anchor);
+
+	if (inResetCursor)
+	{
+		mMarginTop = 0;
+		mMarginBottom = inRows - 1;
+		mCursor.x = mCursor.y = 0;
+
+		EraseInDisplay(2, false);
+	}
+}
+
+void MTerminalEmulator::ResizeTerminal(uint32_t inColumns, uint32_t inRows)
+{
+	int32_t anchor = 0;
+	Resize(inColumns, inRows, anchor, true);
+
+	AddHostRequest(MHostRequest::eTerminalResized);
+}
+
+void MTerminalEmulator::SetBufferSize(uint32_t inBufferSize)
+{
+	mScreenBuffer.SetBufferSize(inBufferSize);
+}
+
+void MTerminalEmulator::SetDefaultCursorShape(bool inBlock, bool inBlink)
+{
+	mCursor.block = mBlockCursor = inBlock;
+	mCursor.blink = mBlinkCursor = inBlink;
+}
+
+void MTerminalEmulator::SetShowStatusLine(bool inShowStatusLine)
+{
+	mShowStatusLine = inShowStatusLine;
+
+	// VT320 ?
+	mDECSSDT = mShowStatusLine ? 1 : 0;
+}
+
+bool MTerminalEmulator::UpdateIndicatorStatusLine(bool inConnected)
+{
+	auto state = std::make_tuple(mCursor.x, mCursor.y, inConnected, mStatusLineBuffer.GetGeneration());
+	if (mIndicatorStatusLine == state)
+		return false;
+
+	std::string text = MFormat(" 1 (%03.3d,%03.3d)", mCursor.y + 1, mCursor.x + 1);
+
+	std::string trailing = "Printer: None          Network: ";
+	trailing += (inConnected ? "Connected    " : "Not Connected");
+
+	if (text.length() + trailing.length() < static_cast<std::size_t>(mTerminalWidth))
+		text += std::string(mTerminalWidth - text.length() - trailing.length(), ' ');
+	text += trailing;
+
+	// the text is plain ASCII, write it directly, no need to emulate it
+	std::u32string line(text.begin(), text.end());
+	mStatusLineBuffer.SetCharacters(0, 0, line.data(), line.length(), MStyle(kStyleNormal));
+	if (line.length() < static_cast<std::size_t>(mTerminalWidth))
+		mStatusLineBuffer.EraseLine(0, line.length(), 0, false);
+
+	mIndicatorStatusLine = std::make_tuple(mCursor.x, mCursor.y, inConnected, mStatusLineBuffer.GetGeneration());
+
+	return true;
+}
+
+std::optional<std::string> MTerminalEmulator::GetUserDefinedKey(uint32_t inKeyCode) const
+{
+	std::optional<std::string> result;
+
+	if (mPFK != nullptr)
+	{
+		auto i = mPFK->key.find(inKeyCode);
+		if (i != mPFK->key.end())
+			result = i->second;
+	}
+
+	return result;
+}
+
+void MTerminalEmulator::EraseInDisplay(uint32_t inMode, bool inSelective)
+{
+	mBuffer->EraseDisplay(mCursor.y, mCursor.x, inMode, inSelective);
+}
+
+void MTerminalEmulator::EraseInLine(uint32_t inMode, bool inSelective)
+{
+	mBuffer->EraseLine(mCursor.y, mCursor.x, inMode, inSelective);
+}
+
+void MTerminalEmulator::ScrollForward()
+{
+	if (mDECSCLM)
+	{
+		mNextSmoothScroll = std::chrono::system_clock::now() + kSmoothScrollDelay;
+		mScrollForward = true;
+		mParser.Suspend();
+	}
+	else
+	{
+		mBuffer->ScrollForward(mMarginTop, mMarginBottom, mMarginLeft, mMarginRight);
+		++mScrollForwardCount;
+	}
+}
+
+void MTerminalEmulator::PerformSmoothScroll()
+{
+	if (mNextSmoothScroll.has_value())
+	{
+		if (mScrollForward)
+		{
+			mBuffer->ScrollForward(mMarginTop, mMarginBottom, mMarginLeft, mMarginRight);
+			++mScrollForwardCount;
+		}
+		else
+			mBuffer->ScrollBackward(mMarginTop, mMarginBottom, mMarginLeft, mMarginRight);
+
+		mNextSmoothScroll.reset();
+	}
+}
+
+void MTerminalEmulator::ScrollBackward()
+{
+	if (mDECSCLM)
+	{
+		mNextSmoothScroll = std::chrono::system_clock::now() + kSmoothScrollDelay;
+		mScrollForward = false;
+		mParser.Suspend();
+	}
+	else
+		mBuffer->ScrollBackward(mMarginTop, mMarginBottom, mMarginLeft, mMarginRight);
+}
+
+void MTerminalEmulator::WriteChar(unicode inChar)
+{
+	MTerminalBuffer *buffer = mDECSASD ? &mStatusLineBuffer : mBuffer;
+
+	int32_t mr = mCursor.DECOM ? mMarginRight : mTerminalWidth - 1;
+	int32_t ml = mCursor.DECOM ? mMarginLeft : 0;
+	int32_t mb = mCursor.DECOM ? mMarginBottom : mTerminalHeight - 1;
+
+	if (mCursor.x >= mr + 1)
+	{
+		if (mCursor.DECAWM)
+		{
+			buffer->WrapLine(mCursor.y);
+			if (mCursor.y < mb)
+				++mCursor.y;
+			else
+				ScrollForward();
+
+			mCursor.x = ml;
+		}
+		else
+			mCursor.x = mr;
+	}
+
+	if (mIRM)
+		buffer->InsertCharacter(mCursor.y, mCursor.x);
+
+	buffer->SetCharacter(mCursor.y, mCursor.x, inChar, mCursor.style, mHyperLink);
+
+	++mCursor.x;
+
+	mLastChar = inChar;
+}
+
+void MTerminalEmulator::WriteChars(const unicode *inText, uint32_t inLength)
+{
+	if (inLength == 0)
+		return;
+
+	// insert mode shifts the rest of the line for each character, keep that simple
+	if (mIRM)
+	{
+		while (inLength-- > 0)
+			WriteChar(*inText++);
+		return;
+	}
+
+	MTerminalBuffer *buffer = mDECSASD ? &mStatusLineBuffer : mBuffer;
+
+	int32_t mr = mCursor.DECOM ? mMarginRight : mTerminalWidth - 1;
+	int32_t ml = mCursor.DECOM ? mMarginLeft : 0;
+	int32_t mb = mCursor.DECOM ? mMarginBottom : mTerminalHeight - 1;
+
+	mLastChar = inText[inLength - 1];
+
+	while (inLength > 0)
+	{
+		if (mCursor.x >= mr + 1)
+		{
+			if (mCursor.DECAWM)
+			{
+				buffer->WrapLine(mCursor.y);
+				if (mCursor.y < mb)
+					++mCursor.y;
+				else
+					ScrollForward();
+
+				mCursor.x = ml;
+			}
+			else
+			{
+				// without autowrap all remaining characters end up in the
+				// last column, only the last one will be visible.
+				mCursor.x = mr;
+				inText += inLength - 1;
+				inLength = 1;
+			}
+		}
+
+		uint32_t n = std::min<uint32_t>(inLength, mr + 1 - mCursor.x);
+
+		buffer->SetCharacters(mCursor.y, mCursor.x, inText, n, mCursor.style, mHyperLink);
+
+		mCursor.x += n;
+		inText += n;
+		inLength -= n;
+	}
+}
+
+void MTerminalEmulator::MoveCursor(MCursorMovement inDirection)
+{
+	int32_t x = mCursor.x, y = mCursor.y;
+
+	switch (inDirection)
+	{
+		case kMoveUp:
+			if (mCursor.y > mMarginTop or (mCursor.y < mMarginTop and mCursor.y > 0))
+				--mCursor.y;
+			break;
+
+		case kMoveDown:
+			if (mCursor.y < mMarginBottom or (mCursor.y > mMarginBottom and mCursor.y < mTerminalHeight - 1))
+				++mCursor.y;
+			break;
+
+		case kMoveRight:
+			if (mCursor.x < mMarginRight or (mCursor.x > mMarginRight and mTerminalWidth - 1))
+				++mCursor.x;
+			break;
+
+		case kMoveLeft:
+			if (mCursor.x >= mTerminalWidth - 1)
+				mCursor.x = mTerminalWidth - 1 - 1;
+			else if (mCursor.x > mMarginLeft or (mCursor.x < mMarginLeft and mCursor.x > 0))
+				--mCursor.x;
+			break;
+
+		case kMoveIND:
+			if (mCursor.y < mMarginBottom)
+				++mCursor.y;
+			else if (mCursor.y == mMarginBottom)
+				ScrollForward();
+			break;
+
+		// same as MoveUp
+		case kMoveRI:
+			if (mCursor.y > mMarginTop)
+				--mCursor.y;
+			else if (mCursor.y == mMarginTop)
+				ScrollBackward();
+			break;
+
+		case kMoveLF:
+			if (mCursor.y < mMarginBottom)
+				++mCursor.y;
+			else if (mCursor.y == mMarginBottom)
+				ScrollForward();
+			break;
+
+		case kMoveCR:
+			mCursor.x = mMarginLeft;
+			break;
+
+		case kMoveCRLF:
+			mCursor.x = mMarginLeft;
+			if (mCursor.y < mMarginBottom)
+				++mCursor.y;
+			else if (mCursor.y == mMarginBottom)
+				ScrollForward();
+			break;
+
+		case kMoveHT:
+			while (mCursor.x < mMarginRight)
+			{
+				++mCursor.x;
+				if (mTabStops[mCursor.x])
+					break;
+				mBuffer->SetIsTab(mCursor.y, mCursor.x, true);
+			}
+			break;
+
+		case kMoveCBT:
+			while (mCursor.x > mMarginLeft)
+			{
+				--mCursor.x;
+				if (mTabStops[mCursor.x])
+					break;
+			}
+			break;
+
+		case kMoveBI:
+			if (mCursor.x > mMarginLeft)
+				--mCursor.x;
+			else if (mCursor.x >= 0)
+				mBuffer->InsertCharacter(mCursor.y, mMarginLeft, mMarginRight);
+			break;
+
+		case kMoveFI:
+			if (mCursor.x < mMarginRight - 1)
+				++mCursor.x;
+			else if (mCursor.x < mTerminalWidth)
+				mBuffer->DeleteCharacter(mCursor.y, mMarginLeft, mMarginRight);
+			break;
+
+		case kMoveSL:
+			for (int32_t line = 0; line < mTerminalHeight; ++line)
+				mBuffer->DeleteCharacter(line, mMarginLeft, mMarginRight);
+			if (mCursor.x > 0)
+				--mCursor.x;
+			break;
+
+		case kMoveSR:
+			for (int32_t line = 0; line < mTerminalHeight - 1; ++line)
+				mBuffer->InsertCharacter(line, mMarginLeft, mMarginRight);
+			if (mCursor.x < mMarginRight)
+				++mCursor.x;
+			break;
+	}
+
+	if (x != mCursor.x or y != mCursor.y)
+		mBuffer->SetDirty(true);
+}
+
+void MTerminalEmulator::MoveCursorTo(int32_t inX, int32_t inY)
+{
+	if (mCursor.DECOM)
+	{
+		inX += mMarginLeft;
+		inY += mMarginTop;
+	}
+
+	if (inX < 0)
+		inX = 0;
+	if (inX > mTerminalWidth - 1)
+		inX = mTerminalWidth - 1;
+
+	if (inY < 0)
+		inY = 0;
+	if (inY > mTerminalHeight - 1)
+		inY = mTerminalHeight - 1;
+
+	if (mCursor.DECOM)
+	{
+		if (inY < mMarginTop)
+			inY = mMarginTop;
+		if (inY > mMarginBottom)
+			inY = mMarginBottom;
+
+		if (inX < mMarginLeft)
+			inX = mMarginLeft;
+		if (inX > mMarginRight)
+			inX = mMarginRight;
+	}
+
+	if (mCursor.x != inX or mCursor.y != inY)
+	{
+		mCursor.x = inX;
+		mCursor.y = inY;
+
+		if (mCursor.y > mTerminalHeight - 1)
+			mCursor.y = mTerminalHeight - 1;
+
+		mBuffer->SetDirty(true);
+	}
+}
+
+void MTerminalEmulator::SetTabstop()
+{
+	if (mCursor.x < mTerminalWidth)
+		mTabStops[mCursor.x] = true;
+}
+
+std::size_t MTerminalEmulator::Emulate(std::span<const uint8_t> inData)
+{
+	UpdateParserModes();
+
+	std::size_t result = mParser.Feed(inData);
+	if (result > 0)
+		++mVersion;
+
+	return result;
+}
+
+void MTerminalEmulator::MarkAttributes(MAttributeTable::MMarks &ioMarks) const
+{
+	mScreenBuffer.MarkAttributes(ioMarks);
+	mAlternateBuffer.MarkAttributes(ioMarks);
+	mStatusLineBuffer.MarkAttributes(ioMarks);
+}
+
+void MTerminalEmulator::UpdateSnapshot(MTerminalSnapshot &ioSnapshot, int32_t inTopLine, bool inHoveredLinks) const
+{
+	int32_t count = mTerminalHeight + (mDECSSDT > 0 ? 1 : 0);
+	bool sameLayout = ioSnapshot.width == mTerminalWidth and ioSnapshot.buffer == mBuffer and
+	                  ioSnapshot.lines.size() == static_cast<std::size_t>(count);
+	bool moved = ioSnapshot.topLine != inTopLine or not sameLayout;
+
+	// If the contents scrolled, by output or by scrolling the view, lines
+	// probably moved up by this many rows, verified for each line below.
+	int32_t shift = 0;
+	if (sameLayout)
+	{
+		int64_t scrolled = (mBuffer->GetScrollCount() - ioSnapshot.scrollCount) + (inTopLine - ioSnapshot.topLine);
+		if (scrolled > -mTerminalHeight and scrolled < mTerminalHeight)
+			shift = static_cast<int32_t>(scrolled);
+	}
+
+	std::vector<MLine> lines;
+	lines.reserve(count);
+
+	std::vector<uint64_t> versions(count, 0);
+
+	ioSnapshot.dirty.assign(count, true);
+	ioSnapshot.hoveredLinks.assign(count, { 0, 0 });
+
+	for (int32_t l = 0; l < count; ++l)
+	{
+		int32_t lineNr = inTopLine + l;
+
+		// lines on screen that were not touched since the last snapshot are taken over as is
+		if (l == mTerminalHeight)
+		{
+			if (not moved and mStatusLineBuffer.GetLineGeneration(0) <= ioSnapshot.statusLineGeneration)
+			{
+				lines.push_back(std::move(ioSnapshot.lines[l]));
+				ioSnapshot.dirty[l] = false;
+				versions[l] = ioSnapshot.lineVersions[l];
+			}
+			else
+				lines.push_back(mStatusLineBuffer.GetLine(0));
+			continue;
+		}
+
+		if (lineNr < 0 and -lineNr > mBuffer->BufferedLines())
+			lines.emplace_back(mTerminalWidth, kXTermColorNone, kXTermColorNone);
+		else if (lineNr >= 0 and not moved and mBuffer->GetLineGeneration(lineNr) <= ioSnapshot.generation)
+		{
+			// other lines may still need the old line for comparison if the contents moved
+			if (shift == 0)
+				lines.push_back(std::move(ioSnapshot.lines[l]));
+			else
+				lines.push_back(ioSnapshot.lines[l]);
+			ioSnapshot.dirty[l] = false;
+			versions[l] = ioSnapshot.lineVersions[l];
+		}
+		else
+			lines.push_back(mBuffer->GetLine(lineNr));
+
+		if (inHoveredLinks and (lineNr >= 0 or -lineNr <= mBuffer->BufferedLines()))
+			ioSnapshot.hoveredLinks[l] = mBuffer->GetHoveredLinkColumBounds(lineNr);
+
+		if (versions[l] != 0)
+			continue;
+
+		if (not moved and lineNr < 0 and ioSnapshot.lines[l] == lines.back())
+		{
+			ioSnapshot.dirty[l] = false;
+			versions[l] = ioSnapshot.lineVersions[l];
+		}
+		else if (shift != 0 and l + shift >= 0 and l + shift < mTerminalHeight and
+				 ioSnapshot.lines[l + shift] == lines.back())
+		{
+			// the same line, but on another row
+			versions[l] = ioSnapshot.lineVersions[l + shift];
+		}
+	}
+
+	std::swap(ioSnapshot.lines, lines);
+
+	for (int32_t l = 0; l < count; ++l)
+	{
+		if (versions[l] == 0)
+			versions[l] = ++ioSnapshot.lineVersion;
+	}
+
+	std::swap(ioSnapshot.lineVersions, versions);
+
+	ioSnapshot.shift = shift;
+	ioSnapshot.scrollCount = mBuffer->GetScrollCount();
+
+	ioSnapshot.version = mVersion;
+	ioSnapshot.buffer = mBuffer;
+	ioSnapshot.generation = mBuffer->GetGeneration();
+	ioSnapshot.statusLineGeneration = mStatusLineBuffer.GetGeneration();
+	ioSnapshot.width = mTerminalWidth;
+	ioSnapshot.height = mTerminalHeight;
+	ioSnapshot.topLine = inTopLine;
+	ioSnapshot.bufferedLines = mBuffer->BufferedLines();
+	ioSnapshot.bufferSerial = mBuffer->GetBufferSerial();
+
+	ioSnapshot.cursor = mCursor;
+	ioSnapshot.DECSCNM = mDECSCNM;
+	ioSnapshot.DECTCEM = mDECTCEM;
+	ioSnapshot.DECSSDT = mDECSSDT;
+
+	mBuffer->GetSelection(ioSnapshot.selLine1, ioSnapshot.selCol1, ioSnapshot.selLine2, ioSnapshot.selCol2,
+		ioSnapshot.blockSelection);
+}
+
+void MTerminalEmulator::SendCommand(std::string inData)
+{
+	if (mS8C1T)
+	{
+		ReplaceAll(inData, "\033D", "\204");  // IND
+		ReplaceAll(inData, "\033E", "\205");  // NEL
+		ReplaceAll(inData, "\033H", "\210");  // HTS
+		ReplaceAll(inData, "\033M", "\215");  // RI
+		ReplaceAll(inData, "\033N", "\216");  // SS2
+		ReplaceAll(inData, "\033O", "\217");  // SS3
+		ReplaceAll(inData, "\033P", "\220");  // DCS
+		ReplaceAll(inData, "\033[", "\233");  // CSI
+		ReplaceAll(inData, "\033\\", "\234"); // ST
+		ReplaceAll(inData, "\033]", "\235");  // OSC
+	}
+
+	if (mResponseCallback)
+		mResponseCallback(std::move(inData));
+}
+
+void MTerminalEmulator::AddHostRequest(MHostRequest::Kind inKind, std::string inText)
+{
+	mHostRequests.push_back({ inKind, std::move(inText) });
+
+	// reports should be sent in the order they were requested and
+	// a synchronized frame should be presented before the next is written
+	switch (inKind)
+	{
+		case MHostRequest::eReportWindowPosition:
+		case MHostRequest::eReportWindowSize:
+		case MHostRequest::eReportWindowTitle:
+		case MHostRequest::eReportTextColor:
+		case MHostRequest::eReportBackColor:
+		case MHostRequest::eSynchronizedOutputEnd:
+			mParser.Suspend();
+			break;
+
+		default:
+			break;
+	}
+}
+
+void MTerminalEmulator::UpdateParserModes()
+{
+	mParser.SetVT52Mode(not mDECANM);
+	mParser.SetC1Controls(mDECSCL >= 2 and mS8C1T);
+}
+
+std::size_t MTerminalEmulator::Print(std::span<const uint8_t> inText)
+{
+	unicode run[kMaxPrintableRun];
+	uint32_t n = 0;
+
+	auto p = inText.begin();
+
+	while (p != inText.end())
+	{
+		// process bytes. We try to keep this code UTF-8 savvy
+		uint8_t ch = *p++;
+
+		// an incomplete UTF-8 sequence interrupted by something else is dropped
+		if (mUTF8Needed > 0 and (ch & 0x0C0) != 0x080)
+			mUTF8Needed = 0;
+
+		unicode uc;
+
+		// if it is an ascii character, map it using GL
+		if (ch < 127) // GL
+		{
+			int set = mCursor.CSGL;
+			if (mCursor.SS != 0)
+				set = mCursor.SS;
+			uc = mCursor.charSetG[set][ch - 32];
+		}
+		else if (mDECNRCM) // GR, no ascii, see if NRC is in use
+		{
+			if (ch < 0x0a0)
+				continue;
+
+			int set = mCursor.CSGR;
+			if (mCursor.SS != 0)
+				set = mCursor.SS;
+			uc = mCursor.charSetG[set][ch - 32 - 128];
+		}
+		else if (mEncoding == kEncodingUTF8)
+		{
+			// sequences may be split over several reads, wait until
+			// the last byte has been received.
+			if (not DecodeUTF8(ch, uc))
+				continue;
+		}
+		else
+			uc = MUnicodeMapping::GetUnicode(kEncodingISO88591, ch);
+
+		// reset the single shift code
+		mCursor.SS = 0;
+
+		// With smooth scrolling each scroll should interrupt emulation,
+		// write characters one at a time in that case.
+		if (mDECSCLM)
+		{
+			WriteChar(uc);
+			if (mNextSmoothScroll.has_value())
+				break;
+			continue;
+		}
+
+		// Collect the run of printable characters and write them
+		// to the screen in one go.
+		run[n++] = uc;
+
+		if (n == kMaxPrintableRun)
+		{
+			WriteChars(run, n);
+			n = 0;
+		}
+	}
+
+	if (n > 0)
+		WriteChars(run, n);
+
+	return p - inText.begin();
+}
+
+void MTerminalEmulator::Execute(uint8_t inControl)
+{
+	mLastChar = 0;
+
+	switch (inControl)
+	{
+		case ENQ:
+		{
+			if (mResponseCallback)
+				mResponseCallback(mAnswerBack);
+			break;
+		}
+
+		case BEL:
+			AddHostRequest(MHostRequest::eBeep);
+			break;
+
+		case BS:
+			MoveCursor(kMoveLeft);
+			break;
+		case HT:
+			MoveCursor(kMoveHT);
+			break;
+		case LF:
+		case VT:
+		case FF:
+			MoveCursor(mLNM ? kMoveCRLF : kMoveLF);
+			break;
+		case CR:
+			MoveCursor(kMoveCR);
+			break;
+		case SO:
+			mCursor.CSGL = 1;
+			break;
+		case SI:
+			mCursor.CSGL = 0;
+			break;
+		case SUB:
+			WriteChar(0x00bf /*¿*/);
+			break;
+
+		case IND:
+			MoveCursor(kMoveIND);
+			break;
+		case NEL:
+			MoveCursor(kMoveCRLF);
+			break;
+		case HTS:
+			SetTabstop();
+			break;
+		case RI:
+			MoveCursor(kMoveRI);
+			break;
+		case SS2:
+			mCursor.SS = 2;
+			break;
+		case SS3:
+			mCursor.SS = 3;
+			break;
+
+		default: /* ignore */
+			break;
+	}
+}
+
+bool MTerminalEmulator::DecodeUTF8(uint8_t inByte, unicode &outChar)
+{
+	bool result = true;
+
+	if ((inByte & 0x0C0) == 0x080)
+	{
+		if (mUTF8Needed == 0) // stray continuation byte
+			outChar = 0xfffd;
+		else
+		{
+			mUTF8Char = (mUTF8Char << 6) | (inByte & 0x03F);
+			if (--mUTF8Needed > 0)
+				result = false;
+			else
+				outChar = mUTF8Char;
+		}
+	}
+	else
+	{
+		result = false;
+
+		if ((inByte & 0x0E0) == 0x0C0)
+		{
+			mUTF8Char = inByte & 0x01F;
+			mUTF8Needed = 1;
+		}
+		else if ((inByte & 0x0F0) == 0x0E0)
+		{
+			mUTF8Char = inByte & 0x00F;
+			mUTF8Needed = 2;
+		}
+		else if ((inByte & 0x0F8) == 0x0F0)
+		{
+			mUTF8Char = inByte & 0x007;
+			mUTF8Needed = 3;
+		}
+		else
+		{
+			outChar = 0xfffd;
+			result = true;
+		}
+	}
+
+	return result;
+}
+
+inline uint32_t MTerminalEmulator::GetParam(uint32_t inParamNr, uint32_t inDefault)
+{
+	uint32_t result = inDefault;
+	if (inParamNr < mArgs.size())
+		result = mArgs[inParamNr];
+	return result;
+}
+
+void MTerminalEmulator::GetRectParam(uint32_t inParamOffset, int32_t &outTop, int32_t &outLeft, int32_t &outBottom, int32_t &outRight)
+{
+	//	int32_t dx = mCursor.DECOM ? mMarginLeft : 0;
+	//	int32_t dy = mCursor.DECOM ? mMarginTop : 0;
+
+	outTop = GetParam(inParamOffset + 0, 1) - 1;
+	outLeft = GetParam(inParamOffset + 1, 1) - 1;
+	outBottom = GetParam(inParamOffset + 2, mTerminalHeight) - 1;
+	outRight = GetParam(inParamOffset + 3, mTerminalWidth) - 1;
+
+	if (mCursor.DECOM)
+	{
+		outTop += mMarginTop;
+		outLeft += mMarginLeft;
+		outBottom += mMarginTop;
+		outRight += mMarginLeft;
+
+		if (outTop < mMarginTop)
+			outTop = mMarginTop;
+		if (outLeft < mMarginLeft)
+			outLeft = mMarginLeft;
+		if (outBottom > mMarginBottom)
+			outBottom = mMarginBottom;
+		if (outRight > mMarginRight)
+			outRight = mMarginRight;
+	}
+}
+
+void MTerminalEmulator::VT52CursorAddress(uint32_t inLine, uint32_t inColumn)
+{
+	MoveCursorTo(inColumn, inLine);
+}
+
+void MTerminalEmulator::EscapeVT52(uint8_t inChar)
+{
+	switch (inChar)
+	{
+		case '<':
+			mDECANM = true;
+			mDECSCL = 1;
+			break;
+		case 'A':
+			MoveCursor(kMoveUp);
+			break;
+		case 'B':
+			MoveCursor(kMoveDown);
+			break;
+		case 'C':
+			MoveCursor(kMoveRight);
+			break;
+		case 'D':
+			MoveCursor(kMoveLeft);
+			break;
+		case 'H':
+			MoveCursorTo(0, 0);
+			break;
+		case 'I':
+			MoveCursor(kMoveRI);
+			break;
+		case '=':
+			mDECNMK = true;
+			break;
+		case '>':
+			mDECNMK = false;
+			break;
+		case 'F':
+			mCursor.CSGL = 1;
+			break;
+		case 'G':
+			mCursor.CSGL = 0;
+			break;
+		case 'K':
+			EraseInLine(0);
+			break;
+		case 'J':
+			EraseInDisplay(0);
+			break;
+		case 'W':
+		case 'X':
+		case 'V':
+		case ']':  /* ignore */
+			break; // printing controls
+		case 'Z':
+			SendCommand("\033/Z");
+			break;
+	}
+}
+
+void MTerminalEmulator::EscDispatch(std::string_view inIntermediates, uint8_t inFinal)
+{
+	if (not mDECANM)
+		EscapeVT52(inFinal);
+	else if (inIntermediates.empty())
+		EscapeStart(inFinal);
+	else if (inIntermediates.length() == 1)
+	{
+		switch (inIntermediates.front())
+		{
+			case '(':
+				SelectCharSet(0, 94, inFinal);
+				break;
+			case ')':
+				SelectCharSet(1, 94, inFinal);
+				break;
+			case '*':
+				SelectCharSet(2, 94, inFinal);
+				break;
+			case '+':
+				SelectCharSet(3, 94, inFinal);
+				break;
+
+			// VT320
+			case '-':
+				SelectCharSet(1, 96, inFinal);
+				break;
+			case '.':
+				SelectCharSet(2, 96, inFinal);
+				break;
+			case '/':
+				SelectCharSet(3, 96, inFinal);
+				break;
+
+			// xterm
+			case '%':
+				SelectCharSet(4, 94, inFinal);
+				break;
+
+			case '#':
+				SelectDouble(inFinal);
+				break;
+			case ' ':
+				SelectControlTransmission(inFinal);
+				break;
+		}
+	}
+
+	UpdateParserModes();
+}
+
+void MTerminalEmulator::EscapeStart(uint8_t inChar)
+{
+	switch (inChar)
+	{
+		// VT100 escape codes
+		case '<':
+			mDECANM = true;
+			break;
+		case '=':
+			mDECNMK = true; /* DECKNAM */
+			break;
+		case '>':
+			mDECNMK = false; /* DECKPNM */
+			break;
+		case 'D':
+			MoveCursor(kMoveIND);
+			break;
+		case 'E':
+			MoveCursor(kMoveCRLF);
+			break;
+		case 'H':
+			SetTabstop();
+			break;
+		case 'M':
+			MoveCursor(kMoveRI);
+			break;
+		case 'N':
+			mCursor.SS = 2;
+			break;
+		case 'O':
+			mCursor.SS = 3;
+			break;
+		case '7':
+			SaveCursor();
+			break;
+		case '8':
+			RestoreCursor();
+			break;
+		case 'Z':
+			SendCommand(kVT420Attributes);
+			break;
+		case 'c':
+			Reset();
+			break;
+
+		// VT220 escape codes
+		case '~':
+			mCursor.CSGR = 1;
+			break;
+		case 'n':
+			mCursor.CSGL = 2;
+			break;
+		case '}':
+			mCursor.CSGR = 2;
+			break;
+		case 'o':
+			mCursor.CSGL = 3;
+			break;
+		case '|':
+			mCursor.CSGR = 3;
+			break;
+
+		// VT320 escape codes
+		case '6':
+			MoveCursor(kMoveBI);
+			break;
+		case '9':
+			MoveCursor(kMoveFI);
+			break;
+
+		// xterm support
+		case 'V':
+			mCursor.style.SetFlag(kProtected);
+			break;
+		case 'W':
+			mCursor.style.ClearFlag(kProtected);
+			break;
+
+		// unimplemented for now
+		case 'l': /* Memory Lock */
+			break;
+		case 'm': /* Memory Unlock */
+			break;
+
+		default: /* ignore */
+			break;
+	}
+}
+
+void MTerminalEmulator::CsiDispatch(std::span<const uint32_t> inParams, std::string_view inIntermediates, uint8_t inFinal)
+{
+	mArgs.assign(inParams.begin(), inParams.end());
+
+	// the command code is the private marker, the intermediates and
+	// the final byte packed into one integer
+	uint32_t cmd = 0;
+	for (char ch : inIntermediates)
+		cmd = cmd << 8 | uint8_t(ch);
+	cmd = cmd << 8 | inFinal;
+
+	if (mDECSCL > 1)
+		ProcessCSILevel4(cmd);
+	else
+		ProcessCSILevel1(cmd);
+
+	UpdateParserModes();
+}
+
+void MTerminalEmulator::ProcessCSILevel1(uint32_t inCmd)
+{
+	uint32_t n = GetParam(0, 1);
+	if (n == 0)
+		n = 1;
+
+	switch (inCmd)
+	{
+		// CBT -- Cursor Backward Tabulation
+		case eCBT:
+			while (n-- > 0)
+				MoveCursor(kMoveCBT);
+			break;
+		// CHA -- Cursor Horizontal Absolute
+		case eCHA:
+			MoveCursorTo(GetParam(0, 1) - 1, mCursor.y);
+			break;
+		// CHT -- Cursor Horizontal Forward Tab
+		case eCHT:
+			while (n-- > 0)
+				MoveCursor(kMoveHT);
+			break;
+		// CNL -- Cursor Next Line
+		case eCNL:
+			while (n-- > 0)
+			{
+				MoveCursor(kMoveCRLF);
+			}
+			break;
+		// CPL -- Cursor Previous Line
+		case eCPL:
+			while (n-- > 0)
+			{
+				MoveCursor(kMoveCR);
+				MoveCursor(kMoveUp);
+			}
+			break;
+		// CUB -- Cursor Backward
+		case eCUB:
+			while (n-- > 0)
+				MoveCursor(kMoveLeft);
+			break;
+		// CUD -- Cursor Down
+		case eCUD:
+			while (n-- > 0)
+				MoveCursor(kMoveDown);
+			break;
+		// CUF -- Cursor Forward
+		case eCUF:
+			while (n-- > 0)
+				MoveCursor(kMoveRight);
+			break;
+		// CUP -- Cursor Position
+		case eCUP:
+			MoveCursorTo(GetParam(1, 1) - 1, GetParam(0, 1) - 1);
+			break;
+		// CUU -- Cursor Up
+		case eCUU:
+			while (n-- > 0)
+				MoveCursor(kMoveUp);
+			break;
+		// DA1 -- Response to Device Attributes
+		case eDA1:
+			SendCommand(kVT420Attributes);
+			break;
+		// DA2 -- Secondary Device Attributes
+		case eDA2:
+			SendCommand("\033[>64;278;1c"); /* compatible with xterm version 278? `*/
+			break;
+		// DA3 -- Tertiary Device Attributes
+		case eDA3:
+			SendCommand("\033P!|00000000\033\\");
+			break;
+
+		// DCH -- Delete Character
+		case eDCH:
+			if (not CursorIsInMargins())
+				break;
+			while (n-- > 0)
+				mBuffer->DeleteCharacter(mCursor.y, mCursor.x, mMarginRight + 1);
+			break;
+
+		// DECCOLM -- Set columns per page
+		case eDECCOLM:
+		{
+			int w = GetParam(0, 0);
+			if (w == 0)
+				w = 80;
+			if (w > 10 and w < 1000) // sensible values please
+				ResizeTerminal(w, mTerminalHeight);
+			mDECVSSM = false;
+			mMarginLeft = 0;
+			mMarginRight = mTerminalWidth - 1;
+			// TODO clear status line if host writable
+			break;
+		}
+
+		// DL -- Delete Line(s)
+		case eDL:
+			if (not CursorIsInMargins())
+				break;
+			while (n-- > 0)
+				mBuffer->ScrollForward(mCursor.y, mMarginBottom, mMarginLeft, mMarginRight);
+			break;
+
+		// DSR1 -- Device Status Report ANSI
+		case eDSR1:
+			switch (mArgs[0])
+			{
+				case 5:
+					SendCommand("\033[0n");
+					break; // terminal OK
+				case 6:
+					SendCommand(MFormat("\033[%d;%dR", mCursor.y + 1, mCursor.x + 1));
+					break;
+				case 15:
+					SendCommand("\033[?13n");
+					break; // we have no printer
+				case 25:
+					SendCommand(MFormat("\033[?2%dn", mPFK != nullptr and mPFK->locked));
+					break;
+				// TODO: Find out the keyboard layout
+				case 26:
+					SendCommand("\033[?27;0n");
+					break; // report an unknown keyboard for now
+			}
+			break;
+		// DSR2 -- Device Status Report DEC
+		case eDSR2:
+			switch (GetParam(0, 0))
+			{
+				case 6:
+					SendCommand(MFormat("\033[?%d;%d;1R", mCursor.y + 1, mCursor.x + 1));
+					break;
+				case 15:
+					SendCommand("\033[?11n");
+					break;
+				case 25:
+					SendCommand(MFormat("\033[?2%dn", mPFK != nullptr and mPFK->locked));
+					break;
+				case 26:
+					SendCommand("\033[?27;1n");
+					break; // report a US keyboard for now
+				case 53:
+					SendCommand("\033[?50n");
+					break; // No locator
+			}
+			break;
+		// ED -- Erase in Display
+		case eED:
+			EraseInDisplay(GetParam(0, 0), false);
+			break;
+		// EL -- Erase in Line
+		case eEL:
+			EraseInLine(GetParam(0, 0), false);
+			break;
+		// HPA -- Horizontal Position Absolute
+		case eHPA:
+			MoveCursorTo(GetParam(0, 1) - 1, mCursor.y);
+			break;
+		// HPR -- Horizontal Position Relative
+		case eHPR:
+			while (n-- > 0)
+				MoveCursor(kMoveRight);
+			break;
+		// HVP -- Horizontal/Vertical Position
+		case eHVP:
+			MoveCursorTo(GetParam(1, 1) - 1, GetParam(0, 1) - 1);
+			break;
+		// IL -- Insert Line
+		case eIL:
+			if (not CursorIsInMargins())
+				break;
+			while (n-- > 0)
+				mBuffer->ScrollBackward(mCursor.y, mMarginBottom, mMarginLeft, mMarginRight);
+			break;
+			//	case eMC:
+			//		break;
+			// NP -- Next Page
+		case eNP: /* unimplemented */
+			break;
+		// PP -- Preceding Page
+		case ePP: /* unimplemented */
+			break;
+		// PPA -- Page Position Absolute
+		case ePPA: /* unimplemented */
+			break;
+		// PPB -- Page Position Backwards
+		case ePPB: /* unimplemented */
+			break;
+		// PPR -- Page Position Relative
+		case ePPR: /* unimplemented */
+			break;
+		// SCORC -- Restore Saved Cursor Position (SCO Console)
+		case eSCORC:
+			RestoreCursor();
+			break;
+		// case eSCOSC:
+		//	break;
+		//  SD -- Pan Up
+		case eSD:
+			while (n-- > 0)
+				ScrollBackward();
+			break;
+		// SGR -- Select Graphic Rendition
+		case eSGR:
+			for (std::size_t i = 0; i < mArgs.size(); ++i)
+			{
+				auto a = mArgs[i];
+
+				switch (a)
+				{
+					case 0:
+						mCursor.style = MStyle();
+						mBuffer->SetColors(kXTermColorNone, kXTermColorNone);
+						break;
+					case 1:
+						mCursor.style.SetFlag(kStyleBold);
+						break;
+					case 4:
+						mCursor.style.SetFlag(kStyleUnderline);
+						break;
+					case 5:
+						mCursor.style.SetFlag(kStyleBlink);
+						break;
+					case 7:
+						mCursor.style.SetFlag(kStyleInverse);
+						break;
+					case 8:
+						mCursor.style.SetFlag(kStyleInvisible);
+						break;
+					case 22:
+						mCursor.style.ClearFlag(kStyleBold);
+						break;
+					case 24:
+						mCursor.style.ClearFlag(kStyleUnderline);
+						break;
+					case 25:
+						mCursor.style.ClearFlag(kStyleBlink);
+						break;
+					case 27:
+						mCursor.style.ClearFlag(kStyleInverse);
+						break;
+
+					// vt300
+					case 28:
+						mCursor.style.ClearFlag(kStyleInvisible);
+						break;
+
+					// xterm colors
+					case 30:
+						mCursor.style.SetForeColor(kXTermColorRegularBack);
+						break;
+					case 31:
+						mCursor.style.SetForeColor(kXTermColorRed);
+						break;
+					case 32:
+						mCursor.style.SetForeColor(kXTermColorGreen);
+						break;
+					case 33:
+						mCursor.style.SetForeColor(kXTermColorYellow);
+						break;
+					case 34:
+						mCursor.style.SetForeColor(kXTermColorBlue);
+						break;
+					case 35:
+						mCursor.style.SetForeColor(kXTermColorMagenta);
+						break;
+					case 36:
+						mCursor.style.SetForeColor(kXTermColorCyan);
+						break;
+					case 37:
+						mCursor.style.SetForeColor(kXTermColorNone);
+						break;
+					case 39:
+						mCursor.style.SetForeColor(kXTermColorNone);
+						break;
+
+					case 40:
+						mCursor.style.SetBackColor(kXTermColorNone);
+						break;
+					case 41:
+						mCursor.style.SetBackColor(kXTermColorRed);
+						break;
+					case 42:
+						mCursor.style.SetBackColor(kXTermColorGreen);
+						break;
+					case 43:
+						mCursor.style.SetBackColor(kXTermColorYellow);
+						break;
+					case 44:
+						mCursor.style.SetBackColor(kXTermColorBlue);
+						break;
+					case 45:
+						mCursor.style.SetBackColor(kXTermColorMagenta);
+						break;
+					case 46:
+						mCursor.style.SetBackColor(kXTermColorCyan);
+						break;
+					case 47:
+						mCursor.style.SetBackColor(kXTermColorRegularText);
+						break;
+					case 49:
+						mCursor.style.SetBackColor(kXTermColorNone);
+						break;
+
+					case 90:
+						mCursor.style.SetForeColor(kXTermColorBrightBlack);
+						break;
+					case 91:
+						mCursor.style.SetForeColor(kXTermColorBrightRed);
+						break;
+					case 92:
+						mCursor.style.SetForeColor(kXTermColorBrightGreen);
+						break;
+					case 93:
+						mCursor.style.SetForeColor(kXTermColorBrightYellow);
+						break;
+					case 94:
+						mCursor.style.SetForeColor(kXTermColorBrightBlue);
+						break;
+					case 95:
+						mCursor.style.SetForeColor(kXTermColorBrightMagenta);
+						break;
+					case 96:
+						mCursor.style.SetForeColor(kXTermColorBrightCyan);
+						break;
+					case 97:
+						mCursor.style.SetForeColor(kXTermColorBrightWhite);
+						break;
+
+					case 100:
+						mCursor.style.SetBackColor(kXTermColorBrightBlack);
+						break;
+					case 101:
+						mCursor.style.SetBackColor(kXTermColorBrightRed);
+						break;
+					case 102:
+						mCursor.style.SetBackColor(kXTermColorBrightGreen);
+						break;
+					case 103:
+						mCursor.style.SetBackColor(kXTermColorBrightYellow);
+						break;
+					case 104:
+						mCursor.style.SetBackColor(kXTermColorBrightBlue);
+						break;
+					case 105:
+						mCursor.style.SetBackColor(kXTermColorBrightMagenta);
+						break;
+					case 106:
+						mCursor.style.SetBackColor(kXTermColorBrightCyan);
+						break;
+					case 107:
+						mCursor.style.SetBackColor(kXTermColorBrightWhite);
+						break;
+
+					// color support, indexed and 24 bit RGB
+					case 38:
+					case 48:
+					case 58:
+					{
+						if (i + 1 >= mArgs.size())
+							break;
+
+						switch (mArgs[++i])
+						{
+							case 5:
+							{
+								if (i + 1 >= mArgs.size())
+									break;
+
+								auto colorIndex = static_cast<MXTermColor>(static_cast<uint8_t>(mArgs[++i]));
+								if (a == 38)
+									mCursor.style.SetForeColor(colorIndex);
+								else if (a == 48)
+									mCursor.style.SetBackColor(colorIndex);
+								else
+									mCursor.style.SetUnderlineColor(colorIndex);
+								break;
+							}
+
+							case 2:
+							{
+								if (i + 3 >= mArgs.size())
+								{
+									i = mArgs.size();
+									break;
+								}
+
+								uint8_t red = static_cast<uint8_t>(mArgs[i + 1]);
+								uint8_t green = static_cast<uint8_t>(mArgs[i + 2]);
+								uint8_t blue = static_cast<uint8_t>(mArgs[i + 3]);
+								i += 3;
+
+								if (a == 38)
+									mCursor.style.SetForeColorRGB(red, green, blue);
+								else if (a == 48)
+									mCursor.style.SetBackColorRGB(red, green, blue);
+								else
+									mCursor.style.SetUnderlineColorRGB(red, green, blue);
+								break;
+							}
+						}
+
+						break;
+					}
+
+					case 59:
+						mCursor.style.SetUnderlineColor(kXTermColorNone);
+						break;
+				}
+
+				if ((a >= 30 and a <= 49) or (a >= 90 and a <= 107))
+					mBuffer->SetColors(mCursor.style.GetForeColorValue(), mCursor.style.GetBackColorValue());
+			}
+			break;
+		// SU -- Pan Down
+		case eSU:
+			while (n-- > 0)
+				ScrollForward();
+			break;
+		// TBC -- Clear Tabs
+		case eTBC:
+			switch (GetParam(0, 0))
+			{
+				case 0:
+					if (mCursor.x < mTerminalWidth)
+						mTabStops[mCursor.x] = false;
+					break;
+				case 3:
+					fill(mTabStops.begin(), mTabStops.end(), false);
+					break;
+			}
+			break;
+		// VPA -- Vertical Line Position Absolute
+		case eVPA:
+			MoveCursorTo(mCursor.x, GetParam(0, 1) - 1);
+			break;
+		// VPR -- Vertical Position Relative
+		case eVPR:
+			MoveCursorTo(mCursor.x, mCursor.y + GetParam(0, 1));
+			break;
+
+		// SM_ANSI -- Set Mode ANSI
+		case eSM_ANSI:
+			for (uint32_t a : mArgs)
+				SetResetMode(a, true, true);
+			break;
+		// RM_ANSI -- Reset Mode ANSI
+		case eRM_ANSI:
+			for (uint32_t a : mArgs)
+				SetResetMode(a, true, false);
+			break;
+		// SM_DEC -- Set Mode DEC
+		case eSM_DEC:
+			for (uint32_t a : mArgs)
+				SetResetMode(a, false, true);
+			break;
+		// RM_DEC -- Reset Mode DEC
+		case eRM_DEC:
+			for (uint32_t a : mArgs)
+				SetResetMode(a, false, false);
+			break;
+		// SAVEMODE -- Save DEC Private Mode Values
+		case eSAVEMODE:
+			for (int a : mArgs)
+				mSavedPrivateMode[a] = GetMode(a, false);
+			break;
+		// RESTMODE -- Restore DEC Private Mode Values
+		case eRESTMODE:
+			for (int a : mArgs)
+				SetResetMode(a, false, mSavedPrivateMode[a]);
+			break;
+		// DECREQTPARM -- no comment
+		case eDECREQTPARM:
+			SendCommand((MFormat("\033[%d;1;1;128;128;1;0x", mArgs[0] + 2)));
+			break;
+		// XTERMEMK -- Reset XTerm modify keys
+		case eXTERMEMK:
+			//				switch (GetParam(0, 0))
+			//				{
+			//					case 1:	mModifyCursorKeys = GetParam(1, 0); break;
+			//					case 1:	mModifyFunctionKeys = GetParam(1, 0); break;
+			//					case 1:	mModifyOtherKeys = GetParam(1, 0); break;
+			//				}
+			break;
+		// XTERMDMK -- Set XTerm modify keys
+		case eXTERMDMK:
+			//				switch (GetParam(0, 0))
+			//				{
+			//					case 1:	mModifyCursorKeys = -1; break;
+			//					case 1:	mModifyFunctionKeys = -1; break;
+			//					case 1:	mModifyOtherKeys = -1; break;
+			//				}
+			break;
+		case eXTERMDMKR: // request modifyCursorKeyState
+			break;
+
+		// REP -- Repeat preceding character
+		case eREP:
+			if (mLastChar != 0)
+			{
+				while (n-- > 0)
+					WriteChar(mLastChar);
+			}
+			break;
+
+		// SL -- Shift Left
+		case eSL:
+			while (n-- > 0)
+				MoveCursor(kMoveSL);
+			break;
+		// SR -- Shift Right
+		case eSR:
+			while (n-- > 0)
+				MoveCursor(kMoveSR);
+			break;
+
+		// DECSCL -- Select Conformance Level
+		case eDECSCL:
+			if (mArgs[0] >= 61 and mArgs[0] <= 65)
+			{
+				mDECSCL = mArgs[0] - 60;
+
+				if (mDECSCL <= 1)
+					mS8C1T = false;
+				else
+				{
+					if (mArgs.size() == 1 or mArgs[1] == 0 or mArgs[1] == 2)
+						mS8C1T = true;
+					else if (mArgs[1] == 1)
+						mS8C1T = false;
+				}
+			}
+			break;
+
+		case eDECELR:
+			PRINT(("DECELR iets met de muis doen?"));
+			// hmmmm
+			break;
+
+		default:
+			PRINT(("Unhandled CSI level 1 command: %x", inCmd));
+			break;
+	}
+}
+
+void MTerminalEmulator::ProcessCSILevel4(uint32_t inCmd)
+{
+	uint32_t n = GetParam(0, 1);
+	if (n == 0)
+		n = 1;
+
+	switch (inCmd)
+	{
+		// ECH -- Erase character
+		case eECH:
+			mBuffer->EraseCharacter(mCursor.y, mCursor.x, n);
+			break;
+
+		// ICH -- Insert character
+		case eICH:
+			if (not CursorIsInMargins())
+				break;
+			while (n-- > 0)
+				mBuffer->InsertCharacter(mCursor.y, mCursor.x, mMarginRight + 1);
+			break;
+
+		// DECDC -- Delete column
+		case eDECDC:
+			if (not CursorIsInMargins())
+				break;
+			while (n-- > 0)
+			{
+				for (int line = mMarginTop; line <= mMarginBottom; ++line)
+					mBuffer->DeleteCharacter(line, mCursor.x, mMarginRight + 1);
+			}
+			break;
+
+		// DECIC -- Insert column
+		case eDECIC:
+			if (not CursorIsInMargins())
+				break;
+			while (n-- > 0)
+			{
+				for (int line = mMarginTop; line <= mMarginBottom; ++line)
+					mBuffer->InsertCharacter(line, mCursor.x, mMarginRight + 1);
+			}
+			break;
+
+		// DECCARA -- Change attributes in rectangular area
+		case eDECCARA:
+		{
+			int32_t t, l, b, r;
+			GetRectParam(0, t, l, b, r);
+
+			for (int a : mArgs)
+			{
+				mBuffer->ForeachInRectangle(t, l, b, r, [a](MChar &inChar, int32_t inLine, int32_t inColumn)
+					{
+					switch (a)
+					{
+						case 0:
+							inChar = MStyle();
+							break;
+						case 1:
+							inChar |= kStyleBold;
+							break;
+						case 4:
+							inChar |= kStyleUnderline;
+							break;
+						case 5:
+							inChar |= kStyleBlink;
+							break;
+						case 7:
+							inChar |= kStyleInverse;
+							break;
+						case 21:
+							inChar &= ~kStyleBold;
+							break;
+						case 24:
+							inChar &= ~kStyleUnderline;
+							break;
+						case 25:
+							inChar &= ~kStyleBlink;
+							break;
+						case 27:
+							inChar &= ~kStyleInverse;
+							break;
+					} });
+			}
+			break;
+		}
+
+		// DECCRA -- Copy rectangular area
+		case eDECCRA:
+		{
+			int ps = GetParam(4, 1);
+			int pd = GetParam(7, 1);
+			if (ps != 1 or pd != 1)
+				break;
+
+			int32_t t, l, b, r;
+			GetRectParam(0, t, l, b, r);
+
+			int32_t w = r - l, h = b - t;
+			int32_t dt = GetParam(5, 1) - 1;
+			if (mCursor.DECOM)
+				dt += mMarginTop;
+			int32_t dl = GetParam(6, 1) - 1;
+			if (mCursor.DECOM)
+				dl += mMarginLeft;
+
+			if (dt + h > mTerminalHeight)
+			{
+				h = mTerminalHeight - dt;
+				b = t + h;
+			}
+
+			if (dl + w > mTerminalWidth)
+			{
+				w = mTerminalWidth - dl;
+				r = l + w;
+			}
+
+			if (w == 0 or h == 0)
+				break;
+
+			std::vector<MChar> buffer(mTerminalWidth * mTerminalHeight);
+			uint32_t i = 0;
+			mBuffer->ForeachInRectangle(t, l, b, r,
+				[&i, &buffer](MChar &inChar, int32_t inLine, int32_t inColumn)
+				{
+					buffer[i++] = inChar;
+				});
+
+			assert(i <= buffer.size());
+			i = 0;
+
+			mBuffer->ForeachInRectangle(dt, dl, dt + h, dl + w,
+				[&i, &buffer](MChar &inChar, int32_t inLine, int32_t inColumn)
+				{
+					inChar = buffer[i++];
+				});
+			break;
+		}
+
+		// DECELF -- Enable local functions
+		case eDECELF: /* unimplemented */
+			break;
+
+		// DECERA -- Erase rectangular area
+		case eDECERA:
+		{
+			int32_t t, l, b, r;
+			GetRectParam(0, t, l, b, r);
+
+			MChar ch(' ', mCursor.style);
+			mBuffer->ForeachInRectangle(t, l, b, r,
+				[ch](MChar &inChar, int32_t inLine, int32_t inColumn)
+				{
+					inChar = ch;
+				});
+			break;
+		}
+		// DECFRA -- Fill rectangular area
+		case eDECFRA:
+		{
+			int32_t t, l, b, r;
+			GetRectParam(1, t, l, b, r);
+
+			MChar ch(GetParam(0, ' '), mCursor.style);
+			mBuffer->ForeachInRectangle(t, l, b, r,
+				[ch](MChar &inChar, int32_t inLine, int32_t inColumn)
+				{
+					inChar = ch;
+				});
+			break;
+		}
+
+		// DECINVM -- Invoke stored macro
+		case eDECINVM: /* unimplemented */
+			break;
+		// DECLFKC -- Local function key control
+		case eDECLFKC: /* unimplemented */
+			break;
+		// DECMSR -- Macro Space Report
+		case eDECMSR: /* unimplemented */
+			break;
+
+		// DECRARA -- Reverse attributes in rectangular area
+		case eDECRARA:
+		{
+			int32_t t, l, b, r;
+			GetRectParam(0, t, l, b, r);
+
+			for (uint32_t ai = 4; ai < mArgs.size(); ++ai)
+			{
+				uint32_t flag{};
+				switch (mArgs[ai])
+				{
+					case 0:
+						flag = kStyleBold | kStyleUnderline | kStyleBlink | kStyleInverse;
+						break;
+					case 1:
+						flag = kStyleBold;
+						break;
+					case 4:
+						flag = kStyleUnderline;
+						break;
+					case 5:
+						flag = kStyleBlink;
+						break;
+					case 7:
+						flag = kStyleInverse;
+						break;
+				}
+
+				mBuffer->ForeachInRectangle(t, l, b, r,
+					[flag](MChar &inChar, int32_t inLine, int32_t inColumn)
+					{
+						inChar.ReverseFlag(MCharStyle(flag));
+					});
+			}
+			break;
+		}
+
+		// DECRPM -- Report mode
+		case eDECRPM: /* unimplemented */
+			break;
+		// DECRQCRA -- Request checksum of rectangular area
+		case eDECRQCRA: /* unimplemented */
+			break;
+		// DECRQDE -- Request displayed extent
+		case eDECRQDE:
+			SendCommand(MFormat("\033[%d;%d;1;1;1\"w", mTerminalHeight, mTerminalWidth));
+			break;
+
+		// DECRQMANSI -- Request mode ANSI
+		case eDECRQMANSI:
+		{
+			int p = GetParam(0, 0);
+			SendCommand(MFormat("\033[%d;%d$y", p, GetMode(p, true) ? 1 : 2));
+			break;
+		}
+		// DECRQMDEC -- Request mode DEC Private
+		case eDECRQMDEC:
+		{
+			int p = GetParam(0, 0);
+			SendCommand(MFormat("\033[?%d;%d$y", p, GetMode(p, false) ? 1 : 2));
+			break;
+		}
+		// DECRQPSR -- Request presentation state
+		case eDECRQPSR:
+			switch (GetParam(0, 0))
+			{
+				case 1: /* DECCIR */
+				{
+					MStyle st = mCursor.style;
+					SendCommand(MFormat("\033P1$u%d;%d;%d;%c;%c;%c;%d;%d;%c;%c%c%c%c\033\\",
+						mCursor.y + 1,
+						mCursor.x + 1,
+						1,
+						char(0x40 + (st & kStyleInverse ? 8 : 0) + (st & kStyleBlink ? 4 : 0) + (st & kStyleUnderline ? 2 : 0) + (st & kStyleBold ? 1 : 0)),
+						char(0x40 + (st & kUnerasable ? 1 : 0)),
+						char(0x40 + (mCursor.DECAWM ? 8 : 0) + (mCursor.SS == 3 ? 4 : 0) + (mCursor.SS == 2 ? 2 : 0) + (mCursor.DECOM ? 1 : 0)),
+						mCursor.CSGL,
+						mCursor.CSGR,
+						char(0x5f), // pffft, not sure about this one... FIXME
+						mCursor.charSetGSel[0],
+						mCursor.charSetGSel[1],
+						mCursor.charSetGSel[2],
+						mCursor.charSetGSel[3]));
+					break;
+				}
+				case 2: /* DECTABSR */
+				{
+					std::vector<std::string> ts;
+					for (int i = 0; i < mTerminalWidth; ++i)
+						if (mTabStops[i])
+							ts.push_back(std::to_string(i + 1));
+					SendCommand(kDCS + "2$u" + Join(ts, "/") + "\033\\");
+					break;
+				}
+			}
+			break;
+		// DECRQUPSS -- Request User-Preferred Supplemental Set
+		case eDECRQUPSS:
+			SendCommand("\033P0!u%5\033\\");
+			break;
+		// DECSACE -- Select attribute change extent
+		case eDECSACE:
+			mDECSACE = (GetParam(0, 1) == 2);
+			break;
+		// DECSASD -- Select active status display
+		case eDECSASD:
+			if (GetParam(0, 0))
+			{
+				if (not mDECSASD)
+				{
+					mSavedSL = mCursor;
+					ResetCursor();
+					mDECSASD = true;
+				}
+			}
+			else
+			{
+				if (mDECSASD)
+				{
+					mCursor = mSavedSL;
+					mDECSASD = false;
+				}
+			}
+			break;
+		// DECSCA -- Select character attribute
+		case eDECSCA:
+			switch (GetParam(0, 0))
+			{
+				case 0:
+				case 2:
+					mCursor.style.ClearFlag(kUnerasable);
+					break;
+				case 1:
+					mCursor.style.SetFlag(kUnerasable);
+					break;
+			}
+			break;
+
+		// DECSED -- Selective erase in display
+		case eDECSED:
+			EraseInDisplay(GetParam(0, 0), true);
+			break;
+			break;
+		// DECSEL -- Selective erase in line
+		case eDECSEL:
+			EraseInLine(GetParam(0, 0), true);
+			break;
+		// DECSERA -- Selective erase rectangular area
+		case eDECSERA:
+		{
+			int32_t t, l, b, r;
+			GetRectParam(0, t, l, b, r);
+
+			mBuffer->ForeachInRectangle(t, l, b, r,
+				[](MChar &inChar, int32_t inLine, int32_t inColumn)
+				{
+					if (not(inChar & kUnerasable))
+						inChar = ' ';
+				});
+			break;
+		}
+		// DECSLPP -- Set Lines Per Page
+		case eDECSLPP:
+		{
+			switch (GetParam(0, 0))
+			{
+				case 11:
+					SendCommand("\033[1t");
+					break;
+				case 13:
+					AddHostRequest(MHostRequest::eReportWindowPosition);
+					break;
+				case 14:
+					AddHostRequest(MHostRequest::eReportWindowSize);
+					break;
+				case 18:
+					SendCommand(MFormat("\033[8;%d;%dt", mTerminalWidth, mTerminalHeight));
+					break;
+				case 20:
+					SendCommand("\033]L\033\\");
+					break;
+				case 21:
+					AddHostRequest(MHostRequest::eReportWindowTitle);
+					break;
+				default:
+				{
+					int h = GetParam(1, 24);
+					if (h >= 4 and h < 240)
+						ResizeTerminal(mTerminalWidth, h);
+					break;
+				}
+			}
+			break;
+		}
+		// DECSLRM -- Set left and right margins
+		case eDECSLRM:
+			//			if (mArgs.size() == 1 and mArgs[0] == 0)
+			//				SaveCursor();
+			//			else
+			if (mDECVSSM)
+			{
+				int32_t left = GetParam(0, 1);
+				if (left < 1)
+					left = 1;
+				int32_t right = GetParam(1, mTerminalWidth);
+				if (right > mTerminalWidth)
+					right = mTerminalWidth;
+				if (right < left + 1)
+					right = left + 1;
+
+				mMarginLeft = left - 1;
+				mMarginRight = right - 1;
+				MoveCursorTo(0, 0);
+			}
+			break;
+		// DECSMKR -- Select modifier key reporting
+		case eDECSMKR: /* unimplemented */
+			break;
+		// DECSNLS -- Select number of lines per screen
+		case eDECSNLS:
+			if (n >= 24 and n < 250)
+				ResizeTerminal(mTerminalWidth, n);
+			break;
+		// DECSR -- Secure reset
+		case eDECSR: /* unimplemented */
+			break;
+		// DECSSDT -- Select status display type
+		case eDECSSDT:
+			mDECSSDT = GetParam(0, 1);
+			ResizeTerminal(mTerminalWidth, mTerminalHeight);
+			break;
+		// DECSTBM -- Set Top and Bottom Margin
+		case eDECSTBM:
+		{
+			int32_t top = GetParam(0, 1);
+			if (top < 1)
+				top = 1;
+			int32_t bottom = GetParam(1, mTerminalHeight);
+			if (bottom > mTerminalHeight)
+				bottom = mTerminalHeight;
+			if (bottom < top + 1)
+				bottom = top + 1;
+
+			mMarginTop = top - 1;
+			mMarginBottom = bottom - 1;
+
+			MoveCursorTo(0, 0);
+			break;
+		}
+		// DECSTR -- Soft terminal reset
+		case eDECSTR:
+			SoftReset();
+			break;
+
+		/*
+			XTerm / DEC VT520
+		*/
+
+		// DECSCUSR -- Set Cursor Style
+		case eDECSCUSR:
+			switch (GetParam(0, 1))
+			{
+				case 1:
+					mCursor.block = true;
+					mCursor.blink = true;
+					break;
+				case 2:
+					mCursor.block = true;
+					mCursor.blink = false;
+					break;
+				case 3:
+					mCursor.block = false;
+					mCursor.blink = true;
+					break;
+				case 4:
+					mCursor.block = false;
+					mCursor.blink = false;
+					break;
+			}
+			mBuffer->SetDirty(true);
+			break;
+		// DECSWBV -- Set Warning Bell Volume
+		case eDECSWBV: /* unimplemented */
+			break;
+		// DECSMBV -- Set Margin Bell Volume
+		case eDECSMBV: /* unimplemented */
+			break;
+
+		default:
+			ProcessCSILevel1(inCmd);
+			break;
+	}
+}
+
+void MTerminalEmulator::SelectCharSet(uint32_t inCharSet, uint32_t inCharCount, uint8_t inChar)
+{
+	if (inCharSet == 4)
+	{
+		switch (inChar)
+		{
+			case '@':
+				mEncoding = kEncodingISO88591;
+				AddHostRequest(MHostRequest::eEncodingChanged);
+				break;
+			case 'G':
+				mEncoding = kEncodingUTF8;
+				AddHostRequest(MHostRequest::eEncodingChanged);
+				break;
+		}
+	}
+	else
+	{
+		if (mDECSCL == 1 and inCharSet > 1)
+		{
+			PRINT(("Unsupported set G%d", inCharSet));
+			return;
+		}
+
+		mCursor.charSetGSel[inCharSet] = inChar;
+
+		if (inCharCount == 96)
+		{
+			switch (inChar)
+			{
+				case 'A':
+					mCursor.charSetG[inCharSet] = kISOLatin1Supplemental;
+					break;
+			}
+		}
+		else
+		{
+			switch (inChar)
+			{
+				case 'A':
+					mCursor.charSetG[inCharSet] = kUKCharSet;
+					break;
+				case 'B':
+					mCursor.charSetG[inCharSet] = kUSCharSet;
+					break;
+				case '4':
+					mCursor.charSetG[inCharSet] = kNLCharSet;
+					break;
+				case 'C':
+				case '5':
+					mCursor.charSetG[inCharSet] = kFICharSet;
+					break;
+				case 'R':
+					mCursor.charSetG[inCharSet] = kFRCharSet;
+					break;
+				case 'Q':
+					mCursor.charSetG[inCharSet] = kCACharSet;
+					break;
+				case 'K':
+					mCursor.charSetG[inCharSet] = kDECharSet;
+					break;
+				case 'Y':
+					mCursor.charSetG[inCharSet] = kITCharSet;
+					break;
+				case 'E':
+				case '6':
+					mCursor.charSetG[inCharSet] = kDKCharSet;
+					break;
+				case 'Z':
+					mCursor.charSetG[inCharSet] = kSPCharSet;
+					break;
+				case 'H':
+				case '7':
+					mCursor.charSetG[inCharSet] = kSECharSet;
+					break;
+				case '=':
+					mCursor.charSetG[inCharSet] = kCHCharSet;
+					break;
+				case '0':
+					mCursor.charSetG[inCharSet] = kLineCharSet;
+					break;
+				case '1':
+					mCursor.charSetG[inCharSet] = kUSCharSet;
+					break;
+				case '2':
+					mCursor.charSetG[inCharSet] = kLineCharSet;
+					break;
+			}
+		}
+	}
+}
+
+void MTerminalEmulator::SelectControlTransmission(uint8_t inCode)
+{
+	switch (inCode)
+	{
+		case 'F':
+			mS8C1T = false;
+			break;
+		case 'G':
+			if (mDECSCL >= 2)
+				mS8C1T = true;
+			break;
+
+		// unimplemented
+		case 'N': /* ANSI conformance level 3 */
+			mCursor.charSetG[0] = kUSCharSet;
+			mCursor.CSGL = 0;
+			// fall through
+		case 'L': /* ANSI conformance level 1 */
+		case 'M': /* ANSI conformance level 2 */
+			mCursor.charSetG[1] = kISOLatin1Supplemental;
+			mCursor.CSGR = 1;
+			break;
+	}
+}
+
+void MTerminalEmulator::SelectDouble(uint8_t inDoubleMode)
+{
+	switch (inDoubleMode)
+	{
+		case '3':
+			mBuffer->SetLineDoubleHeight(mCursor.y, true);
+			break;
+		case '4':
+			mBuffer->SetLineDoubleHeight(mCursor.y, false);
+			break;
+		case '5':
+			mBuffer->SetLineSingleWidth(mCursor.y);
+			break;
+		case '6':
+			mBuffer->SetLineDoubleWidth(mCursor.y);
+			break;
+		case '8':
+			mBuffer->FillWithE();
+			break;
+	}
+}
+
+void MTerminalEmulator::CommitPFK()
+{
+	for (auto k : mNewPFK->key)
+	{
+		std::string s;
+		for (uint32_t i = 0; i < k.second.length(); i += 2)
+		{
+			char c1 = tolower(k.second[i]);
+			char c2 = 0;
+			if (i < k.second.length())
+				c2 = tolower(k.second[i + 1]);
+
+			if (c1 >= '0' and c1 <= '9')
+				c1 -= '0';
+			else
+				c1 -= 'a' + 10;
+
+			if (c2 >= '0' and c2 <= '9')
+				c2 -= '0';
+			else
+				c2 -= 'a' + 10;
+
+			s += char((c1 << 4) | c2);
+		}
+		mNewPFK->key[k.first] = s;
+	}
+
+	if (mNewPFK->clear or mPFK == nullptr)
+	{
+		delete mPFK;
+		mPFK = mNewPFK;
+	}
+	else
+	{
+		for (auto k : mNewPFK->key)
+			mPFK->key[k.first] = k.second;
+		delete mNewPFK;
+	}
+
+	mNewPFK = nullptr;
+}
+
+void MTerminalEmulator::DcsHook(std::span<const uint32_t> inParams, std::string_view inIntermediates, uint8_t inFinal)
+{
+	delete mNewPFK;
+	mNewPFK = nullptr;
+
+	mDECRQSS.clear();
+	mPFKKeyNr = 0;
+
+	if (inIntermediates.empty() and inFinal == '|')
+	{
+		// DECUDK, user defined keys. Pc = 0 clears all keys, Pl = 0 locks them
+		mNewPFK = new MPFK;
+		mNewPFK->clear = inParams[0] == 0;
+		mNewPFK->locked = inParams.size() < 2 or inParams[1] == 0;
+		mState = 13;
+	}
+	else if (inIntermediates == "$" and inFinal == 'q')
+		mState = 22; // DECRQSS
+	else
+		mState = 100; /* unrecognized */
+}
+
+void MTerminalEmulator::DcsPut(std::span<const uint8_t> inData)
+{
+	for (uint8_t ch : inData)
+	{
+		switch (mState)
+		{
+			case 13:
+				if (ch >= '0' and ch <= '9')
+					mPFKKeyNr = mPFKKeyNr * 10 + (ch - '0');
+				else if (ch == '/')
+					mState = 14;
+				else
+					mState = 100;
+				break;
+
+			case 14:
+				if (ch == ';')
+				{
+					mPFKKeyNr = 0;
+					mState = 13;
+				}
+				else if (isxdigit(ch))
+				{
+					uint32_t keyCode = 0;
+					switch (mPFKKeyNr)
+					{
+						case eF1:
+							keyCode = kF1KeyCode;
+							break;
+						case eF2:
+							keyCode = kF2KeyCode;
+							break;
+						case eF3:
+							keyCode = kF3KeyCode;
+							break;
+						case eF4:
+							keyCode = kF4KeyCode;
+							break;
+						case eF5:
+							keyCode = kF5KeyCode;
+							break;
+						case eF6:
+							keyCode = kF6KeyCode;
+							break;
+						case eF7:
+							keyCode = kF7KeyCode;
+							break;
+						case eF8:
+							keyCode = kF8KeyCode;
+							break;
+						case eF9:
+							keyCode = kF9KeyCode;
+							break;
+						case eF10:
+							keyCode = kF10KeyCode;
+							break;
+						case eF11:
+							keyCode = kF11KeyCode;
+							break;
+						case eF12:
+							keyCode = kF12KeyCode;
+							break;
+						case eF13:
+							keyCode = kF13KeyCode;
+							break;
+						case eF14:
+							keyCode = kF14KeyCode;
+							break;
+						case eF15:
+							keyCode = kF15KeyCode;
+							break;
+						case eF16:
+							keyCode = kF16KeyCode;
+							break;
+						case eF17:
+							keyCode = kF17KeyCode;
+							break;
+						case eF18:
+							keyCode = kF18KeyCode;
+							break;
+						case eF19:
+							keyCode = kF19KeyCode;
+							break;
+						case eF20:
+							keyCode = kF20KeyCode;
+							break;
+					}
+
+					if (keyCode != 0)
+						mNewPFK->key[keyCode] += ch;
+				}
+				else
+					mState = 100;
+				break;
+
+			case 22:
+				mDECRQSS += ch;
+				break;
+		}
+	}
+}
+
+void MTerminalEmulator::DcsUnhook()
+{
+	if (mNewPFK)
+		CommitPFK();
+	else if (not mDECRQSS.empty() and mDECSCL >= 4)
+	{
+		std::string response("\033P0$r");
+
+		if (mDECRQSS == "m") // SGR - Set Graphic Rendition
+		{
+			std::vector<std::string> sgr;
+			if (mCursor.style & kStyleBold)
+				sgr.push_back("1");
+			if (mCursor.style & kStyleUnderline)
+				sgr.push_back("4");
+			if (mCursor.style & kStyleBlink)
+				sgr.push_back("5");
+			if (mCursor.style & kStyleInverse)
+				sgr.push_back("7");
+			if (mCursor.style & kStyleInvisible)
+				sgr.push_back("8");
+			if (mCursor.style.IsForeColorRGB())
+			{
+				uint32_t rgb = mCursor.style.GetForeColorRGB();
+				sgr.push_back(MFormat("38;2;%d;%d;%d", (rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff));
+			}
+			else if (mCursor.style.GetForeColor() != kXTermColorNone)
+				sgr.push_back(std::to_string(30 + mCursor.style.GetForeColor()));
+			if (mCursor.style.IsBackColorRGB())
+			{
+				uint32_t rgb = mCursor.style.GetBackColorRGB();
+				sgr.push_back(MFormat("48;2;%d;%d;%d", (rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff));
+			}
+			else if (mCursor.style.GetBackColor() != kXTermColorNone)
+				sgr.push_back(std::to_string(40 + mCursor.style.GetBackColor()));
+
+			response = MFormat("\033P1$r%s", Join(sgr, ";").c_str());
+		}
+		//			else if (mDECRQSS == ",|")	// DECAC - Assign Color
+		//			else if (mDECRQSS == ",}")	// DECATC - Alternate Text Color
+		else if (mDECRQSS == "$}") // DECSASD - Select Active Status Display
+			response = "\033P1$r0}";
+		else if (mDECRQSS == "*x") // DECSACE - Select Attribute Change Extent
+			response = MFormat("\033P1$r%d", mDECSACE ? 2 : 1);
+		else if (mDECRQSS == "\"q") // DECSCA - Set Character Attribute
+			response = mCursor.style & kUnerasable ? "\033P1$r1" : "\033P1$r0";
+		else if (mDECRQSS == "$|") // DECSCPP - Set Columns Per Page
+			response = MFormat("\033P1$r%d", mTerminalWidth);
+		//			else if (mDECRQSS == "*r")	// DECSCS - Select Communication Speed
+		//			else if (mDECRQSS == "*u")	// DECSCP - Select Communication Port
+		else if (mDECRQSS == "\"p") // DECSCL - Set Conformance Level
+		{
+			if (mDECSCL >= 2)
+				response = MFormat("\033P1$r%d;%d", mDECSCL, mS8C1T ? 0 : 1);
+			else
+				response = "\033P1$r61";
+		}
+		else if (mDECRQSS == " q") // DECSCUSR - Set Cursor Style
+		{
+			int cs = mCursor.block ? (mCursor.blink ? 1 : 2) : (mCursor.blink ? 3 : 4);
+			response = MFormat("\033P1$r%d", cs);
+		}
+		//			else if (mDECRQSS == ")p")	// DECSDPT - Select Digital Printed Data Type
+		//			else if (mDECRQSS == "$q")	// DECSDDT - Select Disconnect Delay Time
+		//			else if (mDECRQSS == "*s")	// DECSFC - Select Flow Control Type
+		//			else if (mDECRQSS == " r")	// DECSKCV - Set Key Click Volume
+		else if (mDECRQSS == "s") // DECSLRM - Set Left and Right Margins
+			response = MFormat("\033P1$r%d;%d", mMarginLeft + 1, mMarginRight + 1);
+		else if (mDECRQSS == "t") // DECSLPP - Set Lines Per Page
+			response = MFormat("\033P1$r%d", mTerminalHeight);
+		//			else if (mDECRQSS == " v")	// DECSLCK - Set Lock Key Style
+		//			else if (mDECRQSS == " u")	// DECSMBV - Set Margin Bell Volume
+		else if (mDECRQSS == "*|") // DECSNLS - Set Number of Lines per Screen
+			response = MFormat("\033P1$r%d", mTerminalHeight);
+		//			else if (mDECRQSS == ",x")	// DECSPMA - Session Page Memory Allocation
+		//			else if (mDECRQSS == "+w")	// DECSPP - Set Port Parameter
+		//			else if (mDECRQSS == "$s")	// DECSPRTT - Select Printer Type
+		//			else if (mDECRQSS == "*p")	// DECSPPCS - Select ProPrinter Character Set
+		//			else if (mDECRQSS == " p")	// DECSSCLS - Set Scroll Speed
+		//			else if (mDECRQSS == "p")	// DECSSL - Select Set-Up Language
+		else if (mDECRQSS == "$~") // DECSSDT - Set Status Line Type
+			response = MFormat("\033P1$r%d", mDECSSDT);
+		else if (mDECRQSS == "r") // DECSTBM - Set Top and Bottom Margins
+			response = MFormat("\033P1$r%d;%d", mMarginTop + 1, mMarginBottom + 1);
+		//			else if (mDECRQSS == "\"u")	// DECSTRL - Set Transmit Rate Limit
+		//			else if (mDECRQSS == " t")	// DECSWBV - Set Warning Bell Volume
+		//			else if (mDECRQSS == ",{")	// DECSZS - Select Zero Symbol
+
+		SendCommand(response + mDECRQSS + "\033\\");
+		mDECRQSS.clear();
+	}
+}
+
+void MTerminalEmulator::CollectStringArgs(std::span<const uint8_t> inData)
+{
+	for (uint8_t ch : inData)
+	{
+		switch (mState)
+		{
+			case 0: // start, expect a number, or ';'
+				if (ch == ';')
+				{
+					mArgs.push_back(0);
+					mState = 2;
+				}
+				else if (ch >= '0' and ch <= '9')
+				{
+					mArgs[0] = ch - '0';
+					mState = 1;
+				}
+				else
+				{
+					mArgString += ch;
+					mState = 2;
+				}
+				break;
+
+			case 1:
+				if (ch >= '0' and ch <= '9')
+					mArgs.back() = mArgs.back() * 10 + (ch - '0');
+				else if (ch == ';')
+					mArgs.push_back(0);
+				else // error
+				{
+					mArgString += ch;
+					mState = 2;
+				}
+				break;
+
+			case 2:
+				mArgString += ch;
+				break;
+		}
+	}
+}
+
+void MTerminalEmulator::OscStart()
+{
+	mArgs.assign(1, 0);
+	mArgString.clear();
+	mState = 0;
+}
+
+void MTerminalEmulator::OscPut(std::span<const uint8_t> inData)
+{
+	CollectStringArgs(inData);
+}
+
+void MTerminalEmulator::OscEnd()
+{
+	switch (mArgs[0])
+	{
+		case 0:
+		case 1:
+		case 2:
+		{
+			std::string title = mArgString;
+			for (char &ch : title)
+			{
+				if (std::iscntrl(ch))
+					ch = '_';
+			}
+			AddHostRequest(MHostRequest::eSetWindowTitle, std::move(title));
+			break;
+		}
+
+		case 7:
+		{
+			try
+			{
+				zeep::http::uri uri(mArgString);
+				if (uri.get_scheme() == "file")
+				{
+					mTerminalHost = uri.get_host();
+					mTerminalCWD = uri.get_path().unencoded_string();
+				}
+			}
+			catch (const std::exception &e)
+			{
+				mTerminalHost.clear();
+				mTerminalCWD.clear();
+			}
+			break;
+		}
+
+		case 8:
+			SetHyperLink(mArgString);
+			break;
+
+		case 9:
+			AddHostRequest(MHostRequest::eSetStatusText, mArgString);
+			break;
+
+		case 10:
+			if (mArgString == "?")
+				AddHostRequest(MHostRequest::eReportTextColor);
+			break;
+
+		case 11:
+			if (mArgString == "?")
+				AddHostRequest(MHostRequest::eReportBackColor);
+			break;
+
+			/* unimplemented: veel */
+
+		case 52:
+			if (mArgString.length() > 2 and mArgString[1] == ';' and mArgString[0] == 'c')
+			{
+				if (mArgString[2] == '?')
+					SendCommand("\033]52;c;\033\\"); // empty std::string as reply, sorry
+				else
+				{
+					auto s = zeep::decode_base64({ mArgString.data() + 2, mArgString.length() - 2 });
+					AddHostRequest(MHostRequest::eSetClipboard, s);
+				}
+			}
+			break;
+
+		case 1337:
+			if (mArgString.starts_with("CurrentDir="))
+				mTerminalCWD = mArgString.substr(strlen("CurrentDir="));
+			else if (mArgString == "StealFocus")
+				AddHostRequest(MHostRequest::eStealFocus);
+			else if (mArgString == "CursorShape=0")
+				mBlockCursor = true;
+			else if (mArgString == "CursorShape=1" or mArgString == "CursorShape=2")
+				mBlockCursor = false;
+			break;
+
+		default:
+			PRINT(("Ignored %d OSC option", mArgs[0]));
+			break;
+	}
+}
+
+void MTerminalEmulator::ApcStart()
+{
+	mArgs.assign(1, 0);
+	mArgString.clear();
+	mState = 0;
+}
+
+void MTerminalEmulator::ApcPut(std::span<const uint8_t> inData)
+{
+	CollectStringArgs(inData);
+}
+
+void MTerminalEmulator::ApcEnd()
+{
+	switch (mArgs[0])
+	{
+		case 7:
+		{
+			// Bash function for get is:
+			// get() { file="$1"; printf "\033_7;%s\x9c" $(realpath -qez "$file" | base64 -w0);}
+
+			auto s = zeep::decode_base64({ mArgString.data(), mArgString.length() });
+
+			AddHostRequest(MHostRequest::eDownloadFile, s);
+			break;
+		}
+
+		case 8:
+		{
+			// Bash function for get is:
+			// put() { file="$1"; printf "\033_8;%s\x9c" $(realpath -qz "$file" | base64 -w0);}
+
+			auto s = zeep::decode_base64({ mArgString.data(), mArgString.length() });
+
+			AddHostRequest(MHostRequest::eUploadFile, s);
+			break;
+		}
+
+		case 9:
+			mTerminalCWD = zeep::decode_base64({ mArgString.data(), mArgString.length() });
+			break;
+
+		default:
+			PRINT(("Ignored %d APC option", mArgs[0]));
+			break;
+	}
+}
+
+void MTerminalEmulator::SaveCursor(void)
+{
+	if (mBuffer == &mAlternateBuffer)
+	{
+		mAlternate = mCursor;
+		mAlternate.saved = true;
+	}
+	else
+	{
+		mSaved = mCursor;
+		mSaved.saved = true;
+	}
+}
+
+void MTerminalEmulator::RestoreCursor(void)
+{
+	if (mBuffer == &mAlternateBuffer and mAlternate.saved)
+		mCursor = mAlternate;
+	else if (mBuffer == &mScreenBuffer and mSaved.saved)
+		mCursor = mSaved;
+	else
+	{
+		MoveCursorTo(0, 0);
+
+		mCursor.charSetG[0] = kUSCharSet;
+		mCursor.charSetG[1] = kLineCharSet;
+		mCursor.charSetG[2] = kUSCharSet;
+		mCursor.charSetG[3] = kLineCharSet;
+		mCursor.CSGL = 0;
+		mCursor.CSGR = 2;
+		mCursor.style = MStyle();
+		mCursor.DECOM = false;
+	}
+}
+
+void MTerminalEmulator::SwitchToAlternateScreen()
+{
+	if (mBuffer != &mAlternateBuffer)
+	{
+		mBuffer = &mAlternateBuffer;
+		EraseInDisplay(2);
+		mBuffer->SetDirty(true);
+	}
+}
+
+void MTerminalEmulator::SwitchToRegularScreen()
+{
+	if (mBuffer != &mScreenBuffer)
+	{
+		mBuffer = &mScreenBuffer;
+		mBuffer->SetDirty(true);
+	}
+}
+
+void MTerminalEmulator::SetResetMode(uint32_t inMode, bool inANSI, bool inSet)
+{
+	if (inANSI)
+	{
+		switch (inMode)
+		{
+			case 2:
+				mKAM = inSet;
+				break;
+			case 4:
+				mIRM = inSet;
+				break;
+			case 12:
+				mSRM = inSet;
+				break;
+			case 20:
+				mLNM = inSet;
+				break;
+			default:
+				PRINT(("Ignored %s of option %d", inSet ? "set" : "reset", inMode));
+				break;
+		}
+	}
+	else
+	{
+		switch (inMode)
+		{
+			case 1:
+				mDECCKM = inSet;
+				break;
+			case 2:
+				mDECANM = inSet;
+				break;
+			case 3:           // DECCOLM
+				mDECSSDT = 0; // reset status line conforming to specification
+				ResizeTerminal(inSet ? 132 : 80, mTerminalHeight);
+				break;
+			case 4:
+				mDECSCLM = inSet;
+				break;
+			case 5:
+				mDECSCNM = inSet;
+				break;
+			case 6:
+				mCursor.DECOM = inSet;
+				if (inSet)
+					MoveCursorTo(0, 0);
+				break;
+			case 7:
+				mCursor.DECAWM = inSet;
+				break;
+			case 8:
+				mDECARM = inSet;
+				break;
+			case 12:
+				mCursor.blink = inSet;
+				break;
+			case 18:
+				mDECPFF = inSet;
+				break;
+			case 19:
+				mDECPEX = inSet;
+				break;
+			case 25:
+				mDECTCEM = inSet;
+				break;
+			case 42:
+				mDECNRCM = inSet;
+				break;
+			case 66:
+				mDECNMK = inSet;
+				break;
+			case 67:
+				mDECBKM = inSet;
+				break;
+
+			case 69:
+				mDECVSSM = inSet;
+				if (not mDECVSSM)
+				{
+					mMarginLeft = 0;
+					mMarginRight = mTerminalWidth - 1;
+				}
+				break;
+
+			case 9:
+			case 1000:
+			case 1001:
+			case 1002:
+			case 1003:
+				PRINT(("%s mouse mode for %d", inSet ? "set" : "reset", inMode));
+				if (inSet)
+					mMouseMode = (MouseTrackingMode)inMode;
+				else
+					mMouseMode = eTrackMouseNone;
+				break;
+
+			case 1004:
+				// ignored for now, focus tracking?
+				break;
+
+			case 47: // alternate screen buffer support
+			case 1047:
+				if (inSet)
+					SwitchToAlternateScreen();
+				else
+					SwitchToRegularScreen();
+				break;
+
+			case 1048:
+				if (inSet)
+					SaveCursor();
+				else
+					RestoreCursor();
+				break;
+
+			case 1049:
+				if (inSet)
+				{
+					SaveCursor();
+					SwitchToAlternateScreen();
+				}
+				else
+				{
+					SwitchToRegularScreen();
+					RestoreCursor();
+				}
+				break;
+
+			case 2004:
+				mBracketedPaste = inSet;
+				break;
+
+			case 2026:
+				if (inSet)
+				{
+					if (not mSynchronizedOutput.has_value())
+						mSynchronizedOutput = std::chrono::steady_clock::now() + kSynchronizedOutputTimeout;
+				}
+				else if (mSynchronizedOutput.has_value())
+				{
+					mSynchronizedOutput.reset();
+					AddHostRequest(MHostRequest::eSynchronizedOutputEnd);
+				}
+				break;
+
+			default:
+				PRINT(("Ignored %s of option %d", inSet ? "set" : "reset", inMode));
+				break;
+		}
+	}
+}
+
+bool MTerminalEmulator::GetMode(uint32_t inMode, bool inANSI)
+{
+	bool result = false;
+
+	if (inANSI)
+	{
+		switch (inMode)
+		{
+			case 2:
+				result = mKAM;
+				break;
+			case 4:
+				result = mIRM;
+				break;
+			case 12:
+				result = mSRM;
+				break;
+			case 20:
+				result = mLNM;
+				break;
+		}
+	}
+	else
+	{
+		switch (inMode)
+		{
+			case 1:
+				result = mDECCKM;
+				break;
+			case 2:
+				result = mDECANM;
+				break;
+			case 3:
+				result = mTerminalWidth == 132;
+				break;
+			case 4:
+				result = mDECSCLM;
+				break;
+			case 5:
+				result = mDECSCNM;
+				break;
+			case 6:
+				result = mCursor.DECOM;
+				break;
+			case 7:
+				result = mCursor.DECAWM;
+				break;
+			case 8:
+				result = mDECARM;
+				break;
+			case 12:
+				result = mCursor.blink;
+				break;
+			case 18:
+				result = mDECPFF;
+				break;
+			case 19:
+				result = mDECPEX;
+				break;
+			case 25:
+				result = mDECTCEM;
+				break;
+			case 42:
+				result = mDECNRCM;
+				break;
+			case 66:
+				result = mDECNMK;
+				break;
+			case 67:
+				result = mDECBKM;
+				break;
+			case 69:
+				result = mDECVSSM;
+				break;
+			case 2004:
+				result = mBracketedPaste;
+				break;
+			case 2026:
+				result = mSynchronizedOutput.has_value();
+				break;
+		}
+	}
+
+	return result;
+}
+
+void MTerminalEmulator::SetHyperLink(const std::string &inURI)
+{
+	mHyperLink = 0;
+	if (not inURI.empty())
+	{
+		std::string id, uri;
+
+		if (auto s = inURI.find(';'); s != std::string::npos)
+		{
+			for (auto p : Split(inURI.substr(0, s), ":", true))
+			{
+				if (p.starts_with("id="))
+					id = p.substr(3);
+			}
+
+			uri = inURI.substr(s + 1);
+		}
+		else
+			uri = inURI;
+
+		if (zeep::http::is_valid_uri(uri))
+			mHyperLink = mBuffer->AddHyperLink(uri, id);
+	}
+}
+
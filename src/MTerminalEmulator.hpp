@@ -0,0 +1,425 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#pragma once
+
+#include "MRingBuffer.hpp"
+#include "MTerminalBuffer.hpp"
+#include "MUnicode.hpp"
+#include "MVTParser.hpp"
+
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// --------------------------------------------------------------------
+// Some requests sent by the host cannot be handled by the emulator
+// itself. These are collected and should be processed by the owner
+// of the emulator, typically an MTerminalView.
+
+struct MHostRequest
+{
+	enum Kind
+	{
+		eBeep,
+		eSetWindowTitle,     // text contains the title
+		eSetStatusText,      // text contains the status
+		eSetClipboard,       // text contains the new clipboard data
+		eStealFocus,
+		eDownloadFile,       // text contains the remote path
+		eUploadFile,         // text contains the remote path
+		eEncodingChanged,
+		eTerminalResized,    // the emulator changed its own size or status line
+		eReportWindowPosition,
+		eReportWindowSize,
+		eReportWindowTitle,
+		eReportTextColor,
+		eReportBackColor,
+		eSynchronizedOutputEnd // the frame written with mode 2026 set is complete
+	} kind;
+
+	std::string text;
+};
+
+struct MTerminalSnapshot;
+
+// --------------------------------------------------------------------
+// MTerminalEmulator contains the state of a DEC VT420/xterm terminal
+// and the code to process the data sent by a host. It is independent
+// of any user interface code, responses for the host are sent using
+// the response callback.
+
+class MTerminalEmulator : private MVTParserHandler
+{
+  public:
+	typedef std::function<void(std::string)> ResponseCallback;
+
+	MTerminalEmulator(uint32_t inColumns = 80, uint32_t inRows = 24);
+	~MTerminalEmulator();
+
+	MTerminalEmulator(const MTerminalEmulator &) = delete;
+	MTerminalEmulator &operator=(const MTerminalEmulator &) = delete;
+
+	void SetResponseCallback(ResponseCallback inCallback) { mResponseCallback = std::move(inCallback); }
+
+	// Process the data in inData, returns the number of bytes consumed.
+	// Processing stops early when a smooth scroll is pending or when
+	// a host request needs to be answered before continuing.
+	std::size_t Emulate(std::span<const uint8_t> inData);
+
+	// Send a response to the host, C1 controls are translated into
+	// their eight bit form when needed.
+	void SendCommand(std::string inData);
+
+	std::deque<MHostRequest> TakeHostRequests() { return std::exchange(mHostRequests, {}); }
+	bool HasHostRequests() const { return not mHostRequests.empty(); }
+
+	// The version is incremented each time data from the host was processed
+	uint64_t GetVersion() const { return mVersion; }
+
+	// Copy the lines starting at inTopLine and the state needed to draw them
+	void UpdateSnapshot(MTerminalSnapshot &ioSnapshot, int32_t inTopLine, bool inHoveredLinks) const;
+
+	void Reset(bool inKeepCursorPosition = false);
+	void SoftReset();
+
+	// Resize the buffers, ioAnchor is the top line that should remain visible
+	void Resize(uint32_t inColumns, uint32_t inRows, int32_t &ioAnchor, bool inResetCursor);
+
+	int32_t GetWidth() const { return mTerminalWidth; }
+	int32_t GetHeight() const { return mTerminalHeight; }
+
+	MTerminalBuffer &GetBuffer() { return *mBuffer; }
+	const MTerminalBuffer &GetBuffer() const { return *mBuffer; }
+	const MTerminalBuffer &GetStatusLineBuffer() const { return mStatusLineBuffer; }
+
+	// Mark the attribute table entries used by all buffers
+	void MarkAttributes(MAttributeTable::MMarks &ioMarks) const;
+	bool IsAlternateScreen() const { return mBuffer == &mAlternateBuffer; }
+
+	// Settings, normally taken from the preferences
+	void SetBufferSize(uint32_t inBufferSize);
+	void SetDefaultCursorShape(bool inBlock, bool inBlink);
+	void SetAnswerBack(const std::string &inAnswerBack) { mAnswerBack = inAnswerBack; }
+	void SetShowStatusLine(bool inShowStatusLine);
+
+	MEncoding GetEncoding() const { return mEncoding; }
+	void SetEncoding(MEncoding inEncoding) { mEncoding = inEncoding; }
+
+	struct MCursorState
+	{
+		bool saved;
+		int x, y;
+		const wchar_t *charSetG[4];
+		char charSetGSel[4];
+		int CSGL, CSGR;
+		int SS;
+		MStyle style;
+		bool DECOM, DECAWM;
+		bool blink, block;
+	};
+
+	const MCursorState &GetCursor() const { return mCursor; }
+
+	// Write the VT320 indicator status line, showing cursor position and connection
+	// state. It is only rewritten when these change or when something else wrote
+	// into the status line. Returns true if the status line was rewritten.
+	bool UpdateIndicatorStatusLine(bool inConnected);
+
+	// The modes that are relevant for handling keyboard and mouse input
+	bool GetDECCKM() const { return mDECCKM; }
+	bool GetDECANM() const { return mDECANM; }
+	bool GetDECSCNM() const { return mDECSCNM; }
+	bool GetDECARM() const { return mDECARM; }
+	bool GetDECNMK() const { return mDECNMK; }
+	bool GetDECTCEM() const { return mDECTCEM; }
+	int GetDECSSDT() const { return mDECSSDT; }
+	bool GetKAM() const { return mKAM; }
+	bool GetSRM() const { return mSRM; }
+	bool GetLNM() const { return mLNM; }
+	bool GetBracketedPaste() const { return mBracketedPaste; }
+
+	bool GetDECBKM() const { return mDECBKM; }
+	void SetDECBKM(bool inDECBKM) { mDECBKM = inDECBKM; }
+
+	// User defined keys, if any
+	std::optional<std::string> GetUserDefinedKey(uint32_t inKeyCode) const;
+
+	enum MouseTrackingMode
+	{
+		eTrackMouseNone,
+		eTrackMouseSendXYOnClick = 9,
+		eTrackMouseSendXYOnButton = 1000,
+		eTrackMouseHilightTracking = 1001,
+		eTrackMouseCellMotionTracking = 1002,
+		eTrackMouseAllMotionTracking = 1003
+	};
+
+	MouseTrackingMode GetMouseMode() const { return mMouseMode; }
+
+	// Smooth scrolling (DECSCLM) interrupts emulation for each scrolled line
+	std::optional<std::chrono::system_clock::time_point> GetNextSmoothScroll() const { return mNextSmoothScroll; }
+	void PerformSmoothScroll();
+
+	// Synchronized output (mode 2026), the screen should not be updated until
+	// the mode is reset again or the returned deadline has passed.
+	std::optional<std::chrono::steady_clock::time_point> GetSynchronizedOutputDeadline() const { return mSynchronizedOutput; }
+
+	// The number of lines scrolled into the scrollback buffer since the last call
+	int32_t TakeScrollForwardCount() { return std::exchange(mScrollForwardCount, 0); }
+
+	// OSC 7 support, used in up and downloading files
+	const std::filesystem::path &GetTerminalHost() const { return mTerminalHost; }
+	const std::filesystem::path &GetTerminalCWD() const { return mTerminalCWD; }
+
+  private:
+	// MVTParserHandler
+	std::size_t Print(std::span<const uint8_t> inText) override;
+	void Execute(uint8_t inControl) override;
+	void EscDispatch(std::string_view inIntermediates, uint8_t inFinal) override;
+	void CsiDispatch(std::span<const uint32_t> inParams, std::string_view inIntermediates, uint8_t inFinal) override;
+	void DcsHook(std::span<const uint32_t> inParams, std::string_view inIntermediates, uint8_t inFinal) override;
+	void DcsPut(std::span<const uint8_t> inData) override;
+	void DcsUnhook() override;
+	void OscStart() override;
+	void OscPut(std::span<const uint8_t> inData) override;
+	void OscEnd() override;
+	void ApcStart() override;
+	void ApcPut(std::span<const uint8_t> inData) override;
+	void ApcEnd() override;
+	void VT52CursorAddress(uint32_t inLine, uint32_t inColumn) override;
+
+	void UpdateParserModes();
+	void AddHostRequest(MHostRequest::Kind inKind, std::string inText = {});
+
+	bool DecodeUTF8(uint8_t inByte, unicode &outChar);
+
+	void WriteChar(unicode inChar);
+	void WriteChars(const unicode *inText, uint32_t inLength);
+	void EraseInDisplay(uint32_t inMode, bool inSelective = false);
+	void EraseInLine(uint32_t inMode, bool inSelective = false);
+
+	void ScrollForward();
+	void ScrollBackward();
+
+	void EscapeStart(uint8_t inChar);
+	void EscapeVT52(uint8_t inChar);
+	void SelectCharSet(uint32_t inCharSet, uint32_t inCharCount, uint8_t inChar);
+	void SelectControlTransmission(uint8_t inChar);
+	void SelectDouble(uint8_t inChar);
+	void ProcessCSILevel1(uint32_t inCmd);
+	void ProcessCSILevel4(uint32_t inCmd);
+	void CommitPFK();
+	void CollectStringArgs(std::span<const uint8_t> inData);
+
+	void SaveCursor();
+	void RestoreCursor();
+	void ResetCursor();
+
+	void SwitchToAlternateScreen();
+	void SwitchToRegularScreen();
+
+	// Resize on request of the host, the owner is informed
+	void ResizeTerminal(uint32_t inColumns, uint32_t inRows);
+
+	enum MCursorMovement
+	{
+		kMoveUp,
+		kMoveDown,
+		kMoveLeft,
+		kMoveRight,
+		kMoveIND,
+		kMoveRI,
+		kMoveCR,
+		kMoveLF,
+		kMoveCRLF,
+		kMoveHT,
+		kMoveCBT,
+		kMoveBI,
+		kMoveFI,
+		kMoveSL,
+		kMoveSR
+	};
+
+	void MoveCursor(MCursorMovement inDirection);
+	void MoveCursorTo(int32_t inX, int32_t inY);
+
+	bool CursorIsInMargins() const
+	{
+		return mCursor.y >= mMarginTop and mCursor.y <= mMarginBottom and mCursor.x >= mMarginLeft and mCursor.x <= mMarginRight;
+	}
+
+	void SetTabstop();
+	uint32_t GetParam(uint32_t inParamNr, uint32_t inDefaultValue);
+	void GetRectParam(uint32_t inParamOffset,
+		int32_t &outTop, int32_t &outLeft, int32_t &outBottom, int32_t &outRight);
+
+	void SetResetMode(uint32_t inMode, bool inANSI, bool inSet);
+	bool GetMode(uint32_t inMode, bool inANSI);
+
+	void SetHyperLink(const std::string &inURI);
+
+	ResponseCallback mResponseCallback;
+	std::deque<MHostRequest> mHostRequests;
+	uint64_t mVersion = 0;
+
+	int32_t mTerminalWidth, mTerminalHeight;
+
+	MTerminalBuffer mScreenBuffer, mAlternateBuffer, mStatusLineBuffer;
+	MTerminalBuffer *mBuffer;
+
+	int32_t mMarginLeft, mMarginTop, mMarginRight, mMarginBottom;
+	MEncoding mEncoding = kEncodingUTF8;
+	std::vector<bool> mTabStops;
+
+	unicode mUTF8Char = 0;
+	uint32_t mUTF8Needed = 0;
+
+	MCursorState mCursor, mSaved, mAlternate, mSavedSL;
+
+	std::map<int, bool> mSavedPrivateMode;
+
+	// DEC modes
+	bool mDECCKM;
+	bool mDECANM;
+	bool mDECSCLM;
+	bool mDECSCNM;
+	bool mDECARM;
+	bool mDECPFF;
+	bool mDECPEX;
+	bool mDECNMK;
+	bool mDECBKM;
+	// VT220
+	int mDECSCL;
+	bool mDECTCEM;
+	bool mDECNRCM;
+	// VT420
+	bool mDECVSSM;
+
+	// ANSI modes
+	bool mIRM;
+	bool mKAM;
+	bool mSRM;
+	bool mLNM;
+
+	// VT220 support
+	bool mS8C1T;
+	struct MPFK *mPFK = nullptr; // device control strings
+	struct MPFK *mNewPFK = nullptr;
+
+	// handling of escape sequences
+	MVTParser mParser{ *this };
+
+	int mState;
+	std::vector<uint32_t> mArgs;
+	std::string mArgString;
+	uint32_t mPFKKeyNr;
+
+	// requests coming from host
+	std::string mDECRQSS;
+
+	int32_t mScrollForwardCount = 0;
+
+	std::optional<std::chrono::system_clock::time_point> mNextSmoothScroll;
+	bool mScrollForward;
+
+	// status line
+	bool mDECSASD = false;
+	int mDECSSDT = 0;
+	bool mShowStatusLine = false;
+
+	// what the indicator status line was last written for: cursor, connected and the
+	// generation of the status line buffer after writing it
+	std::optional<std::tuple<int32_t, int32_t, bool, uint64_t>> mIndicatorStatusLine;
+
+	// rectangle extend
+	bool mDECSACE;
+
+	wchar_t mLastChar;
+
+	bool mBlockCursor = false, mBlinkCursor = true;
+	std::string mAnswerBack = "salt";
+
+	MouseTrackingMode mMouseMode;
+	bool mBracketedPaste = false;
+	std::optional<std::chrono::steady_clock::time_point> mSynchronizedOutput;
+
+	int mHyperLink = 0;
+
+	// OSC 7 support, used in up and downloading files
+	std::filesystem::path mTerminalHost, mTerminalCWD;
+};
+
+// --------------------------------------------------------------------
+// A copy of the visible part of the screen along with the state needed
+// to draw it. This allows drawing while the emulator is updating the
+// screen on another thread. The dirty flags mark the lines that differ
+// from the previous snapshot.
+
+struct MTerminalSnapshot
+{
+	uint64_t version = 0;
+
+	// the buffer the lines were taken from and its generation at that time
+	const MTerminalBuffer *buffer = nullptr;
+	uint64_t generation = 0, statusLineGeneration = 0;
+
+	int32_t width = 0, height = 0;
+	int32_t topLine = 0;
+	int32_t bufferedLines = 0;
+	uint64_t bufferSerial = 0; // the serial number of line 0, see MTerminalBuffer::GetBufferSerial
+
+	// height lines starting at topLine, followed by the status line if shown
+	std::vector<MLine> lines;
+	std::vector<bool> dirty;
+
+	// each line gets a new version number when it changes
+	std::vector<uint64_t> lineVersions;
+	uint64_t lineVersion = 0;
+
+	// the number of rows the contents moved up since the previous snapshot
+	int32_t shift = 0;
+	int64_t scrollCount = 0;
+	std::vector<std::tuple<int32_t, int32_t>> hoveredLinks;
+
+	MTerminalEmulator::MCursorState cursor;
+	bool DECSCNM = false, DECTCEM = true;
+	int DECSSDT = 0;
+
+	int32_t selLine1 = 0, selCol1 = 0, selLine2 = 0, selCol2 = 0;
+	bool blockSelection = false;
+};
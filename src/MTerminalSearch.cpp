@@ -0,0 +1,376 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#include "MTerminalSearch.hpp"
+#include "MRegex.hpp"
+#include "MTerminalBuffer.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+// The maximum number of lines searched before the lock is released
+const uint64_t
+	kMaxSliceSize = 4096;
+
+// Compare matches by line only
+struct MSerialLess
+{
+	bool operator()(const MTerminalSearch::MMatch &a, uint64_t b) const { return a.serial < b; }
+	bool operator()(uint64_t a, const MTerminalSearch::MMatch &b) const { return a < b.serial; }
+};
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+MTerminalSearch::MTerminalSearch(LockCallback inLock)
+	: mLock(std::move(inLock))
+{
+	// clang-format off
+	mThread = std::thread(
+		[this]
+		{
+			try
+			{
+				Run();
+			}
+			catch (const std::exception &ex)
+			{
+				std::cerr << "Exception in search thread: " << ex.what() << '\n';
+			}
+		});
+	// clang-format on
+}
+
+MTerminalSearch::~MTerminalSearch()
+{
+	{
+		std::unique_lock lock(mMutex);
+		mStop = true;
+		mCondition.notify_one();
+	}
+
+	if (mThread.joinable())
+		mThread.join();
+}
+
+void MTerminalSearch::Start(const MTerminalBuffer &inBuffer, const std::string &inWhat, bool inIgnoreCase, bool inRegex)
+{
+	if (inWhat.empty())
+	{
+		Stop();
+		return;
+	}
+
+	std::unique_lock lock(mMutex);
+
+	mBuffer = &inBuffer;
+	mWhat = inWhat;
+	mIgnoreCase = inIgnoreCase;
+	mRegex = inRegex;
+
+	Restart();
+
+	mCondition.notify_one();
+}
+
+void MTerminalSearch::Stop()
+{
+	std::unique_lock lock(mMutex);
+
+	mBuffer = nullptr;
+	mWhat.clear();
+	mError.clear();
+
+	mMatches.clear();
+	mScreenMatches.clear();
+	mComplete = true;
+	mIndexComplete = true;
+	++mVersion;
+}
+
+void MTerminalSearch::Restart()
+{
+	mEpoch = mBuffer->GetBufferEpoch();
+	mMatches.clear();
+	mBegin = mEnd = mBuffer->GetBufferSerial();
+	mScreenMatches.clear();
+	mComplete = false;
+	mError.clear();
+	++mVersion;
+
+	// the lines on screen are searched right away, this also validates the pattern
+	try
+	{
+		SearchScreen();
+	}
+	catch (const MRegexError &ex)
+	{
+		mError = ex.what();
+		mComplete = true;
+	}
+}
+
+bool MTerminalSearch::Update()
+{
+	std::unique_lock lock(mMutex);
+
+	if (mBuffer != nullptr and mError.empty())
+	{
+		if (mBuffer->GetBufferEpoch() != mEpoch)
+			Restart();
+		else
+		{
+			if (Prune())
+				++mVersion;
+
+			if (mScreenGeneration != mBuffer->GetGeneration() or mScreenSerial != mBuffer->GetBufferSerial())
+				SearchScreen();
+		}
+
+		// new lines in the scrollback, or the search was interrupted
+		if (mComplete and mEnd < mBuffer->GetBufferSerial())
+		{
+			mComplete = false;
+			mCondition.notify_one();
+		}
+	}
+
+	// the index over the scrollback is not built yet, or was dropped
+	if (mBuffer != nullptr and mIndexComplete and not mBuffer->IsIndexComplete())
+	{
+		mIndexComplete = false;
+		mCondition.notify_one();
+	}
+
+	bool result = mReportedVersion != mVersion;
+	mReportedVersion = mVersion;
+	return result;
+}
+
+std::size_t MTerminalSearch::GetMatchCount() const
+{
+	std::unique_lock lock(mMutex);
+
+	// lines on screen that moved into the scrollback may be counted twice otherwise
+	auto screen = std::lower_bound(mScreenMatches.begin(), mScreenMatches.end(), mEnd, MSerialLess());
+	return mMatches.size() + (mScreenMatches.end() - screen);
+}
+
+bool MTerminalSearch::IsComplete() const
+{
+	std::unique_lock lock(mMutex);
+	return mComplete;
+}
+
+std::optional<std::size_t> MTerminalSearch::GetMatchIndex(uint64_t inSerial, int32_t inColumn) const
+{
+	std::unique_lock lock(mMutex);
+
+	std::optional<std::size_t> result;
+	MMatch m{ inSerial, inColumn, 0 };
+
+	if (inSerial >= mEnd)
+	{
+		auto screen = std::lower_bound(mScreenMatches.begin(), mScreenMatches.end(), mEnd, MSerialLess());
+		auto i = std::lower_bound(screen, mScreenMatches.end(), m);
+		if (i != mScreenMatches.end() and i->serial == inSerial and i->column == inColumn)
+			result = mMatches.size() + (i - screen);
+	}
+	else
+	{
+		auto i = std::lower_bound(mMatches.begin(), mMatches.end(), m);
+		if (i != mMatches.end() and i->serial == inSerial and i->column == inColumn)
+			result = i - mMatches.begin();
+	}
+
+	return result;
+}
+
+void MTerminalSearch::GetMatchColumns(uint64_t inSerial, int32_t inWidth, std::vector<std::tuple<int32_t, int32_t>> &outColumns) const
+{
+	std::unique_lock lock(mMutex);
+
+	outColumns.clear();
+
+	auto forEachMatch = [this](uint64_t inSerial, auto &&inHandler)
+	{
+		if (inSerial >= mEnd)
+		{
+			auto r = std::equal_range(mScreenMatches.begin(), mScreenMatches.end(), inSerial, MSerialLess());
+			std::for_each(r.first, r.second, inHandler);
+		}
+		else
+		{
+			auto r = std::equal_range(mMatches.begin(), mMatches.end(), inSerial, MSerialLess());
+			std::for_each(r.first, r.second, inHandler);
+		}
+	};
+
+	// the last match on the previous line may continue on this one
+	if (inSerial > 0)
+	{
+		int32_t end = 0;
+		forEachMatch(inSerial - 1, [&end](const MMatch &m) { end = m.column + m.length; });
+		if (end > inWidth)
+			outColumns.emplace_back(0, std::min(end - inWidth, inWidth));
+	}
+
+	forEachMatch(inSerial, [&outColumns, inWidth](const MMatch &m)
+		{ outColumns.emplace_back(m.column, std::min(m.column + m.length, inWidth)); });
+}
+
+void MTerminalSearch::Run()
+{
+	for (;;)
+	{
+		{
+			std::unique_lock lock(mMutex);
+			mCondition.wait(lock, [this] { return mStop or not mComplete or not mIndexComplete; });
+			if (mStop)
+				break;
+		}
+
+		// the buffer lock must be taken before our own
+		auto bufferLock = mLock();
+		std::unique_lock lock(mMutex);
+
+		// the search goes first, the index only helps the next one
+		if (not mComplete)
+			SearchSlice();
+		else
+			mIndexComplete = mBuffer == nullptr or mBuffer->BuildIndex(kMaxSliceSize);
+
+		// give the emulator and the user interface a chance to access the buffer
+		lock.unlock();
+		bufferLock = {};
+		std::this_thread::yield();
+	}
+}
+
+bool MTerminalSearch::Prune()
+{
+	bool result = false;
+
+	uint64_t serial = mBuffer->GetBufferSerial();
+	uint64_t first = serial - mBuffer->BufferedLines();
+
+	// lines dropped from the scrollback
+	while (not mMatches.empty() and mMatches.front().serial < first)
+	{
+		mMatches.pop_front();
+		result = true;
+	}
+
+	// and lines moved back onto the screen
+	while (not mMatches.empty() and mMatches.back().serial >= serial)
+	{
+		mMatches.pop_back();
+		result = true;
+	}
+
+	mBegin = std::clamp(mBegin, first, serial);
+	mEnd = std::clamp(mEnd, mBegin, serial);
+
+	return result;
+}
+
+void MTerminalSearch::SearchSlice()
+{
+	if (mBuffer == nullptr)
+	{
+		mComplete = true;
+		return;
+	}
+
+	if (mBuffer->GetBufferEpoch() != mEpoch)
+		Restart();
+
+	bool changed = Prune();
+
+	uint64_t serial = mBuffer->GetBufferSerial();
+	uint64_t first = serial - mBuffer->BufferedLines();
+
+	std::vector<std::tuple<int32_t, int32_t, int32_t>> found;
+
+	if (mEnd < serial)
+	{
+		// lines that moved into the scrollback since the last slice
+		uint64_t end = std::min(serial, mEnd + kMaxSliceSize);
+		mBuffer->FindAll(-static_cast<int32_t>(serial - mEnd), -static_cast<int32_t>(serial - end), mWhat, mIgnoreCase, mRegex, found);
+
+		for (auto &[line, column, length] : found)
+			mMatches.push_back({ serial + line, column, length });
+
+		mEnd = end;
+	}
+	else if (mBegin > first)
+	{
+		// older lines, working our way back
+		uint64_t begin = mBegin - first > kMaxSliceSize ? mBegin - kMaxSliceSize : first;
+		mBuffer->FindAll(-static_cast<int32_t>(serial - begin), -static_cast<int32_t>(serial - mBegin), mWhat, mIgnoreCase, mRegex, found);
+
+		for (auto m = found.rbegin(); m != found.rend(); ++m)
+			mMatches.push_front({ serial + std::get<0>(*m), std::get<1>(*m), std::get<2>(*m) });
+
+		mBegin = begin;
+	}
+	else
+		mComplete = true;
+
+	if (changed or not found.empty())
+		++mVersion;
+}
+
+void MTerminalSearch::SearchScreen()
+{
+	uint64_t serial = mBuffer->GetBufferSerial();
+
+	std::vector<std::tuple<int32_t, int32_t, int32_t>> found;
+	mBuffer->FindAll(0, std::numeric_limits<int32_t>::max(), mWhat, mIgnoreCase, mRegex, found);
+
+	std::vector<MMatch> matches;
+	for (auto &[line, column, length] : found)
+		matches.push_back({ serial + line, column, length });
+
+	if (matches != mScreenMatches)
+	{
+		mScreenMatches = std::move(matches);
+		++mVersion;
+	}
+
+	mScreenGeneration = mBuffer->GetGeneration();
+	mScreenSerial = serial;
+}
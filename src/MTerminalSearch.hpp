@@ -0,0 +1,135 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+class MTerminalBuffer;
+
+// --------------------------------------------------------------------
+// MTerminalSearch finds all occurrences of a string or regular expression
+// in a terminal buffer on a thread of its own. The scrollback is searched in slices, newest
+// lines first, while holding the lock returned by the lock callback.
+// Lines moving into the scrollback are searched when they arrive, the
+// lines on screen each time they change. Matches are stored by the serial
+// number of their line (see MTerminalBuffer::GetBufferSerial) so they
+// remain valid while the contents scroll. When the search is done, the
+// optional trigram index of the buffer is built in slices as well.
+
+class MTerminalSearch
+{
+  public:
+	typedef std::function<std::unique_lock<std::recursive_mutex>()> LockCallback;
+
+	struct MMatch
+	{
+		uint64_t serial;
+		int32_t column, length;
+
+		auto operator<=>(const MMatch &) const = default;
+	};
+
+	MTerminalSearch(LockCallback inLock);
+	~MTerminalSearch();
+
+	MTerminalSearch(const MTerminalSearch &) = delete;
+	MTerminalSearch &operator=(const MTerminalSearch &) = delete;
+
+	// Start a new search in inBuffer, cancelling the current one.
+	// Start, Stop and Update should be called with the buffer lock held.
+	void Start(const MTerminalBuffer &inBuffer, const std::string &inWhat, bool inIgnoreCase, bool inRegex);
+	void Stop();
+
+	// Pick up the changes in the buffer, returns true if the matches
+	// changed since the previous call.
+	bool Update();
+
+	const MTerminalBuffer *GetBuffer() const { return mBuffer; }
+	const std::string &GetWhat() const { return mWhat; }
+	bool GetIgnoreCase() const { return mIgnoreCase; }
+	bool GetRegex() const { return mRegex; }
+
+	// The reason nothing is searched, for an invalid regular expression
+	const std::string &GetError() const { return mError; }
+
+	std::size_t GetMatchCount() const;
+	bool IsComplete() const;
+
+	// The index of the match starting at this position, if any
+	std::optional<std::size_t> GetMatchIndex(uint64_t inSerial, int32_t inColumn) const;
+
+	// The first and last column of the matches in the line with serial number
+	// inSerial, including a match continuing from the previous line.
+	void GetMatchColumns(uint64_t inSerial, int32_t inWidth, std::vector<std::tuple<int32_t, int32_t>> &outColumns) const;
+
+  private:
+	void Run();
+	void Restart();
+	bool Prune();
+	void SearchSlice();
+	void SearchScreen();
+
+	LockCallback mLock;
+
+	// these are only changed by Start and Stop, the search thread reads them holding the buffer lock
+	const MTerminalBuffer *mBuffer = nullptr;
+	std::string mWhat, mError;
+	bool mIgnoreCase = false, mRegex = false;
+
+	// the rest is protected by mMutex, which is taken after the buffer lock
+	mutable std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mStop = false, mComplete = true;
+
+	// the trigram index of the buffer, if any, is built after the search
+	bool mIndexComplete = true;
+
+	uint32_t mEpoch = 0;
+	uint64_t mVersion = 0, mReportedVersion = 0;
+
+	// matches in the scrollback, sorted, and the range of serials searched
+	std::deque<MMatch> mMatches;
+	uint64_t mBegin = 0, mEnd = 0;
+
+	// matches on screen, and the state of the screen they were found in
+	std::vector<MMatch> mScreenMatches;
+	uint64_t mScreenGeneration = 0, mScreenSerial = 0;
+
+	std::thread mThread;
+};
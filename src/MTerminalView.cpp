@@ -31,14 +31,16 @@
 #include "MAlerts.hpp"
 #include "MAnimation.hpp"
 #include "MApplication.hpp"
-#include "MCSICommands.hpp"
 #include "MClipboard.hpp"
+#include "MControlCodes.hpp"
 #include "MControls.hpp"
 #include "MDevice.hpp"
 #include "MError.hpp"
 #include "MFile.hpp"
+#include "MFormat.hpp"
 #include "MPreferences.hpp"
 #include "MPreferencesDialog.hpp"
+#include "MRegex.hpp"
 #include "MSaltApp.hpp"
 #include "MSearchPanel.hpp"
 #include "MSound.hpp"
@@ -46,7 +48,6 @@
 #include "MTerminalBuffer.hpp"
 #include "MUnicode.hpp"
 #include "MUtils.hpp"
-#include "MVT220CharSets.hpp"
 #include "MWindow.hpp"
 
 #include "MTerminalColours.hpp"
@@ -56,6 +57,7 @@
 
 #include <pinch/debug.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <map>
@@ -78,30 +80,13 @@ extern char this_thread_name();
 namespace
 {
 
-// This is what we report as terminal type:
-// 62	VT200 family
-// 1	132 columns
-// 2	printer port
-// 6	selective erase
-// 8	user-defined keys
-// 9	national replacement character-sets
-
-const char
-	//	kVT220Attributes[] = "\033[?62;1;2;6;8;9c";
-	kVT420Attributes[] = "\033[?64;1;2;6;8;9c";
-//	kVT520Attributes[] = "\033[?65;1;2;6;8;9c";
-
 const std::string
 	kCSI("\033["),
-	kSS3("\033O"),
-	kDCS("\033P");
+	kSS3("\033O");
 
 uint32_t
 	kBorderWidth = 4;
 
-std::chrono::system_clock::duration
-	kSmoothScrollDelay = std::chrono::milliseconds(25);
-
 // enum {
 //	kTextColor,
 //	kBackColor,
@@ -116,128 +101,27 @@ MColor
 std::string
 	kControlBreakMessage("Hello, world!");
 
-enum MCtrlChr : uint8_t
-{
-	NUL = 0x00,
-	DLE = 0x10,
-	SP = 0x20,
-	DCS = 0x90,
-	SOH = 0x01,
-	DC1 = 0x11,
-	PU1 = 0x91,
-	STX = 0x02,
-	DC2 = 0x12,
-	PU2 = 0x92,
-	ETX = 0x03,
-	DC3 = 0x13,
-	STS = 0x93,
-	EOT = 0x04,
-	DC4 = 0x14,
-	IND = 0x84,
-	CCH = 0x94,
-	ENQ = 0x05,
-	NAK = 0x15,
-	NEL = 0x85,
-	MW = 0x95,
-	ACK = 0x06,
-	SYN = 0x16,
-	SSA = 0x86,
-	SPA = 0x96,
-	BEL = 0x07,
-	ETB = 0x17,
-	ESA = 0x87,
-	EPA = 0x97,
-	BS = 0x08,
-	CAN = 0x18,
-	HTS = 0x88,
-	HT = 0x09,
-	EM = 0x19,
-	HTJ = 0x89,
-	LF = 0x0a,
-	SUB = 0x1a,
-	VTS = 0x8a,
-	VT = 0x0b,
-	ESC = 0x1b,
-	PLD = 0x8b,
-	CSI = 0x9b,
-	FF = 0x0c,
-	FS = 0x1c,
-	PLU = 0x8c,
-	ST = 0x9c,
-	CR = 0x0d,
-	GS = 0x1d,
-	RI = 0x8d,
-	OSC = 0x9d,
-	SO = 0x0e,
-	RS = 0x1e,
-	SS2 = 0x8e,
-	PM = 0x9e,
-	SI = 0x0f,
-	US = 0x1f,
-	DEL = 0x7f,
-	SS3 = 0x8f,
-	APC = 0x9f
-};
-
-} // namespace
-
-// --------------------------------------------------------------------
-// We even support the weird 'Device Control Strings', programmable function keys
-
-enum MPFKKey
-{
-	eUndefinedKey,
-	eF1 = 11,
-	eF2 = 12,
-	eF3 = 13,
-	eF4 = 14,
-	eF5 = 15,
-	eF6 = 17,
-	eF7 = 18,
-	eF8 = 19,
-	eF9 = 20,
-	eF10 = 21,
-	eF11 = 23,
-	eF12 = 24,
-	eF13 = 25,
-	eF14 = 26,
-	eF15 = 28,
-	eF16 = 29,
-	eF17 = 31,
-	eF18 = 32,
-	eF19 = 33,
-	eF20 = 34
-};
+// Jump scroll: the time spent emulating in one pass, what remains
+// is processed in a next pass, after pending events were handled.
+const std::chrono::steady_clock::duration
+	kEmulationBudget = std::chrono::milliseconds(10);
 
-struct MPFK
-{
-	bool clear;
-	bool locked;
-	std::map<uint32_t, std::string> key;
-};
-
-// --------------------------------------------------------------------
-// Too bad the format library isn't finished yet
+// The maximum number of bytes emulated before checking the budget
+const std::size_t
+	kEmulationSliceSize = 4096;
 
-class MFormat
-{
-  public:
-	template <typename... Arguments>
-	MFormat(const char *fmt, Arguments... args)
-		: m_str(255, 0)
-	{
-		auto n = snprintf(m_str.data(), 255, fmt, args...);
-		m_str.resize(n);
-	}
+// Reading from the channel stops when this much input is waiting to be
+// emulated, and resumes when the emulator caught up to kResumeInputSize.
+const std::size_t
+	kMaxInputSize = 4 * 1024 * 1024,
+	kResumeInputSize = 256 * 1024;
 
-	operator std::string() const
-	{
-		return m_str;
-	}
+// After a resize, the scrollback is rewrapped this many lines beyond
+// the top of the visible area
+const int32_t
+	kReflowLookAhead = 1000;
 
-  private:
-	std::string m_str;
-};
+} // namespace
 
 // --------------------------------------------------------------------
 // The MTerminalView class.
@@ -260,12 +144,8 @@ MTerminalView::MTerminalView(const std::string &inID, MRect inBounds,
 	, mSearchPanel(inSearchPanel)
 	, mTerminalChannel(inTerminalChannel)
 	, mArgv(inArgv)
-	, mTerminalWidth(80)
-	, mTerminalHeight(24)
-	, mScreenBuffer(mTerminalWidth, mTerminalHeight, true)
-	, mAlternateBuffer(mTerminalWidth, mTerminalHeight, false)
-	, mStatusLineBuffer(mTerminalWidth, 1, false)
-	, mBuffer(&mScreenBuffer)
+	, mEmulator(80, 24)
+	, mFrameTimer(MSaltApp::Instance().get_io_context())
 	, eIdle(this, &MTerminalView::Idle)
 
 	, cEnterTOTP(this, "enter-totp", &MTerminalView::OnEnterTOTP)
@@ -293,12 +173,7 @@ MTerminalView::MTerminalView(const std::string &inID, MRect inBounds,
 	, cFindNext(this, "find-next", &MTerminalView::OnFindNext, kF3KeyCode, kControlKey)
 	, cFindPrev(this, "find-previous", &MTerminalView::OnFindPrev, kF3KeyCode, kControlKey | kShiftKey)
 
-	, mPFK(nullptr)
-	, mNewPFK(nullptr)
-	, mEscState(eESC_NONE)
 	, eAnimate(this, &MTerminalView::Animate)
-	, mDECSASD(false)
-	, mDECSSDT(0)
 	, mAnimationManager(new MAnimationManager())
 	, mGraphicalBeep(nullptr)
 	, mDisabledFactor(mAnimationManager->CreateVariable(1, 0, 1))
@@ -310,6 +185,23 @@ MTerminalView::MTerminalView(const std::string &inID, MRect inBounds,
 		{ this->HandleMessage(msg, lang); });
 	AddRoute(mTerminalChannel->eIOStatus, eIOStatus);
 
+	mEmulator.SetResponseCallback(
+		[this](std::string inData)
+		{
+			if (mEmulatorThread and mEmulatorThread->IsEmulatorThread())
+			{
+				// replies should be sent from the user interface thread
+				MSaltApp::Instance().execute(
+					[self = weak_from_this(), data = std::move(inData)]() mutable
+					{
+						if (auto tv = self.lock(); tv and tv->IsOpen())
+							tv->mTerminalChannel->SendData(std::move(data));
+					});
+			}
+			else if (mTerminalChannel != nullptr and mTerminalChannel->IsOpen())
+				mTerminalChannel->SendData(std::move(inData));
+		});
+
 	ReadPreferences();
 
 #if DEBUG
@@ -317,13 +209,36 @@ MTerminalView::MTerminalView(const std::string &inID, MRect inBounds,
 #endif
 	std::string encoding = MPrefs::GetString("default-encoding", "utf-8");
 	if (encoding == "utf-8")
-		mEncoding = kEncodingUTF8;
+		mEmulator.SetEncoding(kEncodingUTF8);
 	else if (encoding == "iso-8859-1")
-		mEncoding = kEncodingISO88591;
+		mEmulator.SetEncoding(kEncodingISO88591);
 	else
-		mEncoding = kEncodingUTF8;
+		mEmulator.SetEncoding(kEncodingUTF8);
+
+	mEmulator.Reset();
+
+	if (MPrefs::GetBoolean("threaded-emulation", false))
+	{
+		mEmulatorThread.reset(new MEmulatorThread(mEmulator, mInputBuffer, kResumeInputSize,
+			[this]()
+			{
+				// at most one wake up is queued at any time
+				if (mWakeUpPending.exchange(true))
+					return;
+
+				MSaltApp::Instance().execute(
+					[self = weak_from_this()]()
+					{
+						if (auto tv = self.lock())
+						{
+							tv->mWakeUpPending = false;
+							tv->Idle();
+						}
+					});
+			}));
+	}
 
-	Reset();
+	mSearch.reset(new MTerminalSearch([this]() { return LockEmulator(); }));
 
 	AddRoute(MSaltApp::Instance().eIdle, eIdle);
 	AddRoute(MPreferencesDialog::ePreferencesChanged, ePreferencesChanged);
@@ -335,9 +250,12 @@ MTerminalView::MTerminalView(const std::string &inID, MRect inBounds,
 
 	AdjustScrollbar(0);
 
-	std::string desc = MFormat("%dx%d", mTerminalWidth, mTerminalHeight);
+	std::string desc = MFormat("%dx%d", mEmulator.GetWidth(), mEmulator.GetHeight());
 	mStatusbar->SetStatusText(2, desc, false);
 
+	// the characters in the emulator and the snapshot use the shared attribute table
+	mAttributeCollector = MAttributeTable::RegisterCollector();
+
 	// and add this to the std::list of open terminals
 	sTerminalList.push_back(this);
 }
@@ -346,12 +264,14 @@ MTerminalView::~MTerminalView()
 {
 	sTerminalList.erase(remove(sTerminalList.begin(), sTerminalList.end(), this), sTerminalList.end());
 
-	delete mPFK;
-	delete mNewPFK;
-
 	RemoveRoute(eIdle, gApp->eIdle);
 	RemoveRoute(eAnimate, mAnimationManager->eAnimate);
 
+	MAttributeTable::UnregisterCollector(mAttributeCollector);
+
+	// the emulator thread reads from mInputBuffer
+	mEmulatorThread.reset();
+
 	delete mAnimationManager;
 	delete mGraphicalBeep;
 	delete mDisabledFactor;
@@ -359,6 +279,8 @@ MTerminalView::~MTerminalView()
 
 void MTerminalView::AddedToWindow()
 {
+	auto lock = LockEmulator();
+
 	MCanvas::AddedToWindow();
 
 	cEnterTOTP.Register();
@@ -388,8 +310,8 @@ void MTerminalView::AddedToWindow()
 	cCopy.SetEnabled(false);
 	cEnterTOTP.SetState(-1);
 
-	cEncodingUtf8.SetChecked(mEncoding == kEncodingUTF8);
-	cBackspaceSendsDel.SetChecked(not mDECBKM);
+	cEncodingUtf8.SetChecked(mEmulator.GetEncoding() == kEncodingUTF8);
+	cBackspaceSendsDel.SetChecked(not mEmulator.GetDECBKM());
 	cDeleteSendsDel.SetChecked(mDeleteIsDel);
 	cVt220Keyboard.SetChecked(not mXTermKeys);
 	cAltSendsEscape.SetChecked(mAltSendsEscape);
@@ -406,11 +328,13 @@ MTerminalView *MTerminalView::GetFrontTerminal()
 
 void MTerminalView::Open()
 {
+	auto lock = LockEmulator();
+
 	mStatusbar->SetStatusText(0, _("Trying to connect"), false);
 
 	MRect bounds = GetBounds();
 
-	mTerminalChannel->SetTerminalSize(mTerminalWidth, mTerminalHeight,
+	mTerminalChannel->SetTerminalSize(mEmulator.GetWidth(), mEmulator.GetHeight(),
 		bounds.width - 2 * kBorderWidth, bounds.height - 2 * kBorderWidth);
 
 	// set some environment variables
@@ -451,10 +375,15 @@ void MTerminalView::Destroy()
 
 void MTerminalView::ReadPreferences()
 {
-	mScreenBuffer.SetBufferSize(MPrefs::GetInteger("buffer-size", 5000));
+	auto lock = LockEmulator();
 
-	mCursor.block = mBlockCursor = MPrefs::GetBoolean("block-cursor", false);
-	mCursor.blink = mBlinkCursor = MPrefs::GetBoolean("blink-cursor", true);
+	mEmulator.SetBufferSize(MPrefs::GetInteger("buffer-size", 5000));
+	mEmulator.SetDefaultCursorShape(MPrefs::GetBoolean("block-cursor", false), MPrefs::GetBoolean("blink-cursor", true));
+
+	std::string answerBack = MPrefs::GetString("answer-back", "salt");
+	for (auto p = answerBack.find_first_of("\r\n"); p != std::string::npos; p = answerBack.find_first_of("\n\r", p))
+		answerBack.erase(answerBack.begin() + p);
+	mEmulator.SetAnswerBack(answerBack);
 
 	mFont = MPrefs::GetString("font", MPrefs::GetString("font", "Consolas 10"));
 	mIgnoreColors = MPrefs::GetBoolean("ignore-color", false);
@@ -488,23 +417,29 @@ void MTerminalView::ReadPreferences()
 	mOldFnKeys = false;
 	mXTermKeys = true;
 
-	// VT320 ?
-	mDECSSDT = MPrefs::GetBoolean("show-status-line", false) ? 1 : 0;
+	mEmulator.SetShowStatusLine(MPrefs::GetBoolean("show-status-line", false));
+
+	int frameRate = MPrefs::GetInteger("frame-rate", 60);
+	if (frameRate < 1)
+		frameRate = 60;
+	mFrameInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) / frameRate;
 
-	if (mCursor.blink == false)
+	if (mEmulator.GetCursor().blink == false)
 		Invalidate();
 }
 
 void MTerminalView::PreferencesChanged()
 {
+	auto lock = LockEmulator();
+
 	ReadPreferences();
 
 	MRect bounds = GetBounds();
 
-	uint32_t w = static_cast<uint32_t>(ceil(mTerminalWidth * mCharWidth) + 2 * kBorderWidth);
-	uint32_t h = mTerminalHeight * mLineHeight + 2 * kBorderWidth;
+	uint32_t w = static_cast<uint32_t>(ceil(mEmulator.GetWidth() * mCharWidth) + 2 * kBorderWidth);
+	uint32_t h = mEmulator.GetHeight() * mLineHeight + 2 * kBorderWidth;
 
-	if (mDECSSDT > 0)
+	if (mEmulator.GetDECSSDT() > 0)
 		h += mLineHeight;
 
 	GetWindow()->ResizeWindow(w - bounds.width, h - bounds.height);
@@ -577,180 +512,36 @@ void MTerminalView::StatusPartClicked(uint32_t inPart, MRect)
 	}
 }
 
-void MTerminalView::ResetCursor()
-{
-	mCursor.x = 0;
-	mCursor.y = 0;
-	mCursor.style = MStyle(kStyleNormal);
-	mCursor.charSetG[0] = kUSCharSet;
-	mCursor.charSetGSel[0] = 'B';
-	mCursor.charSetG[1] = kLineCharSet;
-	mCursor.charSetGSel[1] = '0';
-	mCursor.charSetG[2] = kUSCharSet;
-	mCursor.charSetGSel[2] = 'B';
-	mCursor.charSetG[3] = kLineCharSet;
-	mCursor.charSetGSel[3] = '0';
-	mCursor.CSGL = 0;
-	mCursor.CSGR = 2;
-	mCursor.DECOM = false;
-	mCursor.DECAWM = true;
-	mCursor.SS = 0;
-	mCursor.blink = mBlinkCursor;
-	mCursor.block = mBlockCursor;
-}
-
-void MTerminalView::Reset()
-{
-	mS8C1T = false;
-
-	mTabStops = std::vector<bool>(mTerminalWidth, false);
-	for (int32_t i = 8; i < mTerminalWidth; i += 8)
-		mTabStops[i] = true;
-
-	mEscState = eESC_NONE;
-
-	mMarginTop = 0;
-	mMarginBottom = mTerminalHeight - 1;
-
-	mMarginLeft = 0;
-	mMarginTop = 0;
-	mMarginRight = mTerminalWidth - 1;
-	mMarginBottom = mTerminalHeight - 1;
-
-	ResetCursor();
-
-	mIRM = false;
-	mKAM = false;
-	mLNM = false;
-	mSRM = true;
-
-	mDECCKM = false;
-	mDECANM = true;
-	mDECSCLM = false;
-	mDECSCNM = false;
-	mDECARM = true;
-	mDECPFF = false;
-	mDECPEX = false;
-	mDECNMK = false;
-	mDECBKM = false;
-
-	mDECSCL = 4; // FIXME ? really?
-	mDECTCEM = true;
-	mDECNRCM = false;
-
-	mDECSASD = false;
-	bool needResize = mDECSSDT > 0;
-	mDECSSDT = MPrefs::GetBoolean("show-status-line", false) ? 1 : 0;
-	mDECVSSM = false;
-
-	mCursor.saved = false;
-	mNextSmoothScroll.reset();
-
-	mDECSACE = false;
-
-	mAltSendsEscape = true;
-
-	// avoid problems when restore cursor is called
-	mAlternate.saved = false;
-	mSaved.saved = false;
-	mSavedSL.saved = false;
-
-	if (needResize and GetWindow() != nullptr)
-		ResizeTerminal(mTerminalWidth, mTerminalHeight, true);
-
-	mMouseMode = eTrackMouseNone;
-}
-
-void MTerminalView::SoftReset()
-{
-	mDECTCEM = true;
-	mIRM = false;
-	mDECNMK = false;
-	mDECCKM = false;
-	mMarginTop = 0;
-	mMarginBottom = mTerminalHeight - 1;
-	mDECNRCM = false;
-
-	mCursor.style = MStyle();
-	mCursor.charSetG[0] = kUSCharSet;
-	mCursor.charSetGSel[0] = 'B';
-	mCursor.charSetG[1] = kLineCharSet;
-	mCursor.charSetGSel[1] = '0';
-	mCursor.charSetG[2] = kUSCharSet;
-	mCursor.charSetGSel[2] = 'B';
-	mCursor.charSetG[3] = kLineCharSet;
-	mCursor.charSetGSel[3] = '0';
-	mCursor.CSGL = 0;
-	mCursor.CSGR = 2;
-	mCursor.DECOM = false;
-	mCursor.DECAWM = true; // should be false
-	mCursor.SS = 0;
-
-	mSaved = mCursor;
-}
-
 void MTerminalView::ResizeTerminal(uint32_t inColumns, uint32_t inRows, bool inResetCursor, bool inResizeWindow)
 {
-	int32_t dh = inRows - mTerminalHeight;
-
-	mTerminalWidth = inColumns;
-	mTerminalHeight = inRows;
-
-	mMarginRight = mTerminalWidth - 1;
-	mMarginLeft = 0;
-
-	mMarginBottom = mTerminalHeight - 1;
-	mMarginTop = 0;
-
-	mCursor.y += dh;
-	mSaved.y += dh;
-	mAlternate.y += dh;
-
-	// not sure if this is really what we want:
-	mMarginTop = 0;
-	mMarginBottom = mTerminalHeight - 1;
+	auto lock = LockEmulator();
 
 	int32_t anchor = GetTopLine();
-	mBuffer->Resize(inColumns, inRows, anchor);
+	mEmulator.Resize(inColumns, inRows, anchor, inResetCursor);
 
-	mTabStops = std::vector<bool>(mTerminalWidth, false);
-	for (int32_t i = 8; i < mTerminalWidth; i += 8)
-		mTabStops[i] = true;
+	TerminalResized(anchor, inResizeWindow);
+}
 
+void MTerminalView::TerminalResized(int32_t inTopLine, bool inResizeWindow)
+{
 	if (mStatusbar != nullptr)
 	{
-		std::string desc = MFormat("%dx%d", mTerminalWidth, mTerminalHeight);
+		std::string desc = MFormat("%dx%d", mEmulator.GetWidth(), mEmulator.GetHeight());
 		mStatusbar->SetStatusText(2, desc, false);
 	}
 
 	MRect bounds = GetBounds();
 
 	if (mTerminalChannel->IsOpen())
-		mTerminalChannel->SetTerminalSize(mTerminalWidth, mTerminalHeight,
+		mTerminalChannel->SetTerminalSize(mEmulator.GetWidth(), mEmulator.GetHeight(),
 			bounds.width - 2 * kBorderWidth, bounds.height - 2 * kBorderWidth);
 
-	AdjustScrollbar(anchor);
-
-	if (mBuffer == &mAlternateBuffer)
-		mScreenBuffer.Resize(mTerminalWidth, mTerminalHeight, anchor);
-	else
-		mAlternateBuffer.Resize(mTerminalWidth, mTerminalHeight, anchor);
-
-	mStatusLineBuffer.Resize(mTerminalWidth, 1, anchor);
-
-	if (inResetCursor)
-	{
-		mMarginTop = 0;
-		mMarginBottom = inRows - 1;
-		mCursor.x = mCursor.y = 0;
-
-		EraseInDisplay(2, false);
-	}
+	AdjustScrollbar(inTopLine);
 
 	if (inResizeWindow and GetWindow() != nullptr)
 	{
 		uint32_t w, h;
-		GetTerminalMetrics(mTerminalWidth, mTerminalHeight, mDECSSDT > 0, w, h);
+		GetTerminalMetrics(mEmulator.GetWidth(), mEmulator.GetHeight(), mEmulator.GetDECSSDT() > 0, w, h);
 		GetWindow()->ResizeWindow(w - bounds.width, h - bounds.height);
 	}
 }
@@ -770,15 +561,15 @@ bool MTerminalView::GetCharacterForPosition(int32_t inX, int32_t inY, int32_t &o
 	inX -= kBorderWidth;
 	inY -= kBorderWidth;
 	outLine = (inY / mLineHeight) - (mScrollbar->GetMaxValue() - mScrollbar->GetValue());
-	if (outLine < 0 and outLine < -static_cast<int32_t>(mBuffer->BufferedLines()))
+	if (outLine < 0 and outLine < -static_cast<int32_t>(mEmulator.GetBuffer().BufferedLines()))
 	{
-		outLine = -static_cast<int32_t>(mBuffer->BufferedLines());
+		outLine = -static_cast<int32_t>(mEmulator.GetBuffer().BufferedLines());
 		outColumn = 0;
 	}
-	else if (outLine > mTerminalHeight - 1)
+	else if (outLine > mEmulator.GetHeight() - 1)
 	{
-		outLine = mTerminalHeight - 1;
-		outColumn = mTerminalWidth - 1;
+		outLine = mEmulator.GetHeight() - 1;
+		outColumn = mEmulator.GetWidth() - 1;
 	}
 	else
 	{
@@ -786,8 +577,8 @@ bool MTerminalView::GetCharacterForPosition(int32_t inX, int32_t inY, int32_t &o
 
 		if (outColumn < 0)
 			outColumn = 0;
-		if (outColumn > mTerminalWidth - 1)
-			outColumn = mTerminalWidth - 1;
+		if (outColumn > mEmulator.GetWidth() - 1)
+			outColumn = mEmulator.GetWidth() - 1;
 	}
 
 	return true;
@@ -795,6 +586,8 @@ bool MTerminalView::GetCharacterForPosition(int32_t inX, int32_t inY, int32_t &o
 
 void MTerminalView::ClickPressed(int32_t inX, int32_t inY, int32_t inClickCount, uint32_t inModifiers)
 {
+	auto lock = LockEmulator();
+
 	// PRINT(("Click with modifiers %s%s%s%s", (inModifiers ? "" : " none"), (inModifiers & kShiftKey ? " shift" : ""), (inModifiers & kOptionKey ? " alt" : ""), (inModifiers & kControlKey ? " control" : "")));
 
 	bool done = false;
@@ -805,22 +598,22 @@ void MTerminalView::ClickPressed(int32_t inX, int32_t inY, int32_t inClickCount,
 	int32_t line, column;
 	GetCharacterForPosition(inX, inY, line, column);
 
-	if (not mBuffer->IsSelectionEmpty())
+	if (not mEmulator.GetBuffer().IsSelectionEmpty())
 	{
-		if (inModifiers & kShiftKey and mMouseMode == eTrackMouseNone)
+		if (inModifiers & kShiftKey and mEmulator.GetMouseMode() == MTerminalEmulator::eTrackMouseNone)
 		{
 			mMouseClick = eSingleClick;
 
 			if (line < mMinSelLine or (line == mMinSelLine and column < mMinSelCol))
 			{
-				mBuffer->SetSelection(line, column, mMaxSelLine, mMaxSelCol, mMouseBlockSelect);
+				mEmulator.GetBuffer().SetSelection(line, column, mMaxSelLine, mMaxSelCol, mMouseBlockSelect);
 
 				mMinSelLine = mMaxSelLine;
 				mMinSelCol = mMaxSelCol;
 			}
 			else
 			{
-				mBuffer->SetSelection(mMinSelLine, mMinSelCol, line, column + 1, mMouseBlockSelect);
+				mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, line, column + 1, mMouseBlockSelect);
 
 				mMaxSelLine = mMinSelLine;
 				mMaxSelCol = mMinSelCol;
@@ -831,13 +624,13 @@ void MTerminalView::ClickPressed(int32_t inX, int32_t inY, int32_t inClickCount,
 		}
 		else
 		{
-			mBuffer->SetSelection(0, 0, 0, 0, false);
+			mEmulator.GetBuffer().SetSelection(0, 0, 0, 0, false);
 			Invalidate();
 		}
 	}
-	else if (inModifiers & kControlKey and mMouseMode == eTrackMouseNone)
+	else if (inModifiers & kControlKey and mEmulator.GetMouseMode() == MTerminalEmulator::eTrackMouseNone)
 	{
-		int hoveredLink = mBuffer->GetHoveredLink(line, column);
+		int hoveredLink = mEmulator.GetBuffer().GetHoveredLink(line, column);
 		if (hoveredLink != 0)
 		{
 			mCurrentLink = mAnchorLink = hoveredLink;
@@ -847,7 +640,7 @@ void MTerminalView::ClickPressed(int32_t inX, int32_t inY, int32_t inClickCount,
 		}
 	}
 
-	if (mMouseMode != eTrackMouseNone and inClickCount == 1)
+	if (mEmulator.GetMouseMode() != MTerminalEmulator::eTrackMouseNone and inClickCount == 1)
 	{
 		SendMouseCommand(0, inX, inY, inModifiers);
 		mMouseClick = eTrackClick;
@@ -873,15 +666,15 @@ void MTerminalView::ClickPressed(int32_t inX, int32_t inY, int32_t inClickCount,
 
 				int32_t line, column;
 				GetCharacterForPosition(mLastMouseX, mLastMouseY, line, column);
-				mBuffer->FindWord(line, column, mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol);
+				mEmulator.GetBuffer().FindWord(line, column, mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol);
 
 				if (mMinSelLine != mMaxSelLine or mMinSelCol != mMaxSelCol)
-					mBuffer->SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, false);
+					mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, false);
 				else
 				{
-					mBuffer->SelectCharacter(line, column);
+					mEmulator.GetBuffer().SelectCharacter(line, column);
 					bool isBlock;
-					mBuffer->GetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, isBlock);
+					mEmulator.GetBuffer().GetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, isBlock);
 				}
 
 				Invalidate();
@@ -897,9 +690,9 @@ void MTerminalView::ClickPressed(int32_t inX, int32_t inY, int32_t inClickCount,
 				GetCharacterForPosition(mLastMouseX, mLastMouseY, line, column);
 				mMinSelLine = mMaxSelLine = line;
 				mMinSelCol = 0;
-				mMaxSelCol = mTerminalWidth;
+				mMaxSelCol = mEmulator.GetWidth();
 
-				mBuffer->SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, false);
+				mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, false);
 				Invalidate();
 				break;
 			}
@@ -909,11 +702,13 @@ void MTerminalView::ClickPressed(int32_t inX, int32_t inY, int32_t inClickCount,
 
 void MTerminalView::PointerMotion(int32_t inX, int32_t inY, uint32_t inModifiers)
 {
+	auto lock = LockEmulator();
+
 	using namespace std::chrono_literals;
 
 	if (mMouseClick == eTrackClick)
 	{
-		if (mMouseMode >= eTrackMouseCellMotionTracking)
+		if (mEmulator.GetMouseMode() >= MTerminalEmulator::eTrackMouseCellMotionTracking)
 			SendMouseCommand(32, inX, inY, inModifiers);
 		return;
 	}
@@ -922,7 +717,7 @@ void MTerminalView::PointerMotion(int32_t inX, int32_t inY, uint32_t inModifiers
 
 	int32_t line, column;
 	GetCharacterForPosition(inX, inY, line, column);
-	int hoveredLink = mBuffer->GetHoveredLink(line, column);
+	int hoveredLink = mEmulator.GetBuffer().GetHoveredLink(line, column);
 
 	// shortcuts
 	if (mMouseClick == eNoClick)
@@ -968,7 +763,7 @@ void MTerminalView::PointerMotion(int32_t inX, int32_t inY, uint32_t inModifiers
 			mMinSelCol = column;
 			mMaxSelCol = column + 1;
 
-			mBuffer->SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, mMouseBlockSelect);
+			mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, mMouseBlockSelect);
 		}
 	}
 
@@ -976,35 +771,35 @@ void MTerminalView::PointerMotion(int32_t inX, int32_t inY, uint32_t inModifiers
 	{
 		case eSingleClick:
 			if (line < mMinSelLine or (line == mMinSelLine and column < mMinSelCol))
-				mBuffer->SetSelection(line, column, mMaxSelLine, mMaxSelCol, mMouseBlockSelect);
+				mEmulator.GetBuffer().SetSelection(line, column, mMaxSelLine, mMaxSelCol, mMouseBlockSelect);
 			else if (line > mMaxSelLine or (line == mMaxSelLine and column > mMaxSelCol))
-				mBuffer->SetSelection(mMinSelLine, mMinSelCol, line, column + 1, mMouseBlockSelect);
+				mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, line, column + 1, mMouseBlockSelect);
 			else
-				mBuffer->SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, mMouseBlockSelect);
+				mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol, mMouseBlockSelect);
 			break;
 
 		case eDoubleClick:
 		{
 			int32_t wl1, wc1, wl2, wc2;
-			mBuffer->FindWord(line, column, wl1, wc1, wl2, wc2);
+			mEmulator.GetBuffer().FindWord(line, column, wl1, wc1, wl2, wc2);
 
 			if (wl1 < mMinSelLine or (wl1 == mMinSelLine and wc1 < mMinSelCol))
-				mBuffer->SetSelection(wl1, wc1, mMaxSelLine, mMaxSelCol);
+				mEmulator.GetBuffer().SetSelection(wl1, wc1, mMaxSelLine, mMaxSelCol);
 			else if (wl2 > mMaxSelLine or (wl2 == mMaxSelLine and wc2 > mMaxSelCol))
-				mBuffer->SetSelection(mMinSelLine, mMinSelCol, wl2, wc2);
+				mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, wl2, wc2);
 			else
-				mBuffer->SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol);
+				mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol);
 			break;
 		}
 
 		case eTripleClick:
 		{
 			if (line < mMinSelLine)
-				mBuffer->SetSelection(line, mMinSelCol, mMaxSelLine, mMaxSelCol);
+				mEmulator.GetBuffer().SetSelection(line, mMinSelCol, mMaxSelLine, mMaxSelCol);
 			else if (line > mMaxSelLine)
-				mBuffer->SetSelection(mMinSelLine, mMinSelCol, line, mMaxSelCol);
+				mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, line, mMaxSelCol);
 			else
-				mBuffer->SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol);
+				mEmulator.GetBuffer().SetSelection(mMinSelLine, mMinSelCol, mMaxSelLine, mMaxSelCol);
 			break;
 		}
 
@@ -1022,19 +817,21 @@ void MTerminalView::PointerLeave()
 
 void MTerminalView::ClickReleased(int32_t inX, int32_t inY, uint32_t inModifiers)
 {
-	if (mMouseMode >= eTrackMouseSendXYOnButton)
+	auto lock = LockEmulator();
+
+	if (mEmulator.GetMouseMode() >= MTerminalEmulator::eTrackMouseSendXYOnButton)
 		SendMouseCommand(3, inX, inY, inModifiers);
 	else if (mMouseClick == eLinkClick)
 	{
 		if (mCurrentLink != 0)
 		{
-			LinkClicked(mBuffer->GetHyperLink(mCurrentLink));
+			LinkClicked(mEmulator.GetBuffer().GetHyperLink(mCurrentLink));
 			mCurrentLink = 0;
 		}
 	}
-	else if (not mBuffer->IsSelectionEmpty())
+	else if (not mEmulator.GetBuffer().IsSelectionEmpty())
 	{
-		MClipboard::PrimaryInstance().SetData(mBuffer->GetSelectedText());
+		MClipboard::PrimaryInstance().SetData(mEmulator.GetBuffer().GetSelectedText());
 		cCopy.SetEnabled(true);
 	}
 	else
@@ -1046,9 +843,11 @@ void MTerminalView::ClickReleased(int32_t inX, int32_t inY, uint32_t inModifiers
 
 bool MTerminalView::Scroll(int32_t inX, int32_t inY, int32_t inDeltaX, int32_t inDeltaY, uint32_t inModifiers)
 {
+	auto lock = LockEmulator();
+
 	if (inDeltaY != 0)
 	{
-		if (mMouseMode == eTrackMouseNone)
+		if (mEmulator.GetMouseMode() == MTerminalEmulator::eTrackMouseNone)
 			for (int i = 0; i < 2 * std::abs(inDeltaY); ++i)
 				Scroll(inDeltaY < 0 ? kScrollLineUp : kScrollLineDown);
 		else
@@ -1074,13 +873,41 @@ void MTerminalView::SecondaryMouseButtonClick(int32_t inX, int32_t inY)
 
 void MTerminalView::Draw()
 {
-	// Start by marking the buffer clean
-	// This will also do some post processing like highlighting URL's
-	mBuffer->SetDirty(false);
+	{
+		auto lock = LockEmulator();
+
+		// While output is synchronized the previous frame is drawn again
+		auto deadline = mEmulator.GetSynchronizedOutputDeadline();
+		bool holdFrame = deadline.has_value() and *deadline > std::chrono::steady_clock::now() and
+		                 mSnapshot.width == mEmulator.GetWidth() and mSnapshot.height == mEmulator.GetHeight() and
+		                 mSnapshot.topLine == GetTopLine();
+
+		if (not holdFrame)
+		{
+			// Start by marking the buffer clean
+			// This will also do some post processing like highlighting URL's
+			mEmulator.GetBuffer().SetDirty(false);
 
-	int32_t selLine1, selLine2, selCol1, selCol2;
-	bool blockSelection;
-	mBuffer->GetSelection(selLine1, selCol1, selLine2, selCol2, blockSelection);
+			// From here on we only use the snapshot
+			mEmulator.UpdateSnapshot(mSnapshot, GetTopLine(), mCurrentLink == -1);
+
+			// When the contents scrolled, move the cached layouts along, only
+			// the rows that scrolled into view need to be laid out again
+			int32_t shift = mSnapshot.shift, height = mSnapshot.height;
+			if (shift != 0 and mLineLayouts.size() >= static_cast<std::size_t>(height))
+			{
+				auto b = mLineLayouts.begin(), e = mLineLayouts.begin() + height;
+				if (shift > 0)
+					std::rotate(b, b + shift, e);
+				else
+					std::rotate(b, e + shift, e);
+			}
+		}
+	}
+
+	int32_t selLine1 = mSnapshot.selLine1, selLine2 = mSnapshot.selLine2,
+			selCol1 = mSnapshot.selCol1, selCol2 = mSnapshot.selCol2;
+	bool blockSelection = mSnapshot.blockSelection;
 	if (selLine1 > selLine2)
 		std::swap(selLine1, selLine2);
 	if (selCol1 > selCol2 and selLine1 == selLine2)
@@ -1089,7 +916,7 @@ void MTerminalView::Draw()
 	MDevice dev(this);
 	dev.SetReplaceUnknownCharacters(true);
 
-	//	if (mDECSCNM)
+	//	if (mEmulator.GetDECSCNM())
 	//	{
 	//		copy(mNormalColors, mNormalColors + kColorCount, inverseColor);
 	//		copy(mInverseColors, mInverseColors + kColorCount, normalColor);
@@ -1142,67 +969,32 @@ void MTerminalView::Draw()
 	dev.SetForeColor(fc);
 	dev.SetFont(mFont);
 
-	// fill text layout with a line of spaces
-	// otherwise, it is more difficult to draw background
-	// colors once we have
-	std::string text(mTerminalWidth, ' ');
-	dev.SetText(text);
-
 	float x, y;
 	x = y = static_cast<float>(kBorderWidth);
 
-	int32_t H = mTerminalHeight;
-	if (mDECSSDT > 0)
-	{
-		H += 1;
-
-		if (mDECSSDT == 1)
-		{
-			// write default status line
-			text = MFormat(" 1 (%03.3d,%03.3d)", mCursor.y + 1, mCursor.x + 1);
-
-			std::string trailing = "Printer: None          Network: ";
-			trailing += (mTerminalChannel->IsOpen() ? "Connected    " : "Not Connected");
+	int32_t H = mSnapshot.lines.size();
 
-			if (text.length() + trailing.length() < static_cast<std::size_t>(mTerminalWidth))
-				text += std::string(mTerminalWidth - text.length() - trailing.length(), ' ');
-			text += trailing;
+	if (mLineLayouts.size() != static_cast<std::size_t>(H))
+		mLineLayouts.resize(H);
 
-			bool savedDECSSAD = mDECSASD;
-			auto savedCursor = mCursor;
-
-			mDECSASD = true;
-			ResetCursor();
-
-			for (char c : text)
-				WriteChar(c);
-
-			mCursor = savedCursor;
-			mDECSASD = savedDECSSAD;
-		}
-	}
+	mPalette.Update(mTerminalColors[eText], mTerminalColors[eBack], mTerminalColors[eBold], selectionColor,
+		mIgnoreColors, factor);
 
 	for (int32_t l = 0; l < H; ++l)
 	{
 		MDeviceContextSaver save(dev);
-		text.clear();
-
-		int32_t lineNr = GetTopLine() + l;
 
-		int32_t hvc1 = 0, hvc2 = 0;
-		if (mCurrentLink == -1)
-			std::tie(hvc1, hvc2) = mBuffer->GetHoveredLinkColumBounds(lineNr);
+		int32_t lineNr = mSnapshot.topLine + l;
 
 		// being paranoid
-		if (l != mTerminalHeight and
-			lineNr < 0 and -lineNr > static_cast<int32_t>(mBuffer->BufferedLines()))
+		if (l != mSnapshot.height and
+			lineNr < 0 and -lineNr > mSnapshot.bufferedLines)
 		{
 			y += mLineHeight;
 			continue;
 		}
 
-		const MLine &line(lineNr == mTerminalHeight ? mStatusLineBuffer.GetLine(0) : mBuffer->GetLine(lineNr));
-		static MEncodingTraits<kEncodingUTF8> traits;
+		const MLine &line(mSnapshot.lines[l]);
 
 		float ty = y;
 		if (line.IsDoubleHeight())
@@ -1214,293 +1006,404 @@ void MTerminalView::Draw()
 		else if (line.IsDoubleWidth())
 			dev.SetScale(2.0, 1.0, x, y);
 
-		std::vector<MColor> colors;
-		std::vector<uint32_t> colorIndex, colorOffset;
-		std::vector<uint32_t> backColorIndex, backColorOffset;
-		std::vector<uint32_t> styleValue, styleOffset;
+		int32_t n = mSnapshot.width;
+		if (line.IsDoubleWidth() or line.IsDoubleHeight())
+			n /= 2;
+
+		// everything that determines how this line looks, apart from the cursor and blinking
+		MLineLayoutKey key;
+		key.version = mSnapshot.lineVersions[l];
+		key.paletteVersion = mPalette.GetVersion();
+		key.inverse = mSnapshot.DECSCNM;
+		key.currentLink = mCurrentLink;
+		key.linkClick = mMouseClick == eLinkClick;
 
-		auto pushColor = [&](MColor c, bool back, uint32_t offset)
+		// calculate selected region
+		key.selectionBegin = 1;
+		key.selectionEnd = 0;
+		if (lineNr >= selLine1 and lineNr <= selLine2)
 		{
-			uint32_t ix = find(colors.begin(), colors.end(), c) - colors.begin();
-			if (ix >= colors.size())
-				colors.push_back(c);
-
-			if (back)
+			if (blockSelection)
 			{
-				if (backColorIndex.empty() or backColorIndex.back() != ix)
-				{
-					backColorIndex.push_back(ix);
-					backColorOffset.push_back(offset);
-				}
+				key.selectionBegin = selCol1;
+				key.selectionEnd = selCol2;
+				if (key.selectionBegin > key.selectionEnd)
+					std::swap(key.selectionBegin, key.selectionEnd);
 			}
 			else
 			{
-				if (colorIndex.empty() or colorIndex.back() != ix)
-				{
-					colorIndex.push_back(ix);
-					colorOffset.push_back(offset);
-				}
+				key.selectionBegin = lineNr == selLine1 ? selCol1 : 0;
+				key.selectionEnd = lineNr == selLine2 ? selCol2 : mSnapshot.width;
 			}
-		};
+		}
 
-		pushColor(mTerminalColors[eBack], true, 0);
+		if (mCurrentLink == -1)
+			std::tie(key.hoverBegin, key.hoverEnd) = mSnapshot.hoveredLinks[l];
 
-		int32_t n = mTerminalWidth;
-		if (line.IsDoubleWidth() or line.IsDoubleHeight())
-			n /= 2;
+		if (mSearch->GetBuffer() == mSnapshot.buffer and l < mSnapshot.height)
+			mSearch->GetMatchColumns(mSnapshot.bufferSerial + lineNr, n, key.matches);
 
-		MRect caretRect; // initially empty
-		MColor caretColor;
+		MLineLayout &layout = mLineLayouts[l];
+		if (not(layout.key == key))
+		{
+			layout.key = key;
+			LayoutLine(layout, line, lineNr, n);
+		}
 
-		auto iter = back_inserter(text);
-		for (int32_t c = 0; c < n; ++c)
+		// The font is monospaced, so cells are located by simple arithmetic
+		auto cellBounds = [&](int32_t inFirst, int32_t inLast)
 		{
-			// calculate selected region
-			int32_t sc1 = 1, sc2 = 0;
-			if (lineNr >= selLine1 and lineNr <= selLine2)
-			{
-				if (blockSelection)
-				{
-					sc1 = selCol1;
-					sc2 = selCol2;
-					if (sc1 > sc2)
-						std::swap(sc1, sc2);
-				}
-				else
-				{
-					if (lineNr == selLine1)
-						sc1 = selCol1;
-					else
-						sc1 = 0;
-					if (lineNr == selLine2)
-						sc2 = selCol2;
-					else
-						sc2 = mTerminalWidth;
-				}
-			}
+			return MRect(
+				static_cast<int32_t>(x + ceil(inFirst * mCharWidth)),
+				static_cast<int32_t>(y),
+				static_cast<int32_t>(ceil((inLast - inFirst) * mCharWidth)),
+				mLineHeight);
+		};
 
-			const int
-				eNormalBack = -1,
-				eNormalText = -2,
-				eNormalBold = -3;
+		// draw background rects, no need for a text layout for these
+		for (uint32_t b = 0; b < layout.backColorIndex.size(); ++b)
+		{
+			if (layout.backColorIndex[b] == 0)
+				continue;
 
-			int textColorIx = eNormalText, backColorIx = eNormalBack;
+			dev.SetBackColor(layout.colors[layout.backColorIndex[b]]);
+			dev.EraseRect(cellBounds(layout.backColorColumn[b], layout.backColorColumn[b + 1]));
+		}
 
-			unicode uc = line[c];
-			MStyle st = line[c];
-			int linkNr = line[c].GetHyperLink();
+		// blank lines and trailing blanks are not rendered at all
+		if (not layout.text.empty())
+		{
+			dev.SetText(layout.text);
 
-			if (uc == 0 or st & kStyleInvisible)
-				uc = ' ';
+			if (not layout.colorIndex.empty())
+				dev.SetTextColors(layout.colorIndex.size(), &layout.colorIndex[0], &layout.colorOffset[0], &layout.colors[0]);
 
-			if (st & kStyleBold)
-				textColorIx = eNormalBold;
+			if (not layout.styleValue.empty())
+				dev.SetTextStyles(layout.styleValue.size(), &layout.styleValue[0], &layout.styleOffset[0]);
 
-			if (not mIgnoreColors)
-			{
-				if (st.GetForeColor() == kXTermColorRegularBack)
-					textColorIx = eNormalBack;
-				else if (st.GetForeColor() == kXTermColorRegularText)
-					textColorIx = eNormalText;
-				else if (st.GetForeColor() != kXTermColorNone)
-					textColorIx = st.GetForeColor();
-
-				if (st.GetBackColor() == kXTermColorRegularBack)
-					backColorIx = eNormalBack;
-				else if (st.GetBackColor() == kXTermColorRegularText)
-					backColorIx = eNormalText;
-				else if (st.GetBackColor() != kXTermColorNone)
-					backColorIx = st.GetBackColor();
-
-				if (st & kStyleBold and (textColorIx >= kXTermColorBlack and textColorIx <= kXTermColorWhite))
-					textColorIx += 8;
-			}
+			dev.RenderText(x, ty);
+		}
 
-			if (((st & kStyleInverse) xor mDECSCNM) or
-				(lineNr == mTerminalHeight and (st & kStyleInverse) == 0))
+		// blinking text is hidden by painting its background over it
+		if (mBlinkOn)
+		{
+			for (auto &[first, last, backIx] : layout.blinkRuns)
 			{
-				std::swap(textColorIx, backColorIx);
+				dev.SetBackColor(layout.colors[backIx]);
+				dev.EraseRect(cellBounds(first, last));
 			}
+		}
+
+		// wow, quite a few conditions:
+		int32_t c = mSnapshot.cursor.x;
+		bool drawCaret = mSnapshot.cursor.y == lineNr and c >= 0 and c < n and
+		                 (mBlinkOn or mSnapshot.cursor.blink == false) and
+		                 mSnapshot.DECTCEM and IsActive() and IsFocus() and mTerminalChannel->IsOpen();
 
-			MColor textC, backC;
+		if (drawCaret)
+		{
+			uint32_t offset = layout.offsets[c];
 
-			switch (textColorIx)
+			auto runAt = [](const std::vector<uint32_t> &inOffsets, uint32_t inOffset)
 			{
-				case eNormalBack:
-					textC = mTerminalColors[eBack];
-					break;
-				case eNormalText:
-					textC = mTerminalColors[eText];
-					break;
-				case eNormalBold:
-					textC = mTerminalColors[eBold];
-					break;
-				default:
-					textC = k256AnsiColors[textColorIx];
-					break;
-			}
+				return std::upper_bound(inOffsets.begin(), inOffsets.end(), inOffset) - inOffsets.begin() - 1;
+			};
+
+			MColor backC = layout.colors[layout.backColorIndex[runAt(layout.backColorColumn, c)]];
 
-			switch (backColorIx)
+			if (mSnapshot.cursor.block)
 			{
-				case eNormalBack:
-					backC = mTerminalColors[eBack];
-					break;
-				case eNormalText:
-					backC = mTerminalColors[eText];
-					break;
-				case eNormalBold:
-					backC = mTerminalColors[eBold];
-					break;
-				default:
-					backC = k256AnsiColors[backColorIx];
-					break;
+				MRect caretRect = cellBounds(c, c + 1);
+				dev.SetBackColor(mPalette.GetBold());
+				dev.EraseRect(caretRect);
+
+				// and the character under the cursor, in the background color
+				MColor textC = mPalette.GetBack();
+				uint32_t colorIndex = 0, styleOffset = 0;
+				uint32_t style = layout.styleValue.empty() ? 0 : layout.styleValue[runAt(layout.styleOffset, offset)];
+
+				if (offset < layout.text.length())
+					dev.SetText(layout.text.substr(offset, layout.offsets[c + 1] - offset));
+				else
+					dev.SetText(" ");
+				dev.SetTextColors(1, &colorIndex, &styleOffset, &textC);
+				dev.SetTextStyles(1, &style, &styleOffset);
+				dev.RenderText(static_cast<float>(caretRect.x), ty);
 			}
+			else
+			{
+				MRect caretRect = cellBounds(c, c + 1);
+				caretRect.height = 2;
+				caretRect.y += static_cast<int32_t>(ceil(dev.GetAscent()));
 
-			if (c >= sc1 and c < sc2) // 'selected!'
-				backC = selectionColor;
+				dev.SetBackColor(mTerminalColors[eBold].Distinct(backC));
+				dev.EraseRect(caretRect);
+			}
+		}
 
-			if (textColorIx < 16 and st.GetForeColor() != kXTermColorRegularBack and st.GetBackColor() != kXTermColorRegularText)
-				textC = textC.Distinct(backC);
+		y += mLineHeight;
+	}
+}
 
-			if (st & kStyleBlink and mBlinkOn)
-				textC = backC;
+void MTerminalView::LayoutLine(MLineLayout &ioLayout, const MLine &inLine, int32_t inLineNr, int32_t inColumns)
+{
+	static MEncodingTraits<kEncodingUTF8> traits;
 
-			// wow, quite a few conditions:
-			bool drawCaret = mCursor.y == lineNr and mCursor.x == c and
-			                 (mBlinkOn or mCursor.blink == false) and
-			                 mDECTCEM and IsActive() and IsFocus() and mTerminalChannel->IsOpen();
+	auto &key = ioLayout.key;
 
-			if (drawCaret)
-			{
-				if (mCursor.block)
-				{
-					backC = mTerminalColors[eBold];
-					textC = mTerminalColors[eBack];
-				}
-				else
-				{
-					caretRect = GetCharacterBounds(mCursor.y, mCursor.x);
-					caretRect.height = 2;
-					caretRect.y += static_cast<int32_t>(ceil(dev.GetAscent()));
-					caretColor = mTerminalColors[eBold].Distinct(backC);
-				}
-			}
+	std::string &text = ioLayout.text;
+	std::vector<MColor> &colors = ioLayout.colors;
+	std::vector<uint32_t> &colorIndex = ioLayout.colorIndex, &colorOffset = ioLayout.colorOffset;
+	std::vector<uint32_t> &backColorIndex = ioLayout.backColorIndex, &backColorColumn = ioLayout.backColorColumn;
+	std::vector<uint32_t> &styleValue = ioLayout.styleValue, &styleOffset = ioLayout.styleOffset;
 
-			pushColor(backC, true, text.length());
-			pushColor(textC, false, text.length());
+	text.clear();
+	ioLayout.offsets.clear();
+	colors.clear();
+	colorIndex.clear();
+	colorOffset.clear();
+	backColorIndex.clear();
+	backColorColumn.clear();
+	styleValue.clear();
+	styleOffset.clear();
+	ioLayout.blinkRuns.clear();
 
-			uint32_t style = 0;
-			if (st & kStyleBold)
-				style |= MDevice::eTextStyleBold;
-			if (st & kStyleUnderline)
-				style |= MDevice::eTextStyleUnderline;
+	// background runs are stored by column, text color runs by offset in text
+	auto pushColor = [&](MColor c, bool back, uint32_t offset)
+	{
+		uint32_t ix = find(colors.begin(), colors.end(), c) - colors.begin();
+		if (ix >= colors.size())
+			colors.push_back(c);
 
-			// hyper link tracking
-			if ((linkNr != 0 and linkNr == mCurrentLink) or
-				(mCurrentLink == -1 and c >= hvc1 and c < hvc2))
+		if (back)
+		{
+			if (backColorIndex.empty() or backColorIndex.back() != ix)
 			{
-				style |= MDevice::eTextStyleDoubleUnderline;
-				if (mMouseClick == eLinkClick)
-					style |= MDevice::eTextStyleBold;
+				backColorIndex.push_back(ix);
+				backColorColumn.push_back(offset);
 			}
-
-			if (styleValue.empty() or styleValue.back() != style)
+		}
+		else
+		{
+			if (colorIndex.empty() or colorIndex.back() != ix)
 			{
-				styleValue.push_back(style);
-				styleOffset.push_back(text.length());
+				colorIndex.push_back(ix);
+				colorOffset.push_back(offset);
 			}
+		}
+
+		return ix;
+	};
+
+	pushColor(mPalette.GetBack(), true, 0);
+
+	// the attributes of the current run of characters, resolved
+	int32_t runAttributes = -1;
+	MStyle st;
+	int linkNr = 0;
+	const MTerminalPalette::MColors *runColors = nullptr;
+
+	uint32_t glyphEnd = 0;
 
-			traits.WriteUnicode(iter, uc);
+	// the search match at or after the current column
+	auto match = key.matches.begin();
+
+	auto iter = back_inserter(text);
+	for (int32_t c = 0; c < inColumns; ++c)
+	{
+		unicode uc = inLine[c];
+
+		// resolve the attributes only when they differ from the previous character
+		if (inLine[c].GetAttributes() != runAttributes)
+		{
+			runAttributes = inLine[c].GetAttributes();
+
+			auto &attributes = MAttributeTable::Get(inLine[c].GetAttributes());
+			st = attributes.style;
+			linkNr = attributes.hyperLink;
+
+			bool inverse = ((st & kStyleInverse) xor key.inverse) or
+			               (inLineNr == mSnapshot.height and (st & kStyleInverse) == 0);
+
+			runColors = &mPalette.Resolve(runAttributes, inverse);
 		}
 
-		dev.SetText(text);
+		if (uc == 0 or st & kStyleInvisible)
+			uc = ' ';
+
+		MColor textC = runColors->text, backC = runColors->back;
 
-		// adjust colors, if needed:
-		if (factor > 0)
+		if (c >= key.selectionBegin and c < key.selectionEnd) // 'selected!'
 		{
-			for (MColor &c : colors)
-				c = c.Disable(mTerminalColors[eBack], factor);
+			textC = runColors->selectedText;
+			backC = mPalette.GetSelection();
 		}
-		else if (factor < 0)
+		else
 		{
-			for (MColor &c : colors)
-				c = c.Bleach(-factor);
+			while (match != key.matches.end() and c >= std::get<1>(*match))
+				++match;
+
+			if (match != key.matches.end() and c >= std::get<0>(*match))
+			{
+				textC = runColors->selectedText;
+				backC = mPalette.GetMatch();
+			}
 		}
 
-		if (not colorIndex.empty())
-			dev.SetTextColors(colorIndex.size(), &colorIndex[0], &colorOffset[0], &colors[0]);
+		ioLayout.offsets.push_back(text.length());
 
-		if (not styleValue.empty())
-			dev.SetTextStyles(styleValue.size(), &styleValue[0], &styleOffset[0]);
+		uint32_t backIx = pushColor(backC, true, c);
+		pushColor(textC, false, text.length());
 
-		// draw background rects
-		backColorOffset.push_back(text.length());
-		for (uint32_t b = 0; b < backColorIndex.size(); ++b)
+		if (st & kStyleBlink)
 		{
-			if (backColorIndex[b] == 0)
-				continue;
-
-			dev.RenderTextBackground(x, y, backColorOffset[b],
-				backColorOffset[b + 1] - backColorOffset[b], colors[backColorIndex[b]]);
+			auto &runs = ioLayout.blinkRuns;
+			if (not runs.empty() and std::get<1>(runs.back()) == static_cast<uint32_t>(c) and std::get<2>(runs.back()) == backIx)
+				std::get<1>(runs.back()) = c + 1;
+			else
+				runs.emplace_back(c, c + 1, backIx);
 		}
 
-		dev.RenderText(x, ty);
+		uint32_t style = 0;
+		if (st & kStyleBold)
+			style |= MDevice::eTextStyleBold;
+		if (st & kStyleUnderline)
+			style |= MDevice::eTextStyleUnderline;
+
+		// hyper link tracking
+		if ((linkNr != 0 and linkNr == key.currentLink) or
+			(key.currentLink == -1 and c >= key.hoverBegin and c < key.hoverEnd))
+		{
+			style |= MDevice::eTextStyleDoubleUnderline;
+			if (key.linkClick)
+				style |= MDevice::eTextStyleBold;
+		}
 
-		// draw the caret if needed
-		if (not caretRect.empty())
+		if (styleValue.empty() or styleValue.back() != style)
 		{
-			dev.SetBackColor(caretColor);
-			dev.EraseRect(caretRect);
+			styleValue.push_back(style);
+			styleOffset.push_back(text.length());
 		}
 
-		y += mLineHeight;
+		traits.WriteUnicode(iter, uc);
+
+		// remember where the last visible glyph ended
+		if (uc != ' ' or (style & (MDevice::eTextStyleUnderline | MDevice::eTextStyleDoubleUnderline)))
+			glyphEnd = text.length();
 	}
-}
 
-void MTerminalView::AdjustCursor(int32_t inX, int32_t inY, uint32_t inModifiers)
-{
-	SetCursor(eNormalCursor);
+	ioLayout.offsets.push_back(text.length());
+	backColorColumn.push_back(inColumns);
+
+	// trailing blanks need no text layout, their background is drawn separately
+	text.erase(glyphEnd);
+	while (not colorOffset.empty() and colorOffset.back() >= glyphEnd)
+	{
+		colorOffset.pop_back();
+		colorIndex.pop_back();
+	}
+	while (not styleOffset.empty() and styleOffset.back() >= glyphEnd)
+	{
+		styleOffset.pop_back();
+		styleValue.pop_back();
+	}
 }
 
 void MTerminalView::Idle()
 {
+	auto lock = LockEmulator();
+
 	using namespace std::chrono_literals;
 
 	auto now = std::chrono::system_clock::now();
 
 	bool update = false;
-	int32_t savedCursorX = mCursor.x, savedCursorY = mCursor.y;
+	int32_t savedCursorX = mEmulator.GetCursor().x, savedCursorY = mEmulator.GetCursor().y;
 
-	if (not mInputBuffer.empty() and mNextSmoothScroll.value_or(now) <= now)
+	if (mEmulatorThread)
 	{
-		mScrollForwardCount = 0;
-		int32_t topLine = GetTopLine();
+		// the cursor may have moved since the last time it was drawn
+		savedCursorX = mSnapshot.cursor.x;
+		savedCursorY = mSnapshot.cursor.y;
+
+		// hand over the input, and answer requests the emulator thread is waiting for
+		Emulate();
 
-		if (mNextSmoothScroll.has_value())
+		if (mEmulator.HasHostRequests())
 		{
-			if (mScrollForward)
-			{
-				mBuffer->ScrollForward(mMarginTop, mMarginBottom, mMarginLeft, mMarginRight);
-				++mScrollForwardCount;
-			}
-			else
-			{
-				mBuffer->ScrollBackward(mMarginTop, mMarginBottom, mMarginLeft, mMarginRight);
-			}
+			ProcessHostRequests();
+			mEmulatorThread->Notify();
+		}
+
+		if (mIdleVersion != mEmulator.GetVersion())
+		{
+			mIdleVersion = mEmulator.GetVersion();
 
-			mNextSmoothScroll.reset();
+			int32_t topLine = GetTopLine();
+			bool scrolled = mScrollbar->GetValue() < mScrollbar->GetMaxValue();
+
+			int32_t scrollForwardCount = mEmulator.TakeScrollForwardCount();
+			if (scrolled)
+				topLine -= scrollForwardCount;
+
+			AdjustScrollbar(topLine);
 		}
+	}
+	else if (not mInputBuffer.Empty() and mEmulator.GetNextSmoothScroll().value_or(now) <= now)
+	{
+		int32_t topLine = GetTopLine();
+
+		mEmulator.PerformSmoothScroll();
 
 		bool scrolled = mScrollbar->GetValue() < mScrollbar->GetMaxValue();
 
 		Emulate();
 
+		int32_t scrollForwardCount = mEmulator.TakeScrollForwardCount();
 		if (scrolled)
-			topLine -= mScrollForwardCount;
+			topLine -= scrollForwardCount;
 
 		AdjustScrollbar(topLine);
 	}
 
+	if (mReadSuspended and mInputBuffer.Size() <= kResumeInputSize and mTerminalChannel->IsOpen())
+		ReadData();
+
+	// rewrap the scrollback that was not yet rewrapped after a resize, as far as the user has scrolled
+	if (mEmulator.GetBuffer().NeedsReflow())
+	{
+		int32_t topLine = GetTopLine();
+		int32_t reflowLine = topLine - kReflowLookAhead;
+		if (reflowLine < -mEmulator.GetBuffer().BufferedLines())
+			reflowLine = -mEmulator.GetBuffer().BufferedLines();
+
+		if (mEmulator.GetBuffer().Reflow(reflowLine))
+			AdjustScrollbar(topLine);
+	}
+
+	// (re)start the search when the search string changes, and follow new output
+	if (mSearchPanel->IsVisible())
+	{
+		const MTerminalBuffer &buffer = mEmulator.GetBuffer();
+		std::string what = mSearchPanel->GetSearchString();
+		bool ignoreCase = mSearchPanel->GetIgnoreCase();
+		bool regex = mSearchPanel->GetRegex();
+
+		if (mSearch->GetBuffer() != &buffer or mSearch->GetWhat() != what or
+			mSearch->GetIgnoreCase() != ignoreCase or mSearch->GetRegex() != regex)
+		{
+			mSearch->Start(buffer, what, ignoreCase, regex);
+		}
+	}
+	else if (mSearch->GetBuffer() != nullptr)
+		mSearch->Stop();
+
+	if (mSearch->Update())
+	{
+		UpdateSearchStatus();
+		update = true;
+	}
+
 	if (now - mLastBlink >= 660ms)
 	{
 		mBlinkOn = not mBlinkOn;
@@ -1508,9 +1411,9 @@ void MTerminalView::Idle()
 		update = IsActive() and mTerminalChannel->IsOpen();
 	}
 
-	if (mDECTCEM and IsActive() and mTerminalChannel->IsOpen() and mCursor.blink)
+	if (mEmulator.GetDECTCEM() and IsActive() and mTerminalChannel->IsOpen() and mEmulator.GetCursor().blink)
 	{
-		if (savedCursorX != mCursor.x or savedCursorY != mCursor.y)
+		if (savedCursorX != mEmulator.GetCursor().x or savedCursorY != mEmulator.GetCursor().y)
 		{
 			mBlinkOn = true;
 			mLastBlink = now;
@@ -1518,19 +1421,257 @@ void MTerminalView::Idle()
 		}
 	}
 
-	if (mBuffer->IsDirty())
+	// the indicator status line follows the cursor and the connection state
+	if (mEmulator.GetDECSSDT() == 1 and mEmulator.UpdateIndicatorStatusLine(mTerminalChannel->IsOpen()))
+		update = true;
+
+	// help reclaiming unused entries in the attribute table
+	if (MAttributeTable::NeedsMark(mAttributeCollector))
 	{
-		std::string desc = (MFormat("%d,%d", mCursor.x + 1, mCursor.y + 1));
-		mStatusbar->SetStatusText(3, desc, false);
-	}
+		auto marks = MAttributeTable::CreateMarks();
 
-	if (update or mBuffer->IsDirty())
-		Invalidate();
+		mEmulator.MarkAttributes(marks);
+		for (const MLine &line : mSnapshot.lines)
+		{
+			for (uint32_t c = 0; c < line.size(); ++c)
+				marks[line[c].GetAttributes()] = true;
+		}
+
+		MAttributeTable::Mark(mAttributeCollector, marks);
+	}
+
+	if (mEmulator.GetBuffer().IsDirty())
+	{
+		std::string desc = (MFormat("%d,%d", mEmulator.GetCursor().x + 1, mEmulator.GetCursor().y + 1));
+		mStatusbar->SetStatusText(3, desc, false);
+	}
+
+	if (update or mEmulator.GetBuffer().IsDirty())
+		ScheduleRedraw();
 
 	if (not mSetWindowTitle.empty())
 		GetWindow()->SetTitle(std::exchange(mSetWindowTitle, ""));
 }
 
+void MTerminalView::ScheduleRedraw()
+{
+	auto now = std::chrono::steady_clock::now();
+
+	// While output is synchronized, wait for the end of the frame or the timeout
+	auto deadline = mEmulator.GetSynchronizedOutputDeadline();
+	if (deadline.has_value() and *deadline > now)
+	{
+		if (not mFrameScheduled)
+		{
+			mFrameScheduled = true;
+
+			mFrameTimer.expires_at(*deadline);
+			mFrameTimer.async_wait(asio_ns::bind_executor(MAppExecutor{ &MSaltApp::Instance().get_context() },
+				[self = weak_from_this()](const std::error_code &ec)
+				{
+					if (ec)
+						return;
+
+					if (auto tv = self.lock())
+					{
+						auto lock = tv->LockEmulator();
+						tv->mFrameScheduled = false;
+						tv->ScheduleRedraw();
+					}
+				}));
+		}
+	}
+	else if (mAwaitingEcho and mEmulator.GetBuffer().IsDirty())
+	{
+		// the reply to a keystroke, draw it without waiting for the next frame
+		mAwaitingEcho = false;
+		mLastFrame = now;
+
+		Invalidate();
+		GetWindow()->UpdateNow();
+	}
+	else if (now - mLastFrame >= mFrameInterval)
+	{
+		mLastFrame = now;
+		Invalidate();
+	}
+	else if (not mFrameScheduled)
+	{
+		mFrameScheduled = true;
+
+		mFrameTimer.expires_at(mLastFrame + mFrameInterval);
+		mFrameTimer.async_wait(asio_ns::bind_executor(MAppExecutor{ &MSaltApp::Instance().get_context() },
+			[self = weak_from_this()](const std::error_code &ec)
+			{
+				if (ec)
+					return;
+
+				if (auto tv = self.lock())
+				{
+					auto lock = tv->LockEmulator();
+					tv->mFrameScheduled = false;
+					tv->ScheduleRedraw();
+				}
+			}));
+	}
+}
+
+std::unique_lock<std::recursive_mutex> MTerminalView::LockEmulator()
+{
+	if (mEmulatorThread)
+		return mEmulatorThread->Lock();
+	return std::unique_lock(mEmulatorMutex);
+}
+
+void MTerminalView::Emulate()
+{
+	if (mEmulatorThread)
+	{
+		// the emulator thread consumes mInputBuffer itself
+		if (not mInputBuffer.Empty())
+			mEmulatorThread->Notify();
+		return;
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + kEmulationBudget;
+
+	while (not mInputBuffer.Empty() and not mEmulator.GetNextSmoothScroll().has_value())
+	{
+#if DEBUG
+		if (mDebugUpdate and mEmulator.GetBuffer().IsDirty())
+		{
+			Invalidate();
+			GetWindow()->UpdateNow();
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+#endif
+
+		auto data = mInputBuffer.Peek();
+		if (data.size() > kEmulationSliceSize)
+			data = data.first(kEmulationSliceSize);
+
+		mInputBuffer.Consume(mEmulator.Emulate(data));
+
+		ProcessHostRequests();
+
+		if (std::chrono::steady_clock::now() >= deadline)
+			break;
+	}
+
+	// Out of budget, continue after the events that are pending now
+	if (not mInputBuffer.Empty() and not mEmulator.GetNextSmoothScroll().has_value() and not mEmulationPending)
+	{
+		mEmulationPending = true;
+
+		MSaltApp::Instance().execute(
+			[self = weak_from_this()]()
+			{
+				if (auto tv = self.lock())
+				{
+					tv->mEmulationPending = false;
+					tv->Idle();
+				}
+			});
+	}
+}
+
+void MTerminalView::ProcessHostRequests()
+{
+	for (auto &request : mEmulator.TakeHostRequests())
+	{
+		switch (request.kind)
+		{
+			case MHostRequest::eBeep:
+				Beep();
+				break;
+
+			case MHostRequest::eSetWindowTitle:
+				mSetWindowTitle = request.text;
+				break;
+
+			case MHostRequest::eSetStatusText:
+				mStatusbar->SetStatusText(0, request.text, false);
+				break;
+
+			case MHostRequest::eSetClipboard:
+				MClipboard::Instance().SetData(request.text /* , false */);
+				break;
+
+			case MHostRequest::eStealFocus:
+				GetWindow()->Select();
+				break;
+
+			case MHostRequest::eDownloadFile:
+				DownloadFile(request.text);
+				break;
+
+			case MHostRequest::eUploadFile:
+				UploadFile(request.text);
+				break;
+
+			case MHostRequest::eEncodingChanged:
+				cEncodingUtf8.SetChecked(mEmulator.GetEncoding() == kEncodingUTF8);
+				break;
+
+			case MHostRequest::eTerminalResized:
+				TerminalResized(0, true);
+				break;
+
+			case MHostRequest::eReportWindowPosition:
+			{
+				MRect r;
+				GetWindow()->GetWindowPosition(r);
+				SendCommand(MFormat("\033[3;%d;%dt", r.x, r.y));
+				break;
+			}
+
+			case MHostRequest::eReportWindowSize:
+			{
+				MRect r = GetWindow()->GetBounds();
+				SendCommand(MFormat("\033[4;%d;%dt", r.width, r.height));
+				break;
+			}
+
+			case MHostRequest::eReportWindowTitle:
+				SendCommand(std::string("\033]l") + GetWindow()->GetTitle() + "\033\\");
+				break;
+
+			case MHostRequest::eReportTextColor:
+			{
+				std::string textColor = mTerminalColors[eText].hex();
+
+				SendCommand(
+					"\033]11;rgb:" +
+					textColor.substr(1, 2) + textColor.substr(1, 2) + '/' +
+					textColor.substr(3, 2) + textColor.substr(3, 2) + '/' +
+					textColor.substr(5, 2) + textColor.substr(5, 2) +
+					"\033\\");
+				break;
+			}
+
+			case MHostRequest::eReportBackColor:
+			{
+				std::string backColor = mTerminalColors[eBack].hex();
+
+				SendCommand(
+					"\033]11;rgb:" +
+					backColor.substr(1, 2) + backColor.substr(1, 2) + '/' +
+					backColor.substr(3, 2) + backColor.substr(3, 2) + '/' +
+					backColor.substr(5, 2) + backColor.substr(5, 2) +
+					"\033\\");
+				break;
+			}
+
+			case MHostRequest::eSynchronizedOutputEnd:
+				// present the completed frame at once
+				mLastFrame = std::chrono::steady_clock::now();
+				Invalidate();
+				GetWindow()->UpdateNow();
+				break;
+		}
+	}
+}
+
 std::string MTerminalView::ProcessKeyVT52(uint32_t inKeyCode, uint32_t inModifiers)
 {
 	std::string text;
@@ -1568,21 +1709,21 @@ std::string MTerminalView::ProcessKeyVT52(uint32_t inKeyCode, uint32_t inModifie
 				if (inModifiers & kOptionKey)
 				{
 					inModifiers &= ~kOptionKey;
-					text = mDECNMK ? "\033?m" : "-";
+					text = mEmulator.GetDECNMK() ? "\033?m" : "-";
 				}
 				else
 					text = "\033S";
 				break;
 			case kEnterKeyCode:
-				if (mDECNMK)
+				if (mEmulator.GetDECNMK())
 					text = "\033?M";
-				else if (mLNM)
+				else if (mEmulator.GetLNM())
 					text = "\r\n";
 				else
 					text = "\r";
 				break;
 			default:
-				if (mDECNMK)
+				if (mEmulator.GetDECNMK())
 				{
 					switch (inKeyCode)
 					{
@@ -1620,16 +1761,16 @@ std::string MTerminalView::ProcessKeyANSI(uint32_t inKeyCode, uint32_t inModifie
 	switch (inKeyCode)
 	{
 		case kUpArrowKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + "A";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + "A";
 			break;
 		case kDownArrowKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + "B";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + "B";
 			break;
 		case kRightArrowKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + "C";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + "C";
 			break;
 		case kLeftArrowKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + "D";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + "D";
 			break;
 
 		case kHomeKeyCode:
@@ -1669,28 +1810,28 @@ std::string MTerminalView::ProcessKeyANSI(uint32_t inKeyCode, uint32_t inModifie
 				if (inModifiers & kOptionKey)
 				{
 					inModifiers &= ~kOptionKey;
-					text = mDECNMK ? "\033Om" : "-";
+					text = mEmulator.GetDECNMK() ? "\033Om" : "-";
 				}
 				else
 					text = kSS3 + 'S';
 				break;
 			case kEnterKeyCode:
-				if (mDECNMK)
+				if (mEmulator.GetDECNMK())
 					text = "\033OM";
 				else
-					text = mLNM ? "\r\n" : "\r";
+					text = mEmulator.GetLNM() ? "\r\n" : "\r";
 				break;
 			case ',':
-				text = mDECNMK ? "\033Ol" : ",";
+				text = mEmulator.GetDECNMK() ? "\033Ol" : ",";
 				break;
 			case '+':
-				text = mDECNMK ? "\033Ol" : ",";
+				text = mEmulator.GetDECNMK() ? "\033Ol" : ",";
 				break;
 			case '.':
-				text = mDECNMK ? "\033On" : ".";
+				text = mEmulator.GetDECNMK() ? "\033On" : ".";
 				break;
 			default:
-				if (mDECNMK)
+				if (mEmulator.GetDECNMK())
 					text = kSS3 + char(inKeyCode - '0' + 'p');
 				else
 					text = char(inKeyCode);
@@ -1809,22 +1950,22 @@ std::string MTerminalView::ProcessKeyXTerm(uint32_t inKeyCode, uint32_t inModifi
 	switch (inKeyCode)
 	{
 		case kUpArrowKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + modS3 + "A";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + modS3 + "A";
 			break;
 		case kDownArrowKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + modS3 + "B";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + modS3 + "B";
 			break;
 		case kRightArrowKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + modS3 + "C";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + modS3 + "C";
 			break;
 		case kLeftArrowKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + modS3 + "D";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + modS3 + "D";
 			break;
 		case kHomeKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + modS3 + "H";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + modS3 + "H";
 			break;
 		case kEndKeyCode:
-			text = (mDECCKM ? kSS3 : kCSI) + modS3 + "F";
+			text = (mEmulator.GetDECCKM() ? kSS3 : kCSI) + modS3 + "F";
 			break;
 
 		case kInsertKeyCode:
@@ -1898,7 +2039,7 @@ std::string MTerminalView::ProcessKeyXTerm(uint32_t inKeyCode, uint32_t inModifi
 
 	if (inModifiers & kNumPad)
 	{
-		if (mDECNMK)
+		if (mEmulator.GetDECNMK())
 		{
 			switch (inKeyCode)
 			{
@@ -1969,7 +2110,7 @@ std::string MTerminalView::ProcessKeyXTerm(uint32_t inKeyCode, uint32_t inModifi
 					text = '/';
 					break;
 				case kEnterKeyCode:
-					text = mLNM ? "\r\n" : "\r";
+					text = mEmulator.GetLNM() ? "\r\n" : "\r";
 					break;
 				default:
 					if (inKeyCode >= '0' and inKeyCode <= '9')
@@ -1986,7 +2127,7 @@ std::string MTerminalView::ProcessKeyXTerm(uint32_t inKeyCode, uint32_t inModifi
 			char s[3] = { ESC, static_cast<char>(inKeyCode), 0 };
 			text = s;
 		}
-		else if (mEncoding == kEncodingUTF8)
+		else if (mEmulator.GetEncoding() == kEncodingUTF8)
 		{
 			auto iter = back_inserter(text);
 			MEncodingTraits<kEncodingUTF8>::WriteUnicode(iter, inKeyCode + 128);
@@ -2000,6 +2141,8 @@ std::string MTerminalView::ProcessKeyXTerm(uint32_t inKeyCode, uint32_t inModifi
 
 bool MTerminalView::KeyPressed(uint32_t inKeyCode, char32_t inUnicode, uint32_t inModifiers, bool inAutoRepeat)
 {
+	auto lock = LockEmulator();
+
 	// Special case, for now
 	if (inKeyCode == kTabKeyCode and inModifiers & kControlKey)
 		return false;
@@ -2012,7 +2155,7 @@ bool MTerminalView::KeyPressed(uint32_t inKeyCode, char32_t inUnicode, uint32_t
 	for (;;)
 	{
 		// shortcut
-		if (inAutoRepeat and mDECARM == false)
+		if (inAutoRepeat and mEmulator.GetDECARM() == false)
 			break;
 
 		if (not mTerminalChannel->IsOpen())
@@ -2069,14 +2212,14 @@ bool MTerminalView::KeyPressed(uint32_t inKeyCode, char32_t inUnicode, uint32_t
 			break;
 
 		// VT220, device control strings
+		std::optional<std::string> udk;
 		if (inModifiers == (mUDKWithShift ? kShiftKey : 0) and
 			inKeyCode >= kF1KeyCode and inKeyCode <= kF20KeyCode and
-			mPFK != nullptr and
-			mPFK->key.find(inKeyCode) != mPFK->key.end())
+			(udk = mEmulator.GetUserDefinedKey(inKeyCode)).has_value())
 		{
-			text = mPFK->key[inKeyCode];
+			text = *udk;
 		}
-		else if (mDECANM == false) // We're in VT52 mode
+		else if (mEmulator.GetDECANM() == false) // We're in VT52 mode
 			text = ProcessKeyVT52(inKeyCode, inModifiers);
 		else if (mXTermKeys)
 			text = ProcessKeyXTerm(inKeyCode, inModifiers);
@@ -2088,9 +2231,9 @@ bool MTerminalView::KeyPressed(uint32_t inKeyCode, char32_t inUnicode, uint32_t
 		if (text.empty())
 		{
 			if (inKeyCode == kBackspaceKeyCode)
-				text = mDECBKM ? BS : DEL;
+				text = mEmulator.GetDECBKM() ? BS : DEL;
 			else if (inKeyCode == kReturnKeyCode)
-				text = mLNM ? "\r\n" : "\r";
+				text = mEmulator.GetLNM() ? "\r\n" : "\r";
 			else if (inKeyCode == kTabKeyCode)
 				text = "\t";
 			else if ((inModifiers & ~kNumPad) == kControlKey)
@@ -2149,16 +2292,17 @@ bool MTerminalView::KeyPressed(uint32_t inKeyCode, char32_t inUnicode, uint32_t
 	// brain dead for now
 	if (not text.empty())
 	{
-		mBuffer->ClearSelection();
+		mEmulator.GetBuffer().ClearSelection();
 
-		if (mKAM)
+		if (mEmulator.GetKAM())
 			Beep();
 		else
 		{
 			SendCommand(text);
+			mAwaitingEcho = true;
 
-			if (not mSRM)
-				mInputBuffer.insert(mInputBuffer.end(), text.begin(), text.end());
+			if (not mEmulator.GetSRM())
+				mInputBuffer.Write(text);
 
 			// force a scroll to the bottom
 			Scroll(kScrollToEnd);
@@ -2172,7 +2316,7 @@ bool MTerminalView::KeyPressed(uint32_t inKeyCode, char32_t inUnicode, uint32_t
 		mLastBlink = {};
 		mBlinkOn = true;
 
-		if (mBuffer->IsDirty())
+		if (mEmulator.GetBuffer().IsDirty())
 			Invalidate();
 
 		ObscureCursor();
@@ -2187,19 +2331,20 @@ void MTerminalView::HandleMessage(const std::string &inMessage, const std::strin
 {
 	PRINT_THREAD_ID;
 
-	mInputBuffer.insert(mInputBuffer.end(), inMessage.begin(), inMessage.end());
+	auto lock = LockEmulator();
 
-	std::string tail("\r\n");
-
-	mInputBuffer.insert(mInputBuffer.end(), tail.begin(), tail.end());
+	mInputBuffer.Write(inMessage);
+	mInputBuffer.Write("\r\n");
 
 	Invalidate();
 }
 
 void MTerminalView::EnterText(const std::string &inText /* , bool inRepeat */)
 {
+	auto lock = LockEmulator();
+
 	/* 	// shortcut
-	    if (inRepeat and mDECARM == false)
+	    if (inRepeat and mEmulator.GetDECARM() == false)
 	        return true;
 	 */
 	// bool handled = false;
@@ -2214,15 +2359,17 @@ void MTerminalView::EnterText(const std::string &inText /* , bool inRepeat */)
 	}
 	else
 	{
-		mBuffer->ClearSelection();
+		mEmulator.GetBuffer().ClearSelection();
 
-		if (mKAM)
+		if (mEmulator.GetKAM())
 			Beep();
 		else
 		{
 			SendCommand(inText);
-			if (not mSRM)
-				mInputBuffer.insert(mInputBuffer.end(), inText.begin(), inText.end());
+			mAwaitingEcho = true;
+
+			if (not mEmulator.GetSRM())
+				mInputBuffer.Write(inText);
 
 			// force a scroll to the bottom
 			Scroll(kScrollToEnd);
@@ -2231,7 +2378,7 @@ void MTerminalView::EnterText(const std::string &inText /* , bool inRepeat */)
 		mLastBlink = {};
 		mBlinkOn = true;
 
-		if (mBuffer->IsDirty())
+		if (mEmulator.GetBuffer().IsDirty())
 			Invalidate();
 
 		ObscureCursor();
@@ -2289,6 +2436,8 @@ struct DisallowedChar
 
 bool MTerminalView::DoPaste(const std::string &inText)
 {
+	auto lock = LockEmulator();
+
 	bool result = false;
 
 	std::string text(inText);
@@ -2313,19 +2462,19 @@ bool MTerminalView::DoPaste(const std::string &inText)
 			}
 		}
 
-		mBuffer->ClearSelection();
+		mEmulator.GetBuffer().ClearSelection();
 
-		if (mKAM)
+		if (mEmulator.GetKAM())
 			Beep();
 		else
 		{
-			if (mBracketedPaste)
+			if (mEmulator.GetBracketedPaste())
 				SendCommand(kCSI + "200~" + text + kCSI + "201~");
 			else
 				SendCommand(text);
 
-			if (not mSRM)
-				mInputBuffer.insert(mInputBuffer.end(), text.begin(), text.end());
+			if (not mEmulator.GetSRM())
+				mInputBuffer.Write(text);
 
 			// force a scroll to the bottom
 			Scroll(kScrollToEnd);
@@ -2334,7 +2483,7 @@ bool MTerminalView::DoPaste(const std::string &inText)
 		mLastBlink = {};
 		mBlinkOn = true;
 
-		if (mBuffer->IsDirty())
+		if (mEmulator.GetBuffer().IsDirty())
 			Invalidate();
 
 		ObscureCursor();
@@ -2393,8 +2542,10 @@ void MTerminalView::OnEnterTOTP(int inItemIndex)
 
 void MTerminalView::OnCopy()
 {
-	MClipboard::Instance().SetData(mBuffer->GetSelectedText() /* ,
-	     mBuffer->IsSelectionBlock() */
+	auto lock = LockEmulator();
+
+	MClipboard::Instance().SetData(mEmulator.GetBuffer().GetSelectedText() /* ,
+	     mEmulator.GetBuffer().IsSelectionBlock() */
 	);
 }
 
@@ -2406,7 +2557,9 @@ void MTerminalView::OnPaste()
 
 void MTerminalView::OnSelectAll()
 {
-	mBuffer->SelectAll();
+	auto lock = LockEmulator();
+
+	mEmulator.GetBuffer().SelectAll();
 	Invalidate();
 }
 
@@ -2422,28 +2575,35 @@ void MTerminalView::OnFindPrev()
 
 void MTerminalView::OnReset()
 {
-	value_changer<int32_t> savedX(mCursor.x, mCursor.x), savedY(mCursor.y, mCursor.y);
-	Reset();
+	auto lock = LockEmulator();
+
+	mEmulator.Reset(true);
 }
 
 void MTerminalView::OnResetAndClear()
 {
-	Reset();
-	mBuffer->Clear();
+	auto lock = LockEmulator();
+
+	mEmulator.Reset();
+	mEmulator.GetBuffer().Clear();
 	Invalidate();
 }
 
 void MTerminalView::OnEncodingUtf8(bool inChecked)
 {
+	auto lock = LockEmulator();
+
 	if (inChecked)
-		mEncoding = kEncodingUTF8;
+		mEmulator.SetEncoding(kEncodingUTF8);
 	else
-		mEncoding = kEncodingISO88591;
+		mEmulator.SetEncoding(kEncodingISO88591);
 }
 
 void MTerminalView::OnBackspaceSendsDel(bool inChecked)
 {
-	mDECBKM = not inChecked;
+	auto lock = LockEmulator();
+
+	mEmulator.SetDECBKM(not inChecked);
 }
 
 void MTerminalView::OnDeleteSendsDel(bool inChecked)
@@ -2498,16 +2658,20 @@ void MTerminalView::OnSendSignalKILL()
 
 void MTerminalView::FindNext(MSearchDirection inSearchDirection)
 {
+	auto lock = LockEmulator();
+
 	int32_t l1, l2, c1, c2;
 	bool block;
 
-	mBuffer->GetSelection(l1, c1, l2, c2, block);
+	mEmulator.GetBuffer().GetSelection(l1, c1, l2, c2, block);
 
 	int32_t line, column;
 
 	bool wrapped = false, found;
 	bool ignoreCase = mSearchPanel->GetIgnoreCase();
+	bool regex = mSearchPanel->GetRegex();
 	std::string what = mSearchPanel->GetSearchString();
+	int32_t length = 0;
 
 	if (inSearchDirection == searchDown)
 	{
@@ -2526,8 +2690,8 @@ void MTerminalView::FindNext(MSearchDirection inSearchDirection)
 	{
 		if (l1 == l2 and c1 == c2)
 		{
-			line = GetTopLine() + mTerminalHeight - 1;
-			column = mTerminalWidth - 1;
+			line = GetTopLine() + mEmulator.GetHeight() - 1;
+			column = mEmulator.GetWidth() - 1;
 		}
 		else
 		{
@@ -2540,10 +2704,19 @@ void MTerminalView::FindNext(MSearchDirection inSearchDirection)
 
 	for (;;)
 	{
-		if (inSearchDirection == searchDown)
-			found = mBuffer->FindNext(line, column, what, ignoreCase, false);
-		else
-			found = mBuffer->FindPrevious(line, column, what, ignoreCase, false);
+		try
+		{
+			if (inSearchDirection == searchDown)
+				found = mEmulator.GetBuffer().FindNext(line, column, length, what, ignoreCase, regex, false);
+			else
+				found = mEmulator.GetBuffer().FindPrevious(line, column, length, what, ignoreCase, regex, false);
+		}
+		catch (const MRegexError &ex)
+		{
+			mStatusbar->SetStatusText(0, ex.what(), false);
+			Beep();
+			break;
+		}
 
 		if (found and wrapped)
 		{
@@ -2556,8 +2729,11 @@ void MTerminalView::FindNext(MSearchDirection inSearchDirection)
 
 		if (found)
 		{
-			mBuffer->SetSelection(line, column, line, column + what.length());
+			// a match may continue on the next, soft wrapped, lines
+			int32_t width = mEmulator.GetWidth(), end = column + length - 1;
+			mEmulator.GetBuffer().SetSelection(line, column, line + end / width, end % width + 1);
 			Scroll(kScrollToSelection);
+			UpdateSearchStatus();
 			break;
 		}
 
@@ -2575,16 +2751,54 @@ void MTerminalView::FindNext(MSearchDirection inSearchDirection)
 		}
 		else
 		{
-			line = mTerminalHeight - 1;
-			column = mTerminalWidth - 1;
+			line = mEmulator.GetHeight() - 1;
+			column = mEmulator.GetWidth() - 1;
+		}
+	}
+}
+
+void MTerminalView::UpdateSearchStatus()
+{
+	std::string status;
+
+	if (mSearch->GetBuffer() != nullptr)
+	{
+		std::size_t count = mSearch->GetMatchCount();
+		std::optional<std::size_t> index;
+
+		// the selection is the current match, if it is one
+		const MTerminalBuffer &buffer = mEmulator.GetBuffer();
+		if (not buffer.IsSelectionEmpty())
+		{
+			int32_t line, column;
+			buffer.GetSelectionBegin(line, column);
+			index = mSearch->GetMatchIndex(buffer.GetBufferSerial() + line, column);
 		}
+
+		if (not mSearch->GetError().empty())
+			status = mSearch->GetError();
+		else if (index.has_value())
+			status = MFormat(_("%d of %d"), static_cast<int>(*index + 1), static_cast<int>(count));
+		else if (count == 1)
+			status = _("1 match");
+		else
+			status = MFormat(_("%d matches"), static_cast<int>(count));
+
+		if (not mSearch->IsComplete())
+			status += "...";
+
+		// report the memory used by the scrollback index, if there is one
+		if (std::size_t memory = buffer.GetIndexMemoryUsage(); memory > 0)
+			status += MFormat(_(" (index %d MB)"), static_cast<int>((memory + (1 << 20) - 1) >> 20));
 	}
+
+	mStatusbar->SetStatusText(0, status, false);
 }
 
 int32_t MTerminalView::GetTopLine() const
 {
 	int32_t result = 0;
-	if (mBuffer->BufferedLines() > 0)
+	if (mEmulator.GetBuffer().BufferedLines() > 0)
 		result = mScrollbar->GetValue() - mScrollbar->GetMaxValue();
 	return result;
 }
@@ -2593,8 +2807,8 @@ void MTerminalView::AdjustScrollbar(int32_t inTopLine)
 {
 	// recalculate scrollbar values
 	int32_t min = 0;
-	int32_t max = mBuffer->BufferedLines();
-	int32_t page = mTerminalHeight;
+	int32_t max = mEmulator.GetBuffer().BufferedLines();
+	int32_t page = mEmulator.GetHeight();
 	int32_t value = max + inTopLine;
 
 	if (value < min)
@@ -2604,7 +2818,7 @@ void MTerminalView::AdjustScrollbar(int32_t inTopLine)
 
 	mScrollbar->SetAdjustmentValues(min, max + page - 1, 1, page, value);
 
-	if (mBuffer->BufferedLines() > 0)
+	if (mEmulator.GetBuffer().BufferedLines() > 0)
 		mScrollbar->Enable();
 	else
 		mScrollbar->Disable();
@@ -2612,7 +2826,9 @@ void MTerminalView::AdjustScrollbar(int32_t inTopLine)
 
 void MTerminalView::Scroll(MScrollMessage inMessage)
 {
-	if (mBuffer->BufferedLines() == 0)
+	auto lock = LockEmulator();
+
+	if (mEmulator.GetBuffer().BufferedLines() == 0)
 		return;
 
 	int32_t max = mScrollbar->GetMaxValue();
@@ -2632,14 +2848,14 @@ void MTerminalView::Scroll(MScrollMessage inMessage)
 			break;
 
 		case kScrollPageDown:
-			value += mTerminalHeight;
+			value += mEmulator.GetHeight();
 			if (value > max)
 				value = max;
 			mScrollbar->SetValue(value);
 			break;
 
 		case kScrollPageUp:
-			value -= mTerminalHeight;
+			value -= mEmulator.GetHeight();
 			if (value < min)
 				value = min;
 			mScrollbar->SetValue(value);
@@ -2654,11 +2870,11 @@ void MTerminalView::Scroll(MScrollMessage inMessage)
 			break;
 
 		case kScrollToSelection:
-			if (not mBuffer->IsSelectionEmpty())
+			if (not mEmulator.GetBuffer().IsSelectionEmpty())
 			{
 				int32_t lb, le, cb, ce;
 				bool block;
-				mBuffer->GetSelection(lb, cb, le, ce, block);
+				mEmulator.GetBuffer().GetSelection(lb, cb, le, ce, block);
 
 				bool forceCenter = false;
 
@@ -2668,7 +2884,7 @@ void MTerminalView::Scroll(MScrollMessage inMessage)
 				else if (lb < minLine)
 					forceCenter = true;
 
-				int32_t maxLine = minLine + mTerminalHeight;
+				int32_t maxLine = minLine + mEmulator.GetHeight();
 				if (lb == maxLine and lb < 0)
 					mScrollbar->SetValue(max + lb);
 				else if (lb > maxLine)
@@ -2676,7 +2892,7 @@ void MTerminalView::Scroll(MScrollMessage inMessage)
 
 				if (forceCenter)
 				{
-					value = max + (lb - mTerminalHeight / 3);
+					value = max + (lb - mEmulator.GetHeight() / 3);
 					if (value > max)
 						value = max;
 					if (value < min)
@@ -2723,6 +2939,8 @@ MRect MTerminalView::GetIdealTerminalBounds(uint32_t inColumns, uint32_t inRows)
 
 void MTerminalView::ResizeFrame(int32_t inWidthDelta, int32_t inHeightDelta)
 {
+	auto lock = LockEmulator();
+
 	MCanvas::ResizeFrame(inWidthDelta, inHeightDelta);
 
 	MRect bounds = GetBounds();
@@ -2737,37 +2955,24 @@ void MTerminalView::ResizeFrame(int32_t inWidthDelta, int32_t inHeightDelta)
 	int32_t w = static_cast<int32_t>((bounds.width - 2 * kBorderWidth) / dev.GetXWidth());
 	int32_t h = static_cast<int32_t>((bounds.height - 2 * kBorderWidth) / dev.GetLineHeight());
 
-	if (mDECSSDT > 0)
+	if (mEmulator.GetDECSSDT() > 0)
 		h -= 1;
 
-	if (w != mTerminalWidth or h != mTerminalHeight)
+	if (w != mEmulator.GetWidth() or h != mEmulator.GetHeight())
 		ResizeTerminal(w, h, false, false);
 }
 
 void MTerminalView::SendCommand(std::string inData)
 {
-	if (mTerminalChannel->IsOpen())
-	{
-		if (mS8C1T)
-		{
-			ReplaceAll(inData, "\033D", "\204");  // IND
-			ReplaceAll(inData, "\033E", "\205");  // NEL
-			ReplaceAll(inData, "\033H", "\210");  // HTS
-			ReplaceAll(inData, "\033M", "\215");  // RI
-			ReplaceAll(inData, "\033N", "\216");  // SS2
-			ReplaceAll(inData, "\033O", "\217");  // SS3
-			ReplaceAll(inData, "\033P", "\220");  // DCS
-			ReplaceAll(inData, "\033[", "\233");  // CSI
-			ReplaceAll(inData, "\033\\", "\234"); // ST
-			ReplaceAll(inData, "\033]", "\235");  // OSC
-		}
+	auto lock = LockEmulator();
 
-		mTerminalChannel->SendData(std::move(inData));
-	}
+	mEmulator.SendCommand(std::move(inData));
 }
 
 void MTerminalView::SendMouseCommand(int32_t inButton, int32_t inX, int32_t inY, uint32_t inModifiers)
 {
+	auto lock = LockEmulator();
+
 	int32_t line, column;
 	GetCharacterForPosition(inX, inY, line, column);
 
@@ -2808,9 +3013,9 @@ void MTerminalView::SendMouseCommand(int32_t inButton, int32_t inX, int32_t inY,
 
 void MTerminalView::Opened()
 {
-	cEnterTOTP.SetEnabled(true);
+	auto lock = LockEmulator();
 
-	value_changer<int32_t> x(mCursor.x, 0), y(mCursor.y, 0);
+	cEnterTOTP.SetEnabled(true);
 
 	mStatusbar->SetStatusText(0, _("Connected"), false);
 
@@ -2821,7 +3026,7 @@ void MTerminalView::Opened()
 		mStatusbar->SetStatusText(1, info[0], false);
 	}
 
-	Reset();
+	mEmulator.Reset(true);
 	// EraseInDisplay(2);
 	Invalidate();
 
@@ -2846,7 +3051,10 @@ void MTerminalView::Closed()
 	Invalidate();
 	const char kReconnectMsg[] = "\r\nPress enter or space to reconnect\r\n";
 	std::string reconnectMsg = _(kReconnectMsg);
-	mInputBuffer.insert(mInputBuffer.end(), reconnectMsg.begin(), reconnectMsg.end());
+	{
+		auto lock = LockEmulator();
+		mInputBuffer.Write(reconnectMsg);
+	}
 
 	mStatusbar->SetStatusText(1, "", false);
 
@@ -2888,8 +3096,10 @@ void MTerminalView::HandleOpened(const std::error_code &ec)
 
 	if (ec)
 	{
-		const std::string &msg = ec.message();
-		mInputBuffer.insert(mInputBuffer.end(), msg.begin(), msg.end());
+		{
+			auto lock = LockEmulator();
+			mInputBuffer.Write(ec.message());
+		}
 
 		Closed();
 
@@ -2904,45 +3114,43 @@ void MTerminalView::HandleOpened(const std::error_code &ec)
 		// 	// TODO: Implement
 		// }
 
-		mTerminalChannel->ReadData([this](std::error_code ec, std::streambuf &inData)
-			{ this->HandleReceived(ec, inData); });
+		ReadData();
 	}
 
 	cEnterTOTP.SetEnabled(mTerminalChannel->IsOpen());
 }
 
-void MTerminalView::HandleReceived(const std::error_code &ec, std::streambuf &inData)
+void MTerminalView::ReadData()
+{
+	mReadSuspended = false;
+
+	mTerminalChannel->ReadData(mInputBuffer, [this](std::error_code ec, std::size_t inBytesReceived)
+		{ this->HandleReceived(ec, inBytesReceived); });
+}
+
+void MTerminalView::HandleReceived(const std::error_code &ec, std::size_t inBytesReceived)
 {
 	// PRINT_THREAD_ID;
 
+	auto lock = LockEmulator();
+
+	// The data was read directly into mInputBuffer
+	mInputBuffer.Commit(inBytesReceived);
+
 	if (ec)
 	{
-		const std::string &msg = ec.message();
-		mInputBuffer.insert(mInputBuffer.end(), msg.begin(), msg.end());
+		mInputBuffer.Write(ec.message());
 
 		Closed();
 	}
 	else
 	{
-		// #ifndef NDEBUG
-		// 		pinch::blob b;
-
-		// 		while (inData.in_avail() > 0)
-		// 			b.insert(b.end(), inData.sbumpc());
-
-		// 		pinch::print(std::cerr, b);
-
-		// 		mInputBuffer.insert(mInputBuffer.end(), b.begin(), b.end());
-
-		// 			// mInputBuffer.push_back(inData.sbumpc());
-
-		// #else
-		while (inData.in_avail() > 0)
-			mInputBuffer.push_back(inData.sbumpc());
-		// #endif
-
-		mTerminalChannel->ReadData([this](std::error_code ec, std::streambuf &inData)
-			{ this->HandleReceived(ec, inData); });
+		// Start reading the next chunk, unless the emulator falls behind.
+		// Idle resumes reading once it caught up.
+		if (mInputBuffer.Size() < kMaxInputSize)
+			ReadData();
+		else
+			mReadSuspended = true;
 
 		Idle();
 	}
@@ -2951,2929 +3159,87 @@ void MTerminalView::HandleReceived(const std::error_code &ec, std::streambuf &in
 // --------------------------------------------------------------------
 //
 
-void MTerminalView::EraseInDisplay(uint32_t inMode, bool inSelective)
+void MTerminalView::Animate()
 {
-	mBuffer->EraseDisplay(mCursor.y, mCursor.x, inMode, inSelective);
+	Invalidate();
 }
 
-void MTerminalView::EraseInLine(uint32_t inMode, bool inSelective)
+void MTerminalView::Beep()
 {
-	mBuffer->EraseLine(mCursor.y, mCursor.x, inMode, inSelective);
-}
+	using namespace std::chrono_literals;
 
-void MTerminalView::ScrollForward()
-{
-	if (mDECSCLM)
-	{
-		mNextSmoothScroll = std::chrono::system_clock::now() + kSmoothScrollDelay;
-		mScrollForward = true;
-	}
-	else
+	auto now = std::chrono::system_clock::now();
+	bool beeped = false;
+
+	if (mGraphicalBeep and now - mLastBeep > 250ms)
 	{
-		mBuffer->ScrollForward(mMarginTop, mMarginBottom, mMarginLeft, mMarginRight);
-		++mScrollForwardCount;
+		if (mAnimationManager->Update())
+			PRINT(("duh"));
+
+		MStoryboard *storyboard = mAnimationManager->CreateStoryboard();
+		storyboard->AddTransition(mGraphicalBeep, 0.75, 75ms, "acceleration-decelleration");
+		storyboard->AddTransition(mGraphicalBeep, 0.00, 75ms, "acceleration-decelleration");
+		mAnimationManager->Schedule(storyboard);
+
+		beeped = true;
 	}
-}
 
-void MTerminalView::ScrollBackward()
-{
-	if (mDECSCLM)
+	if (mAudibleBeep and now - mLastBeep > 500ms)
 	{
-		mNextSmoothScroll = std::chrono::system_clock::now() + kSmoothScrollDelay;
-		mScrollForward = false;
+		PlaySound("bell");
+		beeped = true;
 	}
-	else
-		mBuffer->ScrollBackward(mMarginTop, mMarginBottom, mMarginLeft, mMarginRight);
-}
 
-void MTerminalView::WriteChar(unicode inChar)
-{
-	MTerminalBuffer *buffer = mDECSASD ? &mStatusLineBuffer : mBuffer;
+	if (beeped)
+		mLastBeep = now;
+}
 
-	int32_t mr = mCursor.DECOM ? mMarginRight : mTerminalWidth - 1;
-	int32_t ml = mCursor.DECOM ? mMarginLeft : 0;
-	int32_t mb = mCursor.DECOM ? mMarginBottom : mTerminalHeight - 1;
+// --------------------------------------------------------------------
 
-	if (mCursor.x >= mr + 1)
+void MTerminalView::DownloadFile(const std::filesystem::path &path)
+{
+	if (mTerminalChannel->CanDownloadFiles())
 	{
-		if (mCursor.DECAWM)
+		auto lambda = [path, channel = mTerminalChannel](std::filesystem::path inLocalFile, bool inReplace = true)
 		{
-			buffer->WrapLine(mCursor.y);
-			if (mCursor.y < mb)
-				++mCursor.y;
-			else
-				ScrollForward();
+			if (not inReplace)
+			{
+				auto filename = path.filename();
+				auto dir = inLocalFile.parent_path();
+				for (std::size_t i = 1; std::filesystem::exists(inLocalFile); ++i)
+					inLocalFile = dir / (filename.stem().string() + "-(" + std::to_string(i) + ")" + filename.extension().string());
+			}
 
-			mCursor.x = ml;
-		}
+			channel->DownloadFile(path, inLocalFile);
+		};
+
+		if (MPrefs::GetBoolean("always-ask-download-dir", false))
+			MFileDialogs::SaveFileAs(GetWindow(), path, std::move(lambda));
 		else
-			mCursor.x = mr;
+			lambda(GetDownloadDirectory() / path.filename(), false);
 	}
-
-	if (mIRM)
-		buffer->InsertCharacter(mCursor.y, mCursor.x);
-
-	buffer->SetCharacter(mCursor.y, mCursor.x, inChar, mCursor.style, mHyperLink);
-
-	++mCursor.x;
-
-	mLastChar = inChar;
 }
 
-void MTerminalView::MoveCursor(MCursorMovement inDirection)
+void MTerminalView::UploadFile(const std::filesystem::path &path)
 {
-	int32_t x = mCursor.x, y = mCursor.y;
-
-	switch (inDirection)
+	if (mTerminalChannel->CanDownloadFiles())
 	{
-		case kMoveUp:
-			if (mCursor.y > mMarginTop or (mCursor.y < mMarginTop and mCursor.y > 0))
-				--mCursor.y;
-			break;
-
-		case kMoveDown:
-			if (mCursor.y < mMarginBottom or (mCursor.y > mMarginBottom and mCursor.y < mTerminalHeight - 1))
-				++mCursor.y;
-			break;
+		MFileDialogs::ChooseOneFile(GetWindow(), [path, channel = mTerminalChannel](std::filesystem::path file)
+			{ channel->UploadFile(path, file); });
+	}
+}
 
-		case kMoveRight:
-			if (mCursor.x < mMarginRight or (mCursor.x > mMarginRight and mTerminalWidth - 1))
-				++mCursor.x;
-			break;
+// --------------------------------------------------------------------
 
-		case kMoveLeft:
-			if (mCursor.x >= mTerminalWidth - 1)
-				mCursor.x = mTerminalWidth - 1 - 1;
-			else if (mCursor.x > mMarginLeft or (mCursor.x < mMarginLeft and mCursor.x > 0))
-				--mCursor.x;
-			break;
+void MTerminalView::LinkClicked(std::string inLink)
+{
+	auto lock = LockEmulator();
 
-		case kMoveIND:
-			if (mCursor.y < mMarginBottom)
-				++mCursor.y;
-			else if (mCursor.y == mMarginBottom)
-				ScrollForward();
-			break;
+	try
+	{
+		zeep::http::uri uri(inLink);
 
-		// same as MoveUp
-		case kMoveRI:
-			if (mCursor.y > mMarginTop)
-				--mCursor.y;
-			else if (mCursor.y == mMarginTop)
-				ScrollBackward();
-			break;
-
-		case kMoveLF:
-			if (mCursor.y < mMarginBottom)
-				++mCursor.y;
-			else if (mCursor.y == mMarginBottom)
-				ScrollForward();
-			break;
-
-		case kMoveCR:
-			mCursor.x = mMarginLeft;
-			break;
-
-		case kMoveCRLF:
-			mCursor.x = mMarginLeft;
-			if (mCursor.y < mMarginBottom)
-				++mCursor.y;
-			else if (mCursor.y == mMarginBottom)
-				ScrollForward();
-			break;
-
-		case kMoveHT:
-			while (mCursor.x < mMarginRight)
-			{
-				++mCursor.x;
-				if (mTabStops[mCursor.x])
-					break;
-				mBuffer->SetIsTab(mCursor.y, mCursor.x, true);
-			}
-			break;
-
-		case kMoveCBT:
-			while (mCursor.x > mMarginLeft)
-			{
-				--mCursor.x;
-				if (mTabStops[mCursor.x])
-					break;
-			}
-			break;
-
-		case kMoveBI:
-			if (mCursor.x > mMarginLeft)
-				--mCursor.x;
-			else if (mCursor.x >= 0)
-				mBuffer->InsertCharacter(mCursor.y, mMarginLeft, mMarginRight);
-			break;
-
-		case kMoveFI:
-			if (mCursor.x < mMarginRight - 1)
-				++mCursor.x;
-			else if (mCursor.x < mTerminalWidth)
-				mBuffer->DeleteCharacter(mCursor.y, mMarginLeft, mMarginRight);
-			break;
-
-		case kMoveSL:
-			for (int32_t line = 0; line < mTerminalHeight; ++line)
-				mBuffer->DeleteCharacter(line, mMarginLeft, mMarginRight);
-			if (mCursor.x > 0)
-				--mCursor.x;
-			break;
-
-		case kMoveSR:
-			for (int32_t line = 0; line < mTerminalHeight - 1; ++line)
-				mBuffer->InsertCharacter(line, mMarginLeft, mMarginRight);
-			if (mCursor.x < mMarginRight)
-				++mCursor.x;
-			break;
-	}
-
-	if (x != mCursor.x or y != mCursor.y)
-		mBuffer->SetDirty(true);
-}
-
-void MTerminalView::MoveCursorTo(int32_t inX, int32_t inY)
-{
-	if (mCursor.DECOM)
-	{
-		inX += mMarginLeft;
-		inY += mMarginTop;
-	}
-
-	if (inX < 0)
-		inX = 0;
-	if (inX > mTerminalWidth - 1)
-		inX = mTerminalWidth - 1;
-
-	if (inY < 0)
-		inY = 0;
-	if (inY > mTerminalHeight - 1)
-		inY = mTerminalHeight - 1;
-
-	if (mCursor.DECOM)
-	{
-		if (inY < mMarginTop)
-			inY = mMarginTop;
-		if (inY > mMarginBottom)
-			inY = mMarginBottom;
-
-		if (inX < mMarginLeft)
-			inX = mMarginLeft;
-		if (inX > mMarginRight)
-			inX = mMarginRight;
-	}
-
-	if (mCursor.x != inX or mCursor.y != inY)
-	{
-		mCursor.x = inX;
-		mCursor.y = inY;
-
-		if (mCursor.y > mTerminalHeight - 1)
-			mCursor.y = mTerminalHeight - 1;
-
-		mBuffer->SetDirty(true);
-	}
-}
-
-void MTerminalView::SetTabstop()
-{
-	if (mCursor.x < mTerminalWidth)
-		mTabStops[mCursor.x] = true;
-}
-
-void MTerminalView::Emulate()
-{
-	while (not mInputBuffer.empty())
-	{
-		// break on a smooth scroll event
-		if (mNextSmoothScroll.has_value())
-			break;
-
-#if DEBUG
-		if (mDebugUpdate and mBuffer->IsDirty())
-		{
-			Invalidate();
-			GetWindow()->UpdateNow();
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
-		}
-#endif
-		// process bytes. We try to keep this code UTF-8 savvy
-		uint8_t ch = mInputBuffer.front();
-		mInputBuffer.pop_front();
-
-		// start by testing if this byte is a control code
-		// The C1 control codes are never leading bytes in a UTF-8
-		// sequence and so we can easily check for them here.
-
-		if (ch < 0x20 or ch == 0x7f or // a C0 control code
-		                               // or a C1 control code
-			(mDECSCL >= 2 and mS8C1T and (ch & 0xe0) == 0x80))
-		{
-			if (mLastCtrl)
-				mLastChar = 0;
-			mLastCtrl = true;
-
-			// shortcut, do not process control code if in a DCS or OSC std::string
-			if (ch != ESC)
-			{
-				switch (mEscState)
-				{
-					case eDCS:
-						EscapeDCS(ch);
-						continue;
-					case eOSC:
-						EscapeOSC(ch);
-						continue;
-					default:
-						break;
-				}
-			}
-
-			switch (ch)
-			{
-				case ENQ:
-				{
-					std::string answer_back = MPrefs::GetString("answer-back", "salt");
-					for (auto p = answer_back.find_first_of("\r\n"); p != std::string::npos; p = answer_back.find_first_of("\n\r", p))
-						answer_back.erase(answer_back.begin() + p);
-					mTerminalChannel->SendData(answer_back);
-					break;
-				}
-
-				case BEL:
-					if (mEscState == eOSC)
-						EscapeOSC(ch);
-					else
-						Beep();
-					break;
-
-				case BS:
-					MoveCursor(kMoveLeft);
-					break;
-				case HT:
-					MoveCursor(kMoveHT);
-					break;
-				case LF:
-				case VT:
-				case FF:
-					MoveCursor(mLNM ? kMoveCRLF : kMoveLF);
-					break;
-				case CR:
-					MoveCursor(kMoveCR);
-					break;
-				case SO:
-					mCursor.CSGL = 1;
-					break;
-				case SI:
-					mCursor.CSGL = 0;
-					break;
-				case SUB:
-					WriteChar(0x00bf /*¿*/); // fall through
-				case CAN:
-					mEscState = eESC_NONE;
-					break;
-
-				case ESC:
-					// If we're processing an escape std::string and then receive an escape
-					// this can either mean the beginning of a new escape std::string cancelling
-					// the previous, or it may be the start of a ST or BEL sequence.
-					// The latter can only occur when 8 bit controls are in use.
-
-					if (mDECSCL >= 2 and mS8C1T)
-						mEscState = eESC_SEEN;
-					else
-					{
-						switch (mEscState)
-						{
-							case eDCS:
-								mEscState = eDCS_ESC;
-								break;
-							case eOSC:
-								mEscState = eOSC_ESC;
-								break;
-							case ePM:
-								mEscState = ePM_ESC;
-								break;
-							case eAPC:
-								mEscState = eAPC_ESC;
-								break;
-							default:
-								mEscState = eESC_SEEN;
-								break;
-						}
-					}
-					break;
-
-				case IND:
-					MoveCursor(kMoveIND);
-					break;
-				case NEL:
-					MoveCursor(kMoveCRLF);
-					break;
-				case HTS:
-					SetTabstop();
-					break;
-				case RI:
-					MoveCursor(kMoveRI);
-					break;
-				case SS2:
-					mCursor.SS = 2;
-					break;
-				case SS3:
-					mCursor.SS = 3;
-					break;
-				case DCS:
-					mPFKKeyNr = 0;
-					mEscState = eDCS;
-					break;
-				case OSC:
-					mEscState = eOSC;
-					break;
-				case CSI:
-					mEscState = eCSI;
-					break;
-				case PM:
-					mEscState = ePM;
-					break;
-
-				case ST:
-					switch (mEscState)
-					{
-						case eDCS:
-							EscapeDCS(ch);
-							break;
-						case eOSC:
-							EscapeOSC(ch);
-							break;
-						case ePM:
-							mEscState = eESC_NONE;
-							break;
-						case eAPC:
-							mEscState = eESC_NONE;
-							break;
-						default:
-							break;
-					}
-					break;
-
-				default: /* ignore */
-					break;
-			}
-
-			continue;
-		}
-
-		// If we're processing an escape sequence, feed the byte to the processor.
-
-		if (mEscState != eESC_NONE)
-		{
-			if (mEscState == eDCS_ESC or mEscState == ePM_ESC or mEscState == eAPC_ESC or mEscState == eOSC_ESC)
-			{
-				if (ch == '\\')
-				{
-					if (mEscState == eDCS_ESC)
-						EscapeDCS(ST);
-					else if (mEscState == eOSC_ESC)
-						EscapeOSC(ST);
-					mEscState = eESC_NONE;
-				}
-				else if (mDECANM)
-					EscapeStart(ch);
-				else
-					EscapeVT52(ch);
-
-				continue;
-			}
-
-			// OK, so we're in the middle of an escape std::string
-			switch (mEscState)
-			{
-				case eESC_SEEN:
-					if (mDECANM)
-						EscapeStart(ch);
-					else
-						EscapeVT52(ch);
-					break;
-
-				case eCSI:
-					EscapeCSI(ch);
-					break;
-				case eOSC:
-					EscapeOSC(ch);
-					break;
-				case eDCS:
-					EscapeDCS(ch);
-					break;
-				case ePM: /* ignore */
-					break;
-
-				case eAPC:
-					EscapeAPC(ch);
-					break;
-
-				case eSELECT_CHAR_SET:
-					SelectCharSet(ch);
-					break;
-				case eSELECT_CTRL_TRANSM:
-					SelectControlTransmission(ch);
-					break;
-				case eSELECT_DOUBLE:
-					SelectDouble(ch);
-					break;
-
-				// special VT52 handling
-				case eVT52_LINE:
-					mArgs.push_back(ch - US);
-					mEscState = eVT52_COLUMN;
-					break;
-
-				case eVT52_COLUMN:
-					MoveCursorTo((ch - US) - 1, mArgs[0] - 1);
-					mEscState = eESC_NONE;
-					break;
-
-				default:
-					assert(false); // now what?
-			}
-
-			continue; // ignore anything else, we're in an escape std::string
-		}
-
-		mLastCtrl = false;
-
-		// No control character and no escape sequence, so we have to write
-		// this character to the screen.
-		unicode uc = ch;
-
-		// if it is an ascii character, std::map it using GL
-		if (ch >= 32 and ch < 127) // GL
-		{
-			int set = mCursor.CSGL;
-			if (mCursor.SS != 0)
-				set = mCursor.SS;
-			uc = mCursor.charSetG[set][ch - 32];
-		}
-		else // GR
-		{    // no ascii, see if NRC is in use
-			if (mDECNRCM)
-			{
-				int set = mCursor.CSGR;
-				if (mCursor.SS != 0)
-					set = mCursor.SS;
-				uc = mCursor.charSetG[set][ch - 32 - 128];
-			}
-			else // no NRC, maybe the data should be interpreted as UTF-8
-			{
-				if (mEncoding == kEncodingUTF8)
-				{
-					uint32_t len = 1;
-					if ((ch & 0x0E0) == 0x0C0)
-						len = 2;
-					else if ((ch & 0x0F0) == 0x0E0)
-						len = 3;
-					else if ((ch & 0x0F8) == 0x0F0)
-						len = 4;
-
-					// be safe, in case the text in the buffer is too short for a valid UTF-8 character
-					// just wait until we receive some more.
-					mInputBuffer.push_front(ch);
-					if (mInputBuffer.size() < len)
-						break;
-
-					static MEncodingTraits<kEncodingUTF8> traits;
-					traits.ReadUnicode(mInputBuffer.begin(), len, uc);
-
-					while (len-- > 0)
-						mInputBuffer.pop_front();
-				}
-				else
-					uc = MUnicodeMapping::GetUnicode(kEncodingISO88591, ch);
-			}
-		}
-
-		// reset the single shift code
-		mCursor.SS = 0;
-
-		// and write the final unicode to the screen
-		WriteChar(uc);
-	}
-}
-
-inline uint32_t MTerminalView::GetParam(uint32_t inParamNr, uint32_t inDefault)
-{
-	uint32_t result = inDefault;
-	if (inParamNr < mArgs.size())
-		result = mArgs[inParamNr];
-	return result;
-}
-
-void MTerminalView::GetRectParam(uint32_t inParamOffset, int32_t &outTop, int32_t &outLeft, int32_t &outBottom, int32_t &outRight)
-{
-	//	int32_t dx = mCursor.DECOM ? mMarginLeft : 0;
-	//	int32_t dy = mCursor.DECOM ? mMarginTop : 0;
-
-	outTop = GetParam(inParamOffset + 0, 1) - 1;
-	outLeft = GetParam(inParamOffset + 1, 1) - 1;
-	outBottom = GetParam(inParamOffset + 2, mTerminalHeight) - 1;
-	outRight = GetParam(inParamOffset + 3, mTerminalWidth) - 1;
-
-	if (mCursor.DECOM)
-	{
-		outTop += mMarginTop;
-		outLeft += mMarginLeft;
-		outBottom += mMarginTop;
-		outRight += mMarginLeft;
-
-		if (outTop < mMarginTop)
-			outTop = mMarginTop;
-		if (outLeft < mMarginLeft)
-			outLeft = mMarginLeft;
-		if (outBottom > mMarginBottom)
-			outBottom = mMarginBottom;
-		if (outRight > mMarginRight)
-			outRight = mMarginRight;
-	}
-}
-
-void MTerminalView::EscapeVT52(uint8_t inChar)
-{
-	mEscState = eESC_NONE;
-	mArgs.clear();
-	mState = 0;
-
-	switch (inChar)
-	{
-		case '<':
-			mDECANM = true;
-			mDECSCL = 1;
-			break;
-		case 'A':
-			MoveCursor(kMoveUp);
-			break;
-		case 'B':
-			MoveCursor(kMoveDown);
-			break;
-		case 'C':
-			MoveCursor(kMoveRight);
-			break;
-		case 'D':
-			MoveCursor(kMoveLeft);
-			break;
-		case 'H':
-			MoveCursorTo(0, 0);
-			break;
-		case 'Y':
-			mEscState = eVT52_LINE;
-			break;
-		case 'I':
-			MoveCursor(kMoveRI);
-			break;
-		case '=':
-			mDECNMK = true;
-			break;
-		case '>':
-			mDECNMK = false;
-			break;
-		case 'F':
-			mCursor.CSGL = 1;
-			break;
-		case 'G':
-			mCursor.CSGL = 0;
-			break;
-		case 'K':
-			EraseInLine(0);
-			break;
-		case 'J':
-			EraseInDisplay(0);
-			break;
-		case 'W':
-		case 'X':
-		case 'V':
-		case ']':  /* ignore */
-			break; // printing controls
-		case 'Z':
-			SendCommand("\033/Z");
-			break;
-	}
-}
-
-void MTerminalView::EscapeStart(uint8_t inChar)
-{
-	mEscState = eESC_NONE;
-	mArgs.clear();
-	mState = 0;
-
-	switch (inChar)
-	{
-		// VT100 escape codes
-		case '<':
-			mDECANM = true;
-			break;
-		case '=':
-			mDECNMK = true; /* DECKNAM */
-			break;
-		case '>':
-			mDECNMK = false; /* DECKPNM */
-			break;
-		case 'D':
-			MoveCursor(kMoveIND);
-			break;
-		case 'E':
-			MoveCursor(kMoveCRLF);
-			break;
-		case 'H':
-			SetTabstop();
-			break;
-		case 'M':
-			MoveCursor(kMoveRI);
-			break;
-		case 'N':
-			mCursor.SS = 2;
-			break;
-		case 'O':
-			mCursor.SS = 3;
-			break;
-		case '7':
-			SaveCursor();
-			break;
-		case '8':
-			RestoreCursor();
-			break;
-		case '(':
-			mArgs.push_back(0);
-			mArgs.push_back(94);
-			mEscState = eSELECT_CHAR_SET;
-			break;
-		case ')':
-			mArgs.push_back(1);
-			mArgs.push_back(94);
-			mEscState = eSELECT_CHAR_SET;
-			break;
-		case '#':
-			mEscState = eSELECT_DOUBLE;
-			break;
-		case '[':
-			mEscState = eCSI;
-			break;
-		case 'Z':
-			SendCommand(kVT420Attributes);
-			break;
-		case 'c':
-			Reset();
-			break;
-		case '_':
-			mEscState = eAPC;
-			break;
-
-		// VT220 escape codes
-		case 'P':
-			mPFKKeyNr = 0;
-			mEscState = eDCS;
-			break;
-		case '*':
-			mArgs.push_back(2);
-			mArgs.push_back(94);
-			mEscState = eSELECT_CHAR_SET;
-			break;
-		case '+':
-			mArgs.push_back(3);
-			mArgs.push_back(94);
-			mEscState = eSELECT_CHAR_SET;
-			break;
-		case '~':
-			mCursor.CSGR = 1;
-			break;
-		case 'n':
-			mCursor.CSGL = 2;
-			break;
-		case '}':
-			mCursor.CSGR = 2;
-			break;
-		case 'o':
-			mCursor.CSGL = 3;
-			break;
-		case '|':
-			mCursor.CSGR = 3;
-			break;
-		case ' ':
-			mEscState = eSELECT_CTRL_TRANSM;
-			break;
-
-		// VT320 escape codes
-		case '6':
-			MoveCursor(kMoveBI);
-			break;
-		case '9':
-			MoveCursor(kMoveFI);
-			break;
-
-		case '-':
-			mArgs.push_back(1);
-			mArgs.push_back(96);
-			mEscState = eSELECT_CHAR_SET;
-			break;
-		case '.':
-			mArgs.push_back(2);
-			mArgs.push_back(96);
-			mEscState = eSELECT_CHAR_SET;
-			break;
-		case '/':
-			mArgs.push_back(3);
-			mArgs.push_back(96);
-			mEscState = eSELECT_CHAR_SET;
-			break;
-
-		// xterm support
-		case ']':
-			mEscState = eOSC;
-			break;
-		case '%':
-			mArgs.push_back(4);
-			mArgs.push_back(94);
-			mEscState = eSELECT_CHAR_SET;
-			break;
-
-		case 'V':
-			mCursor.style.SetFlag(kProtected);
-			break;
-		case 'W':
-			mCursor.style.ClearFlag(kProtected);
-			break;
-
-		// unimplemented for now
-		case 'l': /* Memory Lock */
-			break;
-		case 'm': /* Memory Unlock */
-			break;
-		case '^': /* privacy message */
-			break;
-		case 'X': /* Start of std::string */
-			break;
-
-		default: /* ignore */
-			break;
-	}
-}
-
-void MTerminalView::EscapeCSI(uint8_t inChar)
-{
-	if (mState == 0)
-	{
-#ifndef NDEBUG
-		mCtrlSeq.clear();
-#endif
-		mCSICmd = 0;
-		mArgs.clear();
-		mArgs.push_back(0);
-		mState = 1;
-	}
-
-#ifndef NDEBUG
-	mCtrlSeq += inChar;
-#endif
-
-	if (inChar >= '0' and inChar <= '9')
-		mArgs.back() = mArgs.back() * 10 + (inChar - '0');
-	else if (inChar == ';')
-		mArgs.push_back(0);
-	else if (inChar >= ' ' and inChar <= '?')
-		mCSICmd = mCSICmd << 8 | uint8_t(inChar);
-	else if (not(inChar >= '0' and inChar <= '~'))
-		mEscState = eESC_NONE; // error
-	else
-	{
-		mEscState = eESC_NONE;
-		mCSICmd = mCSICmd << 8 | uint8_t(inChar);
-
-		MCSICmd cmd = static_cast<MCSICmd>(mCSICmd);
-
-		// PRINT(("CSI: %s (%x)", mCtrlSeq.c_str(), mCSICmd));
-
-		if (mDECSCL > 1)
-			ProcessCSILevel4(cmd);
-		else
-			ProcessCSILevel1(cmd);
-	}
-}
-
-void MTerminalView::ProcessCSILevel1(uint32_t inCmd)
-{
-	uint32_t n = GetParam(0, 1);
-	if (n == 0)
-		n = 1;
-
-	switch (inCmd)
-	{
-		// CBT -- Cursor Backward Tabulation
-		case eCBT:
-			while (n-- > 0)
-				MoveCursor(kMoveCBT);
-			break;
-		// CHA -- Cursor Horizontal Absolute
-		case eCHA:
-			MoveCursorTo(GetParam(0, 1) - 1, mCursor.y);
-			break;
-		// CHT -- Cursor Horizontal Forward Tab
-		case eCHT:
-			while (n-- > 0)
-				MoveCursor(kMoveHT);
-			break;
-		// CNL -- Cursor Next Line
-		case eCNL:
-			while (n-- > 0)
-			{
-				MoveCursor(kMoveCRLF);
-			}
-			break;
-		// CPL -- Cursor Previous Line
-		case eCPL:
-			while (n-- > 0)
-			{
-				MoveCursor(kMoveCR);
-				MoveCursor(kMoveUp);
-			}
-			break;
-		// CUB -- Cursor Backward
-		case eCUB:
-			while (n-- > 0)
-				MoveCursor(kMoveLeft);
-			break;
-		// CUD -- Cursor Down
-		case eCUD:
-			while (n-- > 0)
-				MoveCursor(kMoveDown);
-			break;
-		// CUF -- Cursor Forward
-		case eCUF:
-			while (n-- > 0)
-				MoveCursor(kMoveRight);
-			break;
-		// CUP -- Cursor Position
-		case eCUP:
-			MoveCursorTo(GetParam(1, 1) - 1, GetParam(0, 1) - 1);
-			break;
-		// CUU -- Cursor Up
-		case eCUU:
-			while (n-- > 0)
-				MoveCursor(kMoveUp);
-			break;
-		// DA1 -- Response to Device Attributes
-		case eDA1:
-			SendCommand(kVT420Attributes);
-			break;
-		// DA2 -- Secondary Device Attributes
-		case eDA2:
-			SendCommand("\033[>64;278;1c"); /* compatible with xterm version 278? `*/
-			break;
-		// DA3 -- Tertiary Device Attributes
-		case eDA3:
-			SendCommand("\033P!|00000000\033\\");
-			break;
-
-		// DCH -- Delete Character
-		case eDCH:
-			if (not CursorIsInMargins())
-				break;
-			while (n-- > 0)
-				mBuffer->DeleteCharacter(mCursor.y, mCursor.x, mMarginRight + 1);
-			break;
-
-		// DECCOLM -- Set columns per page
-		case eDECCOLM:
-		{
-			int w = GetParam(0, 0);
-			if (w == 0)
-				w = 80;
-			if (w > 10 and w < 1000) // sensible values please
-				ResizeTerminal(w, mTerminalHeight, true);
-			mDECVSSM = false;
-			mMarginLeft = 0;
-			mMarginRight = mTerminalWidth - 1;
-			// TODO clear status line if host writable
-			break;
-		}
-
-		// DL -- Delete Line(s)
-		case eDL:
-			if (not CursorIsInMargins())
-				break;
-			while (n-- > 0)
-				mBuffer->ScrollForward(mCursor.y, mMarginBottom, mMarginLeft, mMarginRight);
-			break;
-
-		// DSR1 -- Device Status Report ANSI
-		case eDSR1:
-			switch (mArgs[0])
-			{
-				case 5:
-					SendCommand("\033[0n");
-					break; // terminal OK
-				case 6:
-					SendCommand(MFormat("\033[%d;%dR", mCursor.y + 1, mCursor.x + 1));
-					break;
-				case 15:
-					SendCommand("\033[?13n");
-					break; // we have no printer
-				case 25:
-					SendCommand(MFormat("\033[?2%dn", mPFK != nullptr and mPFK->locked));
-					break;
-				// TODO: Find out the keyboard layout
-				case 26:
-					SendCommand("\033[?27;0n");
-					break; // report an unknown keyboard for now
-			}
-			break;
-		// DSR2 -- Device Status Report DEC
-		case eDSR2:
-			switch (GetParam(0, 0))
-			{
-				case 6:
-					SendCommand(MFormat("\033[?%d;%d;1R", mCursor.y + 1, mCursor.x + 1));
-					break;
-				case 15:
-					SendCommand("\033[?11n");
-					break;
-				case 25:
-					SendCommand(MFormat("\033[?2%dn", mPFK != nullptr and mPFK->locked));
-					break;
-				case 26:
-					SendCommand("\033[?27;1n");
-					break; // report a US keyboard for now
-				case 53:
-					SendCommand("\033[?50n");
-					break; // No locator
-			}
-			break;
-		// ED -- Erase in Display
-		case eED:
-			EraseInDisplay(GetParam(0, 0), false);
-			break;
-		// EL -- Erase in Line
-		case eEL:
-			EraseInLine(GetParam(0, 0), false);
-			break;
-		// HPA -- Horizontal Position Absolute
-		case eHPA:
-			MoveCursorTo(GetParam(0, 1) - 1, mCursor.y);
-			break;
-		// HPR -- Horizontal Position Relative
-		case eHPR:
-			while (n-- > 0)
-				MoveCursor(kMoveRight);
-			break;
-		// HVP -- Horizontal/Vertical Position
-		case eHVP:
-			MoveCursorTo(GetParam(1, 1) - 1, GetParam(0, 1) - 1);
-			break;
-		// IL -- Insert Line
-		case eIL:
-			if (not CursorIsInMargins())
-				break;
-			while (n-- > 0)
-				mBuffer->ScrollBackward(mCursor.y, mMarginBottom, mMarginLeft, mMarginRight);
-			break;
-			//	case eMC:
-			//		break;
-			// NP -- Next Page
-		case eNP: /* unimplemented */
-			break;
-		// PP -- Preceding Page
-		case ePP: /* unimplemented */
-			break;
-		// PPA -- Page Position Absolute
-		case ePPA: /* unimplemented */
-			break;
-		// PPB -- Page Position Backwards
-		case ePPB: /* unimplemented */
-			break;
-		// PPR -- Page Position Relative
-		case ePPR: /* unimplemented */
-			break;
-		// SCORC -- Restore Saved Cursor Position (SCO Console)
-		case eSCORC:
-			RestoreCursor();
-			break;
-		// case eSCOSC:
-		//	break;
-		//  SD -- Pan Up
-		case eSD:
-			while (n-- > 0)
-				ScrollBackward();
-			break;
-		// SGR -- Select Graphic Rendition
-		case eSGR:
-			for (std::size_t i = 0; i < mArgs.size(); ++i)
-			{
-				auto a = mArgs[i];
-
-				switch (a)
-				{
-					case 0:
-						mCursor.style = MStyle();
-						mBuffer->SetColors(kXTermColorNone, kXTermColorNone);
-						break;
-					case 1:
-						mCursor.style.SetFlag(kStyleBold);
-						break;
-					case 4:
-						mCursor.style.SetFlag(kStyleUnderline);
-						break;
-					case 5:
-						mCursor.style.SetFlag(kStyleBlink);
-						break;
-					case 7:
-						mCursor.style.SetFlag(kStyleInverse);
-						break;
-					case 8:
-						mCursor.style.SetFlag(kStyleInvisible);
-						break;
-					case 22:
-						mCursor.style.ClearFlag(kStyleBold);
-						break;
-					case 24:
-						mCursor.style.ClearFlag(kStyleUnderline);
-						break;
-					case 25:
-						mCursor.style.ClearFlag(kStyleBlink);
-						break;
-					case 27:
-						mCursor.style.ClearFlag(kStyleInverse);
-						break;
-
-					// vt300
-					case 28:
-						mCursor.style.ClearFlag(kStyleInvisible);
-						break;
-
-					// xterm colors
-					case 30:
-						mCursor.style.SetForeColor(kXTermColorRegularBack);
-						break;
-					case 31:
-						mCursor.style.SetForeColor(kXTermColorRed);
-						break;
-					case 32:
-						mCursor.style.SetForeColor(kXTermColorGreen);
-						break;
-					case 33:
-						mCursor.style.SetForeColor(kXTermColorYellow);
-						break;
-					case 34:
-						mCursor.style.SetForeColor(kXTermColorBlue);
-						break;
-					case 35:
-						mCursor.style.SetForeColor(kXTermColorMagenta);
-						break;
-					case 36:
-						mCursor.style.SetForeColor(kXTermColorCyan);
-						break;
-					case 37:
-						mCursor.style.SetForeColor(kXTermColorNone);
-						break;
-					case 39:
-						mCursor.style.SetForeColor(kXTermColorNone);
-						break;
-
-					case 40:
-						mCursor.style.SetBackColor(kXTermColorNone);
-						break;
-					case 41:
-						mCursor.style.SetBackColor(kXTermColorRed);
-						break;
-					case 42:
-						mCursor.style.SetBackColor(kXTermColorGreen);
-						break;
-					case 43:
-						mCursor.style.SetBackColor(kXTermColorYellow);
-						break;
-					case 44:
-						mCursor.style.SetBackColor(kXTermColorBlue);
-						break;
-					case 45:
-						mCursor.style.SetBackColor(kXTermColorMagenta);
-						break;
-					case 46:
-						mCursor.style.SetBackColor(kXTermColorCyan);
-						break;
-					case 47:
-						mCursor.style.SetBackColor(kXTermColorRegularText);
-						break;
-					case 49:
-						mCursor.style.SetBackColor(kXTermColorNone);
-						break;
-
-					case 90:
-						mCursor.style.SetForeColor(kXTermColorBrightBlack);
-						break;
-					case 91:
-						mCursor.style.SetForeColor(kXTermColorBrightRed);
-						break;
-					case 92:
-						mCursor.style.SetForeColor(kXTermColorBrightGreen);
-						break;
-					case 93:
-						mCursor.style.SetForeColor(kXTermColorBrightYellow);
-						break;
-					case 94:
-						mCursor.style.SetForeColor(kXTermColorBrightBlue);
-						break;
-					case 95:
-						mCursor.style.SetForeColor(kXTermColorBrightMagenta);
-						break;
-					case 96:
-						mCursor.style.SetForeColor(kXTermColorBrightCyan);
-						break;
-					case 97:
-						mCursor.style.SetForeColor(kXTermColorBrightWhite);
-						break;
-
-					case 100:
-						mCursor.style.SetBackColor(kXTermColorBrightBlack);
-						break;
-					case 101:
-						mCursor.style.SetBackColor(kXTermColorBrightRed);
-						break;
-					case 102:
-						mCursor.style.SetBackColor(kXTermColorBrightGreen);
-						break;
-					case 103:
-						mCursor.style.SetBackColor(kXTermColorBrightYellow);
-						break;
-					case 104:
-						mCursor.style.SetBackColor(kXTermColorBrightBlue);
-						break;
-					case 105:
-						mCursor.style.SetBackColor(kXTermColorBrightMagenta);
-						break;
-					case 106:
-						mCursor.style.SetBackColor(kXTermColorBrightCyan);
-						break;
-					case 107:
-						mCursor.style.SetBackColor(kXTermColorBrightWhite);
-						break;
-
-					// color support
-					case 38:
-					case 48:
-					{
-						switch (mArgs[++i])
-						{
-							case 5:
-							{
-								uint8_t colorIndex = static_cast<uint8_t>(mArgs[++i]);
-								if (a == 38)
-									mCursor.style.SetForeColor((MXTermColor)colorIndex);
-								else
-									mCursor.style.SetBackColor((MXTermColor)colorIndex);
-								break;
-							}
-						}
-
-						break;
-					}
-				}
-
-				if ((a >= 30 and a <= 49) or (a >= 90 and a <= 107))
-					mBuffer->SetColors(mCursor.style.GetForeColor(), mCursor.style.GetBackColor());
-			}
-			break;
-		// SU -- Pan Down
-		case eSU:
-			while (n-- > 0)
-				ScrollForward();
-			break;
-		// TBC -- Clear Tabs
-		case eTBC:
-			switch (GetParam(0, 0))
-			{
-				case 0:
-					if (mCursor.x < mTerminalWidth)
-						mTabStops[mCursor.x] = false;
-					break;
-				case 3:
-					fill(mTabStops.begin(), mTabStops.end(), false);
-					break;
-			}
-			break;
-		// VPA -- Vertical Line Position Absolute
-		case eVPA:
-			MoveCursorTo(mCursor.x, GetParam(0, 1) - 1);
-			break;
-		// VPR -- Vertical Position Relative
-		case eVPR:
-			MoveCursorTo(mCursor.x, mCursor.y + GetParam(0, 1));
-			break;
-
-		// SM_ANSI -- Set Mode ANSI
-		case eSM_ANSI:
-			for (uint32_t a : mArgs)
-				SetResetMode(a, true, true);
-			break;
-		// RM_ANSI -- Reset Mode ANSI
-		case eRM_ANSI:
-			for (uint32_t a : mArgs)
-				SetResetMode(a, true, false);
-			break;
-		// SM_DEC -- Set Mode DEC
-		case eSM_DEC:
-			for (uint32_t a : mArgs)
-				SetResetMode(a, false, true);
-			break;
-		// RM_DEC -- Reset Mode DEC
-		case eRM_DEC:
-			for (uint32_t a : mArgs)
-				SetResetMode(a, false, false);
-			break;
-		// SAVEMODE -- Save DEC Private Mode Values
-		case eSAVEMODE:
-			for (int a : mArgs)
-				mSavedPrivateMode[a] = GetMode(a, false);
-			break;
-		// RESTMODE -- Restore DEC Private Mode Values
-		case eRESTMODE:
-			for (int a : mArgs)
-				SetResetMode(a, false, mSavedPrivateMode[a]);
-			break;
-		// DECREQTPARM -- no comment
-		case eDECREQTPARM:
-			SendCommand((MFormat("\033[%d;1;1;128;128;1;0x", mArgs[0] + 2)));
-			break;
-		// XTERMEMK -- Reset XTerm modify keys
-		case eXTERMEMK:
-			//				switch (GetParam(0, 0))
-			//				{
-			//					case 1:	mModifyCursorKeys = GetParam(1, 0); break;
-			//					case 1:	mModifyFunctionKeys = GetParam(1, 0); break;
-			//					case 1:	mModifyOtherKeys = GetParam(1, 0); break;
-			//				}
-			break;
-		// XTERMDMK -- Set XTerm modify keys
-		case eXTERMDMK:
-			//				switch (GetParam(0, 0))
-			//				{
-			//					case 1:	mModifyCursorKeys = -1; break;
-			//					case 1:	mModifyFunctionKeys = -1; break;
-			//					case 1:	mModifyOtherKeys = -1; break;
-			//				}
-			break;
-		case eXTERMDMKR: // request modifyCursorKeyState
-			break;
-
-		// REP -- Repeat preceding character
-		case eREP:
-			if (mLastChar != 0)
-			{
-				while (n-- > 0)
-					WriteChar(mLastChar);
-			}
-			break;
-
-		// SL -- Shift Left
-		case eSL:
-			while (n-- > 0)
-				MoveCursor(kMoveSL);
-			break;
-		// SR -- Shift Right
-		case eSR:
-			while (n-- > 0)
-				MoveCursor(kMoveSR);
-			break;
-
-		// DECSCL -- Select Conformance Level
-		case eDECSCL:
-			if (mArgs[0] >= 61 and mArgs[0] <= 65)
-			{
-				mDECSCL = mArgs[0] - 60;
-
-				if (mDECSCL <= 1)
-					mS8C1T = false;
-				else
-				{
-					if (mArgs.size() == 1 or mArgs[1] == 0 or mArgs[1] == 2)
-						mS8C1T = true;
-					else if (mArgs[1] == 1)
-						mS8C1T = false;
-				}
-			}
-			break;
-
-		case eDECELR:
-			PRINT(("DECELR iets met de muis doen?"));
-			// hmmmm
-			break;
-
-		default:
-			PRINT(("Unhandled CSI level 1 command: %s (%x)", mCtrlSeq.c_str(), mCSICmd));
-			break;
-	}
-}
-
-void MTerminalView::ProcessCSILevel4(uint32_t inCmd)
-{
-	uint32_t n = GetParam(0, 1);
-	if (n == 0)
-		n = 1;
-
-	switch (inCmd)
-	{
-		// ECH -- Erase character
-		case eECH:
-			mBuffer->EraseCharacter(mCursor.y, mCursor.x, n);
-			break;
-
-		// ICH -- Insert character
-		case eICH:
-			if (not CursorIsInMargins())
-				break;
-			while (n-- > 0)
-				mBuffer->InsertCharacter(mCursor.y, mCursor.x, mMarginRight + 1);
-			break;
-
-		// DECDC -- Delete column
-		case eDECDC:
-			if (not CursorIsInMargins())
-				break;
-			while (n-- > 0)
-			{
-				for (int line = mMarginTop; line <= mMarginBottom; ++line)
-					mBuffer->DeleteCharacter(line, mCursor.x, mMarginRight + 1);
-			}
-			break;
-
-		// DECIC -- Insert column
-		case eDECIC:
-			if (not CursorIsInMargins())
-				break;
-			while (n-- > 0)
-			{
-				for (int line = mMarginTop; line <= mMarginBottom; ++line)
-					mBuffer->InsertCharacter(line, mCursor.x, mMarginRight + 1);
-			}
-			break;
-
-		// DECCARA -- Change attributes in rectangular area
-		case eDECCARA:
-		{
-			int32_t t, l, b, r;
-			GetRectParam(0, t, l, b, r);
-
-			for (int a : mArgs)
-			{
-				mBuffer->ForeachInRectangle(t, l, b, r, [a](MChar &inChar, int32_t inLine, int32_t inColumn)
-					{
-					switch (a)
-					{
-						case 0:
-							inChar = MStyle();
-							break;
-						case 1:
-							inChar |= kStyleBold;
-							break;
-						case 4:
-							inChar |= kStyleUnderline;
-							break;
-						case 5:
-							inChar |= kStyleBlink;
-							break;
-						case 7:
-							inChar |= kStyleInverse;
-							break;
-						case 21:
-							inChar &= ~kStyleBold;
-							break;
-						case 24:
-							inChar &= ~kStyleUnderline;
-							break;
-						case 25:
-							inChar &= ~kStyleBlink;
-							break;
-						case 27:
-							inChar &= ~kStyleInverse;
-							break;
-					} });
-			}
-			break;
-		}
-
-		// DECCRA -- Copy rectangular area
-		case eDECCRA:
-		{
-			int ps = GetParam(4, 1);
-			int pd = GetParam(7, 1);
-			if (ps != 1 or pd != 1)
-				break;
-
-			int32_t t, l, b, r;
-			GetRectParam(0, t, l, b, r);
-
-			int32_t w = r - l, h = b - t;
-			int32_t dt = GetParam(5, 1) - 1;
-			if (mCursor.DECOM)
-				dt += mMarginTop;
-			int32_t dl = GetParam(6, 1) - 1;
-			if (mCursor.DECOM)
-				dl += mMarginLeft;
-
-			if (dt + h > mTerminalHeight)
-			{
-				h = mTerminalHeight - dt;
-				b = t + h;
-			}
-
-			if (dl + w > mTerminalWidth)
-			{
-				w = mTerminalWidth - dl;
-				r = l + w;
-			}
-
-			if (w == 0 or h == 0)
-				break;
-
-			std::vector<MChar> buffer(mTerminalWidth * mTerminalHeight);
-			uint32_t i = 0;
-			mBuffer->ForeachInRectangle(t, l, b, r,
-				[&i, &buffer](MChar &inChar, int32_t inLine, int32_t inColumn)
-				{
-					buffer[i++] = inChar;
-				});
-
-			assert(i <= buffer.size());
-			i = 0;
-
-			mBuffer->ForeachInRectangle(dt, dl, dt + h, dl + w,
-				[&i, &buffer](MChar &inChar, int32_t inLine, int32_t inColumn)
-				{
-					inChar = buffer[i++];
-				});
-			break;
-		}
-
-		// DECELF -- Enable local functions
-		case eDECELF: /* unimplemented */
-			break;
-
-		// DECERA -- Erase rectangular area
-		case eDECERA:
-		{
-			int32_t t, l, b, r;
-			GetRectParam(0, t, l, b, r);
-
-			MChar ch(' ', mCursor.style);
-			mBuffer->ForeachInRectangle(t, l, b, r,
-				[ch](MChar &inChar, int32_t inLine, int32_t inColumn)
-				{
-					inChar = ch;
-				});
-			break;
-		}
-		// DECFRA -- Fill rectangular area
-		case eDECFRA:
-		{
-			int32_t t, l, b, r;
-			GetRectParam(1, t, l, b, r);
-
-			MChar ch(GetParam(0, ' '), mCursor.style);
-			mBuffer->ForeachInRectangle(t, l, b, r,
-				[ch](MChar &inChar, int32_t inLine, int32_t inColumn)
-				{
-					inChar = ch;
-				});
-			break;
-		}
-
-		// DECINVM -- Invoke stored macro
-		case eDECINVM: /* unimplemented */
-			break;
-		// DECLFKC -- Local function key control
-		case eDECLFKC: /* unimplemented */
-			break;
-		// DECMSR -- Macro Space Report
-		case eDECMSR: /* unimplemented */
-			break;
-
-		// DECRARA -- Reverse attributes in rectangular area
-		case eDECRARA:
-		{
-			int32_t t, l, b, r;
-			GetRectParam(0, t, l, b, r);
-
-			for (uint32_t ai = 4; ai < mArgs.size(); ++ai)
-			{
-				uint32_t flag{};
-				switch (mArgs[ai])
-				{
-					case 0:
-						flag = kStyleBold | kStyleUnderline | kStyleBlink | kStyleInverse;
-						break;
-					case 1:
-						flag = kStyleBold;
-						break;
-					case 4:
-						flag = kStyleUnderline;
-						break;
-					case 5:
-						flag = kStyleBlink;
-						break;
-					case 7:
-						flag = kStyleInverse;
-						break;
-				}
-
-				mBuffer->ForeachInRectangle(t, l, b, r,
-					[flag](MChar &inChar, int32_t inLine, int32_t inColumn)
-					{
-						inChar.ReverseFlag(MCharStyle(flag));
-					});
-			}
-			break;
-		}
-
-		// DECRPM -- Report mode
-		case eDECRPM: /* unimplemented */
-			break;
-		// DECRQCRA -- Request checksum of rectangular area
-		case eDECRQCRA: /* unimplemented */
-			break;
-		// DECRQDE -- Request displayed extent
-		case eDECRQDE:
-			SendCommand(MFormat("\033[%d;%d;1;1;1\"w", mTerminalHeight, mTerminalWidth));
-			break;
-
-		// DECRQMANSI -- Request mode ANSI
-		case eDECRQMANSI:
-		{
-			int p = GetParam(0, 0);
-			SendCommand(MFormat("\033[%d;%d$y", p, GetMode(p, true) ? 1 : 2));
-			break;
-		}
-		// DECRQMDEC -- Request mode DEC Private
-		case eDECRQMDEC:
-		{
-			int p = GetParam(0, 0);
-			SendCommand(MFormat("\033[?%d;%d$y", p, GetMode(p, false) ? 1 : 2));
-			break;
-		}
-		// DECRQPSR -- Request presentation state
-		case eDECRQPSR:
-			switch (GetParam(0, 0))
-			{
-				case 1: /* DECCIR */
-				{
-					MStyle st = mCursor.style;
-					SendCommand(MFormat("\033P1$u%d;%d;%d;%c;%c;%c;%d;%d;%c;%c%c%c%c\033\\",
-						mCursor.y + 1,
-						mCursor.x + 1,
-						1,
-						char(0x40 + (st & kStyleInverse ? 8 : 0) + (st & kStyleBlink ? 4 : 0) + (st & kStyleUnderline ? 2 : 0) + (st & kStyleBold ? 1 : 0)),
-						char(0x40 + (st & kUnerasable ? 1 : 0)),
-						char(0x40 + (mCursor.DECAWM ? 8 : 0) + (mCursor.SS == 3 ? 4 : 0) + (mCursor.SS == 2 ? 2 : 0) + (mCursor.DECOM ? 1 : 0)),
-						mCursor.CSGL,
-						mCursor.CSGR,
-						char(0x5f), // pffft, not sure about this one... FIXME
-						mCursor.charSetGSel[0],
-						mCursor.charSetGSel[1],
-						mCursor.charSetGSel[2],
-						mCursor.charSetGSel[3]));
-					break;
-				}
-				case 2: /* DECTABSR */
-				{
-					std::vector<std::string> ts;
-					for (int i = 0; i < mTerminalWidth; ++i)
-						if (mTabStops[i])
-							ts.push_back(std::to_string(i + 1));
-					SendCommand(kDCS + "2$u" + Join(ts, "/") + "\033\\");
-					break;
-				}
-			}
-			break;
-		// DECRQUPSS -- Request User-Preferred Supplemental Set
-		case eDECRQUPSS:
-			SendCommand("\033P0!u%5\033\\");
-			break;
-		// DECSACE -- Select attribute change extent
-		case eDECSACE:
-			mDECSACE = (GetParam(0, 1) == 2);
-			break;
-		// DECSASD -- Select active status display
-		case eDECSASD:
-			if (GetParam(0, 0))
-			{
-				if (not mDECSASD)
-				{
-					mSavedSL = mCursor;
-					ResetCursor();
-					mDECSASD = true;
-				}
-			}
-			else
-			{
-				if (mDECSASD)
-				{
-					mCursor = mSavedSL;
-					mDECSASD = false;
-				}
-			}
-			break;
-		// DECSCA -- Select character attribute
-		case eDECSCA:
-			switch (GetParam(0, 0))
-			{
-				case 0:
-				case 2:
-					mCursor.style.ClearFlag(kUnerasable);
-					break;
-				case 1:
-					mCursor.style.SetFlag(kUnerasable);
-					break;
-			}
-			break;
-
-		// DECSED -- Selective erase in display
-		case eDECSED:
-			EraseInDisplay(GetParam(0, 0), true);
-			break;
-			break;
-		// DECSEL -- Selective erase in line
-		case eDECSEL:
-			EraseInLine(GetParam(0, 0), true);
-			break;
-		// DECSERA -- Selective erase rectangular area
-		case eDECSERA:
-		{
-			int32_t t, l, b, r;
-			GetRectParam(0, t, l, b, r);
-
-			mBuffer->ForeachInRectangle(t, l, b, r,
-				[](MChar &inChar, int32_t inLine, int32_t inColumn)
-				{
-					if (not(inChar & kUnerasable))
-						inChar = ' ';
-				});
-			break;
-		}
-		// DECSLPP -- Set Lines Per Page
-		case eDECSLPP:
-		{
-			MRect r;
-
-			switch (GetParam(0, 0))
-			{
-				case 11:
-					SendCommand("\033[1t");
-					break;
-				case 13:
-					GetWindow()->GetWindowPosition(r);
-					SendCommand(MFormat("\033[3;%d;%dt", r.x, r.y));
-					break;
-				case 14:
-					r = GetWindow()->GetBounds();
-					SendCommand(MFormat("\033[4;%d;%dt", r.width, r.height));
-					break;
-				case 18:
-					SendCommand(MFormat("\033[8;%d;%dt", mTerminalWidth, mTerminalHeight));
-					break;
-				case 20:
-					SendCommand("\033]L\033\\");
-					break;
-				case 21:
-					SendCommand(std::string("\033]l") + GetWindow()->GetTitle() + "\033\\");
-					break;
-				default:
-				{
-					int h = GetParam(1, 24);
-					if (h >= 4 and h < 240)
-						ResizeTerminal(mTerminalWidth, h, true);
-					break;
-				}
-			}
-			break;
-		}
-		// DECSLRM -- Set left and right margins
-		case eDECSLRM:
-			//			if (mArgs.size() == 1 and mArgs[0] == 0)
-			//				SaveCursor();
-			//			else
-			if (mDECVSSM)
-			{
-				int32_t left = GetParam(0, 1);
-				if (left < 1)
-					left = 1;
-				int32_t right = GetParam(1, mTerminalWidth);
-				if (right > mTerminalWidth)
-					right = mTerminalWidth;
-				if (right < left + 1)
-					right = left + 1;
-
-				mMarginLeft = left - 1;
-				mMarginRight = right - 1;
-				MoveCursorTo(0, 0);
-			}
-			break;
-		// DECSMKR -- Select modifier key reporting
-		case eDECSMKR: /* unimplemented */
-			break;
-		// DECSNLS -- Select number of lines per screen
-		case eDECSNLS:
-			if (n >= 24 and n < 250)
-				ResizeTerminal(mTerminalWidth, n, true);
-			break;
-		// DECSR -- Secure reset
-		case eDECSR: /* unimplemented */
-			break;
-		// DECSSDT -- Select status display type
-		case eDECSSDT:
-			mDECSSDT = GetParam(0, 1);
-			ResizeTerminal(mTerminalWidth, mTerminalHeight, true);
-			break;
-		// DECSTBM -- Set Top and Bottom Margin
-		case eDECSTBM:
-		{
-			int32_t top = GetParam(0, 1);
-			if (top < 1)
-				top = 1;
-			int32_t bottom = GetParam(1, mTerminalHeight);
-			if (bottom > mTerminalHeight)
-				bottom = mTerminalHeight;
-			if (bottom < top + 1)
-				bottom = top + 1;
-
-			mMarginTop = top - 1;
-			mMarginBottom = bottom - 1;
-
-			MoveCursorTo(0, 0);
-			break;
-		}
-		// DECSTR -- Soft terminal reset
-		case eDECSTR:
-			SoftReset();
-			break;
-
-		/*
-			XTerm / DEC VT520
-		*/
-
-		// DECSCUSR -- Set Cursor Style
-		case eDECSCUSR:
-			switch (GetParam(0, 1))
-			{
-				case 1:
-					mCursor.block = true;
-					mCursor.blink = true;
-					break;
-				case 2:
-					mCursor.block = true;
-					mCursor.blink = false;
-					break;
-				case 3:
-					mCursor.block = false;
-					mCursor.blink = true;
-					break;
-				case 4:
-					mCursor.block = false;
-					mCursor.blink = false;
-					break;
-			}
-			Invalidate();
-			break;
-		// DECSWBV -- Set Warning Bell Volume
-		case eDECSWBV: /* unimplemented */
-			break;
-		// DECSMBV -- Set Margin Bell Volume
-		case eDECSMBV: /* unimplemented */
-			break;
-
-		default:
-			ProcessCSILevel1(inCmd);
-			break;
-	}
-}
-
-void MTerminalView::SelectCharSet(uint8_t inChar)
-{
-	mEscState = eESC_NONE;
-
-	int charset = GetParam(0, 0);
-	int charcount = GetParam(1, 0);
-
-	if (charset == 4)
-	{
-		switch (inChar)
-		{
-			case '@':
-				mEncoding = kEncodingISO88591;
-				cEncodingUtf8.SetChecked(false);
-				break;
-			case 'G':
-				mEncoding = kEncodingUTF8;
-				cEncodingUtf8.SetChecked(true);
-				break;
-		}
-	}
-	else
-	{
-		if (mDECSCL == 1 and charset > 1)
-		{
-			PRINT(("Unsupported set G%d", charset));
-			return;
-		}
-
-		mCursor.charSetGSel[charset] = inChar;
-
-		if (charcount == 96)
-		{
-			switch (inChar)
-			{
-				case 'A':
-					mCursor.charSetG[charset] = kISOLatin1Supplemental;
-					break;
-			}
-		}
-		else
-		{
-			switch (inChar)
-			{
-				case 'A':
-					mCursor.charSetG[charset] = kUKCharSet;
-					break;
-				case 'B':
-					mCursor.charSetG[charset] = kUSCharSet;
-					break;
-				case '4':
-					mCursor.charSetG[charset] = kNLCharSet;
-					break;
-				case 'C':
-				case '5':
-					mCursor.charSetG[charset] = kFICharSet;
-					break;
-				case 'R':
-					mCursor.charSetG[charset] = kFRCharSet;
-					break;
-				case 'Q':
-					mCursor.charSetG[charset] = kCACharSet;
-					break;
-				case 'K':
-					mCursor.charSetG[charset] = kDECharSet;
-					break;
-				case 'Y':
-					mCursor.charSetG[charset] = kITCharSet;
-					break;
-				case 'E':
-				case '6':
-					mCursor.charSetG[charset] = kDKCharSet;
-					break;
-				case 'Z':
-					mCursor.charSetG[charset] = kSPCharSet;
-					break;
-				case 'H':
-				case '7':
-					mCursor.charSetG[charset] = kSECharSet;
-					break;
-				case '=':
-					mCursor.charSetG[charset] = kCHCharSet;
-					break;
-				case '0':
-					mCursor.charSetG[charset] = kLineCharSet;
-					break;
-				case '1':
-					mCursor.charSetG[charset] = kUSCharSet;
-					break;
-				case '2':
-					mCursor.charSetG[charset] = kLineCharSet;
-					break;
-			}
-		}
-	}
-}
-
-void MTerminalView::SelectControlTransmission(uint8_t inCode)
-{
-	switch (inCode)
-	{
-		case 'F':
-			mS8C1T = false;
-			break;
-		case 'G':
-			if (mDECSCL >= 2)
-				mS8C1T = true;
-			break;
-
-		// unimplemented
-		case 'N': /* ANSI conformance level 3 */
-			mCursor.charSetG[0] = kUSCharSet;
-			mCursor.CSGL = 0;
-			// fall through
-		case 'L': /* ANSI conformance level 1 */
-		case 'M': /* ANSI conformance level 2 */
-			mCursor.charSetG[1] = kISOLatin1Supplemental;
-			mCursor.CSGR = 1;
-			break;
-	}
-
-	mEscState = eESC_NONE;
-}
-
-void MTerminalView::SelectDouble(uint8_t inDoubleMode)
-{
-	mEscState = eESC_NONE;
-
-	switch (inDoubleMode)
-	{
-		case '3':
-			mBuffer->SetLineDoubleHeight(mCursor.y, true);
-			break;
-		case '4':
-			mBuffer->SetLineDoubleHeight(mCursor.y, false);
-			break;
-		case '5':
-			mBuffer->SetLineSingleWidth(mCursor.y);
-			break;
-		case '6':
-			mBuffer->SetLineDoubleWidth(mCursor.y);
-			break;
-		case '8':
-			mBuffer->FillWithE();
-			break;
-	}
-}
-
-void MTerminalView::CommitPFK()
-{
-	for (auto k : mNewPFK->key)
-	{
-		std::string s;
-		for (uint32_t i = 0; i < k.second.length(); i += 2)
-		{
-			char c1 = tolower(k.second[i]);
-			char c2 = 0;
-			if (i < k.second.length())
-				c2 = tolower(k.second[i + 1]);
-
-			if (c1 >= '0' and c1 <= '9')
-				c1 -= '0';
-			else
-				c1 -= 'a' + 10;
-
-			if (c2 >= '0' and c2 <= '9')
-				c2 -= '0';
-			else
-				c2 -= 'a' + 10;
-
-			s += char((c1 << 4) | c2);
-		}
-		mNewPFK->key[k.first] = s;
-	}
-
-	if (mNewPFK->clear or mPFK == nullptr)
-	{
-		delete mPFK;
-		mPFK = mNewPFK;
-	}
-	else
-	{
-		for (auto k : mNewPFK->key)
-			mPFK->key[k.first] = k.second;
-		delete mNewPFK;
-	}
-
-	mNewPFK = nullptr;
-}
-
-void MTerminalView::EscapeDCS(uint8_t inChar)
-{
-	if (inChar == ST)
-	{
-		if (mNewPFK)
-			CommitPFK();
-		else if (not mDECRQSS.empty() and mDECSCL >= 4)
-		{
-			std::string response("\033P0$r");
-
-			if (mDECRQSS == "m") // SGR - Set Graphic Rendition
-			{
-				std::vector<std::string> sgr;
-				if (mCursor.style & kStyleBold)
-					sgr.push_back("1");
-				if (mCursor.style & kStyleUnderline)
-					sgr.push_back("4");
-				if (mCursor.style & kStyleBlink)
-					sgr.push_back("5");
-				if (mCursor.style & kStyleInverse)
-					sgr.push_back("7");
-				if (mCursor.style & kStyleInvisible)
-					sgr.push_back("8");
-				if (mCursor.style.GetForeColor() != kXTermColorNone)
-					sgr.push_back(std::to_string(30 + mCursor.style.GetForeColor()));
-				if (mCursor.style.GetBackColor() != kXTermColorNone)
-					sgr.push_back(std::to_string(40 + mCursor.style.GetBackColor()));
-
-				response = MFormat("\033P1$r%s", Join(sgr, ";").c_str());
-			}
-			//			else if (mDECRQSS == ",|")	// DECAC - Assign Color
-			//			else if (mDECRQSS == ",}")	// DECATC - Alternate Text Color
-			else if (mDECRQSS == "$}") // DECSASD - Select Active Status Display
-				response = "\033P1$r0}";
-			else if (mDECRQSS == "*x") // DECSACE - Select Attribute Change Extent
-				response = MFormat("\033P1$r%d", mDECSACE ? 2 : 1);
-			else if (mDECRQSS == "\"q") // DECSCA - Set Character Attribute
-				response = mCursor.style & kUnerasable ? "\033P1$r1" : "\033P1$r0";
-			else if (mDECRQSS == "$|") // DECSCPP - Set Columns Per Page
-				response = MFormat("\033P1$r%d", mTerminalWidth);
-			//			else if (mDECRQSS == "*r")	// DECSCS - Select Communication Speed
-			//			else if (mDECRQSS == "*u")	// DECSCP - Select Communication Port
-			else if (mDECRQSS == "\"p") // DECSCL - Set Conformance Level
-			{
-				if (mDECSCL >= 2)
-					response = MFormat("\033P1$r%d;%d", mDECSCL, mS8C1T ? 0 : 1);
-				else
-					response = "\033P1$r61";
-			}
-			else if (mDECRQSS == " q") // DECSCUSR - Set Cursor Style
-			{
-				int cs = mCursor.block ? (mCursor.blink ? 1 : 2) : (mCursor.blink ? 3 : 4);
-				response = MFormat("\033P1$r%d", cs);
-			}
-			//			else if (mDECRQSS == ")p")	// DECSDPT - Select Digital Printed Data Type
-			//			else if (mDECRQSS == "$q")	// DECSDDT - Select Disconnect Delay Time
-			//			else if (mDECRQSS == "*s")	// DECSFC - Select Flow Control Type
-			//			else if (mDECRQSS == " r")	// DECSKCV - Set Key Click Volume
-			else if (mDECRQSS == "s") // DECSLRM - Set Left and Right Margins
-				response = MFormat("\033P1$r%d;%d", mMarginLeft + 1, mMarginRight + 1);
-			else if (mDECRQSS == "t") // DECSLPP - Set Lines Per Page
-				response = MFormat("\033P1$r%d", mTerminalHeight);
-			//			else if (mDECRQSS == " v")	// DECSLCK - Set Lock Key Style
-			//			else if (mDECRQSS == " u")	// DECSMBV - Set Margin Bell Volume
-			else if (mDECRQSS == "*|") // DECSNLS - Set Number of Lines per Screen
-				response = MFormat("\033P1$r%d", mTerminalHeight);
-			//			else if (mDECRQSS == ",x")	// DECSPMA - Session Page Memory Allocation
-			//			else if (mDECRQSS == "+w")	// DECSPP - Set Port Parameter
-			//			else if (mDECRQSS == "$s")	// DECSPRTT - Select Printer Type
-			//			else if (mDECRQSS == "*p")	// DECSPPCS - Select ProPrinter Character Set
-			//			else if (mDECRQSS == " p")	// DECSSCLS - Set Scroll Speed
-			//			else if (mDECRQSS == "p")	// DECSSL - Select Set-Up Language
-			else if (mDECRQSS == "$~") // DECSSDT - Set Status Line Type
-				response = MFormat("\033P1$r%d", mDECSSDT);
-			else if (mDECRQSS == "r") // DECSTBM - Set Top and Bottom Margins
-				response = MFormat("\033P1$r%d;%d", mMarginTop + 1, mMarginBottom + 1);
-			//			else if (mDECRQSS == "\"u")	// DECSTRL - Set Transmit Rate Limit
-			//			else if (mDECRQSS == " t")	// DECSWBV - Set Warning Bell Volume
-			//			else if (mDECRQSS == ",{")	// DECSZS - Select Zero Symbol
-
-			SendCommand(response + mDECRQSS + "\033\\");
-			mDECRQSS.clear();
-		}
-		return;
-	}
-
-	switch (mState)
-	{
-		case 0:
-			switch (inChar)
-			{
-				case '0':
-					delete mNewPFK;
-					mNewPFK = new MPFK;
-					mNewPFK->clear = mNewPFK->locked = true;
-					mState = 10;
-					break;
-
-				case '1':
-					delete mNewPFK;
-					mNewPFK = new MPFK;
-					mNewPFK->clear = false;
-					mNewPFK->locked = true;
-					mState = 10;
-					break;
-
-				case ';':
-					delete mNewPFK;
-					mNewPFK = new MPFK;
-					mNewPFK->clear = mNewPFK->locked = true;
-					mState = 11;
-					break;
-
-				case '$':
-					mState = 20;
-					break;
-				case '+':
-					mState = 30;
-					break;
-				default:
-					mState = 100; /* unrecognized */
-					break;
-			}
-			break;
-
-			// ';'
-
-		case 10:
-			if (inChar == ';')
-				mState = 11;
-			else
-				mState = 100;
-			break;
-
-		case 11:
-			switch (inChar)
-			{
-				case '0':
-					mState = 12;
-					break;
-				case '1':
-					mNewPFK->locked = false;
-					mState = 12;
-					break;
-				case '|':
-					mState = 13;
-					break;
-				default:
-					mState = 100;
-					break;
-			}
-			break;
-
-		case 12:
-			if (inChar == '|')
-				mState = 13;
-			else
-				mState = 100;
-			break;
-
-		case 13:
-			if (inChar >= '0' and inChar <= '9')
-				mPFKKeyNr = mPFKKeyNr * 10 + (inChar - '0');
-			else if (inChar == '/')
-				mState = 14;
-			else
-				mState = 100;
-			break;
-
-		case 14:
-			if (inChar == ';')
-				mPFKKeyNr = 0;
-			else if (isxdigit(inChar))
-			{
-				uint32_t keyCode;
-				switch (mPFKKeyNr)
-				{
-					case eF1:
-						keyCode = kF1KeyCode;
-						break;
-					case eF2:
-						keyCode = kF2KeyCode;
-						break;
-					case eF3:
-						keyCode = kF3KeyCode;
-						break;
-					case eF4:
-						keyCode = kF4KeyCode;
-						break;
-					case eF5:
-						keyCode = kF5KeyCode;
-						break;
-					case eF6:
-						keyCode = kF6KeyCode;
-						break;
-					case eF7:
-						keyCode = kF7KeyCode;
-						break;
-					case eF8:
-						keyCode = kF8KeyCode;
-						break;
-					case eF9:
-						keyCode = kF9KeyCode;
-						break;
-					case eF10:
-						keyCode = kF10KeyCode;
-						break;
-					case eF11:
-						keyCode = kF11KeyCode;
-						break;
-					case eF12:
-						keyCode = kF12KeyCode;
-						break;
-					case eF13:
-						keyCode = kF13KeyCode;
-						break;
-					case eF14:
-						keyCode = kF14KeyCode;
-						break;
-					case eF15:
-						keyCode = kF15KeyCode;
-						break;
-					case eF16:
-						keyCode = kF16KeyCode;
-						break;
-					case eF17:
-						keyCode = kF17KeyCode;
-						break;
-					case eF18:
-						keyCode = kF18KeyCode;
-						break;
-					case eF19:
-						keyCode = kF19KeyCode;
-						break;
-					case eF20:
-						keyCode = kF20KeyCode;
-						break;
-				}
-				mNewPFK->key[keyCode] += inChar;
-			}
-			else
-				mState = 100;
-			break;
-
-			// $q DECSRQSS
-
-		case 20:
-			if (inChar == 'q')
-				mState = 21;
-			else
-				mState = 100;
-			break;
-
-		case 21:
-			mDECRQSS = inChar;
-			mState = 22;
-			break;
-
-		case 22:
-			mDECRQSS += inChar;
-			break;
-	}
-
-	if (mEscState == eESC_NONE)
-	{
-		delete mNewPFK;
-		mNewPFK = nullptr;
-	}
-}
-
-void MTerminalView::EscapeOSC(uint8_t inChar)
-{
-	if (inChar == BEL or inChar == ST)
-	{
-		// done
-		mEscState = eESC_NONE;
-
-		switch (mArgs[0])
-		{
-			case 0:
-			case 1:
-			case 2:
-				mSetWindowTitle = mArgString;
-				for (char &ch : mSetWindowTitle)
-				{
-					if (std::iscntrl(ch))
-						ch = '_';
-				}
-				break;
-
-			case 7:
-			{
-				try
-				{
-					zeep::http::uri uri(mArgString);
-					if (uri.get_scheme() == "file")
-					{
-						mTerminalHost = uri.get_host();
-						mTerminalCWD = uri.get_path().unencoded_string();
-					}
-				}
-				catch (const std::exception &e)
-				{
-					mTerminalHost.clear();
-					mTerminalCWD.clear();
-				}
-				break;
-			}
-
-			case 8:
-				SetHyperLink(mArgString);
-				break;
-
-			case 9:
-				mStatusbar->SetStatusText(0, mArgString, false);
-				break;
-
-			case 10:
-				if (mArgString == "?")
-				{
-					std::string textColor = mTerminalColors[eText].hex();
-
-					SendCommand(
-						"\033]11;rgb:" +
-						textColor.substr(1, 2) + textColor.substr(1, 2) + '/' +
-						textColor.substr(3, 2) + textColor.substr(3, 2) + '/' +
-						textColor.substr(5, 2) + textColor.substr(5, 2) +
-						"\033\\");
-
-					// PRINT(("Request for text colour"));
-				}
-				break;
-
-			case 11:
-				if (mArgString == "?")
-				{
-					std::string backColor = mTerminalColors[eBack].hex();
-
-					SendCommand(
-						"\033]11;rgb:" +
-						backColor.substr(1, 2) + backColor.substr(1, 2) + '/' +
-						backColor.substr(3, 2) + backColor.substr(3, 2) + '/' +
-						backColor.substr(5, 2) + backColor.substr(5, 2) +
-						"\033\\");
-
-					// PRINT(("Request for background colour"));
-				}
-				break;
-
-				/* unimplemented: veel */
-
-			case 52:
-				if (mArgString.length() > 2 and mArgString[1] == ';' and mArgString[0] == 'c')
-				{
-					if (mArgString[2] == '?')
-						SendCommand("\033]52;c;\033\\"); // empty std::string as reply, sorry
-					else
-					{
-						auto s = zeep::decode_base64({ mArgString.data() + 2, mArgString.length() - 2 });
-						MClipboard::Instance().SetData(s /* , false */);
-					}
-				}
-				break;
-
-			case 1337:
-				if (mArgString.starts_with("CurrentDir="))
-					mTerminalCWD = mArgString.substr(strlen("CurrentDir="));
-				else if (mArgString == "StealFocus")
-					GetWindow()->Select();
-				else if (mArgString == "CursorShape=0")
-					mBlockCursor = true;
-				else if (mArgString == "CursorShape=1" or mArgString == "CursorShape=2")
-					mBlockCursor = false;
-				break;
-
-			default:
-				PRINT(("Ignored %d OSC option", mArgs[0]));
-				break;
-		}
-	}
-	else
-	{
-		switch (mState)
-		{
-			case 0: // start, expect a number, or ';'
-				mArgs.clear();
-				mArgs.push_back(0);
-				mArgString.clear();
-
-				if (inChar == ';')
-				{
-					mArgs.push_back(0);
-					mState = 2;
-				}
-				else if (inChar >= '0' and inChar <= '9')
-				{
-					mArgs[0] = inChar - '0';
-					mState = 1;
-				}
-				else
-				{
-					mArgString += inChar;
-					mState = 2;
-				}
-				break;
-
-			case 1:
-				if (inChar >= '0' and inChar <= '9')
-					mArgs.back() = mArgs.back() * 10 + (inChar - '0');
-				else if (inChar == ';')
-					mArgs.push_back(0);
-				else // error
-				{
-					mArgString += inChar;
-					mState = 2;
-				}
-				break;
-
-			case 2:
-				mArgString += inChar;
-				break;
-		}
-	}
-}
-
-void MTerminalView::EscapeAPC(uint8_t inChar)
-{
-	if (inChar == BEL or inChar == ST)
-	{
-		// done
-		mEscState = eESC_NONE;
-
-		switch (mArgs[0])
-		{
-			case 7:
-			{
-				// Bash function for get is:
-				// get() { file="$1"; printf "\033_7;%s\x9c" $(realpath -qez "$file" | base64 -w0);}
-
-				auto s = zeep::decode_base64({ mArgString.data(), mArgString.length() });
-
-				DownloadFile(s);
-				break;
-			}
-
-			case 8:
-			{
-				// Bash function for get is:
-				// put() { file="$1"; printf "\033_8;%s\x9c" $(realpath -qz "$file" | base64 -w0);}
-
-				auto s = zeep::decode_base64({ mArgString.data(), mArgString.length() });
-
-				UploadFile(s);
-				break;
-			}
-
-			case 9:
-				mTerminalCWD = zeep::decode_base64({ mArgString.data(), mArgString.length() });
-				break;
-
-			default:
-				PRINT(("Ignored %d APC option", mArgs[0]));
-				break;
-		}
-	}
-	else
-	{
-		switch (mState)
-		{
-			case 0: // start, expect a number, or ';'
-				mArgs.clear();
-				mArgs.push_back(0);
-				mArgString.clear();
-
-				if (inChar == ';')
-				{
-					mArgs.push_back(0);
-					mState = 2;
-				}
-				else if (inChar >= '0' and inChar <= '9')
-				{
-					mArgs[0] = inChar - '0';
-					mState = 1;
-				}
-				else
-				{
-					mArgString += inChar;
-					mState = 2;
-				}
-				break;
-
-			case 1:
-				if (inChar >= '0' and inChar <= '9')
-					mArgs.back() = mArgs.back() * 10 + (inChar - '0');
-				else if (inChar == ';')
-					mArgs.push_back(0);
-				else // error
-				{
-					mArgString += inChar;
-					mState = 2;
-				}
-				break;
-
-			case 2:
-				mArgString += inChar;
-				break;
-		}
-	}
-}
-
-void MTerminalView::SaveCursor(void)
-{
-	if (mBuffer == &mAlternateBuffer)
-	{
-		mAlternate = mCursor;
-		mAlternate.saved = true;
-	}
-	else
-	{
-		mSaved = mCursor;
-		mSaved.saved = true;
-	}
-}
-
-void MTerminalView::RestoreCursor(void)
-{
-	if (mBuffer == &mAlternateBuffer and mAlternate.saved)
-		mCursor = mAlternate;
-	else if (mBuffer == &mScreenBuffer and mSaved.saved)
-		mCursor = mSaved;
-	else
-	{
-		MoveCursorTo(0, 0);
-
-		mCursor.charSetG[0] = kUSCharSet;
-		mCursor.charSetG[1] = kLineCharSet;
-		mCursor.charSetG[2] = kUSCharSet;
-		mCursor.charSetG[3] = kLineCharSet;
-		mCursor.CSGL = 0;
-		mCursor.CSGR = 2;
-		mCursor.style = MStyle();
-		mCursor.DECOM = false;
-	}
-}
-
-void MTerminalView::SwitchToAlternateScreen()
-{
-	if (mBuffer != &mAlternateBuffer)
-	{
-		mBuffer = &mAlternateBuffer;
-		EraseInDisplay(2);
-		AdjustScrollbar(0);
-		Invalidate();
-	}
-}
-
-void MTerminalView::SwitchToRegularScreen()
-{
-	if (mBuffer != &mScreenBuffer)
-	{
-		mBuffer = &mScreenBuffer;
-		AdjustScrollbar(0);
-		Invalidate();
-	}
-}
-
-void MTerminalView::Animate()
-{
-	Invalidate();
-}
-
-void MTerminalView::Beep()
-{
-	using namespace std::chrono_literals;
-
-	auto now = std::chrono::system_clock::now();
-	bool beeped = false;
-
-	if (mGraphicalBeep and now - mLastBeep > 250ms)
-	{
-		if (mAnimationManager->Update())
-			PRINT(("duh"));
-
-		MStoryboard *storyboard = mAnimationManager->CreateStoryboard();
-		storyboard->AddTransition(mGraphicalBeep, 0.75, 75ms, "acceleration-decelleration");
-		storyboard->AddTransition(mGraphicalBeep, 0.00, 75ms, "acceleration-decelleration");
-		mAnimationManager->Schedule(storyboard);
-
-		beeped = true;
-	}
-
-	if (mAudibleBeep and now - mLastBeep > 500ms)
-	{
-		PlaySound("bell");
-		beeped = true;
-	}
-
-	if (beeped)
-		mLastBeep = now;
-}
-
-void MTerminalView::SetResetMode(uint32_t inMode, bool inANSI, bool inSet)
-{
-	if (inANSI)
-	{
-		switch (inMode)
-		{
-			case 2:
-				mKAM = inSet;
-				break;
-			case 4:
-				mIRM = inSet;
-				break;
-			case 12:
-				mSRM = inSet;
-				break;
-			case 20:
-				mLNM = inSet;
-				break;
-			default:
-				PRINT(("Ignored %s of option %d", inSet ? "set" : "reset", inMode));
-				break;
-		}
-	}
-	else
-	{
-		switch (inMode)
-		{
-			case 1:
-				mDECCKM = inSet;
-				break;
-			case 2:
-				mDECANM = inSet;
-				break;
-			case 3:           // DECCOLM
-				mDECSSDT = 0; // reset status line conforming to specification
-				ResizeTerminal(inSet ? 132 : 80, mTerminalHeight, true);
-				break;
-			case 4:
-				mDECSCLM = inSet;
-				break;
-			case 5:
-				mDECSCNM = inSet;
-				break;
-			case 6:
-				mCursor.DECOM = inSet;
-				if (inSet)
-					MoveCursorTo(0, 0);
-				break;
-			case 7:
-				mCursor.DECAWM = inSet;
-				break;
-			case 8:
-				mDECARM = inSet;
-				break;
-			case 12:
-				mCursor.blink = inSet;
-				break;
-			case 18:
-				mDECPFF = inSet;
-				break;
-			case 19:
-				mDECPEX = inSet;
-				break;
-			case 25:
-				mDECTCEM = inSet;
-				break;
-			case 42:
-				mDECNRCM = inSet;
-				break;
-			case 66:
-				mDECNMK = inSet;
-				break;
-			case 67:
-				mDECBKM = inSet;
-				break;
-
-			case 69:
-				mDECVSSM = inSet;
-				if (not mDECVSSM)
-				{
-					mMarginLeft = 0;
-					mMarginRight = mTerminalWidth - 1;
-				}
-				break;
-
-			case 9:
-			case 1000:
-			case 1001:
-			case 1002:
-			case 1003:
-				PRINT(("%s mouse mode for %d", inSet ? "set" : "reset", inMode));
-				if (inSet)
-					mMouseMode = (MouseTrackingMode)inMode;
-				else
-					mMouseMode = eTrackMouseNone;
-				break;
-
-			case 1004:
-				// ignored for now, focus tracking?
-				break;
-
-			case 47: // alternate screen buffer support
-			case 1047:
-				if (inSet)
-					SwitchToAlternateScreen();
-				else
-					SwitchToRegularScreen();
-				break;
-
-			case 1048:
-				if (inSet)
-					SaveCursor();
-				else
-					RestoreCursor();
-				break;
-
-			case 1049:
-				if (inSet)
-				{
-					SaveCursor();
-					SwitchToAlternateScreen();
-				}
-				else
-				{
-					SwitchToRegularScreen();
-					RestoreCursor();
-				}
-				break;
-
-			case 2004:
-				mBracketedPaste = inSet;
-				break;
-
-			default:
-				PRINT(("Ignored %s of option %d", inSet ? "set" : "reset", inMode));
-				break;
-		}
-	}
-}
-
-bool MTerminalView::GetMode(uint32_t inMode, bool inANSI)
-{
-	bool result = false;
-
-	if (inANSI)
-	{
-		switch (inMode)
-		{
-			case 2:
-				result = mKAM;
-				break;
-			case 4:
-				result = mIRM;
-				break;
-			case 12:
-				result = mSRM;
-				break;
-			case 20:
-				result = mLNM;
-				break;
-		}
-	}
-	else
-	{
-		switch (inMode)
-		{
-			case 1:
-				result = mDECCKM;
-				break;
-			case 2:
-				result = mDECANM;
-				break;
-			case 3:
-				result = mTerminalWidth == 132;
-				break;
-			case 4:
-				result = mDECSCLM;
-				break;
-			case 5:
-				result = mDECSCNM;
-				break;
-			case 6:
-				result = mCursor.DECOM;
-				break;
-			case 7:
-				result = mCursor.DECAWM;
-				break;
-			case 8:
-				result = mDECARM;
-				break;
-			case 12:
-				result = mCursor.blink;
-				break;
-			case 18:
-				result = mDECPFF;
-				break;
-			case 19:
-				result = mDECPEX;
-				break;
-			case 25:
-				result = mDECTCEM;
-				break;
-			case 42:
-				result = mDECNRCM;
-				break;
-			case 66:
-				result = mDECNMK;
-				break;
-			case 67:
-				result = mDECBKM;
-				break;
-			case 69:
-				result = mDECVSSM;
-				break;
-			case 2004:
-				result = mBracketedPaste;
-				break;
-		}
-	}
-
-	return result;
-}
-
-// --------------------------------------------------------------------
-
-void MTerminalView::DownloadFile(const std::filesystem::path &path)
-{
-	if (mTerminalChannel->CanDownloadFiles())
-	{
-		auto lambda = [path, channel = mTerminalChannel](std::filesystem::path inLocalFile, bool inReplace = true)
-		{
-			if (not inReplace)
-			{
-				auto filename = path.filename();
-				auto dir = inLocalFile.parent_path();
-				for (std::size_t i = 1; std::filesystem::exists(inLocalFile); ++i)
-					inLocalFile = dir / (filename.stem().string() + "-(" + std::to_string(i) + ")" + filename.extension().string());
-			}
-
-			channel->DownloadFile(path, inLocalFile);
-		};
-
-		if (MPrefs::GetBoolean("always-ask-download-dir", false))
-			MFileDialogs::SaveFileAs(GetWindow(), path, std::move(lambda));
-		else
-			lambda(GetDownloadDirectory() / path.filename(), false);
-	}
-}
-
-void MTerminalView::UploadFile(const std::filesystem::path &path)
-{
-	if (mTerminalChannel->CanDownloadFiles())
-	{
-		MFileDialogs::ChooseOneFile(GetWindow(), [path, channel = mTerminalChannel](std::filesystem::path file)
-			{ channel->UploadFile(path, file); });
-	}
-}
-
-// --------------------------------------------------------------------
-
-void MTerminalView::SetHyperLink(const std::string &inURI)
-{
-	mHyperLink = 0;
-	if (not inURI.empty())
-	{
-		std::string id, uri;
-
-		if (auto s = inURI.find(';'); s != std::string::npos)
-		{
-			for (auto p : Split(inURI.substr(0, s), ":", true))
-			{
-				if (p.starts_with("id="))
-					id = p.substr(3);
-			}
-
-			uri = inURI.substr(s + 1);
-		}
-		else
-			uri = inURI;
-
-		if (zeep::http::is_valid_uri(uri))
-			mHyperLink = mBuffer->AddHyperLink(uri, id);
-	}
-}
-
-void MTerminalView::LinkClicked(std::string inLink)
-{
-	try
-	{
-		zeep::http::uri uri(inLink);
-
-		if (uri.get_scheme() == "file" and mTerminalChannel->CanDownloadFiles() and uri.get_host() == mTerminalHost)
+		if (uri.get_scheme() == "file" and mTerminalChannel->CanDownloadFiles() and uri.get_host() == mEmulator.GetTerminalHost())
 		{
 			DownloadFile(uri.get_path().unencoded_string());
 		}
@@ -5951,6 +3317,8 @@ bool MTerminalView::DragAcceptData(int32_t inX, int32_t inY, const std::string &
 
 bool MTerminalView::DragAcceptFile(int32_t inX, int32_t inY, const std::filesystem::path &inFile)
 {
+	auto lock = LockEmulator();
+
 	bool result = false;
 	mDragWithin = false;
 
@@ -5959,7 +3327,7 @@ bool MTerminalView::DragAcceptFile(int32_t inX, int32_t inY, const std::filesyst
 	{
 		std::filesystem::path dest;
 		if (MPrefs::GetBoolean("use-cwd-as-upload-dir", true))
-			dest = mTerminalCWD;
+			dest = mEmulator.GetTerminalCWD();
 		else
 			dest = MPrefs::GetString("upload-dir", ".");
 		if (dest.empty())
@@ -32,19 +32,28 @@
 #include "MCanvas.hpp"
 #include "MCommand.hpp"
 #include "MColor.hpp"
+#include "MEmulatorThread.hpp"
 #include "MP2PEvents.hpp"
+#include "MRingBuffer.hpp"
 #include "MSearchPanel.hpp"
 #include "MTerminalBuffer.hpp"
 #include "MTerminalChannel.hpp"
+#include "MTerminalColours.hpp"
+#include "MTerminalEmulator.hpp"
+#include "MTerminalSearch.hpp"
 #include "MUnicode.hpp"
 
 #include <pinch.hpp>
 
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 
 class MStatusbar;
 class MScrollbar;
@@ -98,7 +107,8 @@ class MTerminalView : public MCanvas, public std::enable_shared_from_this<MTermi
 	void SendMouseCommand(int32_t inButton, int32_t inX, int32_t inY, uint32_t inModifiers);
 
 	void HandleOpened(const std::error_code &ec);
-	void HandleReceived(const std::error_code &ec, std::streambuf &inData);
+	void HandleReceived(const std::error_code &ec, std::size_t inBytesReceived);
+	void ReadData();
 
 	bool KeyPressed(uint32_t inKeyCode, char32_t inUnicode, uint32_t inModifiers, bool inAutoRepeat) override;
 	void EnterText(const std::string &inText/* , bool inRepeat */) override;
@@ -152,83 +162,81 @@ class MTerminalView : public MCanvas, public std::enable_shared_from_this<MTermi
 
 	MTerminalChannel *mTerminalChannel;
 	std::vector<std::string> mArgv;
-	int32_t mTerminalWidth, mTerminalHeight;
 
-	MTerminalBuffer mScreenBuffer, mAlternateBuffer, mStatusLineBuffer;
-	MTerminalBuffer *mBuffer;
-
-	// emulation support
-	void SoftReset();
-	void Reset();
-	void Emulate();
-
-	void WriteChar(unicode inChar);
-	void EraseInDisplay(uint32_t inMode, bool inSelective = false);
-	void EraseInLine(uint32_t inMode, bool inSelective = false);
-
-	void ScrollForward();
-	void ScrollBackward();
-
-	//	typedef std::function<void(char)>	EscapeHandler;
-	void EscapeStart(uint8_t inChar);
-	void EscapeVT52(uint8_t inChar);
-	void SelectCharSet(uint8_t inChar);
-	void SelectControlTransmission(uint8_t inChar);
-	void SelectDouble(uint8_t inChar);
-	void EscapeCSI(uint8_t inChar);
-	void ProcessCSILevel1(uint32_t inCmd);
-	void ProcessCSILevel4(uint32_t inCmd);
-	void EscapeDCS(uint8_t inChar);
-	void CommitPFK();
-	void EscapeOSC(uint8_t inChar);
-	void EscapeAPC(uint8_t inChar);
-
-	void SaveCursor();
-	void RestoreCursor();
-	void ResetCursor();
-
-	void SwitchToAlternateScreen();
-	void SwitchToRegularScreen();
-
-	void DownloadFile(const std::filesystem::path &path);
-	void UploadFile(const std::filesystem::path &path);
-
-	void Beep();
+	// the emulation itself, optionally running on a separate thread
+	MTerminalEmulator mEmulator;
+	std::recursive_mutex mEmulatorMutex;
+	std::unique_ptr<MEmulatorThread> mEmulatorThread;
+	uint64_t mIdleVersion = 0;
+	bool mEmulationPending = false;
+	bool mReadSuspended = false;
+	std::atomic<bool> mWakeUpPending = false;
+	uint32_t mAttributeCollector;
+
+	// all matches for the search string, found in the background while the search panel is shown
+	std::unique_ptr<MTerminalSearch> mSearch;
+	void UpdateSearchStatus();
+
+	// Repaints are coalesced into at most one per display frame,
+	// except for the echo of a keystroke, that is drawn right away.
+	// Reads the emulator state, call it holding the emulator lock.
+	void ScheduleRedraw();
+
+	std::chrono::steady_clock::duration mFrameInterval;
+	std::chrono::steady_clock::time_point mLastFrame;
+	asio_ns::steady_timer mFrameTimer;
+	bool mFrameScheduled = false;
+	bool mAwaitingEcho = false;
+
+	// what is drawn, taken from the emulator at the start of Draw
+	MTerminalSnapshot mSnapshot;
+
+	// The text, colors and styles of a line as handed to MDevice are cached
+	// per row and only rebuilt when the line or the way it is drawn changes.
+	// The cursor and blinking text are drawn on top of the cached layout.
+	struct MLineLayoutKey
+	{
+		uint64_t version = 0;
+		uint32_t paletteVersion = 0;
+		int32_t selectionBegin = 0, selectionEnd = 0;
+		int32_t hoverBegin = 0, hoverEnd = 0;
+		int32_t currentLink = 0;
+		bool linkClick = false, inverse = false;
+		std::vector<std::tuple<int32_t, int32_t>> matches; // the first and last column of each search match
+
+		bool operator==(const MLineLayoutKey &) const = default;
+	};
 
-	enum MCursorMovement
+	struct MLineLayout
 	{
-		kMoveUp,
-		kMoveDown,
-		kMoveLeft,
-		kMoveRight,
-		kMoveIND,
-		kMoveRI,
-		kMoveCR,
-		kMoveLF,
-		kMoveCRLF,
-		kMoveHT,
-		kMoveCBT,
-		kMoveBI,
-		kMoveFI,
-		kMoveSL,
-		kMoveSR
+		MLineLayoutKey key;
+		std::string text; // up to the last visible glyph
+		std::vector<uint32_t> offsets; // offset in text for each column
+		std::vector<MColor> colors;
+		std::vector<uint32_t> colorIndex, colorOffset;
+		std::vector<uint32_t> backColorIndex, backColorColumn;
+		std::vector<uint32_t> styleValue, styleOffset;
+
+		// runs of blinking text, first and last column and the background color index
+		std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> blinkRuns;
 	};
 
-	void MoveCursor(MCursorMovement inDirection);
-	void MoveCursorTo(int32_t inX, int32_t inY);
+	void LayoutLine(MLineLayout &ioLayout, const MLine &inLine, int32_t inLineNr, int32_t inColumns);
 
-	bool CursorIsInMargins() const
-	{
-		return mCursor.y >= mMarginTop and mCursor.y <= mMarginBottom and mCursor.x >= mMarginLeft and mCursor.x <= mMarginRight;
-	}
+	std::vector<MLineLayout> mLineLayouts;
+	MTerminalPalette mPalette;
+
+	// The lock to hold while accessing the emulator, also from the search thread
+	std::unique_lock<std::recursive_mutex> LockEmulator();
+
+	void Emulate();
+	void ProcessHostRequests();
+	void TerminalResized(int32_t inTopLine, bool inResizeWindow);
 
-	void SetTabstop();
-	uint32_t GetParam(uint32_t inParamNr, uint32_t inDefaultValue);
-	void GetRectParam(uint32_t inParamOffset,
-		int32_t &outTop, int32_t &outLeft, int32_t &outBottom, int32_t &outRight);
+	void DownloadFile(const std::filesystem::path &path);
+	void UploadFile(const std::filesystem::path &path);
 
-	void SetResetMode(uint32_t inMode, bool inANSI, bool inSet);
-	bool GetMode(uint32_t inMode, bool inANSI);
+	void Beep();
 
 	MRect GetCharacterBounds(uint32_t inLine, uint32_t inColumn);
 	bool GetCharacterForPosition(int32_t inX, int32_t inY, int32_t &outLine, int32_t &outColumn);
@@ -285,8 +293,7 @@ class MTerminalView : public MCanvas, public std::enable_shared_from_this<MTermi
 	MCommand<void()> cFindNext;
 	MCommand<void()> cFindPrev;
 
-	std::deque<char> mInputBuffer;
-	bool mBracketedPaste = false;
+	MRingBuffer mInputBuffer;
 
 	static std::list<MTerminalView *> sTerminalList;
 
@@ -301,95 +308,14 @@ class MTerminalView : public MCanvas, public std::enable_shared_from_this<MTermi
 	std::string mFont;
 	float mCharWidth;
 	int32_t mLineHeight;
-	int32_t mMarginLeft, mMarginTop, mMarginRight, mMarginBottom;
-	MEncoding mEncoding;
-	std::vector<bool> mTabStops;
-
-	struct MCursorState
-	{
-		bool saved;
-		int x, y;
-		const wchar_t *charSetG[4];
-		char charSetGSel[4];
-		int CSGL, CSGR;
-		int SS;
-		MStyle style;
-		bool DECOM, DECAWM;
-		bool blink, block;
-	} mCursor, mSaved, mAlternate, mSavedSL;
-
-	std::map<int, bool> mSavedPrivateMode;
-
-	// DEC modes
-	bool mDECCKM;
-	bool mDECANM;
-	bool mDECSCLM;
-	bool mDECSCNM;
-	bool mDECARM;
-	bool mDECPFF;
-	bool mDECPEX;
-	bool mDECNMK;
-	bool mDECBKM;
-	// VT220
-	int mDECSCL;
-	bool mDECTCEM;
-	bool mDECNRCM;
-	// VT420
-	bool mDECVSSM;
-
-	// ANSI modes
-	bool mIRM;
-	bool mKAM;
-	bool mSRM;
-	bool mLNM;
 
 	// VT220 support
-	bool mS8C1T;
-	struct MPFK *mPFK; // device control strings
-	struct MPFK *mNewPFK;
 	bool mUDKWithShift;
 
-	// handling of escape sequences
-	enum
-	{
-		eESC_NONE,
-		eESC_SEEN,
-		eCSI,
-		eDCS,
-		eDCS_ESC,
-		eOSC,
-		eOSC_ESC,
-		ePM,
-		ePM_ESC,
-		eAPC,
-		eAPC_ESC,
-
-		eSELECT_CHAR_SET,
-		eSELECT_DOUBLE,
-		eSELECT_CTRL_TRANSM,
-
-		eVT52_LINE,
-		eVT52_COLUMN
-	} mEscState;
-
-	int mState;
-	std::vector<uint32_t> mArgs;
-	std::string mArgString;
-	std::string mCtrlSeq;
-	uint32_t mCSICmd;
-	uint32_t mPFKKeyNr;
-
-	// requests coming from host
-	std::string mDECRQSS;
-
 	// some other state information
 	std::chrono::system_clock::time_point mLastBeep;
-	bool mBlockCursor, mBlinkCursor, mBlinkOn;
+	bool mBlinkOn;
 	std::chrono::system_clock::time_point mLastBlink;
-	int32_t mScrollForwardCount;
-
-	std::optional<std::chrono::system_clock::time_point> mNextSmoothScroll;
-	bool mScrollForward;
 
 	enum
 	{
@@ -410,16 +336,6 @@ class MTerminalView : public MCanvas, public std::enable_shared_from_this<MTermi
 	MEventIn<void()> eAnimate;
 	void Animate();
 
-	// status line
-	bool mDECSASD;
-	int mDECSSDT;
-
-	// rectangle extend
-	bool mDECSACE;
-
-	wchar_t mLastChar;
-	bool mLastCtrl;
-
 	// xterm key handling
 	bool mAltSendsEscape;
 	bool mDeleteIsDel;
@@ -436,21 +352,11 @@ class MTerminalView : public MCanvas, public std::enable_shared_from_this<MTermi
 	MAnimationVariable *mDisabledFactor;
 	bool mIgnoreColors;
 
-	enum MouseTrackingMode
-	{
-		eTrackMouseNone,
-		eTrackMouseSendXYOnClick = 9,
-		eTrackMouseSendXYOnButton = 1000,
-		eTrackMouseHilightTracking = 1001,
-		eTrackMouseCellMotionTracking = 1002,
-		eTrackMouseAllMotionTracking = 1003
-	} mMouseMode;
 	int32_t mMouseTrackX, mMouseTrackY;
 
 	std::string mSetWindowTitle;
 
-	int mHyperLink = 0, mCurrentLink = 0, mAnchorLink = 0;
-	void SetHyperLink(const std::string &inURI);
+	int mCurrentLink = 0, mAnchorLink = 0;
 
 	void LinkClicked(std::string inLink);
 
@@ -459,9 +365,6 @@ class MTerminalView : public MCanvas, public std::enable_shared_from_this<MTermi
 
 	bool mDragWithin = false;
 
-	// OSC 7 support, used in up and downloading files
-	std::filesystem::path mTerminalHost, mTerminalCWD;
-
 #if DEBUG
 	bool mDebugUpdate;
 #endif
@@ -0,0 +1,236 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#include "MTrigramIndex.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+// The distinct trigrams in inText, sorted
+void GetTrigrams(std::string_view inText, std::vector<uint32_t> &outTrigrams)
+{
+	outTrigrams.clear();
+
+	for (std::size_t i = 0; i + 2 < inText.length(); ++i)
+	{
+		outTrigrams.push_back(
+			static_cast<uint32_t>(static_cast<uint8_t>(inText[i])) << 16 |
+			static_cast<uint32_t>(static_cast<uint8_t>(inText[i + 1])) << 8 |
+			static_cast<uint32_t>(static_cast<uint8_t>(inText[i + 2])));
+	}
+
+	std::sort(outTrigrams.begin(), outTrigrams.end());
+	outTrigrams.erase(std::unique(outTrigrams.begin(), outTrigrams.end()), outTrigrams.end());
+}
+
+// Removed entries are only dropped from the front of a posting list
+// once there are enough of them to make moving the rest worthwhile
+const std::size_t
+	kMinCompactSize = 256;
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+void MTrigramIndex::MPosting::Append(uint32_t inLine, std::size_t &ioMemory)
+{
+	assert(Empty() or mLines.back() < inLine);
+
+	std::size_t capacity = mLines.capacity();
+	mLines.push_back(inLine);
+	ioMemory += (mLines.capacity() - capacity) * sizeof(uint32_t);
+}
+
+void MTrigramIndex::MPosting::RemoveFirst(std::size_t &ioMemory)
+{
+	assert(not Empty());
+
+	++mHead;
+
+	if (Empty())
+	{
+		ioMemory -= mLines.capacity() * sizeof(uint32_t);
+		mLines = {};
+		mHead = 0;
+	}
+	else if (mHead >= kMinCompactSize and mHead * 2 >= mLines.size())
+	{
+		mLines.erase(mLines.begin(), mLines.begin() + mHead);
+		mHead = 0;
+	}
+}
+
+// --------------------------------------------------------------------
+
+MTrigramIndex::MTrigramIndex(std::size_t inMaxMemory)
+	: mMaxMemory(inMaxMemory)
+{
+}
+
+void MTrigramIndex::Add(uint64_t inSerial, std::string_view inText, bool inSoftWrapped)
+{
+	assert(Empty() or inSerial == mEnd);
+
+	// start over when the line numbers no longer fit
+	if (not Empty() and inSerial - mBase > std::numeric_limits<uint32_t>::max())
+		Clear();
+
+	if (Empty())
+		mBase = mBegin = mEnd = inSerial;
+
+	uint32_t line = static_cast<uint32_t>(inSerial - mBase);
+
+	GetTrigrams(inText, mTrigrams);
+	for (uint32_t trigram : mTrigrams)
+		mPostings[trigram].Append(line, mMemory);
+
+	if (inSoftWrapped)
+		mWrapped.Append(line, mMemory);
+
+	mEnd = inSerial + 1;
+}
+
+void MTrigramIndex::RemoveFirst(std::string_view inText, bool inSoftWrapped)
+{
+	assert(not Empty());
+
+	GetTrigrams(inText, mTrigrams);
+	for (uint32_t trigram : mTrigrams)
+	{
+		auto i = mPostings.find(trigram);
+		assert(i != mPostings.end() and i->second.mLines[i->second.mHead] == mBegin - mBase);
+
+		i->second.RemoveFirst(mMemory);
+		if (i->second.Empty())
+			mPostings.erase(i);
+	}
+
+	if (inSoftWrapped)
+		mWrapped.RemoveFirst(mMemory);
+
+	if (++mBegin == mEnd)
+		Clear();
+}
+
+bool MTrigramIndex::GetCandidates(std::string_view inWhat, uint64_t inBegin, uint64_t inEnd, std::vector<uint64_t> &outSerials) const
+{
+	if (inWhat.length() < 3)
+		return false;
+
+	outSerials.clear();
+
+	inBegin = std::max(inBegin, mBegin);
+	inEnd = std::min(inEnd, mEnd);
+	if (inBegin >= inEnd)
+		return true;
+
+	uint32_t begin = static_cast<uint32_t>(inBegin - mBase);
+	uint32_t end = static_cast<uint32_t>(inEnd - mBase);
+
+	auto range = [begin, end](const MPosting &inPosting)
+	{
+		auto b = std::lower_bound(inPosting.mLines.begin() + inPosting.mHead, inPosting.mLines.end(), begin);
+		auto e = std::lower_bound(b, inPosting.mLines.end(), end);
+		return std::make_pair(b, e);
+	};
+
+	std::vector<uint32_t> trigrams;
+	GetTrigrams(inWhat, trigrams);
+
+	std::vector<const MPosting *> postings;
+	for (uint32_t trigram : trigrams)
+	{
+		auto i = mPostings.find(trigram);
+		if (i == mPostings.end())
+		{
+			postings.clear();
+			break;
+		}
+		postings.push_back(&i->second);
+	}
+
+	// intersect the posting lists, shortest first
+	std::vector<uint32_t> lines;
+	if (not postings.empty())
+	{
+		std::sort(postings.begin(), postings.end(),
+			[](const MPosting *a, const MPosting *b) { return a->Size() < b->Size(); });
+
+		auto [b, e] = range(*postings.front());
+		lines.assign(b, e);
+
+		for (auto p = postings.begin() + 1; p != postings.end() and not lines.empty(); ++p)
+		{
+			auto [pb, pe] = range(**p);
+
+			std::size_t n = 0;
+			for (std::size_t i = 0; i < lines.size(); ++i)
+			{
+				pb = std::lower_bound(pb, pe, lines[i]);
+				if (pb != pe and *pb == lines[i])
+					lines[n++] = lines[i];
+			}
+			lines.resize(n);
+		}
+	}
+
+	auto [wb, we] = range(mWrapped);
+
+	std::vector<uint32_t> merged;
+	merged.reserve(lines.size() + (we - wb));
+	std::set_union(lines.begin(), lines.end(), wb, we, back_inserter(merged));
+
+	outSerials.reserve(merged.size());
+	for (uint32_t line : merged)
+		outSerials.push_back(mBase + line);
+
+	return true;
+}
+
+std::size_t MTrigramIndex::GetMemoryUsage() const
+{
+	// a rough estimate for the hash table nodes and buckets
+	return mMemory +
+	       mPostings.size() * (sizeof(std::pair<const uint32_t, MPosting>) + sizeof(void *)) +
+	       mPostings.bucket_count() * sizeof(void *);
+}
+
+void MTrigramIndex::Clear()
+{
+	mPostings.clear();
+	mWrapped = {};
+	mBase = mBegin = mEnd = 0;
+	mMemory = 0;
+}
@@ -0,0 +1,93 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// --------------------------------------------------------------------
+// MTrigramIndex records for each sequence of three bytes the lines that
+// contain it. Lines are identified by their serial number and are added
+// newest last and removed oldest first, so the posting lists stay sorted
+// and can be intersected to find the lines that may contain a string.
+// Soft wrapped lines are always candidates, since a match may continue
+// on the next line.
+
+class MTrigramIndex
+{
+  public:
+	MTrigramIndex(std::size_t inMaxMemory);
+
+	MTrigramIndex(const MTrigramIndex &) = delete;
+	MTrigramIndex &operator=(const MTrigramIndex &) = delete;
+
+	// The indexed lines have serial numbers in [Begin(), End())
+	uint64_t Begin() const { return mBegin; }
+	uint64_t End() const { return mEnd; }
+	bool Empty() const { return mBegin == mEnd; }
+
+	// Add the next line, inSerial should be End() unless the index is empty
+	void Add(uint64_t inSerial, std::string_view inText, bool inSoftWrapped);
+
+	// Remove the line Begin(), inText and inSoftWrapped must be what was passed to Add
+	void RemoveFirst(std::string_view inText, bool inSoftWrapped);
+
+	// Store in outSerials the indexed lines in [inBegin, inEnd) that may contain inWhat,
+	// in ascending order. Returns false if inWhat is too short to use the index.
+	bool GetCandidates(std::string_view inWhat, uint64_t inBegin, uint64_t inEnd, std::vector<uint64_t> &outSerials) const;
+
+	// The memory used by the posting lists, the owner should remove lines while IsFull()
+	std::size_t GetMemoryUsage() const;
+	bool IsFull() const { return GetMemoryUsage() > mMaxMemory; }
+
+	void Clear();
+
+  private:
+	// Line numbers are stored relative to mBase to save space, a posting
+	// list starts at mHead, entries before that have been removed.
+	struct MPosting
+	{
+		std::vector<uint32_t> mLines;
+		std::size_t mHead = 0;
+
+		void Append(uint32_t inLine, std::size_t &ioMemory);
+		void RemoveFirst(std::size_t &ioMemory);
+		bool Empty() const { return mHead == mLines.size(); }
+		std::size_t Size() const { return mLines.size() - mHead; }
+	};
+
+	std::unordered_map<uint32_t, MPosting> mPostings;
+	MPosting mWrapped;
+	uint64_t mBase = 0, mBegin = 0, mEnd = 0;
+	std::size_t mMemory = 0, mMaxMemory;
+	std::vector<uint32_t> mTrigrams;
+};
@@ -0,0 +1,441 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#include "MVTParser.hpp"
+
+#include <algorithm>
+#include <utility>
+
+// --------------------------------------------------------------------
+// The transition tables, each entry contains the action in the high
+// byte and the next state in the low byte.
+
+namespace
+{
+
+using State = MVTParser::State;
+using Action = MVTParser::Action;
+using StateTable = std::array<std::array<uint16_t, 256>, MVTParser::eStateCount>;
+
+enum TableKind
+{
+	kANSITable,
+	kANSIWithC1Table,
+	kVT52Table
+};
+
+constexpr uint16_t Transition(Action inAction, State inState)
+{
+	return static_cast<uint16_t>(inAction << 8 | inState);
+}
+
+constexpr StateTable BuildTable(TableKind inKind)
+{
+	StateTable table{};
+
+	auto set = [&table](State inState, int inFrom, int inTo, Action inAction, State inNext)
+	{
+		for (int b = inFrom; b <= inTo; ++b)
+			table[inState][b] = Transition(inAction, inNext);
+	};
+
+	// C0 controls other than CAN, SUB and ESC, those are handled below
+	auto setC0 = [&set](State inState, Action inAction, State inNext)
+	{
+		set(inState, 0x00, 0x17, inAction, inNext);
+		set(inState, 0x19, 0x19, inAction, inNext);
+		set(inState, 0x1c, 0x1f, inAction, inNext);
+	};
+
+	const bool c1 = inKind == kANSIWithC1Table;
+	const int high = c1 ? 0xa0 : 0x80;
+
+	// by default everything is ignored
+	for (int s = 0; s < MVTParser::eStateCount; ++s)
+		set(State(s), 0x00, 0xff, MVTParser::aIgnore, State(s));
+
+	setC0(MVTParser::eGround, MVTParser::aExecute, MVTParser::eGround);
+	set(MVTParser::eGround, 0x20, 0x7e, MVTParser::aPrint, MVTParser::eGround);
+	set(MVTParser::eGround, high, 0xff, MVTParser::aPrint, MVTParser::eGround);
+
+	setC0(MVTParser::eEscape, MVTParser::aExecute, MVTParser::eEscape);
+	set(MVTParser::eEscape, 0x20, 0x2f, MVTParser::aCollect, MVTParser::eEscapeIntermediate);
+	set(MVTParser::eEscape, 0x30, 0x7e, MVTParser::aEscDispatch, MVTParser::eGround);
+	set(MVTParser::eEscape, 'P', 'P', MVTParser::aClear, MVTParser::eDcsEntry);
+	set(MVTParser::eEscape, '[', '[', MVTParser::aClear, MVTParser::eCsiEntry);
+	set(MVTParser::eEscape, ']', ']', MVTParser::aOscStart, MVTParser::eOscString);
+	set(MVTParser::eEscape, 'X', 'X', MVTParser::aNone, MVTParser::eSosPmString);
+	set(MVTParser::eEscape, '^', '^', MVTParser::aNone, MVTParser::eSosPmString);
+	set(MVTParser::eEscape, '_', '_', MVTParser::aApcStart, MVTParser::eApcString);
+
+	setC0(MVTParser::eEscapeIntermediate, MVTParser::aExecute, MVTParser::eEscapeIntermediate);
+	set(MVTParser::eEscapeIntermediate, 0x20, 0x2f, MVTParser::aCollect, MVTParser::eEscapeIntermediate);
+	set(MVTParser::eEscapeIntermediate, 0x30, 0x7e, MVTParser::aEscDispatch, MVTParser::eGround);
+
+	// A colon is accepted as parameter separator in control sequences
+	setC0(MVTParser::eCsiEntry, MVTParser::aExecute, MVTParser::eCsiEntry);
+	set(MVTParser::eCsiEntry, 0x20, 0x2f, MVTParser::aCollect, MVTParser::eCsiIntermediate);
+	set(MVTParser::eCsiEntry, 0x30, 0x3b, MVTParser::aParam, MVTParser::eCsiParam);
+	set(MVTParser::eCsiEntry, 0x3c, 0x3f, MVTParser::aCollect, MVTParser::eCsiParam);
+	set(MVTParser::eCsiEntry, 0x40, 0x7e, MVTParser::aCsiDispatch, MVTParser::eGround);
+
+	setC0(MVTParser::eCsiParam, MVTParser::aExecute, MVTParser::eCsiParam);
+	set(MVTParser::eCsiParam, 0x20, 0x2f, MVTParser::aCollect, MVTParser::eCsiIntermediate);
+	set(MVTParser::eCsiParam, 0x30, 0x3b, MVTParser::aParam, MVTParser::eCsiParam);
+	set(MVTParser::eCsiParam, 0x3c, 0x3f, MVTParser::aIgnore, MVTParser::eCsiIgnore);
+	set(MVTParser::eCsiParam, 0x40, 0x7e, MVTParser::aCsiDispatch, MVTParser::eGround);
+
+	setC0(MVTParser::eCsiIntermediate, MVTParser::aExecute, MVTParser::eCsiIntermediate);
+	set(MVTParser::eCsiIntermediate, 0x20, 0x2f, MVTParser::aCollect, MVTParser::eCsiIntermediate);
+	set(MVTParser::eCsiIntermediate, 0x30, 0x3f, MVTParser::aIgnore, MVTParser::eCsiIgnore);
+	set(MVTParser::eCsiIntermediate, 0x40, 0x7e, MVTParser::aCsiDispatch, MVTParser::eGround);
+
+	setC0(MVTParser::eCsiIgnore, MVTParser::aExecute, MVTParser::eCsiIgnore);
+	set(MVTParser::eCsiIgnore, 0x40, 0x7e, MVTParser::aNone, MVTParser::eGround);
+
+	set(MVTParser::eDcsEntry, 0x20, 0x2f, MVTParser::aCollect, MVTParser::eDcsIntermediate);
+	set(MVTParser::eDcsEntry, 0x30, 0x39, MVTParser::aParam, MVTParser::eDcsParam);
+	set(MVTParser::eDcsEntry, 0x3a, 0x3a, MVTParser::aIgnore, MVTParser::eDcsIgnore);
+	set(MVTParser::eDcsEntry, 0x3b, 0x3b, MVTParser::aParam, MVTParser::eDcsParam);
+	set(MVTParser::eDcsEntry, 0x3c, 0x3f, MVTParser::aCollect, MVTParser::eDcsParam);
+	set(MVTParser::eDcsEntry, 0x40, 0x7e, MVTParser::aHook, MVTParser::eDcsPassthrough);
+
+	set(MVTParser::eDcsParam, 0x20, 0x2f, MVTParser::aCollect, MVTParser::eDcsIntermediate);
+	set(MVTParser::eDcsParam, 0x30, 0x39, MVTParser::aParam, MVTParser::eDcsParam);
+	set(MVTParser::eDcsParam, 0x3a, 0x3a, MVTParser::aIgnore, MVTParser::eDcsIgnore);
+	set(MVTParser::eDcsParam, 0x3b, 0x3b, MVTParser::aParam, MVTParser::eDcsParam);
+	set(MVTParser::eDcsParam, 0x3c, 0x3f, MVTParser::aIgnore, MVTParser::eDcsIgnore);
+	set(MVTParser::eDcsParam, 0x40, 0x7e, MVTParser::aHook, MVTParser::eDcsPassthrough);
+
+	set(MVTParser::eDcsIntermediate, 0x20, 0x2f, MVTParser::aCollect, MVTParser::eDcsIntermediate);
+	set(MVTParser::eDcsIntermediate, 0x30, 0x3f, MVTParser::aIgnore, MVTParser::eDcsIgnore);
+	set(MVTParser::eDcsIntermediate, 0x40, 0x7e, MVTParser::aHook, MVTParser::eDcsPassthrough);
+
+	setC0(MVTParser::eDcsPassthrough, MVTParser::aPut, MVTParser::eDcsPassthrough);
+	set(MVTParser::eDcsPassthrough, 0x20, 0x7e, MVTParser::aPut, MVTParser::eDcsPassthrough);
+	set(MVTParser::eDcsPassthrough, high, 0xff, MVTParser::aPut, MVTParser::eDcsPassthrough);
+
+	set(MVTParser::eOscString, 0x07, 0x07, MVTParser::aOscEnd, MVTParser::eGround);
+	set(MVTParser::eOscString, 0x20, 0x7e, MVTParser::aOscPut, MVTParser::eOscString);
+	set(MVTParser::eOscString, high, 0xff, MVTParser::aOscPut, MVTParser::eOscString);
+
+	set(MVTParser::eApcString, 0x07, 0x07, MVTParser::aApcEnd, MVTParser::eGround);
+	set(MVTParser::eApcString, 0x20, 0x7e, MVTParser::aApcPut, MVTParser::eApcString);
+	set(MVTParser::eApcString, high, 0xff, MVTParser::aApcPut, MVTParser::eApcString);
+
+	// ST always terminates a string, also when C1 controls are not
+	// recognised. Scripts use it to end APC file transfer commands.
+	set(MVTParser::eDcsPassthrough, 0x9c, 0x9c, MVTParser::aUnhook, MVTParser::eGround);
+	set(MVTParser::eDcsIgnore, 0x9c, 0x9c, MVTParser::aNone, MVTParser::eGround);
+	set(MVTParser::eOscString, 0x9c, 0x9c, MVTParser::aOscEnd, MVTParser::eGround);
+	set(MVTParser::eApcString, 0x9c, 0x9c, MVTParser::aApcEnd, MVTParser::eGround);
+	set(MVTParser::eSosPmString, 0x9c, 0x9c, MVTParser::aNone, MVTParser::eGround);
+
+	setC0(MVTParser::eVT52Escape, MVTParser::aExecute, MVTParser::eVT52Escape);
+	set(MVTParser::eVT52Escape, 0x20, 0x7e, MVTParser::aEscDispatch, MVTParser::eGround);
+	set(MVTParser::eVT52Escape, 'Y', 'Y', MVTParser::aNone, MVTParser::eVT52Line);
+
+	setC0(MVTParser::eVT52Line, MVTParser::aExecute, MVTParser::eVT52Line);
+	set(MVTParser::eVT52Line, 0x20, 0x7e, MVTParser::aVT52Line, MVTParser::eVT52Column);
+
+	setC0(MVTParser::eVT52Column, MVTParser::aExecute, MVTParser::eVT52Column);
+	set(MVTParser::eVT52Column, 0x20, 0x7e, MVTParser::aVT52Column, MVTParser::eGround);
+
+	// The transitions from 'anywhere'
+	for (int s = 0; s < MVTParser::eStateCount; ++s)
+	{
+		State state = State(s);
+
+		set(state, 0x18, 0x18, MVTParser::aExecute, MVTParser::eGround);
+		set(state, 0x1a, 0x1a, MVTParser::aExecute, MVTParser::eGround);
+
+		if (inKind == kVT52Table)
+			set(state, 0x1b, 0x1b, MVTParser::aClear, MVTParser::eVT52Escape);
+		else if (state == MVTParser::eDcsPassthrough or state == MVTParser::eOscString or state == MVTParser::eApcString)
+			set(state, 0x1b, 0x1b, MVTParser::aStringEscape, MVTParser::eEscape);
+		else
+			set(state, 0x1b, 0x1b, MVTParser::aClear, MVTParser::eEscape);
+
+		if (c1)
+		{
+			uint16_t st = table[state][0x9c];
+
+			set(state, 0x80, 0x8f, MVTParser::aExecute, MVTParser::eGround);
+			set(state, 0x91, 0x97, MVTParser::aExecute, MVTParser::eGround);
+			set(state, 0x99, 0x9a, MVTParser::aExecute, MVTParser::eGround);
+			set(state, 0x90, 0x90, MVTParser::aClear, MVTParser::eDcsEntry);
+			set(state, 0x9b, 0x9b, MVTParser::aClear, MVTParser::eCsiEntry);
+			set(state, 0x9d, 0x9d, MVTParser::aOscStart, MVTParser::eOscString);
+			set(state, 0x98, 0x98, MVTParser::aNone, MVTParser::eSosPmString);
+			set(state, 0x9e, 0x9e, MVTParser::aNone, MVTParser::eSosPmString);
+			set(state, 0x9f, 0x9f, MVTParser::aApcStart, MVTParser::eApcString);
+
+			if (st == Transition(MVTParser::aIgnore, state))
+				set(state, 0x9c, 0x9c, MVTParser::aNone, MVTParser::eGround);
+		}
+	}
+
+	return table;
+}
+
+constexpr StateTable kTables[] = {
+	BuildTable(kANSITable),
+	BuildTable(kANSIWithC1Table),
+	BuildTable(kVT52Table)
+};
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+MVTParser::MVTParser(MVTParserHandler &inHandler)
+	: mHandler(inHandler)
+{
+	UpdateTable();
+}
+
+void MVTParser::Reset()
+{
+	mState = eGround;
+	mPendingString = eGround;
+	mParamCount = mParam = mIntermediateCount = 0;
+}
+
+void MVTParser::SetVT52Mode(bool inVT52Mode)
+{
+	if (mVT52Mode != inVT52Mode)
+	{
+		mVT52Mode = inVT52Mode;
+		UpdateTable();
+	}
+}
+
+void MVTParser::SetC1Controls(bool inC1Controls)
+{
+	if (mC1Controls != inC1Controls)
+	{
+		mC1Controls = inC1Controls;
+		UpdateTable();
+	}
+}
+
+void MVTParser::UpdateTable()
+{
+	if (mVT52Mode)
+		mTable = kTables[kVT52Table].data();
+	else if (mC1Controls)
+		mTable = kTables[kANSIWithC1Table].data();
+	else
+		mTable = kTables[kANSITable].data();
+}
+
+std::span<const uint32_t> MVTParser::FinishParams()
+{
+	if (mParamCount < kMaxParams)
+		mParams[mParamCount++] = mParam;
+	mParam = 0;
+
+	return { mParams, mParamCount };
+}
+
+std::size_t MVTParser::Feed(std::span<const uint8_t> inData)
+{
+	const uint8_t *data = inData.data();
+	const std::size_t size = inData.size();
+
+	std::size_t i = 0;
+
+	while (i < size)
+	{
+		uint8_t b = data[i];
+
+		// Is this the backslash of an ESC \ ending a string?
+		if (mPendingString != eGround and mState == eEscape and b >= 0x20)
+		{
+			State pending = std::exchange(mPendingString, eGround);
+
+			if (b == '\\')
+			{
+				mState = eGround;
+				++i;
+
+				switch (pending)
+				{
+					case eDcsPassthrough: mHandler.DcsUnhook(); break;
+					case eOscString: mHandler.OscEnd(); break;
+					case eApcString: mHandler.ApcEnd(); break;
+					default: break;
+				}
+
+				if (std::exchange(mSuspended, false))
+					break;
+				continue;
+			}
+		}
+
+		const uint16_t transition = mTable[mState][b];
+		const Action action = static_cast<Action>(transition >> 8);
+		const State state = mState;
+
+		mState = static_cast<State>(transition & 0x0ff);
+
+		switch (action)
+		{
+			case aNone:
+			case aIgnore:
+				++i;
+				continue;
+
+			case aPrint:
+			case aPut:
+			case aOscPut:
+			case aApcPut:
+			{
+				// collect the run of bytes with the same transition
+				std::size_t e = i + 1;
+				while (e < size and mTable[state][data[e]] == transition)
+					++e;
+
+				std::span<const uint8_t> run(data + i, e - i);
+
+				switch (action)
+				{
+					case aPrint:
+					{
+						std::size_t n = mHandler.Print(run);
+						if (n < run.size())
+						{
+							mSuspended = false;
+							return i + n;
+						}
+						break;
+					}
+
+					case aPut: mHandler.DcsPut(run); break;
+					case aOscPut: mHandler.OscPut(run); break;
+					case aApcPut: mHandler.ApcPut(run); break;
+					default: break;
+				}
+
+				i = e;
+				break;
+			}
+
+			case aExecute:
+				++i;
+				mHandler.Execute(b);
+				break;
+
+			case aClear:
+				++i;
+				mParamCount = mParam = mIntermediateCount = 0;
+				mPendingString = eGround;
+				continue;
+
+			case aCollect:
+				++i;
+				if (mIntermediateCount < kMaxIntermediates)
+					mIntermediates[mIntermediateCount++] = b;
+				continue;
+
+			case aParam:
+				++i;
+				if (b == ';' or b == ':')
+				{
+					if (mParamCount < kMaxParams)
+						mParams[mParamCount++] = mParam;
+					mParam = 0;
+				}
+				else
+					mParam = std::min<uint32_t>(mParam * 10 + (b - '0'), kMaxParamValue);
+				continue;
+
+			case aEscDispatch:
+				++i;
+				mHandler.EscDispatch({ mIntermediates, mIntermediateCount }, b);
+				break;
+
+			case aCsiDispatch:
+				++i;
+				mHandler.CsiDispatch(FinishParams(), { mIntermediates, mIntermediateCount }, b);
+				break;
+
+			case aHook:
+				++i;
+				mHandler.DcsHook(FinishParams(), { mIntermediates, mIntermediateCount }, b);
+				break;
+
+			case aUnhook:
+				++i;
+				mHandler.DcsUnhook();
+				break;
+
+			case aOscStart:
+				++i;
+				mHandler.OscStart();
+				break;
+
+			case aOscEnd:
+				++i;
+				mHandler.OscEnd();
+				break;
+
+			case aApcStart:
+				++i;
+				mHandler.ApcStart();
+				break;
+
+			case aApcEnd:
+				++i;
+				mHandler.ApcEnd();
+				break;
+
+			case aStringEscape:
+				++i;
+				mParamCount = mParam = mIntermediateCount = 0;
+				mPendingString = state;
+				continue;
+
+			case aVT52Line:
+				++i;
+				mVT52Line = b - 0x20;
+				continue;
+
+			case aVT52Column:
+				++i;
+				mHandler.VT52CursorAddress(mVT52Line, b - 0x20);
+				break;
+		}
+
+		if (std::exchange(mSuspended, false))
+			break;
+	}
+
+	return i;
+}
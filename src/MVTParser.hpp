@@ -0,0 +1,189 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// --------------------------------------------------------------------
+// MVTParser is a table driven parser for DEC/ANSI control sequences,
+// modelled after the state diagram for the DEC VT500 series terminals
+// by Paul Flo Williams. The parser does not interpret the sequences,
+// it reports them as actions to an MVTParserHandler.
+//
+// Each byte results in a single table lookup, runs of printable text
+// and of string data are reported in one call.
+
+class MVTParserHandler
+{
+  public:
+	virtual ~MVTParserHandler() = default;
+
+	// A run of printable bytes, possibly containing (partial) UTF-8
+	// sequences. Returns the number of bytes actually consumed, if this
+	// is less than the length of the run, parsing is suspended.
+	virtual std::size_t Print(std::span<const uint8_t> inText) = 0;
+
+	// A C0 or C1 control code
+	virtual void Execute(uint8_t inControl) = 0;
+
+	// Escape sequence with intermediate bytes in the range 0x20-0x2f
+	virtual void EscDispatch(std::string_view inIntermediates, uint8_t inFinal) = 0;
+
+	// Control sequence, the intermediates include a private marker
+	// (one of '<=>?') if it was present. Omitted parameters are zero.
+	virtual void CsiDispatch(std::span<const uint32_t> inParams, std::string_view inIntermediates, uint8_t inFinal) = 0;
+
+	// Device control string
+	virtual void DcsHook(std::span<const uint32_t> inParams, std::string_view inIntermediates, uint8_t inFinal) = 0;
+	virtual void DcsPut(std::span<const uint8_t> inData) = 0;
+	virtual void DcsUnhook() = 0;
+
+	// Operating system command
+	virtual void OscStart() = 0;
+	virtual void OscPut(std::span<const uint8_t> inData) = 0;
+	virtual void OscEnd() = 0;
+
+	// Application program command
+	virtual void ApcStart() = 0;
+	virtual void ApcPut(std::span<const uint8_t> inData) = 0;
+	virtual void ApcEnd() = 0;
+
+	// VT52 direct cursor addressing, zero based
+	virtual void VT52CursorAddress(uint32_t inLine, uint32_t inColumn) = 0;
+};
+
+// --------------------------------------------------------------------
+// Strings (DCS, OSC and APC) are only reported as ended when properly
+// terminated by ST (ESC \ or 0x9c) or, for OSC and APC, by BEL. When
+// aborted by CAN, SUB or another escape sequence no end is reported.
+
+class MVTParser
+{
+  public:
+	MVTParser(MVTParserHandler &inHandler);
+
+	MVTParser(const MVTParser &) = delete;
+	MVTParser &operator=(const MVTParser &) = delete;
+
+	// Feed data to the parser, returns the number of bytes consumed.
+	// This is less than the size of inData only when parsing was suspended.
+	std::size_t Feed(std::span<const uint8_t> inData);
+
+	// Stop parsing after the current action, can be called by the handler
+	void Suspend() { mSuspended = true; }
+
+	// Return to the ground state
+	void Reset();
+
+	// In VT52 mode only the VT52 escape sequences are recognised
+	void SetVT52Mode(bool inVT52Mode);
+
+	// Recognise 8-bit C1 controls. If not set, bytes in the range 0x80-0x9f
+	// are treated as printable, they're part of UTF-8 sequences then.
+	void SetC1Controls(bool inC1Controls);
+
+	static constexpr uint32_t kMaxParams = 32;
+	static constexpr uint32_t kMaxIntermediates = 4;
+	static constexpr uint32_t kMaxParamValue = 65535;
+
+	enum State : uint8_t
+	{
+		eGround,
+		eEscape,
+		eEscapeIntermediate,
+		eCsiEntry,
+		eCsiParam,
+		eCsiIntermediate,
+		eCsiIgnore,
+		eDcsEntry,
+		eDcsParam,
+		eDcsIntermediate,
+		eDcsPassthrough,
+		eDcsIgnore,
+		eOscString,
+		eApcString,
+		eSosPmString,
+		eVT52Escape,
+		eVT52Line,
+		eVT52Column,
+
+		eStateCount
+	};
+
+	enum Action : uint8_t
+	{
+		aNone,
+		aIgnore,
+		aPrint,
+		aExecute,
+		aClear,
+		aCollect,
+		aParam,
+		aEscDispatch,
+		aCsiDispatch,
+		aHook,
+		aPut,
+		aUnhook,
+		aOscStart,
+		aOscPut,
+		aOscEnd,
+		aApcStart,
+		aApcPut,
+		aApcEnd,
+		aStringEscape,
+		aVT52Line,
+		aVT52Column
+	};
+
+  private:
+	void UpdateTable();
+	std::span<const uint32_t> FinishParams();
+
+	MVTParserHandler &mHandler;
+
+	const std::array<uint16_t, 256> *mTable;
+	State mState = eGround;
+	State mPendingString = eGround;
+	bool mSuspended = false;
+	bool mVT52Mode = false;
+	bool mC1Controls = false;
+
+	uint32_t mParams[kMaxParams];
+	uint32_t mParamCount = 0;
+	uint32_t mParam = 0;
+
+	char mIntermediates[kMaxIntermediates];
+	uint32_t mIntermediateCount = 0;
+
+	uint32_t mVT52Line = 0;
+};
@@ -0,0 +1,256 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Maarten L. Hekkelman
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Copyright Maarten L. Hekkelman 2011
+// All rights reserved
+
+// Tests for MRegex and for regular expression search in MTerminalBuffer.
+// These run without a display, the exit status is the number of failures.
+
+#include "MRegex.hpp"
+#include "MTerminalBuffer.hpp"
+
+#include <iostream>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+int sFailed = 0;
+
+void Check(bool inCondition, const std::string &inWhat)
+{
+	if (not inCondition)
+	{
+		std::cerr << "FAILED: " << inWhat << '\n';
+		++sFailed;
+	}
+}
+
+// Returns the leftmost longest match of inPattern in inText, if any
+std::optional<std::string> Match(const std::string &inPattern, const std::string &inText, bool inIgnoreCase = false)
+{
+	MRegex rx(inPattern, inIgnoreCase);
+
+	std::size_t begin, end;
+	if (not rx.Search(inText, 0, begin, end))
+		return {};
+
+	return inText.substr(begin, end - begin);
+}
+
+void CheckMatch(const std::string &inPattern, const std::string &inText, const std::string &inExpected, bool inIgnoreCase = false)
+{
+	auto m = Match(inPattern, inText, inIgnoreCase);
+	Check(m.has_value() and *m == inExpected,
+		"'" + inPattern + "' on '" + inText + "' should match '" + inExpected + "'" +
+			(m.has_value() ? " but matched '" + *m + "'" : " but did not match"));
+}
+
+void CheckNoMatch(const std::string &inPattern, const std::string &inText, bool inIgnoreCase = false)
+{
+	auto m = Match(inPattern, inText, inIgnoreCase);
+	Check(not m.has_value(), "'" + inPattern + "' on '" + inText + "' should not match but matched '" + m.value_or("") + "'");
+}
+
+void CheckError(const std::string &inPattern)
+{
+	bool thrown = false;
+
+	try
+	{
+		MRegex rx(inPattern, false);
+	}
+	catch (const MRegexError &)
+	{
+		thrown = true;
+	}
+
+	Check(thrown, "'" + inPattern + "' should be refused");
+}
+
+// --------------------------------------------------------------------
+
+void TestAnchors()
+{
+	CheckMatch("^foo", "foo bar", "foo");
+	CheckNoMatch("^bar", "foo bar");
+	CheckMatch("bar$", "foo bar", "bar");
+	CheckNoMatch("foo$", "foo bar");
+	CheckMatch("^foo bar$", "foo bar", "foo bar");
+	CheckMatch("^$|x", "x", "x");
+}
+
+void TestAlternation()
+{
+	CheckMatch("a|b|c", "xxc", "c");
+	CheckMatch("err(or)?|warn", "a warning", "warn");
+	CheckMatch("cat|category", "category", "category");
+	CheckMatch("(?:ab|cd)+", "xabcdaby", "abcdab");
+}
+
+void TestRepeat()
+{
+	CheckMatch("x{2}", "xaxxx", "xx");
+	CheckMatch("E\\d{3,4}", "code E12 E12345 x", "E1234");
+	CheckNoMatch("E\\d{3,4}", "code E12 x");
+	CheckMatch("a{2,}", "a aaaa", "aaaa");
+	CheckMatch("req-[0-9a-f]{8}", "id req-deadbeef!", "req-deadbeef");
+	CheckError("a{2,1}");
+	CheckError("((a{100}){100}){100}");
+}
+
+void TestClasses()
+{
+	CheckMatch("[a-c]+x", "zzabcabx", "abcabx");
+	CheckMatch("[^ ]+", "   word  ", "word");
+	CheckMatch("[^a-z]+", "abc123def", "123");
+	CheckMatch("[]]", "a]b", "]");
+	CheckMatch("\\w+@\\w+\\.com", "mail joe@ex.com now", "joe@ex.com");
+	CheckMatch("\\S+", "  \tvalue\t", "value");
+
+	// non-ASCII characters are matched as a whole
+	CheckMatch("caf.", "un café noir", "café");
+	CheckMatch("[é]+", "ééé", "ééé");
+	CheckMatch("[^a-z ]+", "abc äöü def", "äöü");
+	CheckMatch("[α-ω]+", "the λόγος", "λ");
+	CheckNoMatch("[^é]", "é");
+	CheckMatch("[^é]+", "éèé", "è");
+	CheckMatch("[^α-ω]+", "λx€λ", "x€");
+	CheckMatch("[^a]", "a\U0001F600", "\U0001F600");
+}
+
+void TestIgnoreCase()
+{
+	// the pattern is folded, the text is expected to be folded already
+	CheckMatch("ERROR", "an error", "error", true);
+	CheckMatch("[A-Z]+", "abc def", "abc", true);
+	CheckMatch("CAFÉ", "un café", "café", true);
+	CheckNoMatch("ERROR", "an error");
+}
+
+void TestEmptyMatches()
+{
+	// matches are never empty
+	CheckNoMatch("a*", "bbb");
+	CheckMatch("a*", "bbaab", "aa");
+	CheckNoMatch("x?", "abc");
+	CheckNoMatch("^", "abc");
+	CheckError("(");
+	CheckError("*a");
+}
+
+// --------------------------------------------------------------------
+
+const uint32_t
+	kWidth = 20,
+	kHeight = 5;
+
+// Print text on the bottom line of the screen, wrapping to the next line
+// like the emulator does when the text does not fit.
+void Print(MTerminalBuffer &ioBuffer, const std::u32string &inText)
+{
+	for (std::size_t i = 0; i < inText.length(); ++i)
+	{
+		if (i > 0 and i % kWidth == 0)
+		{
+			ioBuffer.WrapLine(kHeight - 1);
+			ioBuffer.ScrollForward(0, kHeight - 1, 0, kWidth - 1);
+		}
+
+		ioBuffer.SetCharacter(kHeight - 1, i % kWidth, inText[i]);
+	}
+
+	ioBuffer.ScrollForward(0, kHeight - 1, 0, kWidth - 1);
+}
+
+void TestSoftWrap()
+{
+	MTerminalBuffer buffer(kWidth, kHeight, true);
+
+	Print(buffer, U"first line");
+	Print(buffer, U"0123456789012345 connection refused");
+	Print(buffer, U"hard");
+	Print(buffer, U"break");
+
+	int32_t line = -buffer.BufferedLines(), column = 0, length = 0;
+
+	// the match starts on the first row and continues on the second
+	bool found = buffer.FindNext(line, column, length, "conn\\w+ion", false, true, false);
+	Check(found and column == 17 and length == 10, "regex match across a soft wrap");
+
+	line = -buffer.BufferedLines();
+	column = 0;
+	found = buffer.FindNext(line, column, length, "CONNECTION REF", true, true, false);
+	Check(found and column == 17 and length == 14, "case folded regex match across a soft wrap");
+
+	// lines that ended with a hard line break are not joined
+	line = -buffer.BufferedLines();
+	column = 0;
+	Check(not buffer.FindNext(line, column, length, "hard ?break", false, true, false), "no match across a hard line break");
+
+	std::vector<std::tuple<int32_t, int32_t, int32_t>> matches;
+	buffer.FindAll(-buffer.BufferedLines(), kHeight, "e[ds]", false, true, matches);
+	Check(matches.size() == 1 and std::get<2>(matches.front()) == 2, "find all matches");
+
+	matches.clear();
+	buffer.FindAll(-buffer.BufferedLines(), kHeight, "5 c.*d$", false, true, matches);
+	Check(matches.size() == 1 and std::get<1>(matches.front()) == 15 and std::get<2>(matches.front()) == 20,
+		"find all with a match across a soft wrap");
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+
+int main()
+{
+	try
+	{
+		TestAnchors();
+		TestAlternation();
+		TestRepeat();
+		TestClasses();
+		TestIgnoreCase();
+		TestEmptyMatches();
+		TestSoftWrap();
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Exception: " << ex.what() << '\n';
+		++sFailed;
+	}
+
+	if (sFailed == 0)
+		std::cout << "All tests passed\n";
+
+	return sFailed;
+}